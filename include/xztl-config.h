@@ -0,0 +1,124 @@
+/* xZTL: Zone Translation Layer User-space Library
+ *
+ * Copyright 2019 Samsung Electronics
+ *
+ * Written by Ivan L. Picoli <i.picoli@samsung.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+
+#ifndef XZTLCONFIG
+#define XZTLCONFIG
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/* Runtime configuration of xZTL and ZRocks. Each field has a key, the name
+ * of its environment variable (README, "Runtime options"). A configuration
+ * is filled by xztl_config_init and the loaders below and passed to
+ * xztl_init_config or zrocks_init_config. xztl_init and zrocks_init load
+ * the file named by XZTL_CONFIG_ENV, then the environment.
+ *
+ * Unset fields (XZTL_CONFIG_UNSET, or an empty string) select the built-in
+ * default. Once initialized, each module writes the value in effect back
+ * to the active configuration, see xztl_config_get. */
+#define XZTL_CONFIG_ENV   "XZTL_CONFIG"
+#define XZTL_CONFIG_UNSET -1
+#define XZTL_CONFIG_STR   256
+
+/* ZRocks keys, libztl does not see the ZRocks headers */
+#define XZTL_CONFIG_ZROCKS_BUF_ENV "XZTL_ZROCKS_BUF_ENTS"
+
+struct xztl_config {
+    /* Media */
+    char    async[XZTL_CONFIG_STR]; /* xNVMe backend, empty for auto */
+    int64_t sqpoll;
+    int64_t write_append;
+    char    fault[XZTL_CONFIG_STR]; /* Fault injection spec */
+    int64_t fault_seed;
+
+    /* Core */
+    char    wait[XZTL_CONFIG_STR];
+    char    read_wait[XZTL_CONFIG_STR];
+    int64_t wait_spin_us;
+    int64_t write_kb;
+    int64_t read_kb;
+    char    dma_page[XZTL_CONFIG_STR];
+    int64_t dma_region_mb;
+    int64_t numa;
+    char    bg_cpus[XZTL_CONFIG_STR];   /* CPU lists, empty for none */
+    char    slot_cpus[XZTL_CONFIG_STR];
+    char    app_cpus[XZTL_CONFIG_STR];
+    int64_t prometheus;
+
+    /* ZTL */
+    int64_t nslots;
+    int64_t read_qdepth;
+    int64_t write_qdepth;
+    int64_t write_zone_qdepth;
+    int64_t async_depth;
+    char    dispatch[XZTL_CONFIG_STR];
+    int64_t slot_idle_ms;
+    int64_t bounce_bufs;
+    int64_t map_cache_pgs;
+
+    /* ZRocks */
+    int64_t zrocks_buf_ents;
+};
+
+/**
+ * Unset all fields
+ */
+void xztl_config_init(struct xztl_config *cfg);
+
+/**
+ * Set a field by key, e.g. ("XZTL_READ_QDEPTH", "64")
+ *
+ * @return Returns zero, or XZTL_CONFIG_ERR for an unknown key or a value
+ *         that is not a number
+ */
+int xztl_config_set(struct xztl_config *cfg, const char *key,
+                    const char *val);
+
+/**
+ * Set the fields whose environment variable is defined
+ */
+void xztl_config_load_env(struct xztl_config *cfg);
+
+/**
+ * Set fields from a file of KEY=value lines. Blank lines and lines
+ * starting with '#' are skipped
+ *
+ * @return Returns zero, or XZTL_CONFIG_ERR if the file cannot be read or a
+ *         line is invalid. Valid lines before it are applied
+ */
+int xztl_config_load_file(struct xztl_config *cfg, const char *path);
+
+/**
+ * Copy the configuration in effect. Before xztl_init, the environment
+ * is returned
+ */
+void xztl_config_get(struct xztl_config *cfg);
+
+/**
+ * Print a configuration, one key per line
+ */
+void xztl_config_print(const struct xztl_config *cfg);
+
+/* Internal. xztl_config_apply sets the active configuration, used by the
+ * modules through xztl_config_active */
+void                xztl_config_apply(const struct xztl_config *cfg);
+struct xztl_config *xztl_config_active(void);
+void                xztl_config_log(void);
+
+#endif /* XZTLCONFIG */
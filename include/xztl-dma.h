@@ -0,0 +1,159 @@
+/* xZTL: Zone Translation Layer User-space Library
+ *
+ * Copyright 2019 Samsung Electronics
+ *
+ * Written by Ivan L. Picoli <i.picoli@samsung.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+
+#ifndef XZTLDMA
+#define XZTLDMA
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <xztl-numa.h>
+
+/* DMA buffer arena. Regions of huge pages are mapped once and buffers are
+ * carved from them in power of two size classes. Freed buffers are kept in
+ * per-class free lists and reused. Buffers larger than the biggest class,
+ * or requested when the arena is full, come from the media allocator.
+ *
+ * The arena hands out host memory, as all asynchronous backends used by
+ * the media layer do (io_uring_cmd, io_uring, libaio, thrpool and the
+ * emulated media).
+ *
+ * Environment:
+ *   XZTL_DMA_PAGE=<2M|1G|none>  Huge page size, none disables the arena
+ *   XZTL_DMA_REGION_MB=<MB>     Region size (XZTL_DMA_REGION_MB)
+ *
+ * If huge pages are not reserved (vm.nr_hugepages), regions fall back to
+ * regular pages with transparent huge pages enabled (madvise).
+ *
+ * Buffers asked for a NUMA node come from regions bound to that node, with
+ * their own free lists. Other buffers come from unbound regions. */
+#define XZTL_DMA_PAGE_ENV      "XZTL_DMA_PAGE"
+#define XZTL_DMA_REGION_MB_ENV "XZTL_DMA_REGION_MB"
+
+#define XZTL_DMA_REGION_MB   256
+#define XZTL_DMA_MAX_REGIONS 64
+#define XZTL_DMA_MIN_SHIFT   12 /* 4 KB, smallest class */
+#define XZTL_DMA_NCLASS      15 /* 4 KB to 64 MB */
+#define XZTL_DMA_ALIGN_MAX   (2 * 1024 * 1024)
+#define XZTL_DMA_NLISTS      (XZTL_NUMA_MAX_NODES + 1) /* Unbound + nodes */
+
+enum xztl_dma_status {
+    XZTL_DMA_MAP_ERR = 0x1,
+    XZTL_DMA_MEM_ERR = 0x2
+};
+
+enum xztl_dma_page {
+    XZTL_DMA_PAGE_NONE = 0x0,
+    XZTL_DMA_PAGE_2M   = 0x1,
+    XZTL_DMA_PAGE_1G   = 0x2
+};
+
+struct xztl_dma_region {
+    uint8_t * base;
+    uint64_t  size;
+    uint64_t  carved;  /* Bytes carved from the start of the region */
+    uint8_t   hugetlb; /* Mapped from the huge page pool */
+    int16_t   node;    /* NUMA node the region is bound to, -1 if none */
+    uint8_t * cls;     /* Per 4 KB page: class + 1 of the buffer it starts */
+    uint32_t *req;     /* Per 4 KB page: bytes requested for the buffer */
+};
+
+struct xztl_dma_stats {
+    uint32_t nregions;
+    uint32_t nhugetlb;  /* Regions mapped from the huge page pool */
+    uint32_t nbound;    /* Regions bound to a NUMA node */
+    uint64_t reserved;  /* Bytes mapped in regions */
+    uint64_t carved;    /* Bytes carved from regions */
+    uint64_t used;      /* Bytes of live buffers (class size) */
+    uint64_t requested; /* Bytes requested by live buffers */
+    uint64_t cached;    /* Bytes in the class free lists */
+    uint64_t nalloc;
+    uint64_t nfree;
+    uint64_t ndirect; /* Allocations served by the media allocator */
+
+    uint64_t class_used[XZTL_DMA_NCLASS];   /* Live buffers per class */
+    uint64_t class_cached[XZTL_DMA_NCLASS]; /* Free buffers per class */
+};
+
+struct xztl_dma_arena {
+    uint8_t                active;
+    uint8_t                page; /* enum xztl_dma_page */
+    uint64_t               region_sz;
+    struct xztl_dma_region regions[XZTL_DMA_MAX_REGIONS];
+    void *                 free_head[XZTL_DMA_NLISTS][XZTL_DMA_NCLASS];
+    int32_t                last[XZTL_DMA_NLISTS]; /* Region carved, or -1 */
+    struct xztl_dma_stats  stats;
+    pthread_spinlock_t     spin;
+};
+
+/**
+ * Initializes the DMA arena. The first region is mapped
+ *
+ * @return Returns zero if the call succeeds. The arena is left disabled
+ *         (buffers come from the media) if it cannot be set up
+ */
+int xztl_dma_init(void);
+
+/**
+ * Unmaps all regions. Buffers of the arena must not be used afterwards
+ */
+void xztl_dma_exit(void);
+
+/**
+ * Allocate a DMA buffer from the arena
+ *
+ * @param bytes Buffer size
+ *
+ * @return Returns a 4 KB aligned buffer, or NULL if the arena is disabled,
+ *         the size exceeds the biggest class or no region can be mapped
+ */
+void *xztl_dma_alloc(size_t bytes);
+
+/**
+ * Allocate a DMA buffer from the arena, backed by memory of a NUMA node
+ *
+ * @param bytes Buffer size
+ * @param node  NUMA node, the buffer is not bound if negative
+ *
+ * @return Same as xztl_dma_alloc
+ */
+void *xztl_dma_alloc_node(size_t bytes, int node);
+
+/**
+ * Return a buffer to the arena
+ *
+ * @param ptr Buffer obtained with xztl_dma_alloc
+ *
+ * @return Returns 1 if the buffer belongs to the arena, 0 otherwise
+ */
+int xztl_dma_free(void *ptr);
+
+/**
+ * Copy the usage statistics of the arena
+ *
+ * @param stats Filled with the current statistics
+ */
+void xztl_dma_get_stats(struct xztl_dma_stats *stats);
+
+/**
+ * Print usage and fragmentation of the arena
+ */
+void xztl_dma_print_stats(void);
+
+#endif /* XZTLDMA */
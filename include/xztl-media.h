@@ -23,25 +23,42 @@
 #include <libxnvme.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <sys/uio.h>
 #include <xztl.h>
 
-/* Append Command support */
-#define XZTL_WRITE_APPEND 0
+/* Append Command support. This is the default, the environment variable
+ * XZTL_WRITE_APPEND_ENV overrides it at runtime */
+#define XZTL_WRITE_APPEND     0
+#define XZTL_WRITE_APPEND_ENV "XZTL_WRITE_APPEND"
 
 /* Number of maximum addresses in a single command vector.
- * 	A single address is needed for zone append. We should
- * 	increase this number in case of possible vectored I/Os. */
-#define XZTL_MAX_MADDR 1
+ * 	A vectored command covers contiguous sectors on the media and
+ * 	'naddr' host buffers (prp/nsec). It is submitted as a single
+ * 	NVMe command (the data pointer is built from an iovec list). */
+#define XZTL_MAX_MADDR 16
 
 #define XZTL_MCTX_SZ 640
 
 #define XZTL_MEDIA_MAX_GRP   128     /* groups */
+#define XZTL_MEDIA_MAX_DEV   8       /* devices aggregated by a media */
 #define XZTL_MEDIA_MAX_PUGRP 8       /* punits */
 #define XZTL_MEDIA_MAX_ZNPU  8388608 /* zones */
 #define XZTL_MEDIA_MAX_SECZN 8388608 /* sectors */
 #define XZTL_MEDIA_MAX_SECSZ 1048576 /* bytes */
 #define XZTL_MEDIA_MAX_OOBSZ 128     /* bytes */
 
+#define XZTL_MEDIA_ENGINE_LEN 16
+
+/* Zones per report command of a report iterator */
+#define XZTL_ZN_REPORT_BATCH 1024
+
+/* Media capabilities */
+enum xztl_media_caps {
+    XZTL_MEDIA_CAP_APPEND  = (1 << 0),
+    XZTL_MEDIA_CAP_COPY    = (1 << 1), /* Device-side copy (XZTL_CMD_COPY) */
+    XZTL_MEDIA_CAP_HOSTBUF = (1 << 2), /* I/O to aligned non-DMA buffers */
+};
+
 struct znd_media *get_znd_media(void);
 
 enum xztl_media_opcodes {
@@ -57,6 +74,7 @@ enum xztl_media_opcodes {
     /* I/O commands */
     XZTL_CMD_WRITE       = 0x01,
     XZTL_CMD_READ        = 0x02,
+    XZTL_CMD_COPY        = 0x19,
     XZTL_CMD_WRITE_OCSSD = 0x91,
     XZTL_CMD_READ_OCSSD  = 0x92,
 
@@ -77,7 +95,26 @@ enum xztl_media_opcodes {
     XZTL_MISC_ASYNCH_TERM = 0x2,
     XZTL_MISC_ASYNCH_POKE = 0x3,
     XZTL_MISC_ASYNCH_OUTS = 0x4,
-    XZTL_MISC_ASYNCH_WAIT = 0x5
+    XZTL_MISC_ASYNCH_WAIT = 0x5,
+    XZTL_MISC_ASYNCH_BLOCK = 0x6 /* Block up to 'limit' usec for completions */
+};
+
+/* Context options, XZTL_MISC_ASYNCH_INIT */
+enum xztl_ctx_flags {
+    /* Completions are polled from the device instead of interrupts. Media
+     * that cannot poll create a regular queue, 'polled' tells which */
+    XZTL_CTX_POLL = (1 << 0)
+};
+
+/* Completion held by the fault injection media until 'due'
+ * (ztl-media-fault.h) */
+struct xztl_media_defer {
+    uint64_t       due;
+    xztl_callback *cb; /* Callback of the command */
+    void *         cmd;
+    uint8_t        zn; /* cmd is a struct xztl_zn_mcmd */
+
+    TAILQ_ENTRY(xztl_media_defer) entry;
 };
 
 struct xztl_mthread_ctx {
@@ -86,7 +123,28 @@ struct xztl_mthread_ctx {
     int                 tid;
     int                 comp_active;
     pthread_spinlock_t  qpair_spin;
-    struct xnvme_queue *queue;
+    struct xnvme_queue *queue; /* Queue of the first device */
+    void *              opaque; /* Queue of media not based on xNVMe */
+
+    /* Queues of media aggregating several devices, queues[0] is 'queue' */
+    struct xnvme_queue *queues[XZTL_MEDIA_MAX_DEV];
+    uint16_t            nqueues;
+
+    /* Completions are polled from the device (XZTL_CTX_POLL) */
+    uint8_t polled;
+
+    /* Completion wait (xztl_ctx_media_reap) */
+    int8_t   wait_mode; /* enum xztl_wait_mode, -1 follows core->wait_mode */
+    uint32_t sleep_us;  /* Current blocking period, doubled while idle */
+    uint64_t wait_spin_us;
+    uint64_t wait_sleep_us;
+    uint64_t wait_nsleep;
+
+    /* Completions held by the fault injection media, ordered by due
+     * time */
+    TAILQ_HEAD(xztl_media_defer_head, xztl_media_defer) fault_defer;
+    uint32_t fault_ndefer; /* Held commands */
+    uint32_t fault_nheld;  /* Held completions of the wrapped media */
 };
 
 struct xztl_io_mcmd {
@@ -116,6 +174,19 @@ struct xztl_io_mcmd {
     /* change to pointer when xnvme is updated */
     struct xnvme_cmd_ctx *media_ctx;
 
+    /* Host buffers of vectored commands (naddr > 1) */
+    struct iovec iov[XZTL_MAX_MADDR];
+
+    /* XZTL_CMD_COPY: 'naddr' source ranges (addr[i].g.sect, nsec[i]) are
+     * written in order at copy_dst.g.sect, the zone write pointer. No host
+     * buffer is used. paddr[0] returns the first written sector */
+    struct xztl_maddr copy_dst;
+    void *            media_buf; /* Buffer owned by the media */
+    void *            bounce;    /* ZTL read bounce buffer, NULL if none */
+
+    /* Fault injection media (ztl-media-fault.h) */
+    struct xztl_media_defer fault;
+
     /* Completion queue */
     STAILQ_ENTRY(xztl_io_mcmd) entry;
 };
@@ -123,9 +194,32 @@ struct xztl_io_mcmd {
 struct xztl_zn_mcmd {
     uint8_t           opcode;
     uint8_t           status;
+    uint8_t           synch;
     struct xztl_maddr addr;
     uint32_t          nzones;
     void *            opaque;
+
+    /* Asynchronous management (see xztl_media_submit_zn_asynch) */
+    xztl_callback *          callback;
+    struct xztl_mthread_ctx *async_ctx;
+    void *                   media_ctx;
+
+    /* Fault injection media (ztl-media-fault.h) */
+    struct xztl_media_defer fault;
+};
+
+struct xnvme_znd_report;
+struct xnvme_spec_znd_descr;
+
+/* Iterator over zone descriptors. Reports are fetched from the media in
+ * ranges of 'batch' zones, only one range is held in memory */
+struct xztl_zn_report_iter {
+    uint32_t                 zone;  /* Next zone to return */
+    uint32_t                 end;   /* Last zone + 1 */
+    uint32_t                 batch; /* Zones per report command */
+    uint32_t                 idx;   /* Next descriptor in the report */
+    int                      status;
+    struct xnvme_znd_report *rep;
 };
 
 struct xztl_misc_cmd {
@@ -142,7 +236,7 @@ struct xztl_misc_cmd {
             uint32_t limit; /* Max number of completions */
             uint32_t count; /* Processed completions */
 
-            uint32_t rsv31;
+            uint32_t flags; /* XZTL_CTX_* (XZTL_MISC_ASYNCH_INIT) */
             uint64_t rsv32[4];
         } asynch;
     };
@@ -155,6 +249,12 @@ struct xztl_mgeo {
     uint32_t sec_zn;     /* Sectors per zone */
     uint32_t nbytes;     /* Per sector */
     uint32_t nbytes_oob; /* Per sector */
+    uint32_t sec_mdts;   /* Max sectors per command (0: no limit) */
+
+    /* Copy limits, 0: no limit (XZTL_MEDIA_CAP_COPY) */
+    uint32_t copy_nrange;  /* Max source ranges */
+    uint32_t copy_sec_rng; /* Max sectors per source range */
+    uint32_t copy_sec_max; /* Max sectors per copy */
 
     /* Calculated values */
     uint32_t zn_dev;     /* Total zones in device */
@@ -170,6 +270,8 @@ struct xztl_mgeo {
 };
 
 typedef int(xztl_media_io_fn)(struct xztl_io_mcmd *cmd);
+typedef int(xztl_media_io_batch_fn)(struct xztl_io_mcmd **cmds, uint32_t ncmd,
+                                    uint32_t *nsub);
 typedef int(xztl_media_zn_fn)(struct xztl_zn_mcmd *cmd);
 typedef void *(xztl_media_dma_alloc_fn)(size_t size);
 typedef void(xztl_media_dma_free_fn)(void *ptr);
@@ -180,10 +282,17 @@ struct xztl_media {
     xztl_init_fn *           init_fn;
     xztl_exit_fn *           exit_fn;
     xztl_media_io_fn *       submit_io;
+    xztl_media_io_batch_fn * submit_io_batch; /* Optional */
     xztl_media_zn_fn *       zone_fn;
     xztl_media_dma_alloc_fn *dma_alloc;
     xztl_media_dma_free_fn * dma_free;
     xztl_media_cmd_fn *      cmd_exec;
+
+    /* Asynchronous I/O engine in use (e.g. io_uring_cmd) */
+    char engine[XZTL_MEDIA_ENGINE_LEN];
+
+    /* Supported capabilities (enum xztl_media_caps) */
+    uint32_t caps;
 };
 
 #endif /* XZTL_MEDIA_H */
@@ -0,0 +1,185 @@
+/* xZTL: Zone Translation Layer User-space Library
+ *
+ * Copyright 2019 Samsung Electronics
+ *
+ * Written by Ivan L. Picoli <i.picoli@samsung.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+
+#ifndef XZTLNUMA
+#define XZTLNUMA
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/* NUMA placement. Each ZTL thread slot is bound to a node with CPUs, in
+ * round robin. The slot queue, buffers and commands are allocated while the
+ * initializing thread runs on that node, so memory is local to it.
+ *
+ * Environment:
+ *   XZTL_NUMA=<0|1>  Disable or enable NUMA placement (enabled by default)
+ *
+ * Without libnuma support (numa_available) every node id is -1 and memory
+ * is allocated as before. */
+#define XZTL_NUMA_ENV "XZTL_NUMA"
+
+/* CPU affinity policy, lists of CPUs such as "0-3,8":
+ *   XZTL_BG_CPUS    Management and statistics threads run on these CPUs
+ *   XZTL_SLOT_CPUS  Slot workers are pinned to one of these CPUs each, in
+ *                   round robin. The slot node is the node of its CPU
+ *   XZTL_APP_CPUS   CPUs left to the application. Threads not pinned above
+ *                   run on the other CPUs of the process
+ *
+ * Unset lists leave the threads to the scheduler, slot workers on the CPUs
+ * of their node. CPUs outside the affinity of the process are dropped */
+#define XZTL_BG_CPUS_ENV   "XZTL_BG_CPUS"
+#define XZTL_SLOT_CPUS_ENV "XZTL_SLOT_CPUS"
+#define XZTL_APP_CPUS_ENV  "XZTL_APP_CPUS"
+
+#define XZTL_NUMA_MAX_NODES 64
+#define XZTL_NUMA_MAX_CPUS  1024
+
+/* CPU affinity of a thread before xztl_numa_bind (a cpu_set_t) */
+struct xztl_numa_affinity {
+    uint8_t       bound;
+    unsigned long cpus[XZTL_NUMA_MAX_CPUS / (8 * sizeof(unsigned long))];
+};
+
+struct xztl_numa_node {
+    uint32_t ncpus;
+    uint32_t nslots;  /* Slots bound to the node */
+    uint32_t nused;   /* Slots handed out */
+    uint64_t nlocal;  /* Slots handed out to a caller on the node */
+    uint64_t nremote; /* Slots handed out to a caller on another node */
+};
+
+struct xztl_numa {
+    uint8_t               active;
+    uint16_t              nnodes; /* Nodes with CPUs */
+    int16_t               cpu_nodes[XZTL_NUMA_MAX_NODES]; /* Their ids */
+    struct xztl_numa_node nodes[XZTL_NUMA_MAX_NODES];     /* Indexed by id */
+};
+
+/**
+ * Detects the node topology
+ *
+ * @return Returns zero if the call succeeds. Placement is disabled if the
+ *         system does not support NUMA
+ */
+int xztl_numa_init(void);
+
+/**
+ * Disables placement
+ */
+void xztl_numa_exit(void);
+
+/**
+ * Node of a ZTL thread slot
+ *
+ * @param slot Slot id
+ *
+ * @return Returns the node id, or -1 if placement is disabled
+ */
+int xztl_numa_slot_node(uint16_t slot);
+
+/**
+ * Node of the CPU running the calling thread
+ *
+ * @return Returns the node id, or -1 if placement is disabled
+ */
+int xztl_numa_local_node(void);
+
+/**
+ * Run the calling thread on the CPUs of a node and prefer its memory
+ *
+ * @param node  Node id, nothing is done if negative
+ * @param saved Filled with the previous CPU affinity
+ *
+ * @return Returns zero if the thread was moved
+ */
+int xztl_numa_bind(int node, struct xztl_numa_affinity *saved);
+
+/**
+ * Apply the affinity policy of background threads to the calling thread
+ *
+ * @param name Thread name, for the log
+ */
+void xztl_numa_pin_bg(const char *name);
+
+/**
+ * Apply the affinity policy of slot workers to the calling thread. The
+ * thread also prefers the memory of the slot node
+ *
+ * @param node Node of the slot
+ * @param slot Slot id
+ */
+void xztl_numa_pin_slot(int node, uint16_t slot);
+
+/**
+ * Restore the affinity saved by xztl_numa_bind and the default memory policy
+ *
+ * @param saved CPU affinity returned by xztl_numa_bind
+ */
+void xztl_numa_unbind(struct xztl_numa_affinity *saved);
+
+/**
+ * Bind a range of memory not yet touched to a node
+ *
+ * @param ptr   Page aligned start
+ * @param bytes Range size
+ * @param node  Node id, nothing is done if negative
+ */
+void xztl_numa_place(void *ptr, size_t bytes, int node);
+
+/**
+ * Allocate page aligned memory on a node
+ *
+ * @param bytes Size
+ * @param node  Node id, the memory is not bound if negative
+ *
+ * @return Returns the buffer, or NULL on failure
+ */
+void *xztl_numa_alloc(size_t bytes, int node);
+
+/**
+ * Free memory obtained with xztl_numa_alloc
+ *
+ * @param ptr   Buffer
+ * @param bytes Size given to xztl_numa_alloc
+ */
+void xztl_numa_free(void *ptr, size_t bytes);
+
+/**
+ * Account a slot bound to a node
+ *
+ * @param node Node id
+ */
+void xztl_numa_slot_add(int node);
+
+/**
+ * Account a slot handed out or returned
+ *
+ * @param node  Node of the slot
+ * @param local Caller node, used when the slot is handed out
+ * @param get   1 if the slot is handed out, 0 if it is returned
+ */
+void xztl_numa_slot_use(int node, int local, int get);
+
+/**
+ * Print the CPU affinity policy, the node topology and the slot usage per
+ * node
+ */
+void xztl_numa_print_stats(void);
+
+#endif /* XZTLNUMA */
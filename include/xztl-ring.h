@@ -0,0 +1,86 @@
+/* xZTL: Zone Translation Layer User-space Library
+ *
+ * Copyright 2019 Samsung Electronics
+ *
+ * Written by Ivan L. Picoli <i.picoli@samsung.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+
+#ifndef XZTLRING
+#define XZTLRING
+
+#include <stdint.h>
+
+/* Bounded lock-free ring of pointers. Any number of threads push, a single
+ * thread pops. Each cell carries a sequence number: a producer claims a
+ * position by moving 'head' and publishes the pointer by moving the cell
+ * sequence, the consumer frees the cell by moving it one lap ahead. */
+#define XZTL_RING_CACHELINE 64
+
+enum xztl_ring_status {
+    XZTL_RING_MEM  = 0x1,
+    XZTL_RING_FULL = 0x2
+};
+
+struct xztl_ring_cell {
+    uint64_t seq;
+    void *   ptr;
+};
+
+struct xztl_ring {
+    struct xztl_ring_cell *cells;
+    uint32_t               size; /* Power of two */
+    uint32_t               mask;
+    int16_t                node; /* NUMA node of the cells, -1 if none */
+
+    uint64_t head __attribute__((aligned(XZTL_RING_CACHELINE))); /* Push */
+    uint64_t tail __attribute__((aligned(XZTL_RING_CACHELINE))); /* Pop */
+};
+
+/**
+ * Create a ring
+ *
+ * @param ring Ring to initialize
+ * @param size Number of entries, rounded up to a power of two
+ * @param node NUMA node of the cells, -1 for none
+ *
+ * @return Returns zero if the call succeeds
+ */
+int xztl_ring_init(struct xztl_ring *ring, uint32_t size, int node);
+
+/**
+ * Destroy a ring. Entries still queued are dropped
+ */
+void xztl_ring_exit(struct xztl_ring *ring);
+
+/**
+ * Queue a pointer. Safe from any thread
+ *
+ * @return Returns zero, or XZTL_RING_FULL if the ring has no free entry
+ */
+int xztl_ring_push(struct xztl_ring *ring, void *ptr);
+
+/**
+ * Dequeue up to 'max' pointers in push order. Called by a single thread
+ *
+ * @return Returns the number of pointers written to 'ptr'
+ */
+uint32_t xztl_ring_pop(struct xztl_ring *ring, void **ptr, uint32_t max);
+
+/**
+ * Check if the ring has entries. Exact from the consumer only
+ */
+int xztl_ring_empty(struct xztl_ring *ring);
+
+#endif /* XZTLRING */
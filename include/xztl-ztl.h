@@ -20,7 +20,9 @@
 #ifndef XZTL_ZTL_H
 #define XZTL_ZTL_H
 
+#include <semaphore.h>
 #include <xztl-mempool.h>
+#include <xztl-ring.h>
 #include <xztl.h>
 
 #define APP_MOD_COUNT 9
@@ -39,41 +41,117 @@
 /* Small mapping always follows this granularity */
 #define ZTL_MPE_CPGS 256
 
-/* Media minimum/maximum write size in sectors */
-#define ZTL_WCA_SEC_MCMD     16
+/* Minimum write chunk in sectors, core->write_sec at runtime. Chunks of a
+ * node are given by its chunk_sec (ztl.h) */
+#define ZTL_WCA_SEC_MCMD     XZTL_CMD_SEC_DEF
 #define ZTL_WCA_SEC_MCMD_MIN 1
 
-/* Media maximum read size in sectors */
-#define ZTL_READ_SEC_MCMD ZTL_WCA_SEC_MCMD
+/* Depth of the polled queue of a slot, used by single command reads */
+#define ZTL_READ_POLL_DEPTH 4
+
+/* Depths of the read and write queues of a slot */
+#define ZTL_READ_QDEPTH      128
+#define ZTL_WRITE_QDEPTH     128
+#define ZTL_READ_QDEPTH_ENV  "XZTL_READ_QDEPTH"
+#define ZTL_WRITE_QDEPTH_ENV "XZTL_WRITE_QDEPTH"
+
+/* Writes in flight per zone without zone append, they are submitted in
+ * order. A zone with a failed write is retried ZTL_WCA_WRITE_RETRY times
+ * with a single write in flight */
+#define ZTL_WRITE_ZONE_QDEPTH     4
+#define ZTL_WRITE_ZONE_QDEPTH_MAX 64
+#define ZTL_WRITE_ZONE_QDEPTH_ENV "XZTL_WRITE_ZONE_QDEPTH"
+#define ZTL_WCA_WRITE_RETRY       3
+
+/* Outstanding asynchronous user commands of a slot */
+#define ZTL_ASYNC_DEPTH     32
+#define ZTL_ASYNC_DEPTH_ENV "XZTL_ASYNC_DEPTH"
+
+/* Where synchronous user commands run, selected by ZTL_DISPATCH_ENV:
+ * "inline" in the caller thread or "worker" in the slot worker thread.
+ * The worker pops up to ZTL_WORKER_BATCH commands from its ring at once */
+#define ZTL_DISPATCH_ENV "XZTL_DISPATCH"
+#define ZTL_WORKER_BATCH 16
+
+enum ztl_dispatch_mode {
+    ZTL_DISPATCH_INLINE = 0x0,
+    ZTL_DISPATCH_WORKER = 0x1
+};
 
-/* Set ZTL_WRITE_AFFINITY to 1 to enable thread affinity to a single core */
-#define ZTL_WRITE_AFFINITY 0
-#define ZTL_WRITE_CORE     0
+/* Slot resources are created by the first zrocks_get_resource of the slot
+ * and released once the slot is unused for ZTL_SLOT_IDLE_MS. The management
+ * thread looks for idle slots every ZTL_SLOT_REAP_MS. Read bounce buffers
+ * are shared by the slots, up to ZTL_BOUNCE_BUFS buffers of the largest
+ * read command */
+#define ZTL_SLOT_IDLE_MS     10000
+#define ZTL_SLOT_IDLE_MS_ENV "XZTL_SLOT_IDLE_MS"
+#define ZTL_SLOT_REAP_MS     100
+#define ZTL_BOUNCE_BUFS      256
+#define ZTL_BOUNCE_BUFS_ENV  "XZTL_BOUNCE_BUFS"
+
+/* Slots (struct xztl_thread) handed out by zrocks_get_resource. tid is a
+ * uint8_t, ZTL_TH_NUM_MAX bounds ZTL_TH_NUM_ENV. Free slots are kept in a
+ * bitmap of ZTL_TH_WORDS words */
+#define ZTL_TH_NUM     128
+#define ZTL_TH_NUM_MAX 255
+#define ZTL_TH_NUM_ENV "XZTL_SLOTS"
+#define ZTL_TH_WORDS   ((ZTL_TH_NUM_MAX + 64) / 64)
+
+/* Pages of the mapping cache, 256 MB with 32 KB pages */
+#define ZTL_MAP_CACHE_PGS     8192
+#define ZTL_MAP_CACHE_PGS_ENV "XZTL_MAP_CACHE_PGS"
 
 #define ZTL_ALLOC_NODE_NUM  32
-#define ZTL_TH_NUM          128
 #define ZNS_MAX_BUF_SEC_NUM 16384
 #define ZTL_TH_RC_NUM       (ZNS_MAX_BUF_SEC_NUM / ZTL_WCA_SEC_MCMD)
 
+/* Reads and writes of a slot are submitted on distinct queues, a read
+ * never waits behind the writes of the slot */
 struct xztl_thread {
-    struct xztl_mthread_ctx *tctx;
+    struct xztl_mthread_ctx *tctx; /* Write queue */
+    struct xztl_mthread_ctx *rctx; /* Read queue */
+    struct xztl_mthread_ctx *pctx; /* Polled read queue, rctx if none */
     struct xztl_io_mcmd *    mcmd[ZTL_TH_RC_NUM];
     void *                   prov;
-    char *prp[ZTL_TH_RC_NUM];
 
-    STAILQ_HEAD(, xztl_io_ucmd) ucmd_head;
     STAILQ_HEAD(, ztl_pro_node) free_head;
     uint16_t           nfree;
     pthread_spinlock_t ucmd_spin;
-    pthread_t          wca_thread;
-    uint8_t            wca_running;
+
+    /* Slot worker, started by the first command queued to the slot.
+     * Producers push to the ring and post ucmd_sem if the worker sleeps */
+    struct xztl_ring ring;
+    pthread_t        wca_thread;
+    uint8_t          wca_running;
+    uint8_t          wca_sleeping;
+
+    /* Asynchronous user commands, allocated on first use. Commands are
+     * taken from afree_head, queued to the ring and run by wca_thread.
+     * Completions without callback are queued to cpl_head */
+    struct xztl_io_ucmd *aucmd;
+    STAILQ_HEAD(, xztl_io_ucmd) afree_head;
+    STAILQ_HEAD(, xztl_io_ucmd) cpl_head;
+    uint32_t ainflight;
+    sem_t    ucmd_sem;
     uint8_t            tid;
 
     uint64_t node_id;
 
+    int16_t numa;     /* NUMA node of the slot resources, -1 if none */
+    void *  mcmd_buf; /* Backs mcmd[], allocated on the node */
+
+    /* Set while the slot is handed out, see the free bitmap of the WCA */
     bool usedflag;
+
+    /* Resources are created, set and cleared under the slot lock of the
+     * WCA. idle_us is the time the slot was last released */
+    volatile uint8_t ready;
+    uint64_t         idle_us;
 };
-struct xztl_thread xtd[ZTL_TH_NUM];
+
+/* Slots, allocated by the WCA module init */
+extern struct xztl_thread *xtd;
+extern uint16_t            xtd_num;
 
 enum xztl_mod_types {
     ZTLMOD_BAD = 0x0,
@@ -193,10 +271,9 @@ struct app_zmd {
     uint32_t         entries;
     uint32_t         entry_sz;
 
-    uint8_t *                tbl; /* This is the 'small' fixed table */
-    uint32_t                 ent_per_pg;
-    struct app_tiny_tbl      tiny; /* This is the 'tiny' table for checkpoint */
-    struct xnvme_znd_report *report;
+    uint8_t *           tbl; /* This is the 'small' fixed table */
+    uint32_t            ent_per_pg;
+    struct app_tiny_tbl tiny; /* This is the 'tiny' table for checkpoint */
 };
 
 struct app_grp_flags {
@@ -219,6 +296,7 @@ struct app_pro_addr {
     struct app_group *grp;
     struct xztl_maddr addr[APP_PRO_MAX_OFFS];
     uint32_t          nsec[APP_PRO_MAX_OFFS];
+    uint32_t          stripe_off; /* Node stripe offset of the first sector */
     uint16_t          naddr;
     uint16_t          thread_id;
     uint16_t          ptype;
@@ -267,7 +345,17 @@ typedef int(app_map_upsert_md)(uint64_t index, uint64_t addr,
 typedef int(app_wca_init)(void);
 typedef void(app_wca_exit)(void);
 typedef int(app_wca_submit)(struct xztl_io_ucmd *ucmd);
+typedef int(app_wca_read_fast)(uint32_t node_id, uint64_t offset, void *buf,
+                               size_t size, int tid, uint64_t *lat_ns);
 typedef void(app_wca_callback)(struct xztl_io_mcmd *mcmd);
+typedef struct xztl_io_ucmd *(app_wca_ucmd_get)(int tid);
+typedef void(app_wca_ucmd_put)(struct xztl_io_ucmd *ucmd);
+typedef int(app_wca_submit_async)(struct xztl_io_ucmd *ucmd);
+typedef uint32_t(app_wca_poll)(int tid, struct xztl_io_ucmd **ucmd,
+                               uint32_t max);
+typedef int(app_wca_slot_get)(int node);
+typedef void(app_wca_slot_put)(int tid);
+typedef void(app_wca_slot_reap)(void);
 
 struct app_groups {
     app_grp_init *    init_fn;
@@ -319,12 +407,25 @@ struct app_map_mod {
 };
 
 struct app_wca_mod {
-    uint8_t           mod_id;
-    char *            name;
-    app_wca_init *    init_fn;
-    app_wca_exit *    exit_fn;
-    app_wca_submit *  submit_fn;
-    app_wca_callback *callback_fn;
+    uint8_t            mod_id;
+    char *             name;
+    app_wca_init *     init_fn;
+    app_wca_exit *     exit_fn;
+    app_wca_submit *   submit_fn;
+    app_wca_callback * callback_fn;
+    app_wca_read_fast *read_fast_fn;
+
+    /* Asynchronous user commands */
+    app_wca_ucmd_get *    ucmd_get_fn;
+    app_wca_ucmd_put *    ucmd_put_fn;
+    app_wca_submit_async *submit_async_fn;
+    app_wca_poll *        poll_fn;
+
+    /* Slot allocation. Resources are created on first use and released
+     * when idle */
+    app_wca_slot_get * slot_get_fn;
+    app_wca_slot_put * slot_put_fn;
+    app_wca_slot_reap *slot_reap_fn;
 };
 
 struct app_global {
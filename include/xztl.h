@@ -47,7 +47,9 @@
         }                                     \
     } while (0)
 
-#define XZTL_PROMETHEUS 0
+/* Prometheus exporter, XZTL_PROMETHEUS_ENV overrides it at runtime */
+#define XZTL_PROMETHEUS     0
+#define XZTL_PROMETHEUS_ENV "XZTL_PROMETHEUS"
 
 #define log_erra(format, ...)  syslog(LOG_ERR, format, ##__VA_ARGS__)
 #define log_infoa(format, ...) syslog(LOG_INFO, format, ##__VA_ARGS__)
@@ -133,13 +135,19 @@ struct xztl_io_ucmd {
     uint64_t id;
     void *   buf;
     size_t   size;
-    uint64_t offset;  // for read command
+    uint64_t offset;  // for read command, user size of asynchronous writes
     uint16_t prov_type;
     uint8_t  app_md; /* Application is responsible for mapping/recovery */
     uint8_t  status;
 
     xztl_callback *callback;
 
+    /* Asynchronous commands: index in the pool of the slot and context of
+     * the submitter. 'callback' is called by the slot worker */
+    uint32_t       handle;
+    void *         opaque;
+    xztl_callback *opaque_cb;
+
     struct xztl_th_data xd;
 
     struct app_pro_addr *prov;
@@ -153,13 +161,44 @@ struct xztl_io_ucmd {
     uint16_t completed;
 
     pthread_spinlock_t inflight_spin;
-    volatile uint8_t   minflight[256];
+    volatile uint8_t   minflight[256]; /* Writes in flight per zone */
+    volatile uint16_t  nretry;         /* Failed writes to be retried */
+    volatile uint8_t   wdone;          /* Run by the slot worker */
 
     STAILQ_ENTRY(xztl_io_ucmd) entry;
 };
 
+/* Completion wait policy, selected by XZTL_WAIT_ENV */
+enum xztl_wait_mode {
+    XZTL_WAIT_SPIN   = 0x0, /* Poke the queue until completions arrive */
+    XZTL_WAIT_HYBRID = 0x1, /* Poke for wait_spin_us, then block */
+    XZTL_WAIT_BLOCK  = 0x2  /* Block right away (sleep on znd) */
+};
+
+#define XZTL_WAIT_ENV         "XZTL_WAIT"
+#define XZTL_READ_WAIT_ENV    "XZTL_READ_WAIT" /* Read queues, XZTL_WAIT */
+#define XZTL_WAIT_SPIN_US_ENV "XZTL_WAIT_SPIN_US"
+#define XZTL_WAIT_SPIN_US     50  /* Default spin time in hybrid mode */
+#define XZTL_WAIT_SLEEP_US    256 /* Max blocking period */
+
+/* Media command sizes, selected by XZTL_WRITE_KB_ENV and XZTL_READ_KB_ENV.
+ * Writes are striped across the zones of a node in chunks of 'write_sec'
+ * sectors, a node keeps the chunk it was first written with. Reads are
+ * split in commands of up to 'read_sec' sectors within a chunk. Both are
+ * bounded by the device MDTS */
+#define XZTL_WRITE_KB_ENV     "XZTL_WRITE_KB"
+#define XZTL_READ_KB_ENV      "XZTL_READ_KB"
+#define XZTL_CMD_SEC_DEF      16 /* Default and minimum size */
+#define XZTL_READ_BYTES_MAX   (256 * 1024) /* Largest read command */
+
 struct xztl_core {
     struct xztl_media *media;
+    uint8_t            append;       /* Zone append write path enabled */
+    uint8_t            wait_mode;    /* enum xztl_wait_mode */
+    int8_t             rwait_mode;   /* Read queues, -1 follows wait_mode */
+    uint32_t           wait_spin_us; /* Spin time before blocking */
+    uint32_t           write_sec;    /* Chunk of nodes written from now */
+    uint32_t           read_sec;     /* Max sectors of a read command */
 };
 
 enum xztl_status {
@@ -189,6 +228,11 @@ enum xztl_status {
     XZTL_ZTL_WCA_S2_ERR = 0x17,
     XZTL_ZTL_MD_ERR     = 0x18,
     XZTL_ZTL_RED_ERR    = 0x19,
+    XZTL_MEDIA_QFULL    = 0x1a,
+    XZTL_NUMA_ERR       = 0x1b,
+    XZTL_ZTL_WCA_SLOW   = 0x1c, /* Read needs the multi-command path */
+    XZTL_CMD_SIZE_ERR   = 0x1d,
+    XZTL_CONFIG_ERR     = 0x1e,
     XZTL_MEDIA_ERROR    = 0x100,
 };
 
@@ -205,7 +249,26 @@ enum xztl_stats_io_types {
     XZTL_STATS_APPEND_UCMD,
 
     XZTL_STATS_RECYCLED_BYTES,
-    XZTL_STATS_RECYCLED_ZONES
+    XZTL_STATS_RECYCLED_ZONES,
+
+    XZTL_STATS_WAIT_SPIN_US,
+    XZTL_STATS_WAIT_SLEEP_US,
+    XZTL_STATS_WAIT_SLEEPS,
+
+    XZTL_STATS_READ_FAST,
+    XZTL_STATS_READ_FAST_DIRECT,
+
+    XZTL_STATS_READ_ZCOPY_BYTES,  /* Read into the user buffer */
+    XZTL_STATS_READ_BOUNCE_BYTES, /* Copied from the slot buffers */
+
+    XZTL_STATS_WRITE_RETRY, /* Writes resubmitted after a zone failure */
+
+    XZTL_STATS_SLOT_GET,       /* Slots handed out */
+    XZTL_STATS_SLOT_EXHAUSTED, /* Slot requests with no free slot */
+
+    XZTL_STATS_NODE_REFILL, /* Refills of the free node cache of a slot */
+    XZTL_STATS_NODE_ALLOC,  /* Nodes taken by the refills */
+    XZTL_STATS_NODE_RETRY   /* Contended updates of the free node bitmap */
 };
 
 /* Return xzlt core */
@@ -224,22 +287,48 @@ void xztl_add_media(xztl_register_media_fn *fn);
 /* Set the media abstraction */
 int xztl_media_set(struct xztl_media *media);
 
-/* Initialize XApp instance */
+/* Initialize XApp instance. The configuration is read from the file
+ * named by XZTL_CONFIG and from the environment (xztl-config.h) */
 int xztl_init(const char *device_name);
 
+/* Initialize XApp instance with a configuration (xztl-config.h) */
+struct xztl_config;
+int xztl_init_config(const char *device_name, const struct xztl_config *cfg);
+
+/* Set the media command sizes in sectors, 0 keeps the current size. Nodes
+ * already written keep their chunk */
+int xztl_set_cmd_sec(uint32_t write_sec, uint32_t read_sec);
+
 /* Safe shut down */
 int xztl_exit(void);
 
 /* Media functions */
+struct xztl_zn_report_iter;
+struct xnvme_spec_znd_descr;
+
 void *xztl_media_dma_alloc(size_t bytes);
+void *xztl_media_dma_alloc_node(size_t bytes, int node);
 void  xztl_media_dma_free(void *ptr);
 int   xztl_media_submit_zn(struct xztl_zn_mcmd *cmd);
+int   xztl_media_submit_zn_asynch(struct xztl_zn_mcmd *cmd);
+int   xztl_media_zone_info(uint32_t zone, struct xnvme_spec_znd_descr *zinfo);
+void  xztl_zn_report_iter_init(struct xztl_zn_report_iter *it, uint32_t zone,
+                               uint32_t nzones);
+struct xnvme_spec_znd_descr *
+      xztl_zn_report_iter_next(struct xztl_zn_report_iter *it);
+void  xztl_zn_report_iter_exit(struct xztl_zn_report_iter *it);
 int   xztl_media_submit_misc(struct xztl_misc_cmd *cmd);
 int   xztl_media_submit_io(struct xztl_io_mcmd *cmd);
+int   xztl_media_submit_io_batch(struct xztl_io_mcmd **cmds, uint32_t ncmd,
+                                 uint32_t *nsub);
 
 /* Thread context functions */
 struct xztl_mthread_ctx *xztl_ctx_media_init(uint32_t depth);
+struct xztl_mthread_ctx *xztl_ctx_media_init_flags(uint32_t depth,
+                                                   uint32_t flags);
 int                      xztl_ctx_media_exit(struct xztl_mthread_ctx *tctx);
+uint32_t                 xztl_ctx_media_poke(struct xztl_mthread_ctx *tctx);
+uint32_t                 xztl_ctx_media_reap(struct xztl_mthread_ctx *tctx);
 
 /* Layer specific functions (for testing) */
 int xztl_media_init(void);
@@ -0,0 +1,110 @@
+/* xZTL: Zone Translation Layer User-space Library
+ *
+ * Copyright 2019 Samsung Electronics
+ *
+ * Written by Ivan L. Picoli <i.picoli@samsung.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+
+#ifndef EMUMEDIA
+#define EMUMEDIA
+
+#include <pthread.h>
+#include <stdint.h>
+#include <xztl-media.h>
+#include <xztl.h>
+
+/* Emulated ZNS media. The device name selects the backing store and the
+ * geometry:
+ *
+ *   emu:<file>[?opt=val&...]  Zones on a sparse file
+ *   emu:mem[?opt=val&...]     Zones on anonymous memory
+ *
+ * Options:
+ *   nzones    Number of zones                     (EMU_MEDIA_NZONES)
+ *   zsze      Zone size in sectors                (EMU_MEDIA_ZSZE)
+ *   zcap      Zone capacity in sectors            (zsze)
+ *   nbytes    Sector size in bytes                (EMU_MEDIA_NBYTES)
+ *   mdts      Max data transfer size in bytes     (EMU_MEDIA_MDTS)
+ *   maxopen   Max open zones, 0 for no limit      (0)
+ *   maxactive Max active zones, 0 for no limit    (0)
+ *   lat       Latency per command in usec         (0)
+ *   bw        Bandwidth in MB/s, 0 for no limit   (0)
+ *   ooo       Complete the newest command first,  (0)
+ *             appends are placed at completion
+ */
+#define EMU_MEDIA_PREFIX "emu:"
+#define EMU_MEDIA_MEM    "mem"
+
+#define EMU_MEDIA_NZONES 64
+#define EMU_MEDIA_ZSZE   65536
+#define EMU_MEDIA_NBYTES 4096
+#define EMU_MEDIA_MDTS   (512 * 1024)
+
+enum emu_media_error {
+    EMU_MEDIA_NODEVICE = 0x1,
+    EMU_MEDIA_NOGEO    = 0x2,
+    EMU_INVALID_OPCODE = 0x3,
+    EMU_MEDIA_MEM_ERR  = 0x4,
+    EMU_MEDIA_OPT_ERR  = 0x5,
+    EMU_MEDIA_IO_ERR   = 0x6
+};
+
+/* Zoned command specific status codes (NVMe ZNS) */
+enum emu_media_status {
+    EMU_STATUS_BOUNDARY      = 0xb9,
+    EMU_STATUS_ZONE_FULL     = 0xba,
+    EMU_STATUS_INVALID_WRITE = 0xbd,
+    EMU_STATUS_TOO_MANY_ACT  = 0xbe,
+    EMU_STATUS_TOO_MANY_OPEN = 0xbf,
+    EMU_STATUS_INVALID_TRANS = 0xc0
+};
+
+struct emu_zone {
+    uint64_t zslba;
+    uint64_t wp;
+    uint8_t  zs;
+};
+
+struct emu_media {
+    int      fd;   /* Backing file, -1 for memory */
+    uint8_t *mem;  /* Backing memory */
+    uint64_t nbytes_dev;
+
+    uint32_t nzones;
+    uint64_t zsze;
+    uint64_t zcap;
+    uint32_t nbytes;
+    uint32_t mdts;
+    uint32_t maxopen;
+    uint32_t maxactive;
+
+    /* Latency and bandwidth model */
+    uint32_t lat_us;
+    uint32_t bw_mbs;
+    uint64_t busy_until;
+    uint8_t  ooo; /* Out of order completion */
+
+    uint32_t         nopen;
+    uint32_t         nactive;
+    struct emu_zone *zones;
+    pthread_mutex_t  zone_mutex;
+
+    struct xztl_media media;
+};
+
+/* Registration function */
+int emu_media_register(const char *dev_name);
+
+#endif /* EMUMEDIA */
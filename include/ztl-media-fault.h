@@ -0,0 +1,162 @@
+/* xZTL: Zone Translation Layer User-space Library
+ *
+ * Copyright 2019 Samsung Electronics
+ *
+ * Written by Ivan L. Picoli <i.picoli@samsung.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+
+#ifndef FAULTMEDIA
+#define FAULTMEDIA
+
+#include <pthread.h>
+#include <stdint.h>
+#include <xztl-media.h>
+#include <xztl.h>
+
+/* Fault injection media. Wraps the registered media and injects latency,
+ * errors and timeouts per opcode. Any media can be wrapped (znd, emu).
+ *
+ * The faults are described by a spec, rules of an opcode are separated by
+ * commas and opcodes by semicolons:
+ *
+ *   <op>:<rule>[,<rule>...][;<op>:...]
+ *
+ * Opcodes: read, write, append, reset, finish, report
+ *
+ * Rules (times in usec, probabilities in parts per million):
+ *   fixed=<us>           Latency of every command
+ *   uniform=<min>/<max>  Latency uniformly distributed
+ *   exp=<mean>/<max>     Latency exponentially distributed, capped at max
+ *   stall=<ppm>/<us>     Extra latency of some commands
+ *   err=<ppm>            Commands failed with FAULT_MEDIA_STATUS_ERR
+ *   tmo=<ppm>/<us>       Commands failed with FAULT_MEDIA_STATUS_TMO
+ *                        after 'us'
+ *
+ * Example: "read:exp=100/5000,stall=100/50000;reset:fixed=20000,err=1000"
+ *
+ * Latency is counted from the submission. Asynchronous completions are
+ * held in their context, ordered by due time, and released by the pokes
+ * of the context once the latency has passed. Synchronous commands return
+ * after the latency. Failed and timed out commands are not submitted to
+ * the wrapped media. The random sequence is seeded for reproducibility.
+ *
+ * Environment (read by xztl_init):
+ *   XZTL_FAULT=<spec>       Wrap the media with the spec
+ *   XZTL_FAULT_SEED=<seed>  Seed of the random sequence (FAULT_MEDIA_SEED)
+ */
+#define FAULT_MEDIA_ENV      "XZTL_FAULT"
+#define FAULT_MEDIA_SEED_ENV "XZTL_FAULT_SEED"
+#define FAULT_MEDIA_SEED     0x5eed
+#define FAULT_MEDIA_SPECLEN  1024
+
+enum fault_media_error {
+    FAULT_MEDIA_SPEC_ERR = 0x1,
+    FAULT_MEDIA_NOMEDIA  = 0x2,
+    FAULT_MEDIA_ACTIVE   = 0x3
+};
+
+/* Command status of injected faults */
+enum fault_media_status {
+    FAULT_MEDIA_STATUS_ERR = 0xe0,
+    FAULT_MEDIA_STATUS_TMO = 0xe1
+};
+
+enum fault_media_op {
+    FAULT_MEDIA_READ   = 0x0,
+    FAULT_MEDIA_WRITE  = 0x1,
+    FAULT_MEDIA_APPEND = 0x2,
+    FAULT_MEDIA_RESET  = 0x3,
+    FAULT_MEDIA_FINISH = 0x4,
+    FAULT_MEDIA_REPORT = 0x5,
+    FAULT_MEDIA_NOPS   = 0x6
+};
+
+enum fault_media_dist {
+    FAULT_MEDIA_LAT_NONE    = 0x0,
+    FAULT_MEDIA_LAT_FIXED   = 0x1,
+    FAULT_MEDIA_LAT_UNIFORM = 0x2,
+    FAULT_MEDIA_LAT_EXP     = 0x3
+};
+
+struct fault_media_rule {
+    uint8_t  dist;      /* enum fault_media_dist */
+    uint32_t lat_us;    /* Fixed latency, uniform minimum or mean */
+    uint32_t lat_max;   /* Uniform maximum or exponential cap */
+    uint32_t stall_ppm;
+    uint32_t stall_us;
+    uint32_t err_ppm;
+    uint32_t tmo_ppm;
+    uint32_t tmo_us;
+};
+
+struct fault_media_stats {
+    uint64_t ncmd;
+    uint64_t nstall;
+    uint64_t nerr;
+    uint64_t ntmo;
+    uint64_t lat_us; /* Latency injected */
+};
+
+struct fault_media {
+    uint8_t                  active;
+    uint64_t                 rand;
+    struct fault_media_rule  rules[FAULT_MEDIA_NOPS];
+    struct fault_media_stats stats[FAULT_MEDIA_NOPS];
+    pthread_spinlock_t       spin;
+
+    /* Wrapped media */
+    struct xztl_media inner;
+};
+
+/**
+ * Parse a fault spec
+ *
+ * @param spec  Fault spec (see above)
+ * @param rules Filled with the rules of each opcode
+ *
+ * @return Returns zero if the spec is valid
+ */
+int fault_media_parse(const char *spec, struct fault_media_rule *rules);
+
+/**
+ * Wrap the registered media. Commands are then submitted to the wrapper
+ *
+ * @param spec Fault spec (see above)
+ * @param seed Seed of the random sequence
+ *
+ * @return Returns zero if the media is wrapped
+ */
+int fault_media_wrap(const char *spec, uint64_t seed);
+
+/**
+ * Remove the wrapper, the wrapped media is used again. Commands in flight
+ * must be completed
+ */
+void fault_media_unwrap(void);
+
+/**
+ * Copy the fault statistics of an opcode
+ *
+ * @param op    enum fault_media_op
+ * @param stats Filled with the statistics
+ */
+void fault_media_get_stats(uint8_t op, struct fault_media_stats *stats);
+
+/**
+ * Print the fault statistics of all opcodes
+ */
+void fault_media_print_stats(void);
+
+#endif /* FAULTMEDIA */
@@ -35,13 +35,42 @@ enum znd_media_error {
     ZND_MEDIA_ASYNCH_TH  = 0x8,
     ZND_MEDIA_POKE_ERR   = 0x9,
     ZND_MEDIA_OUTS_ERR   = 0xa,
-    ZND_MEDIA_WAIT_ERR   = 0xb
+    ZND_MEDIA_WAIT_ERR   = 0xb,
+    ZND_MEDIA_ASYNC_CAP  = 0xc,
+    ZND_MEDIA_COPY_ERR   = 0xd,
+    ZND_MEDIA_DEV_GEO    = 0xe,
+    ZND_MEDIA_DEV_BOUND  = 0xf
 };
 
-struct znd_media {
+/* Environment variable used to select the xNVMe asynchronous backend.
+ * Supported: io_uring_cmd, io_uring, libaio, thrpool */
+#define ZND_MEDIA_ASYNC_ENV "XZTL_ASYNC"
+
+/* Environment variable to enable submission queue polling (io_uring) */
+#define ZND_MEDIA_SQPOLL_ENV "XZTL_SQPOLL"
+
+/* Several devices or namespaces may be aggregated into one media, the
+ * device names are separated by ZND_MEDIA_DEV_SEP (e.g.
+ * "/dev/ng0n1,/dev/ng1n1"). All devices must have the same zone geometry.
+ * Zones are interleaved: media zone z is zone z / ndevs of device
+ * z % ndevs, so the consecutive zones of a provisioning node are spread
+ * across the devices. */
+#define ZND_MEDIA_DEV_SEP ","
+
+struct znd_media_dev {
     struct xnvme_dev *      dev;
     const struct xnvme_geo *devgeo;
+    uint32_t                nsid;
+};
+
+struct znd_media {
+    struct xnvme_dev *      dev;    /* First device */
+    const struct xnvme_geo *devgeo; /* Zone geometry, same in all devices */
+    struct znd_media_dev    devs[XZTL_MEDIA_MAX_DEV];
+    uint16_t                ndevs;
     struct xztl_media       media;
+    int                     qopts; /* Queue options (e.g. SQPOLL) */
+    uint8_t                 iopoll; /* Polled queues can be created */
 };
 
 struct znd_log_cmd {
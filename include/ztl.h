@@ -26,6 +26,9 @@
 #define ZTL_PRO_MP_SZ           32 /* Mempool size per thread */
 #define ZTL_PRO_STRIPE          8  /* Number of zones for parallel write */
 #define ZTL_PRO_ZONE_NUM_INNODE ZTL_PRO_STRIPE /* Number of zones per node */
+#define ZTL_PRO_MGMT_QDEPTH     64 /* Management thread queue depth */
+#define ZTL_PRO_MGMT_SUBMIT_ERR 0xff /* Zone command status if not submitted */
+#define ZTL_PRO_REMAP_EXT       16 /* Initial extents of a zone remap table */
 
 enum ztl_pro_type_list { ZTL_PRO_TUSER = 0x0 };
 
@@ -34,12 +37,31 @@ enum ztl_pro_mgmt_opcode {
     ZTL_MGMG_RESET_ZONE = 0x1
 };
 
+/* Sectors at zone offset 'off' were written at 'poff' */
+struct ztl_pro_remap_ext {
+    uint32_t off;
+    uint32_t poff;
+    uint32_t nsec;
+};
+
+/* Extents of a zone written elsewhere by zone append, sorted by 'off' and
+ * not overlapping. Sectors out of the extents are written in place */
+struct ztl_pro_remap {
+    uint32_t                 n;
+    uint32_t                 max;
+    struct ztl_pro_remap_ext ext[];
+};
+
 struct ztl_pro_zone {
     struct xztl_maddr     addr;
     struct app_zmd_entry *zmd_entry;
     uint64_t              capacity;
-    uint8_t               lock;
+    uint8_t               lock; /* Remap table, see ztl_pro_zone_remap */
     uint8_t               state;
+
+    /* NULL if the zone has no remapping */
+    struct ztl_pro_remap *remap;
+    uint32_t  chunk_sec; /* Chunk of the node */
     TAILQ_ENTRY(ztl_pro_zone) entry;
     TAILQ_ENTRY(ztl_pro_zone) open_entry;
 };
@@ -51,12 +73,28 @@ struct ztl_pro_node {
 
     STAILQ_ENTRY(ztl_pro_node) fentry;
     uint32_t zone_num;
+    uint32_t chunk_sec; /* Sectors striped per zone, set while empty */
     uint32_t nr_finish_err;
     uint32_t nr_reset_err;
 
     uint32_t status;
 };
 
+/* Node management request, processed by the management thread */
+struct xnvme_node_mgmt_entry {
+    struct app_group *    grp;
+    struct ztl_pro_node * node;
+    struct xztl_mp_entry *mp_entry;
+    int32_t               op_code;
+    STAILQ_ENTRY(xnvme_node_mgmt_entry) entry;
+};
+
+/* Zone management commands of a node in flight */
+struct ztl_pro_node_mgmt {
+    struct xztl_zn_mcmd cmd[ZTL_PRO_ZONE_NUM_INNODE];
+    uint16_t            outstanding;
+};
+
 struct ztl_pro_node_grp {
     struct ztl_pro_node *vnodes;
     struct ztl_pro_zone *vzones;
@@ -66,7 +104,13 @@ struct ztl_pro_node_grp {
 
     // TAILQ_HEAD (free_list, ztl_pro_node) free_head;
     // TAILQ_HEAD (used_list, ztl_pro_node) full_head;
-    pthread_spinlock_t spin;
+
+    /* Free nodes, one bit per node. A bit of free_sum is set while its
+     * word of free_bits may have free nodes, see ztl_pro_grp_node_take */
+    uint64_t *free_bits;
+    uint64_t *free_sum;
+    uint32_t  nwords;
+    uint32_t  nsum;
 };
 
 /*struct ztl_pro_grp {
@@ -101,8 +145,31 @@ int  ztl_pro_grp_get(struct app_group *grp, struct app_pro_addr *ctx,
                      uint32_t nsec, int32_t *node_id,
                      struct xztl_thread *tdinfo);
 void ztl_pro_grp_free(struct app_group *grp, uint32_t zone_i, uint32_t nsec);
+int  ztl_pro_zone_remap(struct ztl_pro_zone *zone, uint64_t off, uint64_t poff,
+                        uint64_t nsec);
+int  ztl_pro_grp_zone_remap(struct app_group *grp, uint32_t zone_i,
+                            uint64_t sect, uint64_t psect, uint64_t nsec);
+uint64_t ztl_pro_zone_off(struct ztl_pro_zone *zone, uint64_t off,
+                          uint64_t *nsec);
+int      ztl_pro_zone_remap_next(struct ztl_pro_zone *zone, uint64_t off,
+                                 struct ztl_pro_remap_ext *ext);
+void     ztl_pro_zone_remap_free(struct ztl_pro_zone *zone);
+void ztl_pro_grp_node_chunk(struct ztl_pro_node *node, uint32_t chunk_sec);
+uint32_t ztl_pro_grp_node_take(struct app_group *grp, uint32_t hint,
+                               struct ztl_pro_node **nodes, uint32_t max);
+void     ztl_pro_grp_node_put(struct app_group *grp, struct ztl_pro_node *node);
+int  ztl_pro_zone_refresh(struct ztl_pro_zone *zone);
 int  ztl_pro_grp_node_reset(struct app_group *grp, struct ztl_pro_node *node);
 int  ztl_pro_node_reset_zn(struct ztl_pro_zone *zone);
 int  ztl_pro_grp_node_finish(struct app_group *grp, struct ztl_pro_node *node);
+int  ztl_pro_md_init(struct app_group *grp, struct ztl_pro_zone *zone0,
+                     struct ztl_pro_zone *zone1);
+void ztl_pro_md_exit(void);
+int  ztl_pro_md_commit(void);
+void ztl_pro_md_remap(uint32_t zone_i, uint32_t off, uint32_t poff,
+                      uint32_t nsec);
+void ztl_pro_md_chunk(struct ztl_pro_node *node);
+int  ztl_pro_md_reset(struct ztl_pro_node *node);
+void ztl_pro_md_zone_drop(struct ztl_pro_zone *zone);
 int  ztl_pro_grp_submit_mgmt(struct app_group *grp, struct ztl_pro_node *node,
                              int32_t op_code);
@@ -0,0 +1,257 @@
+/* xZTL: Zone Translation Layer User-space Library
+ *
+ * Copyright 2019 Samsung Electronics
+ *
+ * Written by Ivan L. Picoli <i.picoli@samsung.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+
+#include <ctype.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <xztl-config.h>
+#include <xztl-dma.h>
+#include <xztl-media.h>
+#include <xztl-numa.h>
+#include <xztl-ztl.h>
+#include <xztl.h>
+#include <ztl-media-fault.h>
+#include <ztl-media.h>
+
+enum xztl_config_type {
+    XZTL_CONFIG_INT = 0x0,
+    XZTL_CONFIG_TXT = 0x1
+};
+
+struct xztl_config_key {
+    const char *name;
+    uint8_t     type;
+    size_t      off;
+};
+
+#define XZTL_CONFIG_KEY(name, type, field) \
+    { name, type, offsetof(struct xztl_config, field) }
+
+static const struct xztl_config_key xztl_config_keys[] = {
+    XZTL_CONFIG_KEY(ZND_MEDIA_ASYNC_ENV, XZTL_CONFIG_TXT, async),
+    XZTL_CONFIG_KEY(ZND_MEDIA_SQPOLL_ENV, XZTL_CONFIG_INT, sqpoll),
+    XZTL_CONFIG_KEY(XZTL_WRITE_APPEND_ENV, XZTL_CONFIG_INT, write_append),
+    XZTL_CONFIG_KEY(FAULT_MEDIA_ENV, XZTL_CONFIG_TXT, fault),
+    XZTL_CONFIG_KEY(FAULT_MEDIA_SEED_ENV, XZTL_CONFIG_INT, fault_seed),
+    XZTL_CONFIG_KEY(XZTL_WAIT_ENV, XZTL_CONFIG_TXT, wait),
+    XZTL_CONFIG_KEY(XZTL_READ_WAIT_ENV, XZTL_CONFIG_TXT, read_wait),
+    XZTL_CONFIG_KEY(XZTL_WAIT_SPIN_US_ENV, XZTL_CONFIG_INT, wait_spin_us),
+    XZTL_CONFIG_KEY(XZTL_WRITE_KB_ENV, XZTL_CONFIG_INT, write_kb),
+    XZTL_CONFIG_KEY(XZTL_READ_KB_ENV, XZTL_CONFIG_INT, read_kb),
+    XZTL_CONFIG_KEY(XZTL_DMA_PAGE_ENV, XZTL_CONFIG_TXT, dma_page),
+    XZTL_CONFIG_KEY(XZTL_DMA_REGION_MB_ENV, XZTL_CONFIG_INT, dma_region_mb),
+    XZTL_CONFIG_KEY(XZTL_NUMA_ENV, XZTL_CONFIG_INT, numa),
+    XZTL_CONFIG_KEY(XZTL_BG_CPUS_ENV, XZTL_CONFIG_TXT, bg_cpus),
+    XZTL_CONFIG_KEY(XZTL_SLOT_CPUS_ENV, XZTL_CONFIG_TXT, slot_cpus),
+    XZTL_CONFIG_KEY(XZTL_APP_CPUS_ENV, XZTL_CONFIG_TXT, app_cpus),
+    XZTL_CONFIG_KEY(XZTL_PROMETHEUS_ENV, XZTL_CONFIG_INT, prometheus),
+    XZTL_CONFIG_KEY(ZTL_TH_NUM_ENV, XZTL_CONFIG_INT, nslots),
+    XZTL_CONFIG_KEY(ZTL_READ_QDEPTH_ENV, XZTL_CONFIG_INT, read_qdepth),
+    XZTL_CONFIG_KEY(ZTL_WRITE_QDEPTH_ENV, XZTL_CONFIG_INT, write_qdepth),
+    XZTL_CONFIG_KEY(ZTL_WRITE_ZONE_QDEPTH_ENV, XZTL_CONFIG_INT,
+                    write_zone_qdepth),
+    XZTL_CONFIG_KEY(ZTL_ASYNC_DEPTH_ENV, XZTL_CONFIG_INT, async_depth),
+    XZTL_CONFIG_KEY(ZTL_DISPATCH_ENV, XZTL_CONFIG_TXT, dispatch),
+    XZTL_CONFIG_KEY(ZTL_SLOT_IDLE_MS_ENV, XZTL_CONFIG_INT, slot_idle_ms),
+    XZTL_CONFIG_KEY(ZTL_BOUNCE_BUFS_ENV, XZTL_CONFIG_INT, bounce_bufs),
+    XZTL_CONFIG_KEY(ZTL_MAP_CACHE_PGS_ENV, XZTL_CONFIG_INT, map_cache_pgs),
+    XZTL_CONFIG_KEY(XZTL_CONFIG_ZROCKS_BUF_ENV, XZTL_CONFIG_INT,
+                    zrocks_buf_ents)};
+
+#define XZTL_CONFIG_NKEYS \
+    (sizeof(xztl_config_keys) / sizeof(struct xztl_config_key))
+
+static struct xztl_config xztl_cfg;
+static uint8_t            xztl_cfg_active;
+
+void xztl_config_init(struct xztl_config *cfg) {
+    uint32_t key_i;
+
+    memset(cfg, 0x0, sizeof(struct xztl_config));
+    for (key_i = 0; key_i < XZTL_CONFIG_NKEYS; key_i++) {
+        if (xztl_config_keys[key_i].type == XZTL_CONFIG_INT)
+            *(int64_t *)((char *)cfg + xztl_config_keys[key_i].off) =
+                XZTL_CONFIG_UNSET;
+    }
+}
+
+static const struct xztl_config_key *xztl_config_find(const char *key) {
+    uint32_t key_i;
+
+    for (key_i = 0; key_i < XZTL_CONFIG_NKEYS; key_i++) {
+        if (!strcmp(xztl_config_keys[key_i].name, key))
+            return &xztl_config_keys[key_i];
+    }
+
+    return NULL;
+}
+
+int xztl_config_set(struct xztl_config *cfg, const char *key,
+                    const char *val) {
+    const struct xztl_config_key *ckey = xztl_config_find(key);
+    char *                        end;
+    int64_t                       num;
+
+    if (!ckey) {
+        log_erra("xztl-config: Unknown key %s.", key);
+        return XZTL_CONFIG_ERR;
+    }
+
+    if (ckey->type == XZTL_CONFIG_TXT) {
+        snprintf((char *)cfg + ckey->off, XZTL_CONFIG_STR, "%s", val);
+        return XZTL_OK;
+    }
+
+    num = strtoll(val, &end, 0);
+    if (end == val || *end != '\0') {
+        log_erra("xztl-config: %s is not a number (%s).", key, val);
+        return XZTL_CONFIG_ERR;
+    }
+
+    *(int64_t *)((char *)cfg + ckey->off) = num;
+
+    return XZTL_OK;
+}
+
+void xztl_config_load_env(struct xztl_config *cfg) {
+    const char *env;
+    uint32_t    key_i;
+
+    for (key_i = 0; key_i < XZTL_CONFIG_NKEYS; key_i++) {
+        env = getenv(xztl_config_keys[key_i].name);
+        if (env)
+            xztl_config_set(cfg, xztl_config_keys[key_i].name, env);
+    }
+}
+
+static char *xztl_config_trim(char *str) {
+    char *end;
+
+    while (isspace((unsigned char)*str))
+        str++;
+
+    end = str + strlen(str);
+    while (end > str && isspace((unsigned char)end[-1]))
+        end--;
+    *end = '\0';
+
+    return str;
+}
+
+int xztl_config_load_file(struct xztl_config *cfg, const char *path) {
+    FILE *   fp;
+    char     line[XZTL_CONFIG_STR * 2], *key, *val;
+    uint32_t line_i = 0;
+    int      ret    = XZTL_OK;
+
+    fp = fopen(path, "r");
+    if (!fp) {
+        log_erra("xztl-config: Cannot open %s.", path);
+        return XZTL_CONFIG_ERR;
+    }
+
+    while (fgets(line, sizeof(line), fp)) {
+        line_i++;
+        key = xztl_config_trim(line);
+        if (*key == '\0' || *key == '#')
+            continue;
+
+        val = strchr(key, '=');
+        if (!val) {
+            log_erra("xztl-config: %s:%u: Expected KEY=value.", path, line_i);
+            ret = XZTL_CONFIG_ERR;
+            break;
+        }
+        *val++ = '\0';
+
+        ret = xztl_config_set(cfg, xztl_config_trim(key),
+                              xztl_config_trim(val));
+        if (ret) {
+            log_erra("xztl-config: %s:%u: Invalid line.", path, line_i);
+            break;
+        }
+    }
+
+    fclose(fp);
+    return ret;
+}
+
+void xztl_config_apply(const struct xztl_config *cfg) {
+    memcpy(&xztl_cfg, cfg, sizeof(struct xztl_config));
+    xztl_cfg_active = 1;
+}
+
+/* Modules initialized without xztl_init (tests) follow the environment */
+struct xztl_config *xztl_config_active(void) {
+    if (!xztl_cfg_active) {
+        xztl_config_init(&xztl_cfg);
+        xztl_config_load_env(&xztl_cfg);
+        xztl_cfg_active = 1;
+    }
+
+    return &xztl_cfg;
+}
+
+void xztl_config_get(struct xztl_config *cfg) {
+    memcpy(cfg, xztl_config_active(), sizeof(struct xztl_config));
+}
+
+/* Writes the value of a key to 'val', "default" if unset */
+static void xztl_config_value(const struct xztl_config *cfg,
+                              const struct xztl_config_key *ckey, char *val,
+                              size_t len) {
+    const char *str;
+    int64_t     num;
+
+    if (ckey->type == XZTL_CONFIG_TXT) {
+        str = (const char *)cfg + ckey->off;
+        snprintf(val, len, "%s", (*str) ? str : "default");
+        return;
+    }
+
+    num = *(const int64_t *)((const char *)cfg + ckey->off);
+    if (num == XZTL_CONFIG_UNSET)
+        snprintf(val, len, "default");
+    else
+        snprintf(val, len, "%ld", num);
+}
+
+void xztl_config_print(const struct xztl_config *cfg) {
+    char     val[XZTL_CONFIG_STR];
+    uint32_t key_i;
+
+    printf("\n xZTL configuration\n");
+    for (key_i = 0; key_i < XZTL_CONFIG_NKEYS; key_i++) {
+        xztl_config_value(cfg, &xztl_config_keys[key_i], val, sizeof(val));
+        printf("   %-24s %s\n", xztl_config_keys[key_i].name, val);
+    }
+}
+
+void xztl_config_log(void) {
+    char     val[XZTL_CONFIG_STR];
+    uint32_t key_i;
+
+    for (key_i = 0; key_i < XZTL_CONFIG_NKEYS; key_i++) {
+        xztl_config_value(&xztl_cfg, &xztl_config_keys[key_i], val,
+                          sizeof(val));
+        log_infoa("xztl-config: %s=%s", xztl_config_keys[key_i].name, val);
+    }
+}
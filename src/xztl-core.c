@@ -17,13 +17,18 @@
  * limitations under the License.
 */
 
+#include <libxnvme_znd.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <syslog.h>
+#include <xztl-config.h>
+#include <xztl-dma.h>
+#include <xztl-numa.h>
 #include <xztl.h>
 #include <xztl-media.h>
 #include <xztl-ztl.h>
+#include <ztl-media-fault.h>
 
 static struct xztl_core core;
 
@@ -81,12 +86,110 @@ void xztl_print_mcmd(struct xztl_io_mcmd *cmd) {
 
 static xztl_register_media_fn *media_fn = NULL;
 
+/* Buffers come from the DMA arena, or from the media if the arena is
+ * disabled or cannot serve the size */
 void *xztl_media_dma_alloc(size_t bytes) {
+    return xztl_media_dma_alloc_node(bytes, -1);
+}
+
+/* Only arena buffers are bound to the node, media buffers are allocated
+ * wherever the media places them */
+void *xztl_media_dma_alloc_node(size_t bytes, int node) {
+    void *ptr;
+
+    ptr = xztl_dma_alloc_node(bytes, node);
+    if (ptr)
+        return ptr;
+
     return core.media->dma_alloc(bytes);
 }
 
 void xztl_media_dma_free(void *ptr) {
-    core.media->dma_free(ptr);
+    if (!xztl_dma_free(ptr))
+        core.media->dma_free(ptr);
+}
+
+/* Check a copy command against the device copy limits */
+static int xztl_media_copy_native(struct xztl_io_mcmd *cmd) {
+    struct xztl_mgeo *g    = &core.media->geo;
+    uint64_t          nsec = 0;
+    uint32_t          rng_i;
+
+    if (!(core.media->caps & XZTL_MEDIA_CAP_COPY))
+        return 0;
+    if (g->copy_nrange && cmd->naddr > g->copy_nrange)
+        return 0;
+
+    for (rng_i = 0; rng_i < cmd->naddr; rng_i++) {
+        if (g->copy_sec_rng && cmd->nsec[rng_i] > g->copy_sec_rng)
+            return 0;
+        nsec += cmd->nsec[rng_i];
+    }
+
+    return !(g->copy_sec_max && nsec > g->copy_sec_max);
+}
+
+/* Copy through a host buffer when the media cannot copy the command. Each
+ * source range is read and written at the destination in chunks of at most
+ * sec_mdts sectors. Asynchronous commands are completed before returning */
+static int xztl_media_copy_host(struct xztl_io_mcmd *cmd) {
+    struct xztl_io_mcmd io;
+    uint64_t            dst, src, left;
+    uint32_t            rng_i, chunk, nsec;
+    void *              buf;
+    int                 ret = XZTL_OK;
+
+    if (!cmd->naddr || cmd->naddr > XZTL_MAX_MADDR)
+        return XZTL_MEDIA_ERROR;
+
+    chunk = (core.media->geo.sec_mdts) ? core.media->geo.sec_mdts : 128;
+    buf   = xztl_media_dma_alloc((size_t)chunk * core.media->geo.nbytes);
+    if (!buf)
+        return XZTL_MEDIA_ERROR;
+
+    dst = cmd->copy_dst.g.sect;
+    for (rng_i = 0; rng_i < cmd->naddr && !ret; rng_i++) {
+        src  = cmd->addr[rng_i].g.sect;
+        left = cmd->nsec[rng_i];
+
+        while (left && !ret) {
+            nsec = (left > chunk) ? chunk : (uint32_t)left;
+
+            memset(&io, 0x0, sizeof(struct xztl_io_mcmd));
+            io.opcode         = XZTL_CMD_READ;
+            io.synch          = 1;
+            io.naddr          = 1;
+            io.nsec[0]        = nsec;
+            io.addr[0].g.sect = src;
+            io.prp[0]         = (uint64_t)buf;  // NOLINT
+
+            ret = core.media->submit_io(&io);
+            if (ret || io.status)
+                break;
+
+            io.opcode         = XZTL_CMD_WRITE;
+            io.status         = 0;
+            io.addr[0].g.sect = dst;
+
+            ret = core.media->submit_io(&io);
+            if (ret || io.status)
+                break;
+
+            src  += nsec;
+            dst  += nsec;
+            left -= nsec;
+        }
+    }
+
+    xztl_media_dma_free(buf);
+
+    cmd->status   = (ret) ? ret : io.status;
+    cmd->paddr[0] = cmd->copy_dst.g.sect;
+
+    if (!cmd->synch)
+        cmd->callback(cmd);
+
+    return (cmd->synch) ? cmd->status : XZTL_OK;
 }
 
 int xztl_media_submit_io(struct xztl_io_mcmd *cmd) {
@@ -95,13 +198,151 @@ int xztl_media_submit_io(struct xztl_io_mcmd *cmd) {
     if (ZDEBUG_MEDIA_R && (cmd->opcode == XZTL_CMD_READ))
         xztl_print_mcmd(cmd);
 
+    if (cmd->opcode == XZTL_CMD_COPY && !xztl_media_copy_native(cmd))
+        return xztl_media_copy_host(cmd);
+
     return core.media->submit_io(cmd);
 }
 
+/* Submit a batch of commands. Commands are submitted in order and 'nsub'
+ * returns how many were accepted. If the media has no batch support, the
+ * commands are submitted one by one. */
+int xztl_media_submit_io_batch(struct xztl_io_mcmd **cmds, uint32_t ncmd,
+                               uint32_t *nsub) {
+    uint32_t cmd_i;
+    int      ret = XZTL_OK;
+
+    /* Copies may need the host fallback */
+    for (cmd_i = 0; cmd_i < ncmd; cmd_i++)
+        if (cmds[cmd_i]->opcode == XZTL_CMD_COPY)
+            break;
+
+    if (core.media->submit_io_batch && cmd_i == ncmd)
+        return core.media->submit_io_batch(cmds, ncmd, nsub);
+
+    for (cmd_i = 0; cmd_i < ncmd; cmd_i++) {
+        ret = xztl_media_submit_io(cmds[cmd_i]);
+        if (ret)
+            break;
+    }
+
+    *nsub = cmd_i;
+
+    return ret;
+}
+
 int xztl_media_submit_zn(struct xztl_zn_mcmd *cmd) {
+    cmd->synch = 1;
     return core.media->zone_fn(cmd);
 }
 
+/* Submit a zone management command (open, close, finish or reset) to the
+ * queue of cmd->async_ctx. cmd->callback is called with the command when
+ * the queue is poked after completion. Reports are only synchronous. */
+int xztl_media_submit_zn_asynch(struct xztl_zn_mcmd *cmd) {
+    if (cmd->opcode == XZTL_ZONE_MGMT_REPORT || !cmd->async_ctx ||
+        !cmd->callback)
+        return XZTL_MEDIA_ERROR;
+
+    cmd->synch = 0;
+    return core.media->zone_fn(cmd);
+}
+
+/* Report the zones [zone, zone + nzones) into cmd->opaque. The report is
+ * allocated by the media and freed with xnvme_buf_virt_free */
+static int xztl_media_report(struct xztl_zn_mcmd *cmd, uint32_t zone,
+                             uint32_t nzones) {
+    cmd->opcode      = XZTL_ZONE_MGMT_REPORT;
+    cmd->addr.addr   = 0;
+    cmd->addr.g.zone = zone;
+    cmd->nzones      = nzones;
+    cmd->opaque      = NULL;
+
+    return xztl_media_submit_zn(cmd);
+}
+
+/* Refresh the state of a single zone from the media */
+int xztl_media_zone_info(uint32_t zone, struct xnvme_spec_znd_descr *zinfo) {
+    struct xztl_zn_mcmd      cmd;
+    struct xnvme_znd_report *rep;
+    int                      ret;
+
+    ret = xztl_media_report(&cmd, zone, 1);
+    if (ret)
+        return ret;
+
+    rep = (struct xnvme_znd_report *)cmd.opaque;
+    if (rep->nentries)
+        memcpy(zinfo, XNVME_ZND_REPORT_DESCR(rep, 0),
+               sizeof(struct xnvme_spec_znd_descr));
+    else
+        ret = XZTL_MEDIA_ERROR;
+
+    xnvme_buf_virt_free(rep);
+
+    return ret;
+}
+
+void xztl_zn_report_iter_init(struct xztl_zn_report_iter *it, uint32_t zone,
+                              uint32_t nzones) {
+    it->zone   = zone;
+    it->end    = zone + nzones;
+    it->batch  = XZTL_ZN_REPORT_BATCH;
+    it->idx    = 0;
+    it->status = XZTL_OK;
+    it->rep    = NULL;
+}
+
+/* Return the descriptor of the next zone, NULL at the end of the range or
+ * on failure (it->status is set). The descriptor is valid until the next
+ * call. */
+struct xnvme_spec_znd_descr *
+xztl_zn_report_iter_next(struct xztl_zn_report_iter *it) {
+    struct xztl_zn_mcmd cmd;
+    uint32_t            nzones;
+    int                 ret;
+
+    if (it->rep && it->idx == it->rep->nentries) {
+        xnvme_buf_virt_free(it->rep);
+        it->rep = NULL;
+    }
+
+    if (!it->rep) {
+        if (it->zone >= it->end)
+            return NULL;
+
+        nzones = (it->end - it->zone < it->batch) ? it->end - it->zone
+                                                  : it->batch;
+        ret    = xztl_media_report(&cmd, it->zone, nzones);
+        if (ret) {
+            log_erra("xztl-core: Zone report failed. zone %u status %d",
+                     it->zone, cmd.status);
+            it->status = ret;
+            return NULL;
+        }
+
+        it->rep = (struct xnvme_znd_report *)cmd.opaque;
+        it->idx = 0;
+
+        if (!it->rep->nentries) {
+            it->status = XZTL_MEDIA_ERROR;
+            xztl_zn_report_iter_exit(it);
+            return NULL;
+        }
+    }
+
+    it->zone++;
+
+    return XNVME_ZND_REPORT_DESCR(it->rep, it->idx++);
+}
+
+void xztl_zn_report_iter_exit(struct xztl_zn_report_iter *it) {
+    if (it->rep)
+        xnvme_buf_virt_free(it->rep);
+
+    it->rep = NULL;
+}
+
 int xztl_media_submit_misc(struct xztl_misc_cmd *cmd) {
     return core.media->cmd_exec(cmd);
 }
@@ -189,6 +430,141 @@ int xztl_media_set(struct xztl_media *media) {
     return XZTL_OK;
 }
 
+/* Zone append is enabled by XZTL_WRITE_APPEND_ENV (or the compile-time
+ * default) only if the media supports it. */
+static uint8_t xztl_append_init(void) {
+    struct xztl_config *cfg = xztl_config_active();
+    uint8_t             append;
+
+    append = (cfg->write_append != XZTL_CONFIG_UNSET) ? (cfg->write_append != 0)
+                                                     : XZTL_WRITE_APPEND;
+
+    if (append && !(core.media->caps & XZTL_MEDIA_CAP_APPEND)) {
+        log_info("core: Media does not support zone append. Using writes.");
+        append = 0;
+    }
+
+    log_infoa("core: Write path: %s", (append) ? "zone append" : "write");
+    cfg->write_append = append;
+
+    return append;
+}
+
+static const char *xztl_wait_names[] = {"spin", "hybrid", "block"};
+
+/* Returns 'mode' if the variable is not set or unknown */
+static int8_t xztl_wait_parse(const char *env, int8_t mode) {
+    if (!env || env[0] == '\0')
+        return mode;
+    if (!strcmp(env, "spin"))
+        return XZTL_WAIT_SPIN;
+    if (!strcmp(env, "hybrid"))
+        return XZTL_WAIT_HYBRID;
+    if (!strcmp(env, "block"))
+        return XZTL_WAIT_BLOCK;
+
+    log_erra("core: Unknown wait mode %s. Ignored.", env);
+    return mode;
+}
+
+/* Completion wait policy: XZTL_WAIT_ENV selects spin, hybrid or block,
+ * XZTL_WAIT_SPIN_US_ENV the spin time of the hybrid mode. Read queues
+ * follow XZTL_READ_WAIT_ENV if set */
+static void xztl_wait_init(void) {
+    struct xztl_config *cfg = xztl_config_active();
+
+    core.wait_spin_us = XZTL_WAIT_SPIN_US;
+
+    core.wait_mode  = xztl_wait_parse(cfg->wait, XZTL_WAIT_HYBRID);
+    core.rwait_mode = xztl_wait_parse(cfg->read_wait, -1);
+
+    if (cfg->wait_spin_us >= 0)
+        core.wait_spin_us = cfg->wait_spin_us;
+
+    snprintf(cfg->wait, XZTL_CONFIG_STR, "%s",
+             xztl_wait_names[core.wait_mode]);
+    snprintf(cfg->read_wait, XZTL_CONFIG_STR, "%s",
+             xztl_wait_names[(core.rwait_mode < 0) ? core.wait_mode
+                                                   : core.rwait_mode]);
+    cfg->wait_spin_us = core.wait_spin_us;
+
+    log_infoa("core: Completion wait: %s, reads %s (spin %u us)",
+              xztl_wait_names[core.wait_mode],
+              xztl_wait_names[(core.rwait_mode < 0) ? core.wait_mode
+                                                    : core.rwait_mode],
+              core.wait_spin_us);
+}
+
+/* Sizes must hold at least XZTL_CMD_SEC_DEF sectors, the slot commands
+ * are sized for it, and fit in MDTS. Reads also fit in the slot buffers */
+static int xztl_cmd_sec_check(uint32_t nsec, uint32_t max) {
+    uint32_t mdts = core.media->geo.sec_mdts;
+
+    if (nsec < XZTL_CMD_SEC_DEF || (mdts && nsec > mdts) ||
+        (max && nsec > max))
+        return XZTL_CMD_SIZE_ERR;
+
+    return XZTL_OK;
+}
+
+int xztl_set_cmd_sec(uint32_t write_sec, uint32_t read_sec) {
+    uint32_t rmax = XZTL_READ_BYTES_MAX / core.media->geo.nbytes;
+
+    if (write_sec && xztl_cmd_sec_check(write_sec, 0)) {
+        log_erra("core: Invalid write size %u sectors (mdts %u)", write_sec,
+                 core.media->geo.sec_mdts);
+        return XZTL_CMD_SIZE_ERR;
+    }
+
+    if (read_sec && xztl_cmd_sec_check(read_sec, rmax)) {
+        log_erra("core: Invalid read size %u sectors (mdts %u, max %u)",
+                 read_sec, core.media->geo.sec_mdts, rmax);
+        return XZTL_CMD_SIZE_ERR;
+    }
+
+    if (write_sec)
+        core.write_sec = write_sec;
+    if (read_sec)
+        core.read_sec = read_sec;
+
+    return XZTL_OK;
+}
+
+/* XZTL_WRITE_KB_ENV and XZTL_READ_KB_ENV override the default command
+ * sizes, invalid sizes are ignored */
+static void xztl_cmd_sec_init(void) {
+    struct xztl_config *cfg = xztl_config_active();
+
+    core.write_sec = XZTL_CMD_SEC_DEF;
+    core.read_sec  = XZTL_CMD_SEC_DEF;
+
+    if (cfg->write_kb > 0)
+        xztl_set_cmd_sec(cfg->write_kb * 1024U / core.media->geo.nbytes, 0);
+
+    if (cfg->read_kb > 0)
+        xztl_set_cmd_sec(0, cfg->read_kb * 1024U / core.media->geo.nbytes);
+
+    cfg->write_kb = (uint64_t)core.write_sec * core.media->geo.nbytes / 1024;
+    cfg->read_kb  = (uint64_t)core.read_sec * core.media->geo.nbytes / 1024;
+
+    log_infoa("core: Command size: write %u sectors, read %u sectors",
+              core.write_sec, core.read_sec);
+}
+
+/* The registered media is wrapped by the fault injection media if
+ * FAULT_MEDIA_ENV is set */
+static int xztl_fault_init(void) {
+    struct xztl_config *cfg = xztl_config_active();
+
+    if (cfg->fault[0] == '\0')
+        return XZTL_OK;
+
+    if (cfg->fault_seed == XZTL_CONFIG_UNSET)
+        cfg->fault_seed = FAULT_MEDIA_SEED;
+
+    return fault_media_wrap(cfg->fault, cfg->fault_seed);
+}
+
 void xztl_add_media(xztl_register_media_fn *fn) {
     media_fn = fn;
 }
@@ -205,6 +581,12 @@ int xztl_exit(void) {
 
     xztl_mempool_exit();
 
+    xztl_dma_print_stats();
+    xztl_dma_exit();
+
+    xztl_numa_print_stats();
+    xztl_numa_exit();
+
     if (core.media) {
         free(core.media);
         core.media = NULL;
@@ -217,12 +599,30 @@ int xztl_exit(void) {
 }
 
 int xztl_init(const char *dev_name) {
+    struct xztl_config cfg;
+    const char *       path;
+
+    xztl_config_init(&cfg);
+
+    path = getenv(XZTL_CONFIG_ENV);
+    if (path && xztl_config_load_file(&cfg, path))
+        return XZTL_CONFIG_ERR;
+
+    xztl_config_load_env(&cfg);
+
+    return xztl_init_config(dev_name, &cfg);
+}
+
+int xztl_init_config(const char *dev_name, const struct xztl_config *cfg) {
     int ret;
 
     openlog("ztl", LOG_CONS | LOG_PID | LOG_NDELAY, LOG_LOCAL0);
 
     log_info("core: Starting xZTL...");
 
+    /* Modules read their settings from the active configuration */
+    xztl_config_apply(cfg);
+
     if (!media_fn)
         return XZTL_NOMEDIA;
 
@@ -230,10 +630,26 @@ int xztl_init(const char *dev_name) {
     if (ret)
         return XZTL_MEDIA_ERROR | ret;
 
-    ret = xztl_mempool_init();
+    ret = xztl_fault_init();
+    if (ret)
+        return XZTL_MEDIA_ERROR | ret;
+
+    core.append = xztl_append_init();
+    xztl_wait_init();
+    xztl_cmd_sec_init();
+
+    ret = xztl_numa_init();
     if (ret)
         return ret;
 
+    ret = xztl_dma_init();
+    if (ret)
+        goto NUMA;
+
+    ret = xztl_mempool_init();
+    if (ret)
+        goto DMA;
+
     ret = xztl_media_init();
     if (ret)
         goto MP;
@@ -246,6 +662,7 @@ int xztl_init(const char *dev_name) {
     if (ret)
         goto ZTL;
 
+    xztl_config_log();
     log_info("core: xZTL started successfully.");
     return XZTL_OK;
 
@@ -256,5 +673,9 @@ MEDIA:
     xztl_media_exit();
 MP:
     xztl_mempool_exit();
+DMA:
+    xztl_dma_exit();
+NUMA:
+    xztl_numa_exit();
     return ret;
 }
@@ -18,6 +18,8 @@
 */
 
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <xztl-media.h>
 #include <xztl-mempool.h>
 #include <xztl.h>
@@ -25,6 +27,11 @@
 static pthread_spinlock_t       ctxs_spin;
 
 struct xztl_mthread_ctx *xztl_ctx_media_init(uint32_t depth) {
+    return xztl_ctx_media_init_flags(depth, 0);
+}
+
+struct xztl_mthread_ctx *xztl_ctx_media_init_flags(uint32_t depth,
+                                                   uint32_t flags) {
     struct xztl_misc_cmd     cmd;
     struct xztl_mthread_ctx *tctx;
     int                      ret;
@@ -43,14 +50,30 @@ struct xztl_mthread_ctx *xztl_ctx_media_init(uint32_t depth) {
 
     tctx->is_busy     = 0;
     tctx->comp_active = 1;
+    tctx->queue       = NULL;
+    tctx->opaque      = NULL;
+    tctx->nqueues     = 0;
+    tctx->polled      = 0;
+    memset(tctx->queues, 0x0, sizeof(tctx->queues));
+
+    tctx->wait_mode     = -1;
+    tctx->sleep_us      = 1;
+    tctx->wait_spin_us  = 0;
+    tctx->wait_sleep_us = 0;
+    tctx->wait_nsleep   = 0;
+
+    TAILQ_INIT(&tctx->fault_defer);
+    tctx->fault_ndefer = 0;
+    tctx->fault_nheld  = 0;
 
     /* Create asynchronous context via xnvme */
     cmd.opcode         = XZTL_MISC_ASYNCH_INIT;
     cmd.asynch.depth   = depth;
     cmd.asynch.ctx_ptr = tctx;
+    cmd.asynch.flags   = flags;
 
     ret = xztl_media_submit_misc(&cmd);
-    if (ret || !tctx->queue) {
+    if (ret || (!tctx->queue && !tctx->opaque)) {
         log_erra("xztl_ctx_media_init: xztl_media_submit_misc ret [%d] tctx->queue [%p]\n", ret, tctx->queue);
         pthread_spin_destroy(&tctx->qpair_spin);
         free(tctx);
@@ -87,4 +110,95 @@ int xztl_ctx_media_exit(struct xztl_mthread_ctx *tctx) {
     return XZTL_OK;
 }
 
+/* Process the completions of the context without waiting */
+uint32_t xztl_ctx_media_poke(struct xztl_mthread_ctx *tctx) {
+    struct xztl_misc_cmd misc;
+
+    misc.opcode         = XZTL_MISC_ASYNCH_POKE;
+    misc.asynch.ctx_ptr = tctx;
+    misc.asynch.limit   = 0;
+    misc.asynch.count   = 0;
+
+    if (xztl_media_submit_misc(&misc))
+        return 0;
+
+    return misc.asynch.count;
+}
+
+/* Block the thread until completions may be available. The media blocks if
+ * it supports XZTL_MISC_ASYNCH_BLOCK, otherwise the thread sleeps. */
+static void xztl_ctx_media_block(struct xztl_mthread_ctx *tctx,
+                                 uint32_t usec) {
+    struct xztl_misc_cmd misc;
+    struct timespec      ts;
+
+    misc.opcode         = XZTL_MISC_ASYNCH_BLOCK;
+    misc.asynch.ctx_ptr = tctx;
+    misc.asynch.limit   = usec;
+    misc.asynch.count   = 0;
 
+    if (!xztl_media_submit_misc(&misc))
+        return;
+
+    ts.tv_sec  = 0;
+    ts.tv_nsec = usec * 1000;
+    nanosleep(&ts, NULL);
+}
+
+/* Reap completions of the context. If none is available, the thread waits
+ * following tctx->wait_mode (core->wait_mode if not set): poke in a loop
+ * (spin), poke for core->wait_spin_us and then block (hybrid), or block
+ * (block). The blocking
+ * period doubles up to XZTL_WAIT_SLEEP_US while no completion arrives.
+ * Returns the number of completions, it may be 0 after blocking. */
+uint32_t xztl_ctx_media_reap(struct xztl_mthread_ctx *tctx) {
+    struct xztl_core *core;
+    struct timespec   ts;
+    uint64_t          start, now;
+    uint32_t          count;
+    int8_t            mode;
+    get_xztl_core(&core);
+
+    mode = (tctx->wait_mode < 0) ? core->wait_mode : tctx->wait_mode;
+
+    count = xztl_ctx_media_poke(tctx);
+    if (count || mode == XZTL_WAIT_SPIN) {
+        tctx->sleep_us = 1;
+        return count;
+    }
+
+    GET_MICROSECONDS(start, ts);
+    now = start;
+
+    if (mode == XZTL_WAIT_HYBRID) {
+        while (now - start < core->wait_spin_us) {
+            count = xztl_ctx_media_poke(tctx);
+            GET_MICROSECONDS(now, ts);
+            if (count) {
+                tctx->wait_spin_us += now - start;
+                xztl_stats_inc(XZTL_STATS_WAIT_SPIN_US, now - start);
+                tctx->sleep_us = 1;
+                return count;
+            }
+        }
+        tctx->wait_spin_us += now - start;
+        xztl_stats_inc(XZTL_STATS_WAIT_SPIN_US, now - start);
+        start = now;
+    }
+
+    xztl_ctx_media_block(tctx, tctx->sleep_us);
+    count = xztl_ctx_media_poke(tctx);
+    GET_MICROSECONDS(now, ts);
+
+    tctx->wait_sleep_us += now - start;
+    tctx->wait_nsleep++;
+    xztl_stats_inc(XZTL_STATS_WAIT_SLEEP_US, now - start);
+    xztl_stats_inc(XZTL_STATS_WAIT_SLEEPS, 1);
+
+    if (count)
+        tctx->sleep_us = 1;
+    else if (tctx->sleep_us < XZTL_WAIT_SLEEP_US)
+        tctx->sleep_us <<= 1;
+
+    return count;
+}
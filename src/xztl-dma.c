@@ -0,0 +1,430 @@
+/* xZTL: Zone Translation Layer User-space Library
+ *
+ * Copyright 2019 Samsung Electronics
+ *
+ * Written by Ivan L. Picoli <i.picoli@samsung.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <xztl-config.h>
+#include <xztl-dma.h>
+#include <xztl-numa.h>
+#include <xztl.h>
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+#ifndef MAP_HUGE_2MB
+#define MAP_HUGE_2MB (21 << MAP_HUGE_SHIFT)
+#endif
+#ifndef MAP_HUGE_1GB
+#define MAP_HUGE_1GB (30 << MAP_HUGE_SHIFT)
+#endif
+
+#define XZTL_DMA_PAGE_SZ_2M (2ULL * 1024 * 1024)
+#define XZTL_DMA_PAGE_SZ_1G (1024ULL * 1024 * 1024)
+
+static struct xztl_dma_arena arena;
+
+static inline uint64_t xztl_dma_class_sz(uint32_t cls_i) {
+    return 1ULL << (cls_i + XZTL_DMA_MIN_SHIFT);
+}
+
+/* Smallest class that fits 'bytes', XZTL_DMA_NCLASS if none */
+static inline uint32_t xztl_dma_class(size_t bytes) {
+    uint32_t cls_i = 0;
+
+    while (cls_i < XZTL_DMA_NCLASS && xztl_dma_class_sz(cls_i) < bytes)
+        cls_i++;
+
+    return cls_i;
+}
+
+static struct xztl_dma_region *xztl_dma_region_of(void *ptr) {
+    struct xztl_dma_region *reg;
+    uint32_t                reg_i;
+
+    for (reg_i = 0; reg_i < arena.stats.nregions; reg_i++) {
+        reg = &arena.regions[reg_i];
+        if ((uint8_t *)ptr >= reg->base &&
+            (uint8_t *)ptr < reg->base + reg->size)
+            return reg;
+    }
+
+    return NULL;
+}
+
+/* Free list of the buffers bound to 'node', list 0 holds unbound buffers */
+static inline uint32_t xztl_dma_list(int node) {
+    return (node >= 0 && node < XZTL_NUMA_MAX_NODES) ? node + 1 : 0;
+}
+
+static void xztl_dma_push(void *ptr, uint32_t list, uint32_t cls_i) {
+    *(void **)ptr                = arena.free_head[list][cls_i];
+    arena.free_head[list][cls_i] = ptr;
+
+    arena.stats.cached += xztl_dma_class_sz(cls_i);
+    arena.stats.class_cached[cls_i]++;
+}
+
+static void *xztl_dma_pop(uint32_t list, uint32_t cls_i) {
+    void *ptr = arena.free_head[list][cls_i];
+
+    if (!ptr)
+        return NULL;
+
+    arena.free_head[list][cls_i] = *(void **)ptr;
+    arena.stats.cached -= xztl_dma_class_sz(cls_i);
+    arena.stats.class_cached[cls_i]--;
+
+    return ptr;
+}
+
+/* Give the region space [off, end) to the free lists in the biggest aligned
+ * blocks, nothing carved from a region is lost */
+static void xztl_dma_spill(struct xztl_dma_region *reg, uint64_t off,
+                           uint64_t end) {
+    uint32_t cls_i;
+
+    while (off + xztl_dma_class_sz(0) <= end) {
+        cls_i = 0;
+        while (cls_i + 1 < XZTL_DMA_NCLASS &&
+               !(off & (xztl_dma_class_sz(cls_i + 1) - 1)) &&
+               off + xztl_dma_class_sz(cls_i + 1) <= end)
+            cls_i++;
+
+        xztl_dma_push(reg->base + off, xztl_dma_list(reg->node), cls_i);
+        off += xztl_dma_class_sz(cls_i);
+    }
+
+    reg->carved = end;
+}
+
+/* Map a region of huge pages. Falls back to regular pages with transparent
+ * huge pages if the huge page pool cannot back the region. The region is
+ * bound to 'node' before any page is touched */
+static int xztl_dma_map(struct xztl_dma_region *reg, int node) {
+    uint64_t size = arena.region_sz;
+    uint8_t *map, *base;
+    uint64_t head;
+    int      flags;
+
+    memset(reg, 0x0, sizeof(struct xztl_dma_region));
+
+    flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB;
+    flags |= (arena.page == XZTL_DMA_PAGE_1G) ? MAP_HUGE_1GB : MAP_HUGE_2MB;
+
+    base = mmap(NULL, size, PROT_READ | PROT_WRITE, flags, -1, 0);
+    if (base != MAP_FAILED) {
+        reg->hugetlb = 1;
+        goto MAPS;
+    }
+
+    /* Align the region to huge pages so THP can back it */
+    map = mmap(NULL, size + XZTL_DMA_ALIGN_MAX, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED)
+        return XZTL_DMA_MAP_ERR;
+
+    head = (XZTL_DMA_ALIGN_MAX - ((uint64_t)map & (XZTL_DMA_ALIGN_MAX - 1))) &
+           (XZTL_DMA_ALIGN_MAX - 1);
+    base = map + head;
+    if (head)
+        munmap(map, head);
+    munmap(base + size, XZTL_DMA_ALIGN_MAX - head);
+
+    madvise(base, size, MADV_HUGEPAGE);
+
+MAPS:
+    xztl_numa_place(base, size, node);
+
+    reg->base = base;
+    reg->size = size;
+    reg->node = (node >= 0 && node < XZTL_NUMA_MAX_NODES) ? node : -1;
+    reg->cls  = calloc(size >> XZTL_DMA_MIN_SHIFT, sizeof(uint8_t));
+    reg->req  = calloc(size >> XZTL_DMA_MIN_SHIFT, sizeof(uint32_t));
+    if (!reg->cls || !reg->req) {
+        free(reg->cls);
+        free(reg->req);
+        munmap(base, size);
+        return XZTL_DMA_MEM_ERR;
+    }
+
+    arena.stats.nregions++;
+    arena.stats.nhugetlb += reg->hugetlb;
+    arena.stats.nbound += (reg->node >= 0);
+    arena.stats.reserved += size;
+
+    return XZTL_OK;
+}
+
+/* Carve a buffer of class 'cls_i' from the last region of the node. The
+ * alignment gap and the tail of a full region go to the free lists */
+static void *xztl_dma_carve(uint32_t cls_i, int node) {
+    struct xztl_dma_region *reg = NULL;
+    uint32_t                list = xztl_dma_list(node);
+    uint64_t                sz, align, off = 0;
+
+    sz    = xztl_dma_class_sz(cls_i);
+    align = MIN(sz, XZTL_DMA_ALIGN_MAX);
+
+    if (arena.last[list] >= 0) {
+        reg = &arena.regions[arena.last[list]];
+        off = (reg->carved + align - 1) & ~(align - 1);
+    }
+
+    if (!reg || off + sz > reg->size) {
+        if (arena.stats.nregions == XZTL_DMA_MAX_REGIONS)
+            return NULL;
+
+        if (reg) {
+            arena.stats.carved += reg->size - reg->carved;
+            xztl_dma_spill(reg, reg->carved, reg->size);
+        }
+
+        reg = &arena.regions[arena.stats.nregions];
+        if (xztl_dma_map(reg, node))
+            return NULL;
+        arena.last[list] = arena.stats.nregions - 1;
+        off              = 0;
+    }
+
+    arena.stats.carved += off + sz - reg->carved;
+    xztl_dma_spill(reg, reg->carved, off);
+    reg->carved = off + sz;
+
+    return reg->base + off;
+}
+
+void *xztl_dma_alloc(size_t bytes) {
+    return xztl_dma_alloc_node(bytes, -1);
+}
+
+void *xztl_dma_alloc_node(size_t bytes, int node) {
+    struct xztl_dma_region *reg;
+    uint64_t                page;
+    uint32_t                cls_i;
+    void *                  ptr;
+
+    if (!arena.active || !bytes)
+        return NULL;
+
+    if (node >= XZTL_NUMA_MAX_NODES)
+        node = -1;
+
+    cls_i = xztl_dma_class(bytes);
+
+    pthread_spin_lock(&arena.spin);
+
+    if (cls_i == XZTL_DMA_NCLASS ||
+        xztl_dma_class_sz(cls_i) > arena.region_sz)
+        goto DIRECT;
+
+    ptr = xztl_dma_pop(xztl_dma_list(node), cls_i);
+    if (!ptr)
+        ptr = xztl_dma_carve(cls_i, node);
+    if (!ptr)
+        goto DIRECT;
+
+    reg            = xztl_dma_region_of(ptr);
+    page           = ((uint8_t *)ptr - reg->base) >> XZTL_DMA_MIN_SHIFT;
+    reg->cls[page] = cls_i + 1;
+    reg->req[page] = bytes;
+
+    arena.stats.used += xztl_dma_class_sz(cls_i);
+    arena.stats.requested += bytes;
+    arena.stats.class_used[cls_i]++;
+    arena.stats.nalloc++;
+
+    pthread_spin_unlock(&arena.spin);
+
+    return ptr;
+
+DIRECT:
+    arena.stats.ndirect++;
+    pthread_spin_unlock(&arena.spin);
+
+    return NULL;
+}
+
+int xztl_dma_free(void *ptr) {
+    struct xztl_dma_region *reg;
+    uint64_t                page;
+    uint32_t                cls_i;
+
+    if (!arena.active || !ptr)
+        return 0;
+
+    pthread_spin_lock(&arena.spin);
+
+    reg = xztl_dma_region_of(ptr);
+    if (!reg) {
+        pthread_spin_unlock(&arena.spin);
+        return 0;
+    }
+
+    page = ((uint8_t *)ptr - reg->base) >> XZTL_DMA_MIN_SHIFT;
+    if (!reg->cls[page]) {
+        log_erra("xztl-dma: Invalid free %p", ptr);
+        pthread_spin_unlock(&arena.spin);
+        return 1;
+    }
+
+    cls_i = reg->cls[page] - 1;
+
+    arena.stats.used -= xztl_dma_class_sz(cls_i);
+    arena.stats.requested -= reg->req[page];
+    arena.stats.class_used[cls_i]--;
+    arena.stats.nfree++;
+
+    reg->cls[page] = 0;
+    reg->req[page] = 0;
+    xztl_dma_push(ptr, xztl_dma_list(reg->node), cls_i);
+
+    pthread_spin_unlock(&arena.spin);
+
+    return 1;
+}
+
+void xztl_dma_get_stats(struct xztl_dma_stats *stats) {
+    if (!arena.active) {
+        memset(stats, 0x0, sizeof(struct xztl_dma_stats));
+        return;
+    }
+
+    pthread_spin_lock(&arena.spin);
+    memcpy(stats, &arena.stats, sizeof(struct xztl_dma_stats));
+    pthread_spin_unlock(&arena.spin);
+}
+
+void xztl_dma_print_stats(void) {
+    struct xztl_dma_stats st;
+    uint32_t              cls_i;
+
+    if (!arena.active)
+        return;
+
+    xztl_dma_get_stats(&st);
+
+    printf("\n DMA arena (%s pages)\n",
+           (arena.page == XZTL_DMA_PAGE_1G) ? "1G" : "2M");
+    printf("   regions   : %u (%u from the huge page pool, %u node bound)\n",
+           st.nregions, st.nhugetlb, st.nbound);
+    printf("   reserved  : %.2f MB\n", st.reserved / (double)1048576);
+    printf("   carved    : %.2f MB\n", st.carved / (double)1048576);
+    printf("   in use    : %.2f MB (%.2f MB requested)\n",
+           st.used / (double)1048576, st.requested / (double)1048576);
+    printf("   cached    : %.2f MB\n", st.cached / (double)1048576);
+    printf("   alloc/free: %lu/%lu (%lu from the media)\n", st.nalloc,
+           st.nfree, st.ndirect);
+
+    /* Internal: class rounding of live buffers. External: free buffers
+     * held in the class lists */
+    printf("   fragmentation: internal %.2f%%, external %.2f%%\n",
+           (st.used) ? 100.0 * (st.used - st.requested) / st.used : 0.0,
+           (st.carved) ? 100.0 * st.cached / st.carved : 0.0);
+
+    for (cls_i = 0; cls_i < XZTL_DMA_NCLASS; cls_i++) {
+        if (!st.class_used[cls_i] && !st.class_cached[cls_i])
+            continue;
+        printf("   class %8lu KB: used %lu, free %lu\n",
+               xztl_dma_class_sz(cls_i) / 1024, st.class_used[cls_i],
+               st.class_cached[cls_i]);
+    }
+}
+
+void xztl_dma_exit(void) {
+    struct xztl_dma_region *reg;
+    uint32_t                reg_i;
+
+    if (!arena.active)
+        return;
+
+    arena.active = 0;
+
+    for (reg_i = 0; reg_i < arena.stats.nregions; reg_i++) {
+        reg = &arena.regions[reg_i];
+        munmap(reg->base, reg->size);
+        free(reg->cls);
+        free(reg->req);
+    }
+
+    pthread_spin_destroy(&arena.spin);
+    log_info("xztl-dma: Arena stopped.");
+}
+
+int xztl_dma_init(void) {
+    struct xztl_config *cfg = xztl_config_active();
+    const char *        env;
+    uint64_t            page_sz;
+
+    if (arena.active)
+        return XZTL_OK;
+
+    memset(&arena, 0x0, sizeof(struct xztl_dma_arena));
+
+    arena.page = XZTL_DMA_PAGE_2M;
+    env        = (cfg->dma_page[0]) ? cfg->dma_page : NULL;
+    if (env && !strcmp(env, "none")) {
+        log_info("xztl-dma: Arena disabled.");
+        return XZTL_OK;
+    } else if (env && !strcmp(env, "1G")) {
+        arena.page = XZTL_DMA_PAGE_1G;
+    } else if (env && strcmp(env, "2M")) {
+        log_erra("xztl-dma: Unknown page size %s. Using 2M.", env);
+    }
+
+    arena.region_sz = ((cfg->dma_region_mb != XZTL_CONFIG_UNSET)
+                           ? cfg->dma_region_mb
+                           : XZTL_DMA_REGION_MB) *
+                      1048576ULL;
+
+    /* Regions hold whole huge pages */
+    page_sz = (arena.page == XZTL_DMA_PAGE_1G) ? XZTL_DMA_PAGE_SZ_1G
+                                               : XZTL_DMA_PAGE_SZ_2M;
+    arena.region_sz = (arena.region_sz + page_sz - 1) & ~(page_sz - 1);
+    if (!arena.region_sz)
+        arena.region_sz = page_sz;
+
+    snprintf(cfg->dma_page, XZTL_CONFIG_STR, "%s",
+             (arena.page == XZTL_DMA_PAGE_1G) ? "1G" : "2M");
+    cfg->dma_region_mb = arena.region_sz / 1048576;
+
+    if (pthread_spin_init(&arena.spin, 0))
+        return XZTL_MEM;
+
+    memset(arena.last, 0xff, sizeof(arena.last));
+
+    /* The first region is unbound */
+    if (xztl_dma_map(&arena.regions[0], -1)) {
+        log_err("xztl-dma: Could not map a region. Arena disabled.");
+        pthread_spin_destroy(&arena.spin);
+        return XZTL_OK;
+    }
+
+    arena.last[0] = 0;
+    arena.active  = 1;
+    log_infoa("xztl-dma: Arena started. Region %lu MB, %s pages%s.",
+              arena.region_sz / 1048576,
+              (arena.page == XZTL_DMA_PAGE_1G) ? "1G" : "2M",
+              (arena.regions[0].hugetlb) ? "" : " (transparent)");
+
+    return XZTL_OK;
+}
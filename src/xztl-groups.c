@@ -63,7 +63,6 @@ static void groups_zmd_exit(void) {
     struct app_group *grp;
 
     LIST_FOREACH(grp, &app_grp_head, entry) {
-        xnvme_buf_virt_free(grp->zmd.report);
         free(grp->zmd.tbl);
         log_infoa("ztl-group: Zone MD stopped. Grp: %d", grp->id);
     }
@@ -99,7 +98,7 @@ static int groups_zmd_init(struct app_group *grp) {
         ret = ztl()->zmd->create_fn(grp);
         if (ret) {
             log_erra("err report2: %d", ret);
-            goto FREE_REP;
+            goto FREE;
         }
     }
 
@@ -108,8 +107,6 @@ static int groups_zmd_init(struct app_group *grp) {
 
     return XZTL_OK;
 
-FREE_REP:
-    xnvme_buf_virt_free(zmd->report);
 FREE:
     free(zmd->tbl);
     log_erra("ztl-group: Zone MD startup failed. Grp: %d", grp->id);
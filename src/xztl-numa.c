@@ -0,0 +1,458 @@
+/* xZTL: Zone Translation Layer User-space Library
+ *
+ * Copyright 2019 Samsung Electronics
+ *
+ * Written by Ivan L. Picoli <i.picoli@samsung.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+
+#define _GNU_SOURCE
+
+#include <numa.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <xztl-config.h>
+#include <xztl-numa.h>
+#include <xztl.h>
+
+_Static_assert(sizeof(cpu_set_t) <=
+                   sizeof(((struct xztl_numa_affinity *)0)->cpus),
+               "xztl_numa_affinity cannot hold a cpu_set_t");
+
+/* CPU affinity policy, see XZTL_BG_CPUS_ENV. slot_cpus lists the CPUs of
+ * XZTL_SLOT_CPUS in order, slots take them in round robin */
+struct xztl_numa_policy {
+    cpu_set_t proc; /* CPUs of the process at init */
+    cpu_set_t bg;
+    cpu_set_t slot;
+    cpu_set_t app;
+    uint16_t  slot_cpus[XZTL_NUMA_MAX_CPUS];
+    uint16_t  nslot_cpus;
+    uint32_t  nbg_pinned;
+    uint32_t  nslot_pinned;
+};
+
+static struct xztl_numa        numa;
+static struct xztl_numa_policy policy;
+
+static inline int xztl_numa_valid(int node) {
+    return numa.active && node >= 0 && node < XZTL_NUMA_MAX_NODES &&
+           numa.nodes[node].ncpus;
+}
+
+int xztl_numa_slot_node(uint16_t slot) {
+    int node;
+
+    if (!numa.active)
+        return -1;
+
+    /* A slot pinned to a CPU uses the node of the CPU */
+    if (policy.nslot_cpus) {
+        node = numa_node_of_cpu(policy.slot_cpus[slot % policy.nslot_cpus]);
+        if (xztl_numa_valid(node))
+            return node;
+    }
+
+    return numa.cpu_nodes[slot % numa.nnodes];
+}
+
+/* Parse a list such as "0-3,8". CPUs outside the process are dropped */
+static int xztl_numa_cpus_parse(const char *str, cpu_set_t *set) {
+    long  first, last, cpu;
+    char *end;
+
+    CPU_ZERO(set);
+    if (!*str)
+        return XZTL_OK;
+
+    while (*str) {
+        first = strtol(str, &end, 10);
+        if (end == str)
+            return XZTL_CONFIG_ERR;
+
+        last = first;
+        if (*end == '-') {
+            str  = end + 1;
+            last = strtol(str, &end, 10);
+            if (end == str)
+                return XZTL_CONFIG_ERR;
+        }
+
+        if (first < 0 || last < first || last >= XZTL_NUMA_MAX_CPUS)
+            return XZTL_CONFIG_ERR;
+
+        for (cpu = first; cpu <= last; cpu++)
+            CPU_SET(cpu, set);
+
+        if (*end == ',')
+            end++;
+        else if (*end)
+            return XZTL_CONFIG_ERR;
+        str = end;
+    }
+
+    CPU_AND(set, set, &policy.proc);
+
+    return (CPU_COUNT(set)) ? XZTL_OK : XZTL_CONFIG_ERR;
+}
+
+/* Format a set as a list, empty if the set is empty */
+static void xztl_numa_cpus_str(const cpu_set_t *set, char *str, size_t len) {
+    size_t off = 0;
+    int    cpu, first = -1;
+
+    str[0] = '\0';
+    for (cpu = 0; cpu <= XZTL_NUMA_MAX_CPUS && off < len; cpu++) {
+        if (cpu < XZTL_NUMA_MAX_CPUS && CPU_ISSET(cpu, set)) {
+            if (first < 0)
+                first = cpu;
+            continue;
+        }
+        if (first < 0)
+            continue;
+
+        if (first == cpu - 1)
+            off += snprintf(str + off, len - off, "%s%d", (off) ? "," : "",
+                            first);
+        else
+            off += snprintf(str + off, len - off, "%s%d-%d",
+                            (off) ? "," : "", first, cpu - 1);
+        first = -1;
+    }
+}
+
+/* Parse a list of the configuration and write back the CPUs in use */
+static int xztl_numa_policy_cpus(char *str, cpu_set_t *set,
+                                 const char *key) {
+    if (xztl_numa_cpus_parse(str, set)) {
+        log_erra("xztl-numa: %s=%s has no CPU of the process.", key, str);
+        return XZTL_CONFIG_ERR;
+    }
+
+    xztl_numa_cpus_str(set, str, XZTL_CONFIG_STR);
+
+    return XZTL_OK;
+}
+
+static int xztl_numa_policy_init(struct xztl_config *cfg) {
+    char cpus[XZTL_CONFIG_STR];
+    int  cpu;
+
+    memset(&policy, 0x0, sizeof(struct xztl_numa_policy));
+    if (sched_getaffinity(0, sizeof(cpu_set_t), &policy.proc))
+        return XZTL_NUMA_ERR;
+
+    if (xztl_numa_policy_cpus(cfg->bg_cpus, &policy.bg, XZTL_BG_CPUS_ENV) ||
+        xztl_numa_policy_cpus(cfg->slot_cpus, &policy.slot,
+                              XZTL_SLOT_CPUS_ENV) ||
+        xztl_numa_policy_cpus(cfg->app_cpus, &policy.app, XZTL_APP_CPUS_ENV))
+        return XZTL_CONFIG_ERR;
+
+    for (cpu = 0; cpu < XZTL_NUMA_MAX_CPUS; cpu++) {
+        if (CPU_ISSET(cpu, &policy.slot))
+            policy.slot_cpus[policy.nslot_cpus++] = cpu;
+    }
+
+    if (CPU_COUNT(&policy.bg) || CPU_COUNT(&policy.slot) ||
+        CPU_COUNT(&policy.app)) {
+        xztl_numa_cpus_str(&policy.proc, cpus, XZTL_CONFIG_STR);
+        log_infoa("xztl-numa: Affinity of CPUs %s. Background %s, slots %s, "
+                  "application %s",
+                  cpus, cfg->bg_cpus, cfg->slot_cpus, cfg->app_cpus);
+    }
+
+    return XZTL_OK;
+}
+
+/* Drop the application CPUs from a set, unless none is left */
+static void xztl_numa_policy_isolate(cpu_set_t *set) {
+    cpu_set_t others;
+    int       cpu;
+
+    if (!CPU_COUNT(&policy.app))
+        return;
+
+    CPU_ZERO(&others);
+    for (cpu = 0; cpu < XZTL_NUMA_MAX_CPUS; cpu++) {
+        if (CPU_ISSET(cpu, set) && !CPU_ISSET(cpu, &policy.app))
+            CPU_SET(cpu, &others);
+    }
+
+    if (CPU_COUNT(&others))
+        memcpy(set, &others, sizeof(cpu_set_t));
+}
+
+void xztl_numa_pin_bg(const char *name) {
+    char      cpus[XZTL_CONFIG_STR];
+    cpu_set_t set;
+
+    if (CPU_COUNT(&policy.bg)) {
+        memcpy(&set, &policy.bg, sizeof(cpu_set_t));
+    } else if (CPU_COUNT(&policy.app)) {
+        memcpy(&set, &policy.proc, sizeof(cpu_set_t));
+        xztl_numa_policy_isolate(&set);
+    } else {
+        return;
+    }
+
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &set)) {
+        log_erra("xztl-numa: Could not pin the %s thread", name);
+        return;
+    }
+
+    __atomic_fetch_add(&policy.nbg_pinned, 1, __ATOMIC_RELAXED);
+    xztl_numa_cpus_str(&set, cpus, XZTL_CONFIG_STR);
+    log_infoa("xztl-numa: %s thread on CPUs %s", name, cpus);
+}
+
+void xztl_numa_pin_slot(int node, uint16_t slot) {
+    struct xztl_numa_affinity aff;
+    cpu_set_t                 set;
+
+    if (policy.nslot_cpus) {
+        CPU_ZERO(&set);
+        CPU_SET(policy.slot_cpus[slot % policy.nslot_cpus], &set);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &set)) {
+            log_erra("xztl-numa: Could not pin slot %u", slot);
+            return;
+        }
+        if (xztl_numa_valid(node))
+            numa_set_preferred(node);
+
+        __atomic_fetch_add(&policy.nslot_pinned, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    xztl_numa_bind(node, &aff);
+    if (!CPU_COUNT(&policy.app))
+        return;
+
+    if (pthread_getaffinity_np(pthread_self(), sizeof(cpu_set_t), &set))
+        return;
+    xztl_numa_policy_isolate(&set);
+    if (!pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &set))
+        __atomic_fetch_add(&policy.nslot_pinned, 1, __ATOMIC_RELAXED);
+}
+
+int xztl_numa_local_node(void) {
+    int cpu, node;
+
+    if (!numa.active)
+        return -1;
+
+    cpu = sched_getcpu();
+    if (cpu < 0)
+        return -1;
+
+    node = numa_node_of_cpu(cpu);
+
+    return (xztl_numa_valid(node)) ? node : -1;
+}
+
+int xztl_numa_bind(int node, struct xztl_numa_affinity *saved) {
+    saved->bound = 0;
+
+    if (!xztl_numa_valid(node))
+        return XZTL_OK;
+
+    if (pthread_getaffinity_np(pthread_self(), sizeof(cpu_set_t),
+                               (cpu_set_t *)saved->cpus))
+        return XZTL_NUMA_ERR;
+
+    if (numa_run_on_node(node)) {
+        log_erra("xztl-numa: Could not run on node %d", node);
+        return XZTL_NUMA_ERR;
+    }
+
+    numa_set_preferred(node);
+    saved->bound = 1;
+
+    return XZTL_OK;
+}
+
+void xztl_numa_unbind(struct xztl_numa_affinity *saved) {
+    if (!saved->bound)
+        return;
+
+    numa_set_localalloc();
+    pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t),
+                           (cpu_set_t *)saved->cpus);
+    saved->bound = 0;
+}
+
+void xztl_numa_place(void *ptr, size_t bytes, int node) {
+    if (!xztl_numa_valid(node) || !ptr || !bytes)
+        return;
+
+    numa_tonode_memory(ptr, bytes, node);
+}
+
+void *xztl_numa_alloc(size_t bytes, int node) {
+    void *ptr;
+
+    ptr = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED)
+        return NULL;
+
+    /* Bind before the first touch, pages are then faulted on the node */
+    xztl_numa_place(ptr, bytes, node);
+    memset(ptr, 0x0, bytes);
+
+    return ptr;
+}
+
+void xztl_numa_free(void *ptr, size_t bytes) {
+    if (ptr)
+        munmap(ptr, bytes);
+}
+
+void xztl_numa_slot_add(int node) {
+    if (xztl_numa_valid(node))
+        numa.nodes[node].nslots++;
+}
+
+void xztl_numa_slot_use(int node, int local, int get) {
+    struct xztl_numa_node *nd;
+
+    if (!xztl_numa_valid(node))
+        return;
+
+    nd = &numa.nodes[node];
+
+    if (!get) {
+        __atomic_fetch_sub(&nd->nused, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    __atomic_fetch_add(&nd->nused, 1, __ATOMIC_RELAXED);
+    if (node == local)
+        __atomic_fetch_add(&nd->nlocal, 1, __ATOMIC_RELAXED);
+    else
+        __atomic_fetch_add(&nd->nremote, 1, __ATOMIC_RELAXED);
+}
+
+static void xztl_numa_print_policy(void) {
+    char cpus[XZTL_CONFIG_STR];
+
+    printf("\n CPU affinity\n");
+
+    xztl_numa_cpus_str(&policy.bg, cpus, XZTL_CONFIG_STR);
+    printf("   background  : %s (%u threads pinned)\n", (*cpus) ? cpus : "any",
+           __atomic_load_n(&policy.nbg_pinned, __ATOMIC_RELAXED));
+
+    xztl_numa_cpus_str(&policy.slot, cpus, XZTL_CONFIG_STR);
+    printf("   slots       : %s (%u workers pinned)\n",
+           (*cpus) ? cpus : "node CPUs",
+           __atomic_load_n(&policy.nslot_pinned, __ATOMIC_RELAXED));
+
+    xztl_numa_cpus_str(&policy.app, cpus, XZTL_CONFIG_STR);
+    printf("   application : %s\n", (*cpus) ? cpus : "not isolated");
+}
+
+void xztl_numa_print_stats(void) {
+    struct xztl_numa_node *nd;
+    uint16_t               node_i;
+
+    xztl_numa_print_policy();
+
+    if (!numa.active) {
+        printf("\n NUMA placement: disabled\n");
+        return;
+    }
+
+    printf("\n NUMA placement: %u nodes with CPUs\n", numa.nnodes);
+    for (node_i = 0; node_i < numa.nnodes; node_i++) {
+        nd = &numa.nodes[numa.cpu_nodes[node_i]];
+        printf("   node %2d: %3u cpus, slots %3u (in use %3u), "
+               "handed out local %lu, remote %lu\n",
+               numa.cpu_nodes[node_i], nd->ncpus, nd->nslots,
+               __atomic_load_n(&nd->nused, __ATOMIC_RELAXED),
+               __atomic_load_n(&nd->nlocal, __ATOMIC_RELAXED),
+               __atomic_load_n(&nd->nremote, __ATOMIC_RELAXED));
+    }
+}
+
+void xztl_numa_exit(void) {
+    if (!numa.active)
+        return;
+
+    numa.active = 0;
+    log_info("xztl-numa: Placement stopped.");
+}
+
+int xztl_numa_init(void) {
+    struct xztl_config *cfg = xztl_config_active();
+    struct bitmask *    cpus;
+    int                 node, max_node;
+
+    memset(&numa, 0x0, sizeof(struct xztl_numa));
+
+    if (xztl_numa_policy_init(cfg))
+        return XZTL_CONFIG_ERR;
+
+    if (!cfg->numa) {
+        log_info("xztl-numa: Placement disabled.");
+        return XZTL_OK;
+    }
+
+    cfg->numa = 0;
+    if (numa_available() < 0) {
+        log_info("xztl-numa: NUMA not supported. Placement disabled.");
+        return XZTL_OK;
+    }
+
+    cpus = numa_allocate_cpumask();
+    if (!cpus)
+        return XZTL_MEM;
+
+    max_node = numa_max_node();
+    if (max_node >= XZTL_NUMA_MAX_NODES)
+        max_node = XZTL_NUMA_MAX_NODES - 1;
+
+    /* Slots are bound only to nodes with CPUs, memory only nodes are
+     * never local to a caller */
+    for (node = 0; node <= max_node; node++) {
+        if (!numa_bitmask_isbitset(numa_all_nodes_ptr, node))
+            continue;
+        if (numa_node_to_cpus(node, cpus))
+            continue;
+
+        numa.nodes[node].ncpus = numa_bitmask_weight(cpus);
+        if (!numa.nodes[node].ncpus)
+            continue;
+
+        numa.cpu_nodes[numa.nnodes] = node;
+        numa.nnodes++;
+    }
+
+    numa_free_cpumask(cpus);
+
+    if (!numa.nnodes) {
+        log_info("xztl-numa: No node with CPUs. Placement disabled.");
+        return XZTL_OK;
+    }
+
+    numa.active = 1;
+    cfg->numa   = 1;
+    log_infoa("xztl-numa: Placement started. %u nodes with CPUs.",
+              numa.nnodes);
+
+    return XZTL_OK;
+}
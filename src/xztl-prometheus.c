@@ -24,6 +24,7 @@
 #include <time.h>
 #include <unistd.h>
 #include <xztl-mempool.h>
+#include <xztl-numa.h>
 #include <xztl.h>
 
 struct xztl_prometheus_stats {
@@ -116,6 +117,7 @@ static void xztl_prometheus_reset(void) {
 }
 
 void *xztl_prometheus_flush(void *arg) {
+    xztl_numa_pin_bg("xztl-prometheus flush");
     GET_MICROSECONDS(pr_stats.us_s, pr_stats.ts_s);
 
     xztl_flush_running++;
@@ -200,6 +202,7 @@ static void xztl_prometheus_flush_latency(void) {
 }
 
 void *xztl_prometheus_latency_th(void *arg) {
+    xztl_numa_pin_bg("xztl-prometheus latency");
     GET_MICROSECONDS(pr_stats.us_l_s, pr_stats.ts_l_s);
 
     xztl_flush_l_running++;
@@ -0,0 +1,109 @@
+/* xZTL: Zone Translation Layer User-space Library
+ *
+ * Copyright 2019 Samsung Electronics
+ *
+ * Written by Ivan L. Picoli <i.picoli@samsung.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <xztl-numa.h>
+#include <xztl-ring.h>
+#include <xztl.h>
+
+int xztl_ring_init(struct xztl_ring *ring, uint32_t size, int node) {
+    uint32_t cell_i;
+
+    ring->size = 1;
+    while (ring->size < size)
+        ring->size <<= 1;
+    ring->mask = ring->size - 1;
+    ring->node = node;
+
+    ring->cells = xztl_numa_alloc(ring->size * sizeof(struct xztl_ring_cell),
+                                  node);
+    if (!ring->cells)
+        return XZTL_RING_MEM;
+
+    for (cell_i = 0; cell_i < ring->size; cell_i++)
+        ring->cells[cell_i].seq = cell_i;
+
+    ring->head = 0;
+    ring->tail = 0;
+
+    return XZTL_OK;
+}
+
+void xztl_ring_exit(struct xztl_ring *ring) {
+    xztl_numa_free(ring->cells, ring->size * sizeof(struct xztl_ring_cell));
+    ring->cells = NULL;
+}
+
+int xztl_ring_push(struct xztl_ring *ring, void *ptr) {
+    struct xztl_ring_cell *cell;
+    uint64_t               pos, seq;
+    int64_t                diff;
+
+    pos = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+    while (1) {
+        cell = &ring->cells[pos & ring->mask];
+        seq  = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+        diff = (int64_t)(seq - pos);
+
+        if (!diff) {
+            if (__atomic_compare_exchange_n(&ring->head, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED))
+                break;
+        } else if (diff < 0) {
+            /* The cell was not popped since the previous lap */
+            return XZTL_RING_FULL;
+        } else {
+            pos = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+        }
+    }
+
+    cell->ptr = ptr;
+    __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+
+    return XZTL_OK;
+}
+
+uint32_t xztl_ring_pop(struct xztl_ring *ring, void **ptr, uint32_t max) {
+    struct xztl_ring_cell *cell;
+    uint64_t               pos;
+    uint32_t               n = 0;
+
+    pos = ring->tail;
+    while (n < max) {
+        cell = &ring->cells[pos & ring->mask];
+        if (__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) != pos + 1)
+            break;
+
+        ptr[n++] = cell->ptr;
+        __atomic_store_n(&cell->seq, pos + ring->size, __ATOMIC_RELEASE);
+        pos++;
+    }
+    __atomic_store_n(&ring->tail, pos, __ATOMIC_RELAXED);
+
+    return n;
+}
+
+int xztl_ring_empty(struct xztl_ring *ring) {
+    uint64_t pos = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+
+    return __atomic_load_n(&ring->cells[pos & ring->mask].seq,
+                           __ATOMIC_ACQUIRE) != pos + 1;
+}
@@ -21,12 +21,16 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <xztl-config.h>
+#include <xztl-numa.h>
 #include <xztl.h>
 
-#define XZTL_STATS_IO_TYPES 11
+#define XZTL_STATS_IO_TYPES 24
 
 struct xztl_stats_data {
     uint64_t io[XZTL_STATS_IO_TYPES];
+    char     engine[XZTL_MEDIA_ENGINE_LEN];
+    uint8_t  prometheus; /* Exporter started */
 };
 
 static struct xztl_stats_data xztl_stats;
@@ -35,12 +39,19 @@ void xztl_stats_print_io(void) {
     uint64_t tot_b, tot_b_w, tot_b_r;
     double   wa;
 
+    printf("\n Media I/O engine: %s\n", xztl_stats.engine);
+
     printf("\n User I/O commands\n");
     printf("   write  : %lu\n", xztl_stats.io[XZTL_STATS_APPEND_UCMD]);
-    printf("   read   : %lu\n", xztl_stats.io[XZTL_STATS_READ_UCMD]);
+    printf("   read   : %lu (fast path %lu, in place %lu)\n",
+           xztl_stats.io[XZTL_STATS_READ_UCMD],
+           xztl_stats.io[XZTL_STATS_READ_FAST],
+           xztl_stats.io[XZTL_STATS_READ_FAST_DIRECT]);
 
     printf("\n Media I/O commands\n");
-    printf("   append : %lu\n", xztl_stats.io[XZTL_STATS_APPEND_MCMD]);
+    printf("   append : %lu (retried %lu)\n",
+           xztl_stats.io[XZTL_STATS_APPEND_MCMD],
+           xztl_stats.io[XZTL_STATS_WRITE_RETRY]);
     printf("   read   : %lu\n", xztl_stats.io[XZTL_STATS_READ_MCMD]);
     printf("   reset  : %lu\n", xztl_stats.io[XZTL_STATS_RESET_MCMD]);
 
@@ -56,6 +67,14 @@ void xztl_stats_print_io(void) {
            (double)tot_b_w / (double)1048576, (uint64_t)tot_b_w);  // NOLINT
     printf("   data read        : %10.2lf MB (%lu bytes)\n",
            (double)tot_b_r / (double)1048576, (uint64_t)tot_b_r);  // NOLINT
+    printf("     zero-copy      : %10.2lf MB (%lu bytes)\n",
+           (double)xztl_stats.io[XZTL_STATS_READ_ZCOPY_BYTES] /  // NOLINT
+               (double)1048576,
+           xztl_stats.io[XZTL_STATS_READ_ZCOPY_BYTES]);
+    printf("     bounced        : %10.2lf MB (%lu bytes)\n",
+           (double)xztl_stats.io[XZTL_STATS_READ_BOUNCE_BYTES] /  // NOLINT
+               (double)1048576,
+           xztl_stats.io[XZTL_STATS_READ_BOUNCE_BYTES]);
 
     tot_b_r = xztl_stats.io[XZTL_STATS_READ_BYTES];
     tot_b_w = xztl_stats.io[XZTL_STATS_APPEND_BYTES];
@@ -71,6 +90,25 @@ void xztl_stats_print_io(void) {
            (double)tot_b_r / (double)1048576, (uint64_t)tot_b_r);  // NOLINT
 
     printf("\n Write Amplification: %.6lf\n", wa);
+
+    printf("\n Completion wait\n");
+    printf("   spinning : %lu us\n", xztl_stats.io[XZTL_STATS_WAIT_SPIN_US]);
+    printf("   sleeping : %lu us (%lu sleeps)\n",
+           xztl_stats.io[XZTL_STATS_WAIT_SLEEP_US],
+           xztl_stats.io[XZTL_STATS_WAIT_SLEEPS]);
+
+    printf("\n Slots\n");
+    printf("   handed out : %lu (none free %lu)\n",
+           xztl_stats.io[XZTL_STATS_SLOT_GET],
+           xztl_stats.io[XZTL_STATS_SLOT_EXHAUSTED]);
+
+    printf("\n Free nodes\n");
+    printf("   refills    : %lu (nodes %lu, contended %lu)\n",
+           xztl_stats.io[XZTL_STATS_NODE_REFILL],
+           xztl_stats.io[XZTL_STATS_NODE_ALLOC],
+           xztl_stats.io[XZTL_STATS_NODE_RETRY]);
+
+    xztl_numa_print_stats();
 }
 
 void xztl_stats_print_io_simple(void) {
@@ -81,7 +119,8 @@ void xztl_stats_print_io_simple(void) {
     app_w     = xztl_stats.io[XZTL_STATS_APPEND_BYTES_U];
     padding_w = flush_w - app_w;
 
-    printf("\nZTL Application Writes : %.2f MB (%lu bytes)\n",
+    printf("\nZTL I/O engine         : %s\n", xztl_stats.engine);
+    printf("ZTL Application Writes : %.2f MB (%lu bytes)\n",
            app_w / (double)1048576, app_w);  // NOLINT
     printf("ZTL Padding            : %.2f MB (%lu bytes)\n",
            padding_w / (double)1048576, padding_w);  // NOLINT
@@ -134,22 +173,19 @@ void xztl_stats_add_io(struct xztl_io_mcmd *cmd) {
         &xztl_stats.io[type_b],
         xztl_stats.io[type_b] + (nsec * core->media->geo.nbytes));
 
-#if XZTL_PROMETHEUS
     /* Prometheus */
-    xztl_prometheus_add_io(cmd);
-#endif
+    if (xztl_stats.prometheus)
+        xztl_prometheus_add_io(cmd);
 }
 
 void xztl_stats_inc(uint32_t type, uint64_t val) {
     xztl_atomic_int64_update(&xztl_stats.io[type], xztl_stats.io[type] + val);
 
-#if XZTL_PROMETHEUS
     /* Prometheus */
-    if (type == XZTL_STATS_APPEND_BYTES_U) {
+    if (xztl_stats.prometheus && type == XZTL_STATS_APPEND_BYTES_U) {
         xztl_prometheus_add_wa(xztl_stats.io[XZTL_STATS_APPEND_BYTES_U],
                                xztl_stats.io[XZTL_STATS_APPEND_BYTES]);
     }
-#endif
 }
 
 void xztl_stats_reset_io(void) {
@@ -160,20 +196,31 @@ void xztl_stats_reset_io(void) {
 }
 
 void xztl_stats_exit(void) {
-#if XZTL_PROMETHEUS
-    xztl_prometheus_exit();
-#endif
+    if (xztl_stats.prometheus)
+        xztl_prometheus_exit();
+    xztl_stats.prometheus = 0;
 }
 
 int xztl_stats_init(void) {
+    struct xztl_config *cfg = xztl_config_active();
+    struct xztl_core *  core;
+    get_xztl_core(&core);
+
     memset(xztl_stats.io, 0x0, sizeof(uint64_t) * XZTL_STATS_IO_TYPES);
 
-#if XZTL_PROMETHEUS
-    if (xztl_prometheus_init()) {
+    /* Keep the engine name, the media is gone when stats are printed */
+    snprintf(xztl_stats.engine, XZTL_MEDIA_ENGINE_LEN, "%s",
+             (core->media->engine[0]) ? core->media->engine : "unknown");
+
+    xztl_stats.prometheus = (cfg->prometheus != XZTL_CONFIG_UNSET)
+                                ? (cfg->prometheus != 0)
+                                : XZTL_PROMETHEUS;
+    cfg->prometheus       = xztl_stats.prometheus;
+    if (xztl_stats.prometheus && xztl_prometheus_init()) {
         log_err("xztl-stats: Prometheus not started.");
+        xztl_stats.prometheus = 0;
         return -1;
     }
-#endif
 
     return 0;
 }
@@ -23,11 +23,11 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/queue.h>
+#include <xztl-config.h>
 #include <xztl-ztl.h>
 #include <xztl.h>
 #include <ztl.h>
 
-#define MAP_BUF_PGS  8192 /* 256 MB per cache with 32KB page */
 #define MAP_N_CACHES 1
 
 #define MAP_ADDR_FLAG ((1 & AND64) << 63)
@@ -165,10 +165,15 @@ WAIT:
     return 0;
 }
 
+/* Pages per cache, ZTL_MAP_CACHE_PGS_ENV */
 static int map_init_cache(struct map_cache *cache) {
-    uint32_t pg_i;
+    struct xztl_config *cfg = xztl_config_active();
+    uint32_t            pg_i, npgs;
 
-    cache->pg_buf = calloc(MAP_BUF_PGS, sizeof(struct map_cache_entry));
+    npgs = (cfg->map_cache_pgs > 0) ? cfg->map_cache_pgs : ZTL_MAP_CACHE_PGS;
+    cfg->map_cache_pgs = npgs;
+
+    cache->pg_buf = calloc(npgs, sizeof(struct map_cache_entry));
     if (!cache->pg_buf) {
         log_err("Map cache initialization failed.\n");
         return -1;
@@ -186,7 +191,7 @@ static int map_init_cache(struct map_cache *cache) {
     cache->nfree = 0;
     cache->nused = 0;
 
-    for (pg_i = 0; pg_i < MAP_BUF_PGS; pg_i++) {
+    for (pg_i = 0; pg_i < npgs; pg_i++) {
         cache->pg_buf[pg_i].dirty     = 0;
         cache->pg_buf[pg_i].buf_sz    = map_pg_sz;
         cache->pg_buf[pg_i].addr.addr = 0x0;
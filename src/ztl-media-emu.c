@@ -0,0 +1,927 @@
+/* xZTL: Zone Translation Layer User-space Library
+ *
+ * Copyright 2019 Samsung Electronics
+ *
+ * Written by Ivan L. Picoli <i.picoli@samsung.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+
+/* fallocate */
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <libxnvme.h>
+#include <libxnvme_spec.h>
+#include <libxnvme_znd.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <xztl-media.h>
+#include <xztl.h>
+#include <ztl-media-emu.h>
+
+#define EMU_MEDIA_ALIGN  4096
+#define EMU_MEDIA_MAGIC  0x454d555a4e53ULL /* EMUZNS */
+#define EMU_MEDIA_OPTLEN 256
+
+/* Completion queue of a thread context. Commands are executed at
+ * submission and completed by poke once the modeled time has passed.
+ * Out of order, appends are executed at completion. */
+struct emu_queue_ent {
+    xztl_callback *      callback;
+    void *               arg;
+    struct xztl_io_mcmd *cmd; /* Executed at completion */
+    uint64_t             due;
+};
+
+struct emu_queue {
+    uint32_t             depth;
+    uint32_t             head;
+    uint32_t             outstanding;
+    struct emu_queue_ent ents[];
+};
+
+/* Zone state persisted at the end of a backing file */
+struct emu_media_state {
+    uint64_t magic;
+    uint64_t zsze;
+    uint64_t zcap;
+    uint32_t nzones;
+    uint32_t nbytes;
+};
+
+static struct emu_media emumedia;
+
+static inline uint64_t emu_media_nsec(struct xztl_io_mcmd *cmd) {
+    uint32_t naddr = (cmd->naddr) ? cmd->naddr : 1;
+    uint64_t nsec  = 0;
+    uint32_t sec_i;
+
+    for (sec_i = 0; sec_i < naddr; sec_i++)
+        nsec += cmd->nsec[sec_i];
+
+    return nsec;
+}
+
+/* Copy data between the host buffers and the backing store */
+static int emu_media_data(struct xztl_io_mcmd *cmd, uint64_t slba,
+                          uint8_t write) {
+    uint32_t naddr = (cmd->naddr) ? cmd->naddr : 1;
+    uint64_t off   = slba * emumedia.nbytes;
+    uint64_t len;
+    uint32_t sec_i;
+    ssize_t  ret;
+    char *   buf;
+
+    if (off + emu_media_nsec(cmd) * emumedia.nbytes > emumedia.nbytes_dev)
+        return EMU_STATUS_BOUNDARY;
+
+    for (sec_i = 0; sec_i < naddr; sec_i++) {
+        buf = (char *)cmd->prp[sec_i];  // NOLINT
+        len = cmd->nsec[sec_i] * emumedia.nbytes;
+
+        if (emumedia.fd < 0) {
+            if (write)
+                memcpy(emumedia.mem + off, buf, len);
+            else
+                memcpy(buf, emumedia.mem + off, len);
+        } else {
+            while (len) {
+                ret = (write) ? pwrite(emumedia.fd, buf, len, off)
+                              : pread(emumedia.fd, buf, len, off);
+                if (ret <= 0)
+                    return EMU_MEDIA_IO_ERR;
+                buf += ret;
+                off += ret;
+                len -= ret;
+            }
+            continue;
+        }
+
+        off += len;
+    }
+
+    return XZTL_OK;
+}
+
+/* Discard the data of a zone after a reset */
+static void emu_media_discard(struct emu_zone *zone) {
+    uint64_t off = zone->zslba * emumedia.nbytes;
+    uint64_t len = emumedia.zsze * emumedia.nbytes;
+
+    if (emumedia.fd >= 0) {
+        fallocate(emumedia.fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, off,
+                  len);
+        return;
+    }
+
+    if (off % EMU_MEDIA_ALIGN || len % EMU_MEDIA_ALIGN)
+        memset(emumedia.mem + off, 0x0, len);
+    else
+        madvise(emumedia.mem + off, len, MADV_DONTNEED);
+}
+
+/* Zone state transitions. Must be called with the zone mutex held */
+
+static uint16_t emu_media_zone_do_open(struct emu_zone *zone, uint8_t zs) {
+    if (zone->zs == XNVME_SPEC_ZND_STATE_EMPTY && emumedia.maxactive &&
+        emumedia.nactive >= emumedia.maxactive)
+        return EMU_STATUS_TOO_MANY_ACT;
+
+    if (emumedia.maxopen && emumedia.nopen >= emumedia.maxopen)
+        return EMU_STATUS_TOO_MANY_OPEN;
+
+    if (zone->zs == XNVME_SPEC_ZND_STATE_EMPTY)
+        emumedia.nactive++;
+
+    emumedia.nopen++;
+    zone->zs = zs;
+
+    return XZTL_OK;
+}
+
+static uint16_t emu_media_zone_write(struct emu_zone *zone, uint64_t *slba,
+                                     uint64_t nsec, uint8_t append) {
+    uint16_t status;
+
+    switch (zone->zs) {
+        case XNVME_SPEC_ZND_STATE_FULL:
+            return EMU_STATUS_ZONE_FULL;
+        case XNVME_SPEC_ZND_STATE_EMPTY:
+        case XNVME_SPEC_ZND_STATE_CLOSED:
+        case XNVME_SPEC_ZND_STATE_IOPEN:
+        case XNVME_SPEC_ZND_STATE_EOPEN:
+            break;
+        default:
+            return EMU_STATUS_INVALID_WRITE;
+    }
+
+    if (append)
+        *slba = zone->wp;
+    else if (*slba != zone->wp)
+        return EMU_STATUS_INVALID_WRITE;
+
+    if (zone->wp + nsec > zone->zslba + emumedia.zcap)
+        return EMU_STATUS_BOUNDARY;
+
+    /* Implicit open */
+    if (zone->zs == XNVME_SPEC_ZND_STATE_EMPTY ||
+        zone->zs == XNVME_SPEC_ZND_STATE_CLOSED) {
+        status = emu_media_zone_do_open(zone, XNVME_SPEC_ZND_STATE_IOPEN);
+        if (status)
+            return status;
+    }
+
+    zone->wp += nsec;
+
+    if (zone->wp == zone->zslba + emumedia.zcap) {
+        emumedia.nopen--;
+        emumedia.nactive--;
+        zone->zs = XNVME_SPEC_ZND_STATE_FULL;
+    }
+
+    return XZTL_OK;
+}
+
+static uint16_t emu_media_zone_action(struct emu_zone *zone, uint8_t op) {
+    uint8_t open = (zone->zs == XNVME_SPEC_ZND_STATE_IOPEN ||
+                    zone->zs == XNVME_SPEC_ZND_STATE_EOPEN);
+
+    switch (op) {
+        case XZTL_ZONE_MGMT_OPEN:
+            if (zone->zs == XNVME_SPEC_ZND_STATE_EOPEN)
+                return XZTL_OK;
+            if (zone->zs == XNVME_SPEC_ZND_STATE_IOPEN) {
+                zone->zs = XNVME_SPEC_ZND_STATE_EOPEN;
+                return XZTL_OK;
+            }
+            if (zone->zs == XNVME_SPEC_ZND_STATE_FULL)
+                return EMU_STATUS_INVALID_TRANS;
+            return emu_media_zone_do_open(zone, XNVME_SPEC_ZND_STATE_EOPEN);
+
+        case XZTL_ZONE_MGMT_CLOSE:
+            if (zone->zs == XNVME_SPEC_ZND_STATE_CLOSED)
+                return XZTL_OK;
+            if (!open)
+                return EMU_STATUS_INVALID_TRANS;
+            emumedia.nopen--;
+            if (zone->wp == zone->zslba) {
+                emumedia.nactive--;
+                zone->zs = XNVME_SPEC_ZND_STATE_EMPTY;
+            } else {
+                zone->zs = XNVME_SPEC_ZND_STATE_CLOSED;
+            }
+            return XZTL_OK;
+
+        case XZTL_ZONE_MGMT_FINISH:
+            if (open)
+                emumedia.nopen--;
+            if (open || zone->zs == XNVME_SPEC_ZND_STATE_CLOSED)
+                emumedia.nactive--;
+            zone->wp = zone->zslba + emumedia.zcap;
+            zone->zs = XNVME_SPEC_ZND_STATE_FULL;
+            return XZTL_OK;
+
+        case XZTL_ZONE_MGMT_RESET:
+            if (open)
+                emumedia.nopen--;
+            if (open || zone->zs == XNVME_SPEC_ZND_STATE_CLOSED)
+                emumedia.nactive--;
+            if (zone->wp != zone->zslba)
+                emu_media_discard(zone);
+            zone->wp = zone->zslba;
+            zone->zs = XNVME_SPEC_ZND_STATE_EMPTY;
+            return XZTL_OK;
+
+        default:
+            return EMU_INVALID_OPCODE;
+    }
+}
+
+/* Modeled completion time of a command in microseconds */
+static uint64_t emu_media_due(uint64_t nbytes) {
+    struct timespec ts;
+    uint64_t        now, start;
+
+    if (!emumedia.lat_us && !emumedia.bw_mbs)
+        return 0;
+
+    GET_MICROSECONDS(now, ts);
+
+    /* 1 MB/s transfers 1 byte per microsecond */
+    if (emumedia.bw_mbs) {
+        pthread_mutex_lock(&emumedia.zone_mutex);
+        start = (emumedia.busy_until > now) ? emumedia.busy_until : now;
+        emumedia.busy_until = start + nbytes / emumedia.bw_mbs;
+        now                 = emumedia.busy_until;
+        pthread_mutex_unlock(&emumedia.zone_mutex);
+    }
+
+    return now + emumedia.lat_us;
+}
+
+/* Copy sectors within the backing store, the data does not reach the host
+ * buffers */
+static uint16_t emu_media_copy_data(uint64_t src, uint64_t dst,
+                                    uint64_t nsec) {
+    loff_t  off_in  = src * emumedia.nbytes;
+    loff_t  off_out = dst * emumedia.nbytes;
+    size_t  len     = nsec * emumedia.nbytes;
+    ssize_t ret;
+
+    if (off_in + len > emumedia.nbytes_dev)
+        return EMU_STATUS_BOUNDARY;
+
+    if (emumedia.fd < 0) {
+        memmove(emumedia.mem + off_out, emumedia.mem + off_in, len);
+        return XZTL_OK;
+    }
+
+    while (len) {
+        ret = copy_file_range(emumedia.fd, &off_in, emumedia.fd, &off_out,
+                              len, 0);
+        if (ret <= 0)
+            return EMU_MEDIA_IO_ERR;
+        len -= ret;
+    }
+
+    return XZTL_OK;
+}
+
+static uint16_t emu_media_execute(struct xztl_io_mcmd *cmd) {
+    struct emu_zone *zone;
+    uint64_t         slba, nsec;
+    uint32_t         rng_i;
+    uint16_t         status;
+
+    nsec = emu_media_nsec(cmd);
+
+    switch (cmd->opcode) {
+        case XZTL_CMD_READ:
+            return emu_media_data(cmd, cmd->addr[0].g.sect, 0);
+
+        case XZTL_CMD_WRITE:
+            slba = cmd->addr[0].g.sect;
+            if (slba / emumedia.zsze >= emumedia.nzones)
+                return EMU_STATUS_BOUNDARY;
+            zone = &emumedia.zones[slba / emumedia.zsze];
+            break;
+
+        case XZTL_ZONE_APPEND:
+            if (cmd->addr[0].g.zone >= emumedia.nzones)
+                return EMU_STATUS_BOUNDARY;
+            zone = &emumedia.zones[cmd->addr[0].g.zone];
+            break;
+
+        case XZTL_CMD_COPY:
+            slba = cmd->copy_dst.g.sect;
+            if (slba / emumedia.zsze >= emumedia.nzones)
+                return EMU_STATUS_BOUNDARY;
+            zone = &emumedia.zones[slba / emumedia.zsze];
+            break;
+
+        default:
+            return EMU_INVALID_OPCODE;
+    }
+
+    /* The write pointer is moved under the lock, data is copied after */
+    pthread_mutex_lock(&emumedia.zone_mutex);
+    status = emu_media_zone_write(zone, &slba, nsec,
+                                  cmd->opcode == XZTL_ZONE_APPEND);
+    pthread_mutex_unlock(&emumedia.zone_mutex);
+    if (status)
+        return status;
+
+    cmd->paddr[0] = slba;
+
+    if (cmd->opcode != XZTL_CMD_COPY)
+        return emu_media_data(cmd, slba, 1);
+
+    for (rng_i = 0; rng_i < cmd->naddr; rng_i++) {
+        status = emu_media_copy_data(cmd->addr[rng_i].g.sect, slba,
+                                     cmd->nsec[rng_i]);
+        if (status)
+            return status;
+        slba += cmd->nsec[rng_i];
+    }
+
+    return XZTL_OK;
+}
+
+/* Queue a completion, the entry must have been checked to be free */
+static void emu_media_queue_cpl(struct emu_queue *queue,
+                                xztl_callback *callback, void *arg,
+                                struct xztl_io_mcmd *cmd, uint64_t nbytes) {
+    uint32_t tail;
+
+    tail = (queue->head + queue->outstanding) % queue->depth;
+    queue->ents[tail].callback = callback;
+    queue->ents[tail].arg      = arg;
+    queue->ents[tail].cmd      = cmd;
+    queue->ents[tail].due      = emu_media_due(nbytes);
+    queue->outstanding++;
+}
+
+static int emu_media_submit_io(struct xztl_io_mcmd *cmd) {
+    struct emu_queue *queue;
+
+    if (cmd->opcode != XZTL_CMD_READ && cmd->opcode != XZTL_CMD_WRITE &&
+        cmd->opcode != XZTL_ZONE_APPEND && cmd->opcode != XZTL_CMD_COPY)
+        return EMU_INVALID_OPCODE;
+
+    if (cmd->synch) {
+        cmd->status = emu_media_execute(cmd);
+        if (cmd->status)
+            xztl_print_mcmd(cmd);
+        return cmd->status;
+    }
+
+    queue = (struct emu_queue *)cmd->async_ctx->opaque;
+    if (queue->outstanding == queue->depth)
+        return XZTL_MEDIA_QFULL;
+
+    /* Out of order, appends are placed in completion order */
+    if (emumedia.ooo && cmd->opcode == XZTL_ZONE_APPEND) {
+        emu_media_queue_cpl(queue, cmd->callback, cmd, cmd,
+                            emu_media_nsec(cmd) * emumedia.nbytes);
+        return XZTL_OK;
+    }
+
+    cmd->status = emu_media_execute(cmd);
+    if (cmd->status)
+        xztl_print_mcmd(cmd);
+
+    emu_media_queue_cpl(queue, cmd->callback, cmd, NULL,
+                        emu_media_nsec(cmd) * emumedia.nbytes);
+
+    return XZTL_OK;
+}
+
+static int emu_media_zone_report(struct xztl_zn_mcmd *cmd) {
+    struct xnvme_znd_report *    rep;
+    struct xnvme_spec_znd_descr *zinfo;
+    uint64_t                     nbytes;
+    uint32_t                     zone_i, zone, nzones;
+
+    /* Range of the report, nzones 0 reports up to the end */
+    zone = emumedia.media.geo.zn_grp * cmd->addr.g.grp + cmd->addr.g.zone;
+    if (zone >= emumedia.nzones)
+        return EMU_STATUS_BOUNDARY;
+
+    nzones = emumedia.nzones - zone;
+    if (cmd->nzones && cmd->nzones < nzones)
+        nzones = cmd->nzones;
+
+    nbytes = sizeof(struct xnvme_znd_report) +
+             nzones * sizeof(struct xnvme_spec_znd_descr);
+
+    rep = xnvme_buf_virt_alloc(EMU_MEDIA_ALIGN, nbytes);
+    if (!rep)
+        return EMU_MEDIA_MEM_ERR;
+
+    memset(rep, 0x0, nbytes);
+    rep->report_nbytes  = nbytes;
+    rep->entries_nbytes = nbytes - sizeof(struct xnvme_znd_report);
+    rep->zd_nbytes      = sizeof(struct xnvme_spec_znd_descr);
+    rep->zdext_nbytes   = 0;
+    rep->zrent_nbytes   = sizeof(struct xnvme_spec_znd_descr);
+    rep->zslba          = zone * emumedia.zsze;
+    rep->zelba          = (zone + nzones - 1) * emumedia.zsze;
+    rep->nzones         = emumedia.nzones;
+    rep->nentries       = nzones;
+    rep->extended       = 0;
+
+    pthread_mutex_lock(&emumedia.zone_mutex);
+    for (zone_i = 0; zone_i < nzones; zone_i++) {
+        zinfo        = XNVME_ZND_REPORT_DESCR(rep, zone_i);
+        zinfo->zt    = XNVME_SPEC_ZND_TYPE_SEQWR;
+        zinfo->zs    = emumedia.zones[zone + zone_i].zs;
+        zinfo->zcap  = emumedia.zcap;
+        zinfo->zslba = emumedia.zones[zone + zone_i].zslba;
+        zinfo->wp    = emumedia.zones[zone + zone_i].wp;
+    }
+    pthread_mutex_unlock(&emumedia.zone_mutex);
+
+    cmd->opaque = (void *)rep;  // NOLINT
+
+    return XZTL_OK;
+}
+
+static int emu_media_zone_manage(struct xztl_zn_mcmd *cmd) {
+    struct emu_queue *queue = NULL;
+    uint64_t          zone_i;
+    uint16_t          status = XZTL_OK;
+
+    if (!cmd->synch) {
+        queue = (struct emu_queue *)cmd->async_ctx->opaque;
+        if (queue->outstanding == queue->depth)
+            return XZTL_MEDIA_QFULL;
+    }
+
+    zone_i = emumedia.media.geo.zn_grp * cmd->addr.g.grp + cmd->addr.g.zone;
+
+    pthread_mutex_lock(&emumedia.zone_mutex);
+
+    /* Select all: zones in a state not accepting the action are skipped */
+    if (cmd->nzones > 1) {
+        for (zone_i = 0; zone_i < emumedia.nzones; zone_i++)
+            emu_media_zone_action(&emumedia.zones[zone_i], cmd->opcode);
+    } else if (zone_i < emumedia.nzones) {
+        status = emu_media_zone_action(&emumedia.zones[zone_i], cmd->opcode);
+    } else {
+        status = EMU_STATUS_BOUNDARY;
+    }
+
+    pthread_mutex_unlock(&emumedia.zone_mutex);
+
+    cmd->status = status;
+
+    /* Asynchronous commands report the status in the callback */
+    if (queue) {
+        emu_media_queue_cpl(queue, cmd->callback, cmd, NULL, 0);
+        return XZTL_OK;
+    }
+
+    return status;
+}
+
+static int emu_media_zone_mgmt(struct xztl_zn_mcmd *cmd) {
+    switch (cmd->opcode) {
+        case XZTL_ZONE_MGMT_RESET:
+            xztl_stats_inc(XZTL_STATS_RESET_MCMD, 1);
+            return emu_media_zone_manage(cmd);
+        case XZTL_ZONE_MGMT_CLOSE:
+        case XZTL_ZONE_MGMT_FINISH:
+        case XZTL_ZONE_MGMT_OPEN:
+            return emu_media_zone_manage(cmd);
+        case XZTL_ZONE_MGMT_REPORT:
+            return emu_media_zone_report(cmd);
+        default:
+            return EMU_INVALID_OPCODE;
+    }
+}
+
+static void *emu_media_dma_alloc(size_t size) {
+    size_t nbytes = (size + EMU_MEDIA_ALIGN - 1) / EMU_MEDIA_ALIGN;
+
+    return aligned_alloc(EMU_MEDIA_ALIGN, nbytes * EMU_MEDIA_ALIGN);
+}
+
+static void emu_media_dma_free(void *ptr) {
+    free(ptr);
+}
+
+static int emu_media_async_poke(struct emu_queue *queue, uint32_t *c,
+                                uint16_t max) {
+    struct emu_queue_ent ent;
+    struct timespec      ts;
+    uint64_t             now   = 0;
+    uint32_t             count = 0;
+    uint32_t             ent_i;
+
+    if (emumedia.lat_us || emumedia.bw_mbs)
+        GET_MICROSECONDS(now, ts);
+
+    while (queue->outstanding && (!max || count < max)) {
+        /* Out of order, the newest command completes first */
+        ent_i = (emumedia.ooo) ? (queue->head + queue->outstanding - 1) %
+                                     queue->depth
+                               : queue->head;
+        if (queue->ents[ent_i].due > now)
+            break;
+
+        /* The entry is released before the callback, it may submit */
+        ent = queue->ents[ent_i];
+        if (!emumedia.ooo)
+            queue->head = (queue->head + 1) % queue->depth;
+        queue->outstanding--;
+        count++;
+
+        if (ent.cmd) {
+            ent.cmd->status = emu_media_execute(ent.cmd);
+            if (ent.cmd->status)
+                xztl_print_mcmd(ent.cmd);
+        }
+
+        ent.callback(ent.arg);
+    }
+
+    *c = count;
+
+    return XZTL_OK;
+}
+
+static int emu_media_async_wait(struct emu_queue *queue, uint32_t *c) {
+    uint32_t count, total = 0;
+
+    while (queue->outstanding) {
+        emu_media_async_poke(queue, &count, 0);
+        total += count;
+    }
+
+    *c = total;
+
+    return XZTL_OK;
+}
+
+/* Sleep until the first queued command is due, up to 'usec' */
+static int emu_media_async_block(struct emu_queue *queue, uint32_t usec) {
+    struct timespec ts;
+    uint64_t        now, due;
+
+    if (!queue->outstanding)
+        return XZTL_OK;
+
+    due = queue->ents[queue->head].due;
+    GET_MICROSECONDS(now, ts);
+    if (due <= now)
+        return XZTL_OK;
+
+    usleep((due - now < usec) ? due - now : usec);
+
+    return XZTL_OK;
+}
+
+static int emu_media_asynch_init(struct xztl_misc_cmd *cmd) {
+    struct xztl_mthread_ctx *tctx;
+    struct emu_queue *       queue;
+
+    tctx  = cmd->asynch.ctx_ptr;
+    queue = calloc(1, sizeof(struct emu_queue) +
+                          cmd->asynch.depth * sizeof(struct emu_queue_ent));
+    if (!queue)
+        return EMU_MEDIA_MEM_ERR;
+
+    /* Emulated completions are only delivered by pokes, every queue is
+     * polled */
+    queue->depth = cmd->asynch.depth;
+    tctx->opaque = queue;
+    tctx->polled = !!(cmd->asynch.flags & XZTL_CTX_POLL);
+
+    return XZTL_OK;
+}
+
+static int emu_media_asynch_term(struct xztl_misc_cmd *cmd) {
+    struct emu_queue *queue;
+    uint32_t          count;
+
+    queue = (struct emu_queue *)cmd->asynch.ctx_ptr->opaque;
+    if (queue->outstanding)
+        emu_media_async_wait(queue, &count);
+
+    free(queue);
+    cmd->asynch.ctx_ptr->opaque = NULL;
+
+    return XZTL_OK;
+}
+
+static int emu_media_cmd_exec(struct xztl_misc_cmd *cmd) {
+    struct emu_queue *queue;
+
+    queue = (struct emu_queue *)cmd->asynch.ctx_ptr->opaque;
+
+    switch (cmd->opcode) {
+        case XZTL_MISC_ASYNCH_INIT:
+            return emu_media_asynch_init(cmd);
+
+        case XZTL_MISC_ASYNCH_TERM:
+            return emu_media_asynch_term(cmd);
+
+        case XZTL_MISC_ASYNCH_POKE:
+            return emu_media_async_poke(queue, &cmd->asynch.count,
+                                        cmd->asynch.limit);
+
+        case XZTL_MISC_ASYNCH_OUTS:
+            cmd->asynch.count = queue->outstanding;
+            return XZTL_OK;
+
+        case XZTL_MISC_ASYNCH_WAIT:
+            return emu_media_async_wait(queue, &cmd->asynch.count);
+
+        case XZTL_MISC_ASYNCH_BLOCK:
+            return emu_media_async_block(queue, cmd->asynch.limit);
+
+        default:
+            return EMU_INVALID_OPCODE;
+    }
+}
+
+/* Load the zone state from a backing file created by a previous run. Open
+ * zones are closed, as a device does after a power cycle. */
+static void emu_media_state_load(void) {
+    struct emu_media_state st;
+    struct emu_zone *      zone;
+    uint32_t               zone_i;
+    size_t                 nbytes;
+
+    if (emumedia.fd < 0)
+        return;
+
+    if (pread(emumedia.fd, &st, sizeof(st), emumedia.nbytes_dev) !=
+        sizeof(st))
+        return;
+
+    if (st.magic != EMU_MEDIA_MAGIC || st.nzones != emumedia.nzones ||
+        st.zsze != emumedia.zsze || st.zcap != emumedia.zcap ||
+        st.nbytes != emumedia.nbytes) {
+        log_info("emu-media: Zone state does not match. Starting empty.");
+        return;
+    }
+
+    nbytes = emumedia.nzones * sizeof(struct emu_zone);
+    if (pread(emumedia.fd, emumedia.zones, nbytes,
+              emumedia.nbytes_dev + sizeof(st)) != nbytes) {
+        log_info("emu-media: Zone state is truncated. Starting empty.");
+        for (zone_i = 0; zone_i < emumedia.nzones; zone_i++) {
+            emumedia.zones[zone_i].zslba = zone_i * emumedia.zsze;
+            emumedia.zones[zone_i].wp    = zone_i * emumedia.zsze;
+            emumedia.zones[zone_i].zs    = XNVME_SPEC_ZND_STATE_EMPTY;
+        }
+        return;
+    }
+
+    for (zone_i = 0; zone_i < emumedia.nzones; zone_i++) {
+        zone = &emumedia.zones[zone_i];
+        if (zone->zs == XNVME_SPEC_ZND_STATE_IOPEN ||
+            zone->zs == XNVME_SPEC_ZND_STATE_EOPEN)
+            zone->zs = XNVME_SPEC_ZND_STATE_CLOSED;
+        if (zone->zs == XNVME_SPEC_ZND_STATE_CLOSED)
+            emumedia.nactive++;
+    }
+}
+
+static void emu_media_state_save(void) {
+    struct emu_media_state st;
+    size_t                 nbytes;
+
+    if (emumedia.fd < 0)
+        return;
+
+    st.magic  = EMU_MEDIA_MAGIC;
+    st.nzones = emumedia.nzones;
+    st.zsze   = emumedia.zsze;
+    st.zcap   = emumedia.zcap;
+    st.nbytes = emumedia.nbytes;
+
+    nbytes = emumedia.nzones * sizeof(struct emu_zone);
+    if (pwrite(emumedia.fd, &st, sizeof(st), emumedia.nbytes_dev) !=
+            sizeof(st) ||
+        pwrite(emumedia.fd, emumedia.zones, nbytes,
+               emumedia.nbytes_dev + sizeof(st)) != nbytes)
+        log_err("emu-media: Could not save the zone state.");
+}
+
+static int emu_media_init(void) {
+    return XZTL_OK;
+}
+
+static int emu_media_exit(void) {
+    emu_media_state_save();
+
+    if (emumedia.fd >= 0)
+        close(emumedia.fd);
+    else if (emumedia.mem)
+        munmap(emumedia.mem, emumedia.nbytes_dev);
+
+    pthread_mutex_destroy(&emumedia.zone_mutex);
+    free(emumedia.zones);
+    emumedia.zones = NULL;
+    emumedia.mem   = NULL;
+    emumedia.fd    = -1;
+
+    return XZTL_OK;
+}
+
+/* Parse 'opt=val&opt=val' into the emulator settings */
+static int emu_media_parse_opts(char *opts) {
+    char *   opt, *val, *save;
+    uint64_t num;
+
+    for (opt = strtok_r(opts, "&", &save); opt;
+         opt = strtok_r(NULL, "&", &save)) {
+        val = strchr(opt, '=');
+        if (!val) {
+            log_erra("emu-media: Invalid option: %s", opt);
+            return EMU_MEDIA_OPT_ERR;
+        }
+        *val++ = '\0';
+        num    = strtoull(val, NULL, 0);
+
+        if (!strcmp(opt, "nzones"))
+            emumedia.nzones = num;
+        else if (!strcmp(opt, "zsze"))
+            emumedia.zsze = num;
+        else if (!strcmp(opt, "zcap"))
+            emumedia.zcap = num;
+        else if (!strcmp(opt, "nbytes"))
+            emumedia.nbytes = num;
+        else if (!strcmp(opt, "mdts"))
+            emumedia.mdts = num;
+        else if (!strcmp(opt, "maxopen"))
+            emumedia.maxopen = num;
+        else if (!strcmp(opt, "maxactive"))
+            emumedia.maxactive = num;
+        else if (!strcmp(opt, "lat"))
+            emumedia.lat_us = num;
+        else if (!strcmp(opt, "bw"))
+            emumedia.bw_mbs = num;
+        else if (!strcmp(opt, "ooo"))
+            emumedia.ooo = !!num;
+        else {
+            log_erra("emu-media: Unknown option: %s", opt);
+            return EMU_MEDIA_OPT_ERR;
+        }
+    }
+
+    if (!emumedia.zcap)
+        emumedia.zcap = emumedia.zsze;
+
+    if (!emumedia.nzones || !emumedia.zsze || emumedia.zcap > emumedia.zsze ||
+        emumedia.nbytes < 512 || (emumedia.nbytes & (emumedia.nbytes - 1)) ||
+        emumedia.mdts < emumedia.nbytes) {
+        log_err("emu-media: Invalid geometry.");
+        return EMU_MEDIA_NOGEO;
+    }
+
+    return XZTL_OK;
+}
+
+static int emu_media_open(const char *path) {
+    emumedia.nbytes_dev = emumedia.nzones * emumedia.zsze * emumedia.nbytes;
+
+    if (!strcmp(path, EMU_MEDIA_MEM)) {
+        emumedia.fd  = -1;
+        emumedia.mem = mmap(NULL, emumedia.nbytes_dev, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (emumedia.mem == MAP_FAILED) {
+            emumedia.mem = NULL;
+            return EMU_MEDIA_MEM_ERR;
+        }
+        return XZTL_OK;
+    }
+
+    /* Sparse file, zone state is kept after the data */
+    emumedia.fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (emumedia.fd < 0)
+        return EMU_MEDIA_NODEVICE;
+
+    if (ftruncate(emumedia.fd,
+                  emumedia.nbytes_dev + sizeof(struct emu_media_state) +
+                      emumedia.nzones * sizeof(struct emu_zone))) {
+        close(emumedia.fd);
+        emumedia.fd = -1;
+        return EMU_MEDIA_NODEVICE;
+    }
+
+    return XZTL_OK;
+}
+
+int emu_media_register(const char *dev_name) {
+    struct xztl_media *m;
+    char               path[EMU_MEDIA_OPTLEN];
+    char *             opts;
+    uint32_t           zone_i;
+    int                ret;
+
+    if (strncmp(dev_name, EMU_MEDIA_PREFIX, strlen(EMU_MEDIA_PREFIX)))
+        return EMU_MEDIA_NODEVICE;
+
+    memset(&emumedia, 0x0, sizeof(struct emu_media));
+    emumedia.fd     = -1;
+    emumedia.nzones = EMU_MEDIA_NZONES;
+    emumedia.zsze   = EMU_MEDIA_ZSZE;
+    emumedia.nbytes = EMU_MEDIA_NBYTES;
+    emumedia.mdts   = EMU_MEDIA_MDTS;
+
+    snprintf(path, EMU_MEDIA_OPTLEN, "%s",
+             dev_name + strlen(EMU_MEDIA_PREFIX));
+    opts = strchr(path, '?');
+    if (opts)
+        *opts++ = '\0';
+    else
+        opts = path + strlen(path);
+
+    ret = emu_media_parse_opts(opts);
+    if (ret)
+        return ret;
+
+    emumedia.zones = calloc(emumedia.nzones, sizeof(struct emu_zone));
+    if (!emumedia.zones)
+        return EMU_MEDIA_MEM_ERR;
+
+    for (zone_i = 0; zone_i < emumedia.nzones; zone_i++) {
+        emumedia.zones[zone_i].zslba = zone_i * emumedia.zsze;
+        emumedia.zones[zone_i].wp    = zone_i * emumedia.zsze;
+        emumedia.zones[zone_i].zs    = XNVME_SPEC_ZND_STATE_EMPTY;
+    }
+
+    if (pthread_mutex_init(&emumedia.zone_mutex, NULL)) {
+        ret = EMU_MEDIA_MEM_ERR;
+        goto ZONES;
+    }
+
+    ret = emu_media_open(path);
+    if (ret) {
+        log_erra("emu-media: Could not open %s", path);
+        goto MUTEX;
+    }
+
+    emu_media_state_load();
+
+    log_infoa("emu-media: %s, %u zones, zsze %lu, zcap %lu, lat %u us, "
+              "bw %u MB/s", path, emumedia.nzones, emumedia.zsze,
+              emumedia.zcap, emumedia.lat_us, emumedia.bw_mbs);
+
+    m = &emumedia.media;
+
+    m->geo.ngrps      = 1;
+    m->geo.pu_grp     = 1;
+    m->geo.zn_pu      = emumedia.nzones;
+    m->geo.sec_zn     = emumedia.zsze;
+    m->geo.nbytes     = emumedia.nbytes;
+    m->geo.nbytes_oob = 0;
+    m->geo.sec_mdts   = emumedia.mdts / emumedia.nbytes;
+
+    m->caps = XZTL_MEDIA_CAP_APPEND | XZTL_MEDIA_CAP_COPY |
+              XZTL_MEDIA_CAP_HOSTBUF;
+    snprintf(m->engine, XZTL_MEDIA_ENGINE_LEN, "emu");
+
+    m->init_fn   = emu_media_init;
+    m->exit_fn   = emu_media_exit;
+    m->submit_io = emu_media_submit_io;
+    m->zone_fn   = emu_media_zone_mgmt;
+    m->dma_alloc = emu_media_dma_alloc;
+    m->dma_free  = emu_media_dma_free;
+    m->cmd_exec  = emu_media_cmd_exec;
+
+    ret = xztl_media_set(m);
+    if (ret) {
+        emu_media_exit();
+        return ret;
+    }
+
+    return XZTL_OK;
+
+MUTEX:
+    pthread_mutex_destroy(&emumedia.zone_mutex);
+ZONES:
+    free(emumedia.zones);
+    emumedia.zones = NULL;
+    return ret;
+}
@@ -0,0 +1,600 @@
+/* xZTL: Zone Translation Layer User-space Library
+ *
+ * Copyright 2019 Samsung Electronics
+ *
+ * Written by Ivan L. Picoli <i.picoli@samsung.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <xztl-media.h>
+#include <xztl.h>
+#include <ztl-media-fault.h>
+
+#define FAULT_MEDIA_PPM 1000000
+
+static struct fault_media faultmedia;
+
+static const char *fault_media_names[FAULT_MEDIA_NOPS] = {
+    "read", "write", "append", "reset", "finish", "report"};
+
+/* Fault decided at submission */
+struct fault_media_draw {
+    uint8_t  op;
+    uint8_t  status;  /* Injected status, 0 if the command is submitted */
+    uint64_t due;     /* Completion time (usec) */
+};
+
+/* xorshift64*, the sequence only depends on the seed and the order of the
+ * commands */
+static uint64_t fault_media_rand(void) {
+    uint64_t x = faultmedia.rand;
+
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    faultmedia.rand = x;
+
+    return x * 0x2545f4914f6cdd1dULL;
+}
+
+static inline uint32_t fault_media_ppm(void) {
+    return fault_media_rand() % FAULT_MEDIA_PPM;
+}
+
+/* Natural logarithm of x in (0, 1], libm is not a dependency. The mantissa
+ * term uses the atanh series, accurate to 1e-5 */
+static double fault_media_ln(double x) {
+    uint64_t bits;
+    double   m, t, t2;
+    int      e;
+
+    memcpy(&bits, &x, sizeof(bits));
+    e    = (int)((bits >> 52) & 0x7ff) - 1023;
+    bits = (bits & ((1ULL << 52) - 1)) | (1023ULL << 52);
+    memcpy(&m, &bits, sizeof(m));
+
+    t  = (m - 1) / (m + 1);
+    t2 = t * t;
+
+    return e * 0.6931471805599453 +
+           2 * t * (1 + t2 / 3 + t2 * t2 / 5 + t2 * t2 * t2 / 7);
+}
+
+static uint64_t fault_media_latency(struct fault_media_rule *rule) {
+    double u;
+
+    switch (rule->dist) {
+        case FAULT_MEDIA_LAT_FIXED:
+            return rule->lat_us;
+        case FAULT_MEDIA_LAT_UNIFORM:
+            if (rule->lat_max <= rule->lat_us)
+                return rule->lat_us;
+            return rule->lat_us +
+                   fault_media_rand() % (rule->lat_max - rule->lat_us + 1);
+        case FAULT_MEDIA_LAT_EXP:
+            /* u in (0, 1] */
+            u = ((fault_media_rand() >> 11) + 1) * (1.0 / (1ULL << 53));
+            u = -fault_media_ln(u) * rule->lat_us;
+            return (rule->lat_max && u > rule->lat_max) ? rule->lat_max
+                                                        : (uint64_t)u;
+        default:
+            return 0;
+    }
+}
+
+static void fault_media_draw(uint8_t op, struct fault_media_draw *draw) {
+    struct fault_media_rule * rule = &faultmedia.rules[op];
+    struct fault_media_stats *st   = &faultmedia.stats[op];
+    struct timespec           ts;
+    uint64_t                  lat;
+
+    GET_MICROSECONDS(draw->due, ts);
+    draw->op     = op;
+    draw->status = 0;
+
+    pthread_spin_lock(&faultmedia.spin);
+
+    st->ncmd++;
+
+    if (rule->tmo_ppm && fault_media_ppm() < rule->tmo_ppm) {
+        draw->status = FAULT_MEDIA_STATUS_TMO;
+        lat          = rule->tmo_us;
+        st->ntmo++;
+    } else if (rule->err_ppm && fault_media_ppm() < rule->err_ppm) {
+        draw->status = FAULT_MEDIA_STATUS_ERR;
+        lat          = 0;
+        st->nerr++;
+    } else {
+        lat = fault_media_latency(rule);
+        if (rule->stall_ppm && fault_media_ppm() < rule->stall_ppm) {
+            lat += rule->stall_us;
+            st->nstall++;
+        }
+    }
+
+    st->lat_us += lat;
+
+    pthread_spin_unlock(&faultmedia.spin);
+
+    draw->due += lat;
+}
+
+/* Hold the calling thread until the completion time */
+static void fault_media_hold(uint64_t due) {
+    struct timespec ts;
+    uint64_t        now;
+
+    GET_MICROSECONDS(now, ts);
+    if (now >= due)
+        return;
+
+    ts.tv_sec  = (due - now) / 1000000;
+    ts.tv_nsec = ((due - now) % 1000000) * 1000;
+    nanosleep(&ts, NULL);
+}
+
+static int fault_media_io_op(struct xztl_io_mcmd *cmd) {
+    switch (cmd->opcode) {
+        case XZTL_CMD_READ:
+            return FAULT_MEDIA_READ;
+        case XZTL_CMD_WRITE:
+            return FAULT_MEDIA_WRITE;
+        case XZTL_ZONE_APPEND:
+            return FAULT_MEDIA_APPEND;
+        default:
+            return -1;
+    }
+}
+
+static int fault_media_zn_op(struct xztl_zn_mcmd *cmd) {
+    switch (cmd->opcode) {
+        case XZTL_ZONE_MGMT_RESET:
+            return FAULT_MEDIA_RESET;
+        case XZTL_ZONE_MGMT_FINISH:
+            return FAULT_MEDIA_FINISH;
+        case XZTL_ZONE_MGMT_REPORT:
+            return FAULT_MEDIA_REPORT;
+        default:
+            return -1;
+    }
+}
+
+/* Hold the completion in the context until its due time. The list is
+ * ordered by due time, most commands are due after the ones held */
+static void fault_media_defer(struct xztl_mthread_ctx *  tctx,
+                              struct xztl_media_defer *def) {
+    struct xztl_media_defer *prev;
+
+    pthread_spin_lock(&faultmedia.spin);
+
+    TAILQ_FOREACH_REVERSE(prev, &tctx->fault_defer, xztl_media_defer_head,
+                          entry) {
+        if (prev->due <= def->due)
+            break;
+    }
+    if (prev)
+        TAILQ_INSERT_AFTER(&tctx->fault_defer, prev, def, entry);
+    else
+        TAILQ_INSERT_HEAD(&tctx->fault_defer, def, entry);
+    tctx->fault_ndefer++;
+
+    pthread_spin_unlock(&faultmedia.spin);
+}
+
+static void fault_media_complete(struct xztl_media_defer *def) {
+    struct xztl_io_mcmd *iocmd;
+    struct xztl_zn_mcmd *zncmd;
+
+    if (def->zn) {
+        zncmd           = (struct xztl_zn_mcmd *)def->cmd;  // NOLINT
+        zncmd->callback = def->cb;
+        zncmd->callback(zncmd);
+    } else {
+        iocmd           = (struct xztl_io_mcmd *)def->cmd;  // NOLINT
+        iocmd->callback = def->cb;
+        iocmd->callback(iocmd);
+    }
+}
+
+/* Complete the held commands of the context that are due. Callbacks run
+ * without the lock, they may submit new commands */
+static uint32_t fault_media_release(struct xztl_mthread_ctx *tctx) {
+    TAILQ_HEAD(, xztl_media_defer) due_head = TAILQ_HEAD_INITIALIZER(due_head);
+    struct xztl_media_defer *def;
+    struct timespec          ts;
+    uint64_t                 now;
+    uint32_t                 count = 0;
+
+    if (!__atomic_load_n(&tctx->fault_ndefer, __ATOMIC_ACQUIRE))
+        return 0;
+
+    GET_MICROSECONDS(now, ts);
+
+    pthread_spin_lock(&faultmedia.spin);
+    while ((def = TAILQ_FIRST(&tctx->fault_defer)) && def->due <= now) {
+        TAILQ_REMOVE(&tctx->fault_defer, def, entry);
+        TAILQ_INSERT_TAIL(&due_head, def, entry);
+        tctx->fault_ndefer--;
+        count++;
+    }
+    pthread_spin_unlock(&faultmedia.spin);
+
+    while ((def = TAILQ_FIRST(&due_head))) {
+        TAILQ_REMOVE(&due_head, def, entry);
+        fault_media_complete(def);
+    }
+
+    return count;
+}
+
+/* Due time of the first held command, 0 if none */
+static uint64_t fault_media_next_due(struct xztl_mthread_ctx *tctx) {
+    struct xztl_media_defer *def;
+    uint64_t                 due;
+
+    pthread_spin_lock(&faultmedia.spin);
+    def = TAILQ_FIRST(&tctx->fault_defer);
+    due = (def) ? def->due : 0;
+    pthread_spin_unlock(&faultmedia.spin);
+
+    return due;
+}
+
+/* Completions of the wrapped media are released when they are due, by the
+ * poke of the context */
+static void fault_media_io_callback(void *arg) {
+    struct xztl_io_mcmd *cmd = (struct xztl_io_mcmd *)arg;
+
+    cmd->async_ctx->fault_nheld++;
+    fault_media_defer(cmd->async_ctx, &cmd->fault);
+}
+
+static void fault_media_zn_callback(void *arg) {
+    struct xztl_zn_mcmd *cmd = (struct xztl_zn_mcmd *)arg;
+
+    cmd->async_ctx->fault_nheld++;
+    fault_media_defer(cmd->async_ctx, &cmd->fault);
+}
+
+static int fault_media_submit_io(struct xztl_io_mcmd *cmd) {
+    struct fault_media_draw draw;
+    int                     op, ret;
+
+    op = fault_media_io_op(cmd);
+    if (op < 0)
+        return faultmedia.inner.submit_io(cmd);
+
+    fault_media_draw(op, &draw);
+
+    if (cmd->synch) {
+        if (draw.status) {
+            fault_media_hold(draw.due);
+            cmd->status = draw.status;
+            return cmd->status;
+        }
+        ret = faultmedia.inner.submit_io(cmd);
+        fault_media_hold(draw.due);
+        return ret;
+    }
+
+    cmd->fault.due = draw.due;
+    cmd->fault.cb  = cmd->callback;
+    cmd->fault.cmd = cmd;
+    cmd->fault.zn  = 0;
+
+    /* Injected failures complete without reaching the media */
+    if (draw.status) {
+        cmd->status = draw.status;
+        fault_media_defer(cmd->async_ctx, &cmd->fault);
+        return XZTL_OK;
+    }
+
+    cmd->callback = fault_media_io_callback;
+
+    ret = faultmedia.inner.submit_io(cmd);
+    if (ret)
+        cmd->callback = cmd->fault.cb;
+
+    return ret;
+}
+
+static int fault_media_zone_fn(struct xztl_zn_mcmd *cmd) {
+    struct fault_media_draw draw;
+    int                     op, ret;
+
+    op = fault_media_zn_op(cmd);
+    if (op < 0)
+        return faultmedia.inner.zone_fn(cmd);
+
+    fault_media_draw(op, &draw);
+
+    if (cmd->synch) {
+        if (draw.status) {
+            fault_media_hold(draw.due);
+            cmd->status = draw.status;
+            return cmd->status;
+        }
+        ret = faultmedia.inner.zone_fn(cmd);
+        fault_media_hold(draw.due);
+        return ret;
+    }
+
+    cmd->fault.due = draw.due;
+    cmd->fault.cb  = cmd->callback;
+    cmd->fault.cmd = cmd;
+    cmd->fault.zn  = 1;
+
+    if (draw.status) {
+        cmd->status = draw.status;
+        fault_media_defer(cmd->async_ctx, &cmd->fault);
+        return XZTL_OK;
+    }
+
+    cmd->callback = fault_media_zn_callback;
+
+    ret = faultmedia.inner.zone_fn(cmd);
+    if (ret)
+        cmd->callback = cmd->fault.cb;
+
+    return ret;
+}
+
+/* Held commands are outstanding until released. Pokes count the released
+ * commands instead of the completions held */
+static int fault_media_cmd_exec(struct xztl_misc_cmd *cmd) {
+    struct xztl_mthread_ctx *tctx = cmd->asynch.ctx_ptr;
+    struct timespec          ts;
+    uint64_t                 due, now;
+    uint32_t                 nheld;
+    int                      ret;
+
+    switch (cmd->opcode) {
+        case XZTL_MISC_ASYNCH_POKE:
+            nheld = tctx->fault_nheld;
+            ret   = faultmedia.inner.cmd_exec(cmd);
+            if (ret)
+                return ret;
+            cmd->asynch.count -= tctx->fault_nheld - nheld;
+            cmd->asynch.count += fault_media_release(tctx);
+            return XZTL_OK;
+
+        case XZTL_MISC_ASYNCH_OUTS:
+            ret = faultmedia.inner.cmd_exec(cmd);
+            if (!ret)
+                cmd->asynch.count +=
+                    __atomic_load_n(&tctx->fault_ndefer, __ATOMIC_ACQUIRE);
+            return ret;
+
+        case XZTL_MISC_ASYNCH_WAIT:
+            ret = faultmedia.inner.cmd_exec(cmd);
+            if (ret)
+                return ret;
+            while ((due = fault_media_next_due(tctx))) {
+                fault_media_hold(due);
+                cmd->asynch.count += fault_media_release(tctx);
+            }
+            return XZTL_OK;
+
+        /* Sleep until the first held command is due if it is within the
+         * limit */
+        case XZTL_MISC_ASYNCH_BLOCK:
+            due = fault_media_next_due(tctx);
+            GET_MICROSECONDS(now, ts);
+            if (due && due <= now + cmd->asynch.limit) {
+                fault_media_hold(due);
+                return XZTL_OK;
+            }
+            return faultmedia.inner.cmd_exec(cmd);
+
+        default:
+            return faultmedia.inner.cmd_exec(cmd);
+    }
+}
+
+static int fault_media_exit(void) {
+    fault_media_print_stats();
+    fault_media_unwrap();
+
+    return faultmedia.inner.exit_fn();
+}
+
+/* Parse "a" or "a/b" */
+static int fault_media_parse_pair(const char *val, uint32_t *a, uint32_t *b,
+                                  int need_b) {
+    char *end;
+
+    *a = strtoul(val, &end, 10);
+    if (end == val)
+        return FAULT_MEDIA_SPEC_ERR;
+
+    if (*end == '/') {
+        val = end + 1;
+        *b  = strtoul(val, &end, 10);
+        if (end == val)
+            return FAULT_MEDIA_SPEC_ERR;
+    } else if (need_b) {
+        return FAULT_MEDIA_SPEC_ERR;
+    }
+
+    return (*end == '\0') ? XZTL_OK : FAULT_MEDIA_SPEC_ERR;
+}
+
+static int fault_media_parse_rule(char *str, struct fault_media_rule *rule) {
+    uint32_t unused;
+    char *   val;
+
+    val = strchr(str, '=');
+    if (!val)
+        return FAULT_MEDIA_SPEC_ERR;
+    *val++ = '\0';
+
+    if (!strcmp(str, "fixed")) {
+        rule->dist = FAULT_MEDIA_LAT_FIXED;
+        return fault_media_parse_pair(val, &rule->lat_us, &unused, 0);
+    } else if (!strcmp(str, "uniform")) {
+        rule->dist = FAULT_MEDIA_LAT_UNIFORM;
+        return fault_media_parse_pair(val, &rule->lat_us, &rule->lat_max, 1);
+    } else if (!strcmp(str, "exp")) {
+        rule->dist = FAULT_MEDIA_LAT_EXP;
+        return fault_media_parse_pair(val, &rule->lat_us, &rule->lat_max, 0);
+    } else if (!strcmp(str, "stall")) {
+        return fault_media_parse_pair(val, &rule->stall_ppm, &rule->stall_us,
+                                      1);
+    } else if (!strcmp(str, "err")) {
+        return fault_media_parse_pair(val, &rule->err_ppm, &unused, 0);
+    } else if (!strcmp(str, "tmo")) {
+        return fault_media_parse_pair(val, &rule->tmo_ppm, &rule->tmo_us, 1);
+    }
+
+    return FAULT_MEDIA_SPEC_ERR;
+}
+
+int fault_media_parse(const char *spec, struct fault_media_rule *rules) {
+    char     buf[FAULT_MEDIA_SPECLEN];
+    char *   op_s, *rule_s, *rules_s, *save_op, *save_rule;
+    uint32_t op_i;
+    int      ret;
+
+    memset(rules, 0x0, sizeof(struct fault_media_rule) * FAULT_MEDIA_NOPS);
+
+    if (strlen(spec) >= FAULT_MEDIA_SPECLEN)
+        return FAULT_MEDIA_SPEC_ERR;
+    snprintf(buf, FAULT_MEDIA_SPECLEN, "%s", spec);
+
+    for (op_s = strtok_r(buf, ";", &save_op); op_s;
+         op_s = strtok_r(NULL, ";", &save_op)) {
+        rules_s = strchr(op_s, ':');
+        if (!rules_s)
+            return FAULT_MEDIA_SPEC_ERR;
+        *rules_s++ = '\0';
+
+        for (op_i = 0; op_i < FAULT_MEDIA_NOPS; op_i++)
+            if (!strcmp(op_s, fault_media_names[op_i]))
+                break;
+        if (op_i == FAULT_MEDIA_NOPS) {
+            log_erra("fault-media: Unknown opcode %s", op_s);
+            return FAULT_MEDIA_SPEC_ERR;
+        }
+
+        for (rule_s = strtok_r(rules_s, ",", &save_rule); rule_s;
+             rule_s = strtok_r(NULL, ",", &save_rule)) {
+            ret = fault_media_parse_rule(rule_s, &rules[op_i]);
+            if (ret) {
+                log_erra("fault-media: Invalid rule %s of %s", rule_s,
+                         op_s);
+                return ret;
+            }
+        }
+    }
+
+    return XZTL_OK;
+}
+
+void fault_media_get_stats(uint8_t op, struct fault_media_stats *stats) {
+    if (op >= FAULT_MEDIA_NOPS || !faultmedia.active) {
+        memset(stats, 0x0, sizeof(struct fault_media_stats));
+        return;
+    }
+
+    pthread_spin_lock(&faultmedia.spin);
+    memcpy(stats, &faultmedia.stats[op], sizeof(struct fault_media_stats));
+    pthread_spin_unlock(&faultmedia.spin);
+}
+
+void fault_media_print_stats(void) {
+    struct fault_media_stats st;
+    uint32_t                 op_i;
+
+    if (!faultmedia.active)
+        return;
+
+    printf("\n Fault injection\n");
+    for (op_i = 0; op_i < FAULT_MEDIA_NOPS; op_i++) {
+        fault_media_get_stats(op_i, &st);
+        if (!st.ncmd)
+            continue;
+        printf("   %-6s : %lu cmds, %lu stalls, %lu errors, %lu timeouts, "
+               "%lu us injected\n",
+               fault_media_names[op_i], st.ncmd, st.nstall, st.nerr, st.ntmo,
+               st.lat_us);
+    }
+}
+
+void fault_media_unwrap(void) {
+    struct xztl_core *core;
+
+    if (!faultmedia.active)
+        return;
+
+    get_xztl_core(&core);
+    if (core->media) {
+        core->media->submit_io       = faultmedia.inner.submit_io;
+        core->media->submit_io_batch = faultmedia.inner.submit_io_batch;
+        core->media->zone_fn         = faultmedia.inner.zone_fn;
+        core->media->cmd_exec        = faultmedia.inner.cmd_exec;
+        core->media->exit_fn         = faultmedia.inner.exit_fn;
+        memcpy(core->media->engine, faultmedia.inner.engine,
+               XZTL_MEDIA_ENGINE_LEN);
+    }
+
+    faultmedia.active = 0;
+    pthread_spin_destroy(&faultmedia.spin);
+    log_info("fault-media: Media unwrapped.");
+}
+
+int fault_media_wrap(const char *spec, uint64_t seed) {
+    struct xztl_core *core;
+    int               ret;
+
+    if (faultmedia.active)
+        return FAULT_MEDIA_ACTIVE;
+
+    get_xztl_core(&core);
+    if (!core->media)
+        return FAULT_MEDIA_NOMEDIA;
+
+    memset(&faultmedia, 0x0, sizeof(struct fault_media));
+
+    ret = fault_media_parse(spec, faultmedia.rules);
+    if (ret)
+        return ret;
+
+    if (pthread_spin_init(&faultmedia.spin, 0))
+        return XZTL_MEM;
+
+    /* xorshift needs a non-zero state */
+    faultmedia.rand = (seed) ? seed : FAULT_MEDIA_SEED;
+
+    memcpy(&faultmedia.inner, core->media, sizeof(struct xztl_media));
+
+    /* Batches are split so every command goes through the wrapper */
+    core->media->submit_io       = fault_media_submit_io;
+    core->media->submit_io_batch = NULL;
+    core->media->zone_fn         = fault_media_zone_fn;
+    core->media->cmd_exec        = fault_media_cmd_exec;
+    core->media->exit_fn         = fault_media_exit;
+    snprintf(core->media->engine, XZTL_MEDIA_ENGINE_LEN, "%.*s+fault",
+             XZTL_MEDIA_ENGINE_LEN - 8, faultmedia.inner.engine);
+
+    faultmedia.active = 1;
+    log_infoa("fault-media: Media wrapped. Spec '%s', seed %lu", spec,
+              faultmedia.rand);
+
+    return XZTL_OK;
+}
@@ -25,15 +25,26 @@
 #include <pthread.h>
 #include <sched.h>
 #include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sys/queue.h>
+#include <sys/stat.h>
 #include <time.h>
 #include <unistd.h>
+#include <xztl-config.h>
 #include <xztl-media.h>
 #include <xztl.h>
 #include <ztl-media.h>
 
 #define XZTL_MAX_CALLBACK_THREAD 10
 
+/* Asynchronous backends in fallback order */
+static const char *znd_media_async_list[] = {"io_uring_cmd", "io_uring",
+                                             "libaio", "thrpool"};
+#define ZND_MEDIA_ASYNC_COUNT \
+    (sizeof(znd_media_async_list) / sizeof(znd_media_async_list[0]))
+
 struct znd_media zndmedia;
 static uint16_t  callback_thread_num;
 
@@ -43,6 +54,92 @@ inline struct znd_media *get_znd_media(void) {
 
 extern char *dev_name;
 
+/* Device of a media sector, 'lba' returns the sector in the device. Zones
+ * are interleaved across the devices (see ZND_MEDIA_DEV_SEP) */
+static inline struct znd_media_dev *znd_media_dev_lba(uint64_t sect,
+                                                       uint64_t *lba) {
+    uint64_t nsect, zone;
+
+    if (zndmedia.ndevs == 1) {
+        *lba = sect;
+        return &zndmedia.devs[0];
+    }
+
+    nsect = zndmedia.devgeo->nsect;
+    zone  = sect / nsect;
+    *lba  = (zone / zndmedia.ndevs) * nsect + sect % nsect;
+
+    return &zndmedia.devs[zone % zndmedia.ndevs];
+}
+
+/* Device of a command covering 'nsec' sectors from 'sect'. Commands may not
+ * cross a zone boundary when zones are spread over several devices */
+static inline struct znd_media_dev *
+znd_media_dev_io(uint64_t sect, uint64_t nsec, uint64_t *lba) {
+    uint64_t nsect = zndmedia.devgeo->nsect;
+
+    if (zndmedia.ndevs > 1 && (sect % nsect) + nsec > nsect)
+        return NULL;
+
+    return znd_media_dev_lba(sect, lba);
+}
+
+/* First sector of a zone address */
+static inline uint64_t znd_media_zone_sect(struct xztl_maddr *addr) {
+    return ((uint64_t)zndmedia.media.geo.zn_grp * addr->g.grp +
+            addr->g.zone) *
+           zndmedia.devgeo->nsect;
+}
+
+static inline uint64_t znd_media_cmd_nsec(struct xztl_io_mcmd *cmd) {
+    uint64_t nsec = 0;
+    uint32_t sec_i;
+
+    for (sec_i = 0; sec_i < cmd->naddr; sec_i++)
+        nsec += cmd->nsec[sec_i];
+
+    return nsec;
+}
+
+/* Get a command context from the thread queue of a device. Returns NULL if
+ * all entries of the queue are in use, the caller must poke the queue and
+ * retry. */
+static inline struct xnvme_cmd_ctx *
+znd_media_get_ctx(struct xztl_mthread_ctx *tctx, struct znd_media_dev *mdev) {
+    struct xnvme_queue *queue = tctx->queues[mdev - zndmedia.devs];
+
+    if (xnvme_queue_get_outstanding(queue) >=
+        xnvme_queue_get_capacity(queue))
+        return NULL;
+
+    return xnvme_queue_get_cmd_ctx(queue);
+}
+
+/* Submit a vectored command. The command covers contiguous sectors starting
+ * at 'slba' and cmd->naddr host buffers. A single NVMe command is issued,
+ * the data pointer (PRP list or SGL) is built from the iovec list. */
+static int znd_media_submit_vec(struct xztl_io_mcmd *cmd,
+                                struct xnvme_cmd_ctx *ctx, uint8_t opcode,
+                                struct znd_media_dev *mdev, uint64_t slba) {
+    uint32_t sec_i;
+    uint64_t nsec = 0;
+
+    for (sec_i = 0; sec_i < cmd->naddr; sec_i++) {
+        cmd->iov[sec_i].iov_base = (void *)cmd->prp[sec_i];  // NOLINT
+        cmd->iov[sec_i].iov_len  = cmd->nsec[sec_i] * zndmedia.devgeo->nbytes;
+        nsec += cmd->nsec[sec_i];
+    }
+
+    /* Zone append uses the same layout for ZSLBA and NLB */
+    ctx->cmd.common.opcode = opcode;
+    ctx->cmd.common.nsid   = mdev->nsid;
+    ctx->cmd.nvm.slba      = slba;
+    ctx->cmd.nvm.nlb       = (uint16_t)nsec - 1;
+
+    return xnvme_cmd_passv(ctx, cmd->iov, cmd->naddr,
+                           nsec * zndmedia.devgeo->nbytes, NULL, 0, 0);
+}
+
 static void znd_media_async_cb(struct xnvme_cmd_ctx *ctx, void *cb_arg) {
     struct xztl_io_mcmd *cmd;
     uint16_t             sec_i = 0;
@@ -50,12 +147,21 @@ static void znd_media_async_cb(struct xnvme_cmd_ctx *ctx, void *cb_arg) {
     cmd         = (struct xztl_io_mcmd *)cb_arg;
     cmd->status = xnvme_cmd_ctx_cpl_status(ctx);
 
+    /* The device returns its own sector, the zone start is kept in paddr */
     if (!cmd->status && cmd->opcode == XZTL_ZONE_APPEND)
-        cmd->paddr[sec_i] = *(uint64_t *)&ctx->cpl.cdw0;  // NOLINT
+        cmd->paddr[sec_i] += *(uint64_t *)&ctx->cpl.cdw0 %  // NOLINT
+                             zndmedia.devgeo->nsect;
 
     if (cmd->opcode == XZTL_CMD_WRITE)
         cmd->paddr[sec_i] = cmd->addr[sec_i].g.sect;
 
+    /* The source ranges are no longer needed by the device */
+    if (cmd->opcode == XZTL_CMD_COPY) {
+        cmd->paddr[sec_i] = cmd->copy_dst.g.sect;
+        xnvme_buf_free(ctx->dev, cmd->media_buf);
+        cmd->media_buf = NULL;
+    }
+
     if (cmd->status) {
         xztl_print_mcmd(cmd);
         xnvme_cmd_ctx_pr(ctx, XNVME_PR_DEF);
@@ -63,25 +169,34 @@ static void znd_media_async_cb(struct xnvme_cmd_ctx *ctx, void *cb_arg) {
 
     cmd->callback(cmd);
 
-    struct xztl_mthread_ctx *tctx = cmd->async_ctx;
-    xnvme_queue_put_cmd_ctx(tctx->queue, cmd->media_ctx);
+    /* The context returns to the queue of its device */
+    xnvme_queue_put_cmd_ctx(ctx->async.queue, ctx);
 }
 
 static int znd_media_submit_read_synch(struct xztl_io_mcmd *cmd) {
-    uint64_t             slba;
-    uint16_t             sec_i = 0;
-    struct timespec      ts_s, ts_e;
-    struct xnvme_cmd_ctx ctx = xnvme_cmd_ctx_from_dev(zndmedia.dev);
+    struct znd_media_dev *mdev;
+    uint64_t              slba;
+    uint16_t              sec_i = 0;
+    struct timespec       ts_s, ts_e;
+    struct xnvme_cmd_ctx  ctx;
 
     /* The read path is not group based. It uses only sectors */
-    slba = cmd->addr[sec_i].g.sect;
+    mdev = znd_media_dev_io(cmd->addr[sec_i].g.sect, znd_media_cmd_nsec(cmd),
+                            &slba);
+    if (!mdev)
+        return ZND_MEDIA_DEV_BOUND;
+
+    ctx = xnvme_cmd_ctx_from_dev(mdev->dev);
 
     int ret;
 
     GET_MICROSECONDS(cmd->us_start, ts_s);
-    ret = xnvme_nvm_read(&ctx, xnvme_dev_get_nsid(zndmedia.dev), slba,
-                         (uint16_t)cmd->nsec[sec_i] - 1,
-                         (void *)cmd->prp[sec_i], NULL); // NOLINT
+    ret = (cmd->naddr > 1)
+              ? znd_media_submit_vec(cmd, &ctx, XNVME_SPEC_NVM_OPC_READ, mdev,
+                                     slba)
+              : xnvme_nvm_read(&ctx, mdev->nsid, slba,
+                               (uint16_t)cmd->nsec[sec_i] - 1,
+                               (void *)cmd->prp[sec_i], NULL);  // NOLINT
     GET_MICROSECONDS(cmd->us_end, ts_e);
 
     /* WARNING: Uncommenting this line causes performance drop */
@@ -97,62 +212,108 @@ static int znd_media_submit_read_asynch(struct xztl_io_mcmd *cmd) {
     uint16_t                 sec_i = 0;
     uint64_t                 slba;
     void *                   dbuf;
+    struct znd_media_dev *   mdev;
     struct xztl_mthread_ctx *tctx;
     struct xnvme_cmd_ctx *   xnvme_ctx;
     int                      ret;
 
+    /* The read path is not group based. It uses only sectors */
+    mdev = znd_media_dev_io(cmd->addr[sec_i].g.sect, znd_media_cmd_nsec(cmd),
+                            &slba);
+    if (!mdev)
+        return ZND_MEDIA_DEV_BOUND;
+
     tctx      = cmd->async_ctx;
-    xnvme_ctx = xnvme_queue_get_cmd_ctx(tctx->queue);
+    xnvme_ctx = znd_media_get_ctx(tctx, mdev);
+    if (!xnvme_ctx)
+        return XZTL_MEDIA_QFULL;
 
     dbuf = (void *)cmd->prp[sec_i];  // NOLINT
 
-    /* The write path is not group based. It uses only sectors */
-    slba = cmd->addr[sec_i].g.sect;
-
     xnvme_ctx->async.cb     = znd_media_async_cb;
     xnvme_ctx->async.cb_arg = (void *)cmd; // NOLINT
-    xnvme_ctx->dev          = zndmedia.dev;
+    xnvme_ctx->dev          = mdev->dev;
 
     cmd->media_ctx = xnvme_ctx;
 
-    ret = xnvme_nvm_read(xnvme_ctx, xnvme_dev_get_nsid(zndmedia.dev), slba,
-                         (uint16_t)cmd->nsec[sec_i] - 1, dbuf, NULL);
-    if (ret)
+    ret = (cmd->naddr > 1)
+              ? znd_media_submit_vec(cmd, xnvme_ctx, XNVME_SPEC_NVM_OPC_READ,
+                                     mdev, slba)
+              : xnvme_nvm_read(xnvme_ctx, mdev->nsid, slba,
+                               (uint16_t)cmd->nsec[sec_i] - 1, dbuf, NULL);
+    if (ret) {
+        xnvme_queue_put_cmd_ctx(xnvme_ctx->async.queue, xnvme_ctx);
         xztl_print_mcmd(cmd);
+    }
 
     return ret;
 }
 
 static int znd_media_submit_write_synch(struct xztl_io_mcmd *cmd) {
-    return ZND_INVALID_OPCODE;
+    struct znd_media_dev *mdev;
+    uint64_t              slba;
+    uint16_t              sec_i = 0;
+    struct xnvme_cmd_ctx  ctx;
+    int                   ret;
+
+    mdev = znd_media_dev_io(cmd->addr[sec_i].g.sect, znd_media_cmd_nsec(cmd),
+                            &slba);
+    if (!mdev)
+        return ZND_MEDIA_DEV_BOUND;
+
+    ctx = xnvme_cmd_ctx_from_dev(mdev->dev);
+
+    ret = (cmd->naddr > 1)
+              ? znd_media_submit_vec(cmd, &ctx, XNVME_SPEC_NVM_OPC_WRITE, mdev,
+                                     slba)
+              : xnvme_nvm_write(&ctx, mdev->nsid, slba,
+                                (uint16_t)cmd->nsec[sec_i] - 1,
+                                (void *)cmd->prp[sec_i], NULL);  // NOLINT
+
+    cmd->status = (ret) ? xnvme_cmd_ctx_cpl_status(&ctx) : XZTL_OK;
+    cmd->paddr[sec_i] = cmd->addr[sec_i].g.sect;
+
+    if (ret)
+        xztl_print_mcmd(cmd);
+
+    return ret;
 }
 
 static int znd_media_submit_write_asynch(struct xztl_io_mcmd *cmd) {
     uint16_t                 sec_i = 0;
     uint64_t                 slba;
     void *                   dbuf;
+    struct znd_media_dev *   mdev;
     struct xztl_mthread_ctx *tctx;
     struct xnvme_cmd_ctx *   xnvme_ctx;
     int                      ret;
 
+    /* The write path is not group based. It uses only sectors */
+    mdev = znd_media_dev_io(cmd->addr[sec_i].g.sect, znd_media_cmd_nsec(cmd),
+                            &slba);
+    if (!mdev)
+        return ZND_MEDIA_DEV_BOUND;
+
     tctx      = cmd->async_ctx;
-    xnvme_ctx = xnvme_queue_get_cmd_ctx(tctx->queue);
+    xnvme_ctx = znd_media_get_ctx(tctx, mdev);
+    if (!xnvme_ctx)
+        return XZTL_MEDIA_QFULL;
 
     dbuf = (void *)cmd->prp[sec_i];  // NOLINT
 
-    /* The write path is not group based. It uses only sectors */
-    slba = cmd->addr[sec_i].g.sect;
-
     xnvme_ctx->async.cb     = znd_media_async_cb;
     xnvme_ctx->async.cb_arg = (void *)cmd; // NOLINT
-    xnvme_ctx->dev          = zndmedia.dev;
+    xnvme_ctx->dev          = mdev->dev;
     cmd->media_ctx          = xnvme_ctx;
 
-    ret = xnvme_nvm_write(xnvme_ctx, xnvme_dev_get_nsid(zndmedia.dev), slba,
-                          (uint16_t)cmd->nsec[sec_i] - 1, dbuf, NULL);
+    ret = (cmd->naddr > 1)
+              ? znd_media_submit_vec(cmd, xnvme_ctx, XNVME_SPEC_NVM_OPC_WRITE,
+                                     mdev, slba)
+              : xnvme_nvm_write(xnvme_ctx, mdev->nsid, slba,
+                                (uint16_t)cmd->nsec[sec_i] - 1, dbuf, NULL);
 
     if (ret) {
-        xnvme_queue_put_cmd_ctx(tctx->queue, xnvme_ctx);
+        xnvme_queue_put_cmd_ctx(xnvme_ctx->async.queue, xnvme_ctx);
         xztl_print_mcmd(cmd);
     }
 
@@ -167,35 +328,128 @@ static int znd_media_submit_append_asynch(struct xztl_io_mcmd *cmd) {
     uint16_t                 zone_i = 0;
     uint64_t                 zlba;
     const void *             dbuf;
+    struct znd_media_dev *   mdev;
     struct xztl_mthread_ctx *tctx;
     struct xnvme_cmd_ctx *   xnvme_ctx;
     int                      ret;
 
+    /* The write path separates zones into groups */
+    cmd->paddr[zone_i] = znd_media_zone_sect(&cmd->addr[zone_i]);
+    mdev               = znd_media_dev_lba(cmd->paddr[zone_i], &zlba);
+
     tctx      = cmd->async_ctx;
-    xnvme_ctx = xnvme_queue_get_cmd_ctx(tctx->queue);
+    xnvme_ctx = znd_media_get_ctx(tctx, mdev);
+    if (!xnvme_ctx)
+        return XZTL_MEDIA_QFULL;
 
     dbuf = (const void *)cmd->prp[zone_i];
 
-    /* The write path separates zones into groups */
-    zlba = (zndmedia.media.geo.zn_grp * cmd->addr[zone_i].g.grp +
-            cmd->addr[zone_i].g.zone) *
-           zndmedia.devgeo->nsect;
-
     xnvme_ctx->async.cb     = znd_media_async_cb;
     xnvme_ctx->async.cb_arg = (void *)cmd;  // NOLINT
+    xnvme_ctx->dev          = mdev->dev;
     cmd->media_ctx          = xnvme_ctx;
 
-    ret = (!XZTL_WRITE_APPEND)
-              ? xnvme_znd_append(xnvme_ctx, xnvme_dev_get_nsid(zndmedia.dev),
-                                 zlba, (uint16_t)cmd->nsec[zone_i] - 1, dbuf,
-                                 NULL)
-              : -1;
+    /* The written LBA is returned in the completion (see
+     * znd_media_async_cb), appends to the same zone may complete in any
+     * order */
+    ret = (cmd->naddr > 1)
+              ? znd_media_submit_vec(cmd, xnvme_ctx, XNVME_SPEC_ZND_OPC_APPEND,
+                                     mdev, zlba)
+              : xnvme_znd_append(xnvme_ctx, mdev->nsid, zlba,
+                                 (uint16_t)cmd->nsec[zone_i] - 1, dbuf, NULL);
+    if (ret) {
+        xnvme_queue_put_cmd_ctx(xnvme_ctx->async.queue, xnvme_ctx);
+        xztl_print_mcmd(cmd);
+    }
+
+    return ret;
+}
+
+/* Build the source range list (format 0) of a copy command in a DMA buffer.
+ * The buffer is kept in cmd->media_buf until the command completes. Copies
+ * are only offered by media of a single device (see znd_media_register) */
+static struct xnvme_spec_nvm_scopy_source_range *
+znd_media_copy_ranges(struct xztl_io_mcmd *cmd) {
+    struct xnvme_spec_nvm_scopy_source_range *ranges;
+    uint32_t                                  rng_i;
+
+    if (!cmd->naddr || cmd->naddr > zndmedia.media.geo.copy_nrange)
+        return NULL;
+
+    ranges = xnvme_buf_alloc(zndmedia.dev, sizeof(*ranges));
+    if (!ranges)
+        return NULL;
+
+    memset(ranges, 0x0, sizeof(*ranges));
+    for (rng_i = 0; rng_i < cmd->naddr; rng_i++) {
+        ranges->entry[rng_i].slba = cmd->addr[rng_i].g.sect;
+        ranges->entry[rng_i].nlb  = (uint16_t)cmd->nsec[rng_i] - 1;
+    }
+
+    cmd->media_buf = ranges;
+
+    return ranges;
+}
+
+static int znd_media_submit_copy_synch(struct xztl_io_mcmd *cmd) {
+    struct xnvme_spec_nvm_scopy_source_range *ranges;
+    struct xnvme_cmd_ctx ctx = xnvme_cmd_ctx_from_dev(zndmedia.dev);
+    int                  ret;
+
+    ranges = znd_media_copy_ranges(cmd);
+    if (!ranges)
+        return ZND_MEDIA_COPY_ERR;
+
+    ret = xnvme_nvm_scopy(&ctx, zndmedia.devs[0].nsid, cmd->copy_dst.g.sect,
+                          ranges, cmd->naddr - 1, XNVME_NVM_SCOPY_FMT_ZERO);
+
+    cmd->status   = (ret) ? xnvme_cmd_ctx_cpl_status(&ctx) : XZTL_OK;
+    cmd->paddr[0] = cmd->copy_dst.g.sect;
+
+    xnvme_buf_free(zndmedia.dev, ranges);
+    cmd->media_buf = NULL;
+
     if (ret)
         xztl_print_mcmd(cmd);
 
     return ret;
 }
 
+static int znd_media_submit_copy_asynch(struct xztl_io_mcmd *cmd) {
+    struct xnvme_spec_nvm_scopy_source_range *ranges;
+    struct xztl_mthread_ctx *                 tctx;
+    struct xnvme_cmd_ctx *                    xnvme_ctx;
+    int                                       ret;
+
+    tctx      = cmd->async_ctx;
+    xnvme_ctx = znd_media_get_ctx(tctx, &zndmedia.devs[0]);
+    if (!xnvme_ctx)
+        return XZTL_MEDIA_QFULL;
+
+    ranges = znd_media_copy_ranges(cmd);
+    if (!ranges) {
+        xnvme_queue_put_cmd_ctx(xnvme_ctx->async.queue, xnvme_ctx);
+        return ZND_MEDIA_COPY_ERR;
+    }
+
+    xnvme_ctx->async.cb     = znd_media_async_cb;
+    xnvme_ctx->async.cb_arg = (void *)cmd;  // NOLINT
+    xnvme_ctx->dev          = zndmedia.dev;
+    cmd->media_ctx          = xnvme_ctx;
+
+    ret = xnvme_nvm_scopy(xnvme_ctx, zndmedia.devs[0].nsid,
+                          cmd->copy_dst.g.sect, ranges, cmd->naddr - 1,
+                          XNVME_NVM_SCOPY_FMT_ZERO);
+    if (ret) {
+        xnvme_queue_put_cmd_ctx(xnvme_ctx->async.queue, xnvme_ctx);
+        xnvme_buf_free(zndmedia.dev, ranges);
+        cmd->media_buf = NULL;
+        xztl_print_mcmd(cmd);
+    }
+
+    return ret;
+}
+
 static int znd_media_submit_io(struct xztl_io_mcmd *cmd) {
     switch (cmd->opcode) {
         case XZTL_ZONE_APPEND:
@@ -207,44 +461,182 @@ static int znd_media_submit_io(struct xztl_io_mcmd *cmd) {
         case XZTL_CMD_WRITE:
             return (cmd->synch) ? znd_media_submit_write_synch(cmd)
                                 : znd_media_submit_write_asynch(cmd);
+        case XZTL_CMD_COPY:
+            return (cmd->synch) ? znd_media_submit_copy_synch(cmd)
+                                : znd_media_submit_copy_asynch(cmd);
         default:
             return ZND_INVALID_OPCODE;
     }
     return 0;
 }
 
-static inline int znd_media_zone_manage(struct xztl_zn_mcmd *cmd, uint8_t op) {
-    uint32_t             lba;
-    struct xnvme_cmd_ctx xnvme_ctx = xnvme_cmd_ctx_from_dev(zndmedia.dev);
-    int                  ret;
-    bool                 select_all = false;
+static void znd_media_zn_async_cb(struct xnvme_cmd_ctx *ctx, void *cb_arg) {
+    struct xztl_zn_mcmd *cmd;
 
-    lba = ((zndmedia.devgeo->nzone * cmd->addr.g.grp) + cmd->addr.g.zone) *
-          zndmedia.devgeo->nsect;
+    cmd         = (struct xztl_zn_mcmd *)cb_arg;
+    cmd->status = xnvme_cmd_ctx_cpl_status(ctx);
+
+    if (cmd->status)
+        xnvme_cmd_ctx_pr(ctx, XNVME_PR_DEF);
+
+    cmd->callback(cmd);
+
+    xnvme_queue_put_cmd_ctx(ctx->async.queue, ctx);
+}
+
+/* Apply a management command to all zones of all devices (synchronous) */
+static int znd_media_zone_manage_all(struct xztl_zn_mcmd *cmd, uint8_t op) {
+    struct xnvme_cmd_ctx ctx;
+    uint16_t             dev_i;
+    int                  ret = XZTL_OK;
+
+    cmd->status = XZTL_OK;
+    for (dev_i = 0; dev_i < zndmedia.ndevs && !ret; dev_i++) {
+        ctx = xnvme_cmd_ctx_from_dev(zndmedia.devs[dev_i].dev);
+        ret = xnvme_znd_mgmt_send(&ctx, zndmedia.devs[dev_i].nsid, 0, true, op,
+                                  0x0, NULL);
+        if (ret)
+            cmd->status = xnvme_cmd_ctx_cpl_status(&ctx);
+    }
+
+    return ret;
+}
+
+static inline int znd_media_zone_manage(struct xztl_zn_mcmd *cmd, uint8_t op) {
+    uint64_t              lba;
+    struct znd_media_dev *mdev;
+    struct xnvme_cmd_ctx  sctx;
+    struct xnvme_cmd_ctx *xnvme_ctx = &sctx;
+    int                   ret;
 
     /* If this bit is set to '1', then the SLBA field shall be ignored.  */
     if (cmd->nzones > 1) {
-        select_all = true;
+        if (!cmd->synch)
+            return ZND_INVALID_OPCODE;
+        return znd_media_zone_manage_all(cmd, op);
+    }
+
+    mdev = znd_media_dev_lba(znd_media_zone_sect(&cmd->addr), &lba);
+
+    if (cmd->synch) {
+        sctx                    = xnvme_cmd_ctx_from_dev(mdev->dev);
+        xnvme_ctx->async.queue  = NULL;
+        xnvme_ctx->async.cb_arg = NULL;
+    } else {
+        xnvme_ctx = znd_media_get_ctx(cmd->async_ctx, mdev);
+        if (!xnvme_ctx)
+            return XZTL_MEDIA_QFULL;
+
+        xnvme_ctx->async.cb     = znd_media_zn_async_cb;
+        xnvme_ctx->async.cb_arg = (void *)cmd;  // NOLINT
+        xnvme_ctx->dev          = mdev->dev;
+        cmd->media_ctx          = xnvme_ctx;
     }
-    xnvme_ctx.async.queue  = NULL;
-    xnvme_ctx.async.cb_arg = NULL;
-    ret = xnvme_znd_mgmt_send(&xnvme_ctx, xnvme_dev_get_nsid(zndmedia.dev), lba,
-                              select_all, op, 0x0, NULL);
-    cmd->status = (ret) ? xnvme_cmd_ctx_cpl_status(&xnvme_ctx) : XZTL_OK;
+
+    ret = xnvme_znd_mgmt_send(xnvme_ctx, mdev->nsid, lba, false, op, 0x0,
+                              NULL);
+
+    if (!cmd->synch) {
+        if (ret)
+            xnvme_queue_put_cmd_ctx(xnvme_ctx->async.queue, xnvme_ctx);
+        return ret;
+    }
+
+    cmd->status = (ret) ? xnvme_cmd_ctx_cpl_status(xnvme_ctx) : XZTL_OK;
     // return (ret) ? op : XZTL_OK;
     return ret;
 }
 
+/* Report of zones interleaved across several devices. The zones of each
+ * device are reported in a single command, the descriptors are merged in
+ * media zone order and the zone addresses are converted to media sectors */
+static int znd_media_zone_report_devs(struct xztl_zn_mcmd *cmd,
+                                      uint64_t zone, uint64_t nzones) {
+    struct xnvme_znd_report *    rep, *drep[XZTL_MEDIA_MAX_DEV];
+    struct xnvme_spec_znd_descr *zinfo, *dinfo;
+    uint64_t                     first[XZTL_MEDIA_MAX_DEV];
+    uint64_t                     nbytes, nsect, zone_i, cnt;
+    uint16_t                     ndevs = zndmedia.ndevs, dev_i;
+    int                          ret   = ZND_MEDIA_REPORT_ERR;
+
+    nsect = zndmedia.devgeo->nsect;
+    memset(drep, 0x0, sizeof(drep));
+
+    /* First media zone of the range in each device */
+    for (dev_i = 0; dev_i < ndevs; dev_i++) {
+        first[dev_i] = zone + (dev_i + ndevs - zone % ndevs) % ndevs;
+        if (first[dev_i] >= zone + nzones)
+            continue;
+
+        cnt         = (zone + nzones - 1 - first[dev_i]) / ndevs + 1;
+        drep[dev_i] = xnvme_znd_report_from_dev(
+            zndmedia.devs[dev_i].dev, (first[dev_i] / ndevs) * nsect, cnt, 0);
+        if (!drep[dev_i] || drep[dev_i]->nentries < cnt)
+            goto FREE;
+    }
+
+    nbytes = sizeof(struct xnvme_znd_report) +
+             nzones * sizeof(struct xnvme_spec_znd_descr);
+
+    rep = xnvme_buf_virt_alloc(sizeof(void *), nbytes);
+    if (!rep)
+        goto FREE;
+
+    memset(rep, 0x0, nbytes);
+    rep->report_nbytes  = nbytes;
+    rep->entries_nbytes = nbytes - sizeof(struct xnvme_znd_report);
+    rep->zd_nbytes      = sizeof(struct xnvme_spec_znd_descr);
+    rep->zrent_nbytes   = sizeof(struct xnvme_spec_znd_descr);
+    rep->zslba          = zone * nsect;
+    rep->zelba          = (zone + nzones - 1) * nsect;
+    rep->nzones         = zndmedia.media.geo.zn_dev;
+    rep->nentries       = nzones;
+
+    for (zone_i = zone; zone_i < zone + nzones; zone_i++) {
+        dev_i = zone_i % ndevs;
+        dinfo = XNVME_ZND_REPORT_DESCR(drep[dev_i],
+                                       (zone_i - first[dev_i]) / ndevs);
+        zinfo = XNVME_ZND_REPORT_DESCR(rep, zone_i - zone);
+
+        memcpy(zinfo, dinfo, sizeof(struct xnvme_spec_znd_descr));
+        zinfo->zslba = zone_i * nsect;
+        zinfo->wp    = zinfo->zslba + (dinfo->wp - dinfo->zslba);
+    }
+
+    cmd->opaque = (void *)rep;  // NOLINT
+    ret         = XZTL_OK;
+
+FREE:
+    for (dev_i = 0; dev_i < ndevs; dev_i++) {
+        if (drep[dev_i])
+            xnvme_buf_virt_free(drep[dev_i]);
+    }
+
+    return ret;
+}
+
+/* Report 'nzones' zones starting at the command address. Descriptor 0 of the
+ * report is the first zone of the range. nzones 0 reports up to the end of
+ * the device. */
 static int znd_media_zone_report(struct xztl_zn_mcmd *cmd) {
     struct xnvme_znd_report *rep;
-    size_t                   limit;
-    uint32_t                 lba;
-
-    // Reading everything until not necessary anymore
-    lba = 0;  // ((zndmedia.devgeo->nzone * cmd->addr.g.grp) + cmd->addr.g.zone)
-              // * zndmedia.devgeo->nsect;
-    limit = 0;  // cmd->nzones;
-    rep   = xnvme_znd_report_from_dev(zndmedia.dev, lba, limit, 0);
+    uint64_t                 zone, nzones;
+
+    zone = znd_media_zone_sect(&cmd->addr) / zndmedia.devgeo->nsect;
+    if (zone >= zndmedia.media.geo.zn_dev)
+        return ZND_MEDIA_REPORT_ERR;
+
+    if (zndmedia.ndevs > 1) {
+        nzones = zndmedia.media.geo.zn_dev - zone;
+        if (cmd->nzones && cmd->nzones < nzones)
+            nzones = cmd->nzones;
+
+        return znd_media_zone_report_devs(cmd, zone, nzones);
+    }
+
+    rep = xnvme_znd_report_from_dev(zndmedia.dev,
+                                    zone * zndmedia.devgeo->nsect,
+                                    cmd->nzones, 0);
     if (!rep)
         return ZND_MEDIA_REPORT_ERR;
 
@@ -277,6 +669,8 @@ static int znd_media_zone_mgmt(struct xztl_zn_mcmd *cmd) {
     return XZTL_OK;
 }
 
+/* Buffers are allocated by the first device. Devices aggregated in a media
+ * share the backend, which must accept buffers of any of the devices */
 static void *znd_media_dma_alloc(size_t size) {
     return xnvme_buf_alloc(zndmedia.dev, size);
 }
@@ -285,62 +679,122 @@ static void znd_media_dma_free(void *ptr) {
     xnvme_buf_free(zndmedia.dev, ptr);
 }
 
-static int znd_media_async_poke(struct xnvme_queue *queue, uint32_t *c,
+/* The queues of all devices are processed, 'max' applies per queue */
+static int znd_media_async_poke(struct xztl_mthread_ctx *tctx, uint32_t *c,
                                 uint16_t max) {
-    int ret;
-    ret = xnvme_queue_poke(queue, max);
-    if (ret < 0)
-        return ZND_MEDIA_POKE_ERR;
+    uint16_t q_i;
+    int      ret;
 
-    *c = ret;
+    *c = 0;
+    for (q_i = 0; q_i < tctx->nqueues; q_i++) {
+        ret = xnvme_queue_poke(tctx->queues[q_i], max);
+        if (ret < 0)
+            return ZND_MEDIA_POKE_ERR;
+
+        *c += ret;
+    }
 
     return XZTL_OK;
 }
 
-static int znd_media_async_outs(struct xnvme_queue *queue, uint32_t *c) {
-    int ret;
+static int znd_media_async_outs(struct xztl_mthread_ctx *tctx, uint32_t *c) {
+    uint16_t q_i;
+    int      ret;
 
-    ret = xnvme_queue_get_outstanding(queue);
-    if (ret < 0)
-        return ZND_MEDIA_OUTS_ERR;
+    *c = 0;
+    for (q_i = 0; q_i < tctx->nqueues; q_i++) {
+        ret = xnvme_queue_get_outstanding(tctx->queues[q_i]);
+        if (ret < 0)
+            return ZND_MEDIA_OUTS_ERR;
 
-    *c = ret;
+        *c += ret;
+    }
 
     return XZTL_OK;
 }
 
-static int znd_media_async_wait(struct xnvme_queue *queue, uint32_t *c) {
-    int ret;
+static int znd_media_async_wait(struct xztl_mthread_ctx *tctx, uint32_t *c) {
+    uint16_t q_i;
+    int      ret;
 
-    ret = xnvme_queue_get_outstanding(queue);
-    if (ret)
-        return ZND_MEDIA_WAIT_ERR;
+    *c = 0;
+    for (q_i = 0; q_i < tctx->nqueues; q_i++) {
+        ret = xnvme_queue_wait(tctx->queues[q_i]);
+        if (ret < 0)
+            return ZND_MEDIA_WAIT_ERR;
 
-    *c = ret;
+        *c += ret;
+    }
 
     return XZTL_OK;
 }
 
+static int znd_media_asynch_term(struct xztl_misc_cmd *cmd) {
+    struct xztl_mthread_ctx *tctx = cmd->asynch.ctx_ptr;
+    int                      ret  = XZTL_OK;
+
+    while (tctx->nqueues) {
+        tctx->nqueues--;
+        if (xnvme_queue_term(tctx->queues[tctx->nqueues]))
+            ret = ZND_MEDIA_ASYNCH_ERR;
+        tctx->queues[tctx->nqueues] = NULL;
+    }
+    tctx->queue = NULL;
+
+    return ret;
+}
+
+/* Create a queue per device in the thread context. Polled queues
+ * (XZTL_CTX_POLL) need poll queues in the NVMe driver, without them the
+ * context gets regular queues and polling is not tried again */
 static int znd_media_asynch_init(struct xztl_misc_cmd *cmd) {
     struct xztl_mthread_ctx *tctx;
+    struct xnvme_dev *       dev;
+    uint16_t                 dev_i;
     int                      ret;
 
-    tctx = cmd->asynch.ctx_ptr;
-
-    ret = xnvme_queue_init(zndmedia.dev, cmd->asynch.depth, 0, &tctx->queue);
-    if (ret) {
-        return ZND_MEDIA_ASYNCH_ERR;
+    tctx          = cmd->asynch.ctx_ptr;
+    tctx->nqueues = 0;
+    tctx->polled  = (cmd->asynch.flags & XZTL_CTX_POLL) && zndmedia.iopoll;
+
+    for (dev_i = 0; dev_i < zndmedia.ndevs; dev_i++) {
+        dev = zndmedia.devs[dev_i].dev;
+
+        if (tctx->polled) {
+            ret = xnvme_queue_init(dev, cmd->asynch.depth,
+                                   zndmedia.qopts | XNVME_QUEUE_IOPOLL,
+                                   &tctx->queues[dev_i]);
+            if (ret && !dev_i) {
+                log_info("znd-media: Polled queues not supported. "
+                         "Disabling.");
+                zndmedia.iopoll = 0;
+                tctx->polled    = 0;
+            } else if (ret) {
+                znd_media_asynch_term(cmd);
+                return ZND_MEDIA_ASYNCH_ERR;
+            } else {
+                tctx->nqueues++;
+                continue;
+            }
+        }
+
+        ret = xnvme_queue_init(dev, cmd->asynch.depth, zndmedia.qopts,
+                               &tctx->queues[dev_i]);
+        if (ret && zndmedia.qopts) {
+            log_info("znd-media: Queue options not supported. Disabling.");
+            zndmedia.qopts = 0;
+            ret = xnvme_queue_init(dev, cmd->asynch.depth, 0,
+                                   &tctx->queues[dev_i]);
+        }
+        if (ret) {
+            znd_media_asynch_term(cmd);
+            return ZND_MEDIA_ASYNCH_ERR;
+        }
+
+        tctx->nqueues++;
     }
 
-    return XZTL_OK;
-}
-
-static int znd_media_asynch_term(struct xztl_misc_cmd *cmd) {
-    int ret;
-
-    ret = xnvme_queue_term(cmd->asynch.ctx_ptr->queue);
-    if (ret)
-        return ZND_MEDIA_ASYNCH_ERR;
+    tctx->queue = tctx->queues[0];
 
     return XZTL_OK;
 }
@@ -354,17 +808,19 @@ static int znd_media_cmd_exec(struct xztl_misc_cmd *cmd) {
             return znd_media_asynch_term(cmd);
 
         case XZTL_MISC_ASYNCH_POKE:
-            return znd_media_async_poke(cmd->asynch.ctx_ptr->queue,
+            return znd_media_async_poke(cmd->asynch.ctx_ptr,
                                         &cmd->asynch.count, cmd->asynch.limit);
 
         case XZTL_MISC_ASYNCH_OUTS:
-            return znd_media_async_outs(cmd->asynch.ctx_ptr->queue,
+            return znd_media_async_outs(cmd->asynch.ctx_ptr,
                                         &cmd->asynch.count);
 
         case XZTL_MISC_ASYNCH_WAIT:
-            return znd_media_async_wait(cmd->asynch.ctx_ptr->queue,
+            return znd_media_async_wait(cmd->asynch.ctx_ptr,
                                         &cmd->asynch.count);
 
+        /* XZTL_MISC_ASYNCH_BLOCK is not supported, xNVMe queues expose no
+         * completion notification. The core sleeps between pokes */
         default:
             return ZND_INVALID_OPCODE;
     }
@@ -374,24 +830,120 @@ static int znd_media_init(void) {
     return XZTL_OK;
 }
 
+static void znd_media_close(void) {
+    while (zndmedia.ndevs) {
+        zndmedia.ndevs--;
+        xnvme_dev_close(zndmedia.devs[zndmedia.ndevs].dev);
+        zndmedia.devs[zndmedia.ndevs].dev = NULL;
+    }
+    zndmedia.dev = NULL;
+}
+
 static int znd_media_exit(void) {
-    if (zndmedia.dev)
-        xnvme_dev_close(zndmedia.dev);
+    znd_media_close();
 
     return XZTL_OK;
 }
 
-int znd_media_register(const char *dev_name) {
+/* Check if the device node type fits the asynchronous backend.
+ * io_uring_cmd needs the NVMe generic char device (e.g. /dev/ng0n1) while
+ * io_uring and libaio need the block device (e.g. /dev/nvme0n1). */
+static int znd_media_async_check(const char *dev_name, const char *async) {
+    struct stat st;
+
+    if (!strcmp(async, "thrpool"))
+        return XZTL_OK;
+
+    if (stat(dev_name, &st))
+        return ZND_MEDIA_ASYNC_CAP;
+
+    if (!strcmp(async, "io_uring_cmd"))
+        return (S_ISCHR(st.st_mode)) ? XZTL_OK : ZND_MEDIA_ASYNC_CAP;
+
+    return (S_ISBLK(st.st_mode)) ? XZTL_OK : ZND_MEDIA_ASYNC_CAP;
+}
+
+/* Open the device with a given asynchronous backend. The backend is
+ * accepted only if a queue can be created on it. */
+static struct xnvme_dev *znd_media_open(const char *dev_name,
+                                        const char *async) {
+    struct xnvme_dev *  dev;
+    struct xnvme_queue *queue;
+    struct xnvme_opts   opts = xnvme_opts_default();
+
+    if (znd_media_async_check(dev_name, async)) {
+        log_infoa("znd-media: Backend %s not supported by %s", async,
+                  dev_name);
+        return NULL;
+    }
+
+    opts.async = async;
+
+    dev = xnvme_dev_open(dev_name, &opts);
+    if (!dev) {
+        log_infoa("znd-media: Could not open %s with backend %s", dev_name,
+                  async);
+        return NULL;
+    }
+
+    if (xnvme_queue_init(dev, 1, 0, &queue)) {
+        log_infoa("znd-media: Backend %s failed to create a queue", async);
+        xnvme_dev_close(dev);
+        return NULL;
+    }
+    xnvme_queue_term(queue);
+
+    return dev;
+}
+
+/* Try the user selected backend first (ZND_MEDIA_ASYNC_ENV), then follow
+ * the fallback order in znd_media_async_list. */
+static struct xnvme_dev *znd_media_open_async(const char *dev_name) {
+    struct xztl_config *cfg = xztl_config_active();
+    struct xnvme_dev *  dev;
+    const char *        async;
+    uint16_t            async_i;
+
+    async = cfg->async;
+    if (async[0] != '\0') {
+        dev = znd_media_open(dev_name, async);
+        if (dev)
+            goto OPEN;
+
+        log_erra("znd-media: Backend %s is not available. Falling back.",
+                 async);
+    }
+
+    for (async_i = 0; async_i < ZND_MEDIA_ASYNC_COUNT; async_i++) {
+        async = znd_media_async_list[async_i];
+        dev   = znd_media_open(dev_name, async);
+        if (dev)
+            goto OPEN;
+    }
+
+    return NULL;
+
+OPEN:
+    snprintf(zndmedia.media.engine, XZTL_MEDIA_ENGINE_LEN, "%s", async);
+    log_infoa("znd-media: Asynchronous backend: %s", async);
+    if (async != cfg->async)
+        snprintf(cfg->async, XZTL_CONFIG_STR, "%s", async);
+
+    return dev;
+}
+
+/* Devices after the first one use the backend of the first device. All
+ * devices must have the zone geometry of the first device */
+static int znd_media_add_dev(const char *dev_name) {
     const struct xnvme_geo *devgeo;
+    struct znd_media_dev *  mdev;
     struct xnvme_dev *      dev;
-    struct xztl_media *     m;
-    // char async[15] = "io_uring_cmd";
-    char async[15] = "thrpool";
 
-    struct xnvme_opts opts = xnvme_opts_default();
-    opts.async             = &async;
+    if (zndmedia.ndevs == XZTL_MEDIA_MAX_DEV)
+        return ZND_MEDIA_NODEVICE;
 
-    dev = xnvme_dev_open(dev_name, &opts);
+    dev = (zndmedia.ndevs) ? znd_media_open(dev_name, zndmedia.media.engine)
+                           : znd_media_open_async(dev_name);
     if (!dev)
         return ZND_MEDIA_NODEVICE;
 
@@ -401,24 +953,126 @@ int znd_media_register(const char *dev_name) {
         return ZND_MEDIA_NOGEO;
     }
 
-    zndmedia.dev    = dev;
-    zndmedia.devgeo = devgeo;
-    m               = &zndmedia.media;
+    if (zndmedia.ndevs &&
+        (devgeo->type != zndmedia.devgeo->type ||
+         devgeo->npugrp != 1 || devgeo->npunit != 1 ||
+         zndmedia.devgeo->npugrp != 1 || zndmedia.devgeo->npunit != 1 ||
+         devgeo->nzone != zndmedia.devgeo->nzone ||
+         devgeo->nsect != zndmedia.devgeo->nsect ||
+         devgeo->nbytes != zndmedia.devgeo->nbytes)) {
+        log_erra("znd-media: Geometry of %s does not match the first device",
+                 dev_name);
+        xnvme_dev_close(dev);
+        return ZND_MEDIA_DEV_GEO;
+    }
+
+    mdev         = &zndmedia.devs[zndmedia.ndevs];
+    mdev->dev    = dev;
+    mdev->devgeo = devgeo;
+    mdev->nsid   = xnvme_dev_get_nsid(dev);
+
+    if (!zndmedia.ndevs) {
+        zndmedia.dev    = dev;
+        zndmedia.devgeo = devgeo;
+    }
+    zndmedia.ndevs++;
+
+    log_infoa("znd-media: Device %d: %s", zndmedia.ndevs - 1, dev_name);
+
+    return XZTL_OK;
+}
+
+int znd_media_register(const char *dev_name) {
+    const struct xnvme_spec_idfy_ctrlr *ctrlr;
+    const struct xnvme_spec_idfy_ns *   ns;
+    const struct xnvme_geo *            devgeo;
+    struct xztl_media *                 m;
+    struct xztl_config *                cfg;
+    char *                              names, *name, *save;
+    uint32_t                            mdts;
+    uint16_t                            dev_i;
+    int                                 ret = ZND_MEDIA_NODEVICE;
+
+    names = strdup(dev_name);
+    if (!names)
+        return ZND_MEDIA_NODEVICE;
+
+    zndmedia.ndevs = 0;
+    for (name = strtok_r(names, ZND_MEDIA_DEV_SEP, &save); name;
+         name = strtok_r(NULL, ZND_MEDIA_DEV_SEP, &save)) {
+        ret = znd_media_add_dev(name);
+        if (ret)
+            break;
+    }
+    free(names);
+
+    if (ret || !zndmedia.ndevs) {
+        znd_media_close();
+        return (ret) ? ret : ZND_MEDIA_NODEVICE;
+    }
 
+    devgeo = zndmedia.devgeo;
+    m      = &zndmedia.media;
+
+    /* The zones of all devices are interleaved in the groups of the first */
     m->geo.ngrps      = devgeo->npugrp;
     m->geo.pu_grp     = devgeo->npunit;
-    m->geo.zn_pu      = devgeo->nzone;
+    m->geo.zn_pu      = devgeo->nzone * zndmedia.ndevs;
     m->geo.sec_zn     = devgeo->nsect;
     m->geo.nbytes     = devgeo->nbytes;
     m->geo.nbytes_oob = devgeo->nbytes_oob;
 
-    m->init_fn   = znd_media_init;
-    m->exit_fn   = znd_media_exit;
-    m->submit_io = znd_media_submit_io;
-    m->zone_fn   = znd_media_zone_mgmt;
-    m->dma_alloc = znd_media_dma_alloc;
-    m->dma_free  = znd_media_dma_free;
-    m->cmd_exec  = znd_media_cmd_exec;
+    m->geo.sec_mdts = devgeo->mdts_nbytes / devgeo->nbytes;
+    for (dev_i = 1; dev_i < zndmedia.ndevs; dev_i++) {
+        mdts = zndmedia.devs[dev_i].devgeo->mdts_nbytes / devgeo->nbytes;
+        if (mdts < m->geo.sec_mdts)
+            m->geo.sec_mdts = mdts;
+    }
+
+    m->caps = 0;
+    if (devgeo->type == XNVME_GEO_ZONED)
+        m->caps |= XZTL_MEDIA_CAP_APPEND;
+
+    /* The kernel backends accept any aligned buffer, SPDK (nvme) needs
+     * DMA memory */
+    if (strcmp(m->engine, "nvme"))
+        m->caps |= XZTL_MEDIA_CAP_HOSTBUF;
+
+    /* Simple Copy (ONCS bit 8). MSRC is 0-based. Copies would cross devices
+     * in a media of several devices, the core copies through the host */
+    ctrlr = xnvme_dev_get_ctrlr(zndmedia.dev);
+    ns    = xnvme_dev_get_ns(zndmedia.dev);
+    if (zndmedia.ndevs == 1 && ctrlr && ns && ctrlr->oncs.copy) {
+        m->caps |= XZTL_MEDIA_CAP_COPY;
+        m->geo.copy_nrange  = (ns->msrc + 1U < XZTL_MAX_MADDR)
+                                  ? ns->msrc + 1U
+                                  : XZTL_MAX_MADDR;
+        m->geo.copy_sec_rng = ns->mssrl;
+        m->geo.copy_sec_max = ns->mcl;
+        log_infoa("znd-media: Simple Copy supported. ranges %u, mssrl %u, "
+                  "mcl %u", m->geo.copy_nrange, m->geo.copy_sec_rng,
+                  m->geo.copy_sec_max);
+    }
+
+    /* SQ polling is only available on the io_uring backends */
+    zndmedia.qopts = 0;
+    cfg            = xztl_config_active();
+    if (cfg->sqpoll > 0 && !strncmp(m->engine, "io_uring", 8)) {
+        zndmedia.qopts = XNVME_QUEUE_SQPOLL;
+        log_info("znd-media: Submission queue polling enabled.");
+    }
+    cfg->sqpoll = (zndmedia.qopts & XNVME_QUEUE_SQPOLL) ? 1 : 0;
+
+    /* Completion polling is tried when a polled context is created */
+    zndmedia.iopoll = 1;
+
+    m->init_fn         = znd_media_init;
+    m->exit_fn         = znd_media_exit;
+    m->submit_io       = znd_media_submit_io;
+    m->zone_fn         = znd_media_zone_mgmt;
+    m->dma_alloc       = znd_media_dma_alloc;
+    m->dma_free        = znd_media_dma_free;
+    m->cmd_exec        = znd_media_cmd_exec;
 
     return xztl_media_set(m);
 }
@@ -20,7 +20,9 @@
 #include <libxnvme_spec.h>
 #include <libxnvme_znd.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/queue.h>
+#include <xztl-numa.h>
 #include <xztl-ztl.h>
 #include <xztl.h>
 #include <ztl.h>
@@ -28,13 +30,8 @@
 
 struct xztl_mthread_info mthread;
 
-struct xnvme_node_mgmt_entry {
-    struct app_group *    grp;
-    struct ztl_pro_node * node;
-    struct xztl_mp_entry *mp_entry;
-    int32_t               op_code;
-    STAILQ_ENTRY(xnvme_node_mgmt_entry) entry;
-};
+/* Queue of the management thread, zones of a node are managed in parallel */
+static struct xztl_mthread_ctx *mgmt_tctx;
 
 static pthread_spinlock_t xnvme_mgmt_spin;
 static STAILQ_HEAD(xnvme_emu_head, xnvme_node_mgmt_entry) submit_head;
@@ -55,32 +52,47 @@ int ztl_pro_grp_get(struct app_group *grp, struct app_pro_addr *ctx,
     pro                          = (struct ztl_pro_node_grp *)grp->pro;
     struct ztl_pro_node *node    = &pro->vnodes[*node_id];
 
-    uint64_t nlevel     = nsec / (ZTL_PRO_ZONE_NUM_INNODE * ZTL_READ_SEC_MCMD);
-    int32_t  remain_sec = nsec % (ZTL_PRO_ZONE_NUM_INNODE * ZTL_READ_SEC_MCMD);
-    int      zn_i       = 0;
-    ctx->naddr          = 0;
+    uint32_t chunk     = node->chunk_sec;
+    uint32_t level_sec = ZTL_PRO_ZONE_NUM_INNODE * chunk;
+    uint64_t zone_sec[ZTL_PRO_ZONE_NUM_INNODE];
+    uint64_t written, soff, left, piece;
+    int      zn_i = 0;
+
+    /* The write continues the stripe of the node where the previous one
+     * stopped, a read finds node sector s in zone (s % level) / chunk */
+    written = 0;
+    for (zn_i = 0; zn_i < ZTL_PRO_ZONE_NUM_INNODE; zn_i++)
+        written += node->vzones[zn_i]->zmd_entry->wptr_inflight -
+                   node->vzones[zn_i]->addr.g.sect;
+
+    soff = written % level_sec;
+    left = nsec % level_sec;
+    for (zn_i = 0; zn_i < ZTL_PRO_ZONE_NUM_INNODE; zn_i++)
+        zone_sec[zn_i] = (uint64_t)(nsec / level_sec) * chunk;
+    while (left) {
+        piece = chunk - soff % chunk;
+        piece = (piece < left) ? piece : left;
+        zone_sec[soff / chunk] += piece;
+        left -= piece;
+        soff = (soff + piece) % level_sec;
+    }
+
+    ctx->stripe_off = written % level_sec;
+    ctx->naddr      = 0;
     for (zn_i = 0; zn_i < ZTL_PRO_ZONE_NUM_INNODE; zn_i++) {
         struct ztl_pro_zone *zone = node->vzones[zn_i];
         uint64_t sec_avlb = zone->zmd_entry->addr.g.sect + zone->capacity -
                             zone->zmd_entry->wptr_inflight;
-        uint64_t actual_sec =
-            nlevel * ZTL_READ_SEC_MCMD +
-            (remain_sec >= ZTL_READ_SEC_MCMD ? ZTL_READ_SEC_MCMD : remain_sec);
+        uint64_t actual_sec = zone_sec[zn_i];
 
         if (sec_avlb < actual_sec) {
             printf(
-                "ztl-pro-grp: left sector is not enough sec_avlb[%u] "
-                "actual_sec[%u] remain_sec[%d]",
-                sec_avlb, actual_sec, remain_sec);
+                "ztl-pro-grp: left sector is not enough sec_avlb[%lu] "
+                "actual_sec[%lu] stripe_off[%u]",
+                sec_avlb, actual_sec, ctx->stripe_off);
             goto NO_LEFT;
         }
 
-        if (remain_sec >= ZTL_READ_SEC_MCMD) {
-            remain_sec -= ZTL_READ_SEC_MCMD;
-        } else {
-            remain_sec = 0;
-        }
-
         ctx->naddr++;
         ctx->addr[zn_i].addr   = zone->addr.addr;
         ctx->addr[zn_i].g.sect = zone->zmd_entry->wptr_inflight;
@@ -89,10 +101,10 @@ int ztl_pro_grp_get(struct app_group *grp, struct app_pro_addr *ctx,
 
         ZDEBUG(ZDEBUG_PRO,
                "ztl-pro-grp  (get): (%d/%d/0x%lx/0x%lx/0x%lx) "
-               " sp: %d, remain_sec: %d",
+               " sp: %d, stripe_off: %d",
                zone->addr.g.grp, zone->addr.g.zone, (uint64_t)zone->addr.g.sect,
                zone->zmd_entry->wptr, zone->zmd_entry->wptr_inflight,
-               ctx->nsec[zn_i], remain_sec);
+               ctx->nsec[zn_i], ctx->stripe_off);
     }
 
     return 0;
@@ -131,31 +143,314 @@ void ztl_pro_grp_free(struct app_group *grp, uint32_t zone_i, uint32_t nsec) {
         ztl_pro_grp_print_status(grp);
 }
 
+static inline void ztl_pro_zone_lock(struct ztl_pro_zone *zone) {
+    while (__atomic_test_and_set(&zone->lock, __ATOMIC_ACQUIRE)) {
+    }
+}
+
+static inline void ztl_pro_zone_unlock(struct ztl_pro_zone *zone) {
+    __atomic_clear(&zone->lock, __ATOMIC_RELEASE);
+}
+
+/* First extent of the table ending after 'off' */
+static uint32_t ztl_pro_remap_find(struct ztl_pro_remap *remap, uint64_t off) {
+    uint32_t first = 0, last = remap->n, mid;
+
+    while (first < last) {
+        mid = (first + last) / 2;
+        if (remap->ext[mid].off + remap->ext[mid].nsec <= off)
+            first = mid + 1;
+        else
+            last = mid;
+    }
+
+    return first;
+}
+
+/* Zone append may complete the commands of a zone out of order, placing
+ * the 'nsec' sectors at zone offset 'off' at 'poff' instead. The extent is
+ * recorded so the read path can find them. The table is allocated at the
+ * first remapping of the zone and grows under the zone lock. Extents
+ * replayed twice from the node metadata log replace the overlapped ones */
+int ztl_pro_zone_remap(struct ztl_pro_zone *zone, uint64_t off, uint64_t poff,
+                       uint64_t nsec) {
+    struct ztl_pro_remap *   remap;
+    struct ztl_pro_remap_ext ins[3], *ext;
+    uint32_t                 first, last, nins, n, max;
+    uint64_t                 end = off + nsec;
+
+    if (!nsec)
+        return XZTL_OK;
+
+    ztl_pro_zone_lock(zone);
+
+    remap = zone->remap;
+    first = last = 0;
+    if (remap) {
+        first = last = ztl_pro_remap_find(remap, off);
+        while (last < remap->n && remap->ext[last].off < end)
+            last++;
+    }
+
+    /* Overlapped extents keep their sectors out of the new one */
+    nins = 0;
+    if (first < last && remap->ext[first].off < off) {
+        ins[nins]      = remap->ext[first];
+        ins[nins].nsec = off - remap->ext[first].off;
+        nins++;
+    }
+    if (off != poff) {
+        ins[nins].off  = off;
+        ins[nins].poff = poff;
+        ins[nins].nsec = nsec;
+        nins++;
+    }
+    if (first < last && remap->ext[last - 1].off + remap->ext[last - 1].nsec >
+                            end) {
+        ext            = &remap->ext[last - 1];
+        ins[nins].off  = end;
+        ins[nins].poff = ext->poff + (end - ext->off);
+        ins[nins].nsec = ext->off + ext->nsec - end;
+        nins++;
+    }
+
+    n = (remap) ? remap->n - (last - first) + nins : nins;
+    if (n && (!remap || n > remap->max)) {
+        max = (remap) ? remap->max * 2 : ZTL_PRO_REMAP_EXT;
+        while (max < n)
+            max *= 2;
+
+        remap = realloc(remap, sizeof(struct ztl_pro_remap) +
+                                   max * sizeof(struct ztl_pro_remap_ext));
+        if (!remap) {
+            ztl_pro_zone_unlock(zone);
+            log_erra("ztl-pro-grp: Remap table allocation failed. Zone %d",
+                     zone->addr.g.zone);
+            return XZTL_ZTL_PROV_ERR;
+        }
+
+        if (!zone->remap)
+            remap->n = 0;
+        remap->max  = max;
+        zone->remap = remap;
+    }
+
+    if (remap) {
+        memmove(&remap->ext[first + nins], &remap->ext[last],
+                (remap->n - last) * sizeof(struct ztl_pro_remap_ext));
+        memcpy(&remap->ext[first], ins,
+               nins * sizeof(struct ztl_pro_remap_ext));
+        remap->n = n;
+    }
+
+    ztl_pro_zone_unlock(zone);
+
+    return XZTL_OK;
+}
+
+/* Remap the 'nsec' sectors written at 'psect' instead of 'sect'. The record
+ * is queued to the node metadata log, the writer commits it before the user
+ * command completes */
+int ztl_pro_grp_zone_remap(struct app_group *grp, uint32_t zone_i,
+                           uint64_t sect, uint64_t psect, uint64_t nsec) {
+    struct ztl_pro_zone *    zone;
+    struct ztl_pro_node_grp *pro;
+    uint64_t                 off, poff;
+    int                      ret;
+
+    pro  = (struct ztl_pro_node_grp *)grp->pro;
+    zone = &(pro->vzones[zone_i - get_metadata_zone_num()]);
+    off  = sect - zone->addr.g.sect;
+    poff = psect - zone->addr.g.sect;
+
+    ret = ztl_pro_zone_remap(zone, off, poff, nsec);
+    if (ret)
+        return ret;
+
+    ztl_pro_md_remap(zone_i, off, poff, nsec);
+
+    ZDEBUG(ZDEBUG_PRO, "ztl-pro-grp (remap): (%d/%d) 0x%lx -> 0x%lx, %lu",
+           zone->addr.g.grp, zone->addr.g.zone, sect, psect, nsec);
+
+    return XZTL_OK;
+}
+
+/* Translate a logical offset within the zone into the written offset.
+ * 'nsec' is cut to the sectors written contiguously from there */
+uint64_t ztl_pro_zone_off(struct ztl_pro_zone *zone, uint64_t off,
+                          uint64_t *nsec) {
+    struct ztl_pro_remap_ext *ext;
+    uint64_t                  poff = off, run = *nsec;
+    uint32_t                  ext_i;
+
+    if (!__atomic_load_n(&zone->remap, __ATOMIC_ACQUIRE))
+        return off;
+
+    ztl_pro_zone_lock(zone);
+    if (zone->remap) {
+        ext_i = ztl_pro_remap_find(zone->remap, off);
+        if (ext_i < zone->remap->n) {
+            ext = &zone->remap->ext[ext_i];
+            if (ext->off <= off) {
+                poff = ext->poff + (off - ext->off);
+                run  = ext->off + ext->nsec - off;
+            } else {
+                run = ext->off - off;
+            }
+        }
+    }
+    ztl_pro_zone_unlock(zone);
+
+    if (run < *nsec)
+        *nsec = run;
+
+    return poff;
+}
+
+/* Copy the first extent ending after 'off'. Returns 0 if there is none */
+int ztl_pro_zone_remap_next(struct ztl_pro_zone *zone, uint64_t off,
+                            struct ztl_pro_remap_ext *ext) {
+    uint32_t ext_i;
+    int      found = 0;
+
+    ztl_pro_zone_lock(zone);
+    if (zone->remap) {
+        ext_i = ztl_pro_remap_find(zone->remap, off);
+        if (ext_i < zone->remap->n) {
+            *ext  = zone->remap->ext[ext_i];
+            found = 1;
+        }
+    }
+    ztl_pro_zone_unlock(zone);
+
+    return found;
+}
+
+void ztl_pro_zone_remap_free(struct ztl_pro_zone *zone) {
+    struct ztl_pro_remap *remap;
+
+    ztl_pro_zone_lock(zone);
+    remap       = zone->remap;
+    zone->remap = NULL;
+    ztl_pro_zone_unlock(zone);
+
+    free(remap);
+}
+
+/* Set the chunk of an empty node. Provisioning, remapping and reads of the
+ * node follow it until the node is reset */
+void ztl_pro_grp_node_chunk(struct ztl_pro_node *node, uint32_t chunk_sec) {
+    uint32_t zn_i;
+
+    node->chunk_sec = chunk_sec;
+    for (zn_i = 0; zn_i < node->zone_num; zn_i++)
+        node->vzones[zn_i]->chunk_sec = chunk_sec;
+}
+
+/* Reload the state and write pointer of a zone from the media. Used when a
+ * zone management command fails and the zone state is unknown. */
+int ztl_pro_zone_refresh(struct ztl_pro_zone *zone) {
+    struct xnvme_spec_znd_descr zinfo;
+    struct xztl_core *          core;
+    int                         ret;
+    get_xztl_core(&core);
+
+    ret = xztl_media_zone_info(
+        zone->addr.g.grp * core->media->geo.zn_grp + zone->addr.g.zone,
+        &zinfo);
+    if (ret) {
+        log_erra("ztl-pro: Zone refresh failed (%d/%d)", zone->addr.g.grp,
+                 zone->addr.g.zone);
+        return ret;
+    }
+
+    zone->state = zinfo.zs;
+    xztl_atomic_int64_update(&zone->zmd_entry->wptr, zinfo.wp);
+    xztl_atomic_int64_update(&zone->zmd_entry->wptr_inflight, zinfo.wp);
+
+    return XZTL_OK;
+}
+
+static void ztl_pro_grp_mgmt_callback(void *arg) {
+    struct xztl_zn_mcmd *     cmd;
+    struct ztl_pro_node_mgmt *mgmt;
+
+    cmd  = (struct xztl_zn_mcmd *)arg;
+    mgmt = (struct ztl_pro_node_mgmt *)cmd->opaque;
+    mgmt->outstanding--;
+}
+
+/* Submit a zone management command to all zones of a node and wait for the
+ * completions. With the management queue, the commands run in parallel.
+ * The status of each zone is returned in mgmt->cmd[i].status. */
+static int ztl_pro_grp_node_mgmt(struct ztl_pro_node *node, uint8_t opcode,
+                                 struct ztl_pro_node_mgmt *mgmt) {
+    struct xztl_zn_mcmd *cmd;
+    int                  ret = XZTL_OK;
+    int                  zn_i;
+
+    mgmt->outstanding = 0;
+
+    for (zn_i = 0; zn_i < ZTL_PRO_ZONE_NUM_INNODE; zn_i++) {
+        cmd            = &mgmt->cmd[zn_i];
+        cmd->opcode    = opcode;
+        cmd->addr.addr = node->vzones[zn_i]->addr.addr;
+        cmd->nzones    = 1;
+        cmd->status    = 0;
+
+        if (!mgmt_tctx) {
+            ret = xztl_media_submit_zn(cmd);
+            if (ret && !cmd->status)
+                cmd->status = ZTL_PRO_MGMT_SUBMIT_ERR;
+            continue;
+        }
+
+        cmd->async_ctx = mgmt_tctx;
+        cmd->callback  = ztl_pro_grp_mgmt_callback;
+        cmd->opaque    = (void *)mgmt;  // NOLINT
+
+        mgmt->outstanding++;
+    RETRY:
+        ret = xztl_media_submit_zn_asynch(cmd);
+        if (ret == XZTL_MEDIA_QFULL) {
+            xztl_ctx_media_reap(mgmt_tctx);
+            goto RETRY;
+        }
+        if (ret) {
+            mgmt->outstanding--;
+            cmd->status = ZTL_PRO_MGMT_SUBMIT_ERR;
+        }
+    }
+
+    while (mgmt->outstanding)
+        xztl_ctx_media_reap(mgmt_tctx);
+
+    return ret;
+}
+
 int ztl_pro_grp_node_finish(struct app_group *grp, struct ztl_pro_node *node) {
-    struct ztl_pro_zone *zone;
-    struct xztl_zn_mcmd cmd;
-    int                 ret;
+    struct ztl_pro_node_mgmt mgmt;
+    struct ztl_pro_zone *    zone;
+    int                      ret = XZTL_OK;
 
+    /* Explicit finishes the zones */
+    ztl_pro_grp_node_mgmt(node, XZTL_ZONE_MGMT_FINISH, &mgmt);
 
     for (int i = 0; i < ZTL_PRO_ZONE_NUM_INNODE; i++) {
-        /* Explicit closes the zone */
-        zone          = node->vzones[i];
-        cmd.opcode    = XZTL_ZONE_MGMT_FINISH;
-        cmd.addr.addr = zone->addr.addr;
-        cmd.nzones    = 1;
-        ret           = xztl_media_submit_zn(&cmd);
-
-        if (ret || cmd.status) {
+        zone = node->vzones[i];
+
+        if (mgmt.cmd[i].status) {
             log_erra("ztl-pro: Zone finish failure (%lld). status %d",
-                     zone->addr.g.zone, cmd.status);
+                     zone->addr.g.zone, mgmt.cmd[i].status);
             xztl_atomic_int32_update(&node->nr_finish_err,
                                      node->nr_finish_err + 1);
-            goto ERR;
+            ztl_pro_zone_refresh(zone);
+            ret = XZTL_ZTL_PROV_ERR;
+            continue;
         }
         zone->zmd_entry->wptr = zone->addr.g.sect + zone->capacity;
     }
 
-ERR:
     return ret;
 }
 
@@ -182,12 +477,23 @@ int ztl_pro_grp_submit_mgmt(struct app_group *grp, struct ztl_pro_node *node,
 }
 
 static void *ztl_pro_grp_process_mgmt(void *args) {
-    mthread.comp_active = 1;
     struct xnvme_node_mgmt_entry *et;
     int                           ret;
+
+    xztl_numa_pin_bg("ztl-pro management");
+
+    mgmt_tctx = xztl_ctx_media_init(ZTL_PRO_MGMT_QDEPTH);
+    if (!mgmt_tctx)
+        log_err("ztl-pro: Management queue not available. Zones are "
+                "managed synchronously.");
+
     while (mthread.comp_active) {
         usleep(1);
 
+        /* The WCA module starts after the management thread */
+        if (ztl()->wca && ztl()->wca->slot_reap_fn)
+            ztl()->wca->slot_reap_fn();
+
     NEXT:
         if (!STAILQ_EMPTY(&submit_head)) {
             pthread_spin_lock(&xnvme_mgmt_spin);
@@ -215,6 +521,9 @@ static void *ztl_pro_grp_process_mgmt(void *args) {
         }
     }
 
+    xztl_ctx_media_exit(mgmt_tctx);
+    mgmt_tctx = NULL;
+
     return XZTL_OK;
 }
 
@@ -223,39 +532,180 @@ static void ztl_pro_grp_zones_free(struct app_group *grp) {
     struct ztl_pro_node_grp *pro;
     struct ztl_pro_node *    vnode;
     uint8_t                  ptype;
+    uint32_t                 zone_i;
 
     pro = (struct ztl_pro_node_grp *)grp->pro;
+    for (zone_i = 0; zone_i < grp->zmd.entries; zone_i++)
+        free(pro->vzones[zone_i].remap);
+
     free(pro->vnodes);
     free(pro->vzones);
 }
 
+/* Bookkeeping after a successful zone reset */
+static void ztl_pro_zone_reset_done(struct ztl_pro_zone *zone) {
+    struct app_zmd_entry *zmde = zone->zmd_entry;
+
+    xztl_atomic_int64_update(&zmde->wptr, zone->addr.g.sect);
+    xztl_atomic_int64_update(&zmde->wptr_inflight, zone->addr.g.sect);
+
+    /* The zone is empty, chunks are written in place again */
+    ztl_pro_md_zone_drop(zone);
+}
+
+/* Take free nodes of one bitmap word. The summary bit of the word is
+ * cleared once the word is empty, and set again if a node was freed
+ * meanwhile */
+static uint32_t ztl_pro_grp_word_take(struct ztl_pro_node_grp *pro,
+                                      uint32_t word, struct ztl_pro_node **nodes,
+                                      uint32_t max) {
+    uint64_t old, take, bits, bit;
+    uint32_t n = 0;
+
+    old = __atomic_load_n(&pro->free_bits[word], __ATOMIC_RELAXED);
+    while (old) {
+        take = 0;
+        bits = old;
+        for (n = 0; bits && n < max; n++) {
+            take |= bits & (~bits + 1);
+            bits &= bits - 1;
+        }
+
+        if (__atomic_compare_exchange_n(&pro->free_bits[word], &old,
+                                        old & ~take, 1, __ATOMIC_ACQUIRE,
+                                        __ATOMIC_RELAXED))
+            break;
+
+        n = 0;
+        xztl_stats_inc(XZTL_STATS_NODE_RETRY, 1);
+    }
+
+    if (!old || !(old & ~take)) {
+        bit = 1ULL << (word % 64);
+        __atomic_fetch_and(&pro->free_sum[word / 64], ~bit, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&pro->free_bits[word], __ATOMIC_SEQ_CST))
+            __atomic_fetch_or(&pro->free_sum[word / 64], bit,
+                              __ATOMIC_RELEASE);
+    }
+
+    if (!old)
+        return 0;
+
+    for (bits = take, n = 0; bits; bits &= bits - 1, n++) {
+        nodes[n] = &pro->vnodes[word * 64 + __builtin_ctzll(bits)];
+        __atomic_store_n(&nodes[n]->status, XZTL_ZMD_NODE_USED,
+                         __ATOMIC_RELAXED);
+    }
+
+    return n;
+}
+
+/* Take up to 'max' free nodes without locking. The search starts at the
+ * word of node 'hint', callers with distinct hints take from distinct
+ * words */
+uint32_t ztl_pro_grp_node_take(struct app_group *grp, uint32_t hint,
+                               struct ztl_pro_node **nodes, uint32_t max) {
+    struct ztl_pro_node_grp *pro = (struct ztl_pro_node_grp *)grp->pro;
+    uint64_t                 sum;
+    uint32_t                 sum_i, sum_n, first, cnt = 0;
+
+    if (!pro->nwords)
+        return 0;
+
+    first = (hint / 64) % pro->nwords;
+    for (sum_n = 0; sum_n <= pro->nsum && cnt < max; sum_n++) {
+        sum_i = (first / 64 + sum_n) % pro->nsum;
+        sum   = __atomic_load_n(&pro->free_sum[sum_i], __ATOMIC_ACQUIRE);
+
+        /* The first summary word is searched from the hint on, and again
+         * from its start at the end */
+        if (!sum_n)
+            sum &= ~0ULL << (first % 64);
+
+        while (sum && cnt < max) {
+            cnt += ztl_pro_grp_word_take(pro, sum_i * 64 + __builtin_ctzll(sum),
+                                         &nodes[cnt], max - cnt);
+            sum &= sum - 1;
+        }
+    }
+
+    return cnt;
+}
+
+/* Give back a node, called by the management thread after a reset */
+void ztl_pro_grp_node_put(struct app_group *grp, struct ztl_pro_node *node) {
+    struct ztl_pro_node_grp *pro  = (struct ztl_pro_node_grp *)grp->pro;
+    uint32_t                 word = node->id / 64;
+
+    __atomic_store_n(&node->status, XZTL_ZMD_NODE_FREE, __ATOMIC_RELAXED);
+    __atomic_fetch_or(&pro->free_bits[word], 1ULL << (node->id % 64),
+                      __ATOMIC_SEQ_CST);
+    __atomic_fetch_or(&pro->free_sum[word / 64], 1ULL << (word % 64),
+                      __ATOMIC_RELEASE);
+}
+
+static int ztl_pro_grp_node_map_init(struct ztl_pro_node_grp *pro) {
+    uint32_t node_i;
+
+    pro->nwords    = (pro->totalnode + 63) / 64;
+    pro->nsum      = (pro->nwords + 63) / 64;
+    pro->free_bits = calloc(pro->nwords + 1, sizeof(uint64_t));
+    pro->free_sum  = calloc(pro->nsum + 1, sizeof(uint64_t));
+    if (!pro->free_bits || !pro->free_sum) {
+        free(pro->free_bits);
+        free(pro->free_sum);
+        return XZTL_ZTL_PROV_ERR;
+    }
+
+    for (node_i = 0; node_i < pro->totalnode; node_i++) {
+        if (pro->vnodes[node_i].status != XZTL_ZMD_NODE_FREE ||
+            pro->vnodes[node_i].zone_num != ZTL_PRO_ZONE_NUM_INNODE)
+            continue;
+
+        pro->free_bits[node_i / 64] |= 1ULL << (node_i % 64);
+        pro->free_sum[node_i / 64 / 64] |= 1ULL << ((node_i / 64) % 64);
+    }
+
+    return XZTL_OK;
+}
+
 int ztl_pro_grp_node_reset(struct app_group *grp, struct ztl_pro_node *node) {
+    struct ztl_pro_node_mgmt mgmt;
     struct ztl_pro_zone *    zone;
     struct ztl_pro_node_grp *node_grp = grp->pro;
-    int                      ret;
+    int                      ret      = XZTL_OK;
+
+    ztl_pro_grp_node_mgmt(node, XZTL_ZONE_MGMT_RESET, &mgmt);
 
     for (int i = 0; i < ZTL_PRO_ZONE_NUM_INNODE; i++) {
         zone = node->vzones[i];
-        ret  = ztl_pro_node_reset_zn(zone);
-        if (ret) {
+
+        if (mgmt.cmd[i].status) {
+            log_erra("ztl_pro_node_reset: Zone: %lu reset failure. status "
+                     "%d\n", zone->addr.g.zone, mgmt.cmd[i].status);
             xztl_atomic_int32_update(&node->nr_reset_err,
                                      node->nr_reset_err + 1);
-            goto ERR;
+            ztl_pro_zone_refresh(zone);
+            ret = XZTL_ZTL_PROV_ERR;
+            continue;
         }
+        ztl_pro_zone_reset_done(zone);
     }
 
-    node_grp->vnodes[node->id].status = XZTL_ZMD_NODE_FREE;
+    /* The node is free once the log tells its chunks are not remapped */
+    if (!ret)
+        ret = ztl_pro_md_reset(node);
+
+    if (!ret)
+        ztl_pro_grp_node_put(grp, &node_grp->vnodes[node->id]);
 
-ERR:
     return ret;
 }
 
 int ztl_pro_node_reset_zn(struct ztl_pro_zone *zone) {
-    struct xztl_zn_mcmd   cmd;
-    struct app_zmd_entry *zmde;
-    int                   ret = 0;
+    struct xztl_zn_mcmd cmd;
+    int                 ret = 0;
 
-    zmde          = zone->zmd_entry;
     cmd.opcode    = XZTL_ZONE_MGMT_RESET;
     cmd.addr.addr = zone->addr.addr;
     cmd.nzones    = 1;
@@ -267,8 +717,7 @@ int ztl_pro_node_reset_zn(struct ztl_pro_zone *zone) {
         goto ERR;
     }
 
-    xztl_atomic_int64_update(&zmde->wptr, zone->addr.g.sect);
-    xztl_atomic_int64_update(&zmde->wptr_inflight, zone->addr.g.sect);
+    ztl_pro_zone_reset_done(zone);
 ERR:
     return ret;
 }
@@ -286,9 +735,22 @@ int ztl_pro_grp_reset_all_zones(struct app_group *grp) {
     return 0;
 }
 
+/* A node holds no data if its first zones are empty. Striped writes start
+ * at zone 0 */
+static int ztl_pro_grp_node_empty(struct ztl_pro_node *node, uint32_t nzones) {
+    uint32_t zn_i;
+
+    for (zn_i = 0; zn_i < nzones; zn_i++) {
+        if (node->vzones[zn_i]->state != XNVME_SPEC_ZND_STATE_EMPTY)
+            return 0;
+    }
+
+    return 1;
+}
+
 int ztl_pro_grp_node_init(struct app_group *grp) {
     struct xnvme_spec_znd_descr *zinfo;
-    struct xnvme_znd_report *    rep;
+    struct xztl_zn_report_iter   it;
     struct ztl_pro_zone *        zone;
     struct app_zmd_entry *       zmde;
     struct ztl_pro_node_grp *    pro;
@@ -304,7 +766,8 @@ int ztl_pro_grp_node_init(struct app_group *grp) {
 
     int metadata_zone_num = get_metadata_zone_num();
 
-    int32_t node_num = grp->zmd.entries / ZTL_PRO_ZONE_NUM_INNODE;
+    /* The zones after the last node are gathered in one more */
+    int32_t node_num = grp->zmd.entries / ZTL_PRO_ZONE_NUM_INNODE + 1;
     pro->vnodes      = calloc(node_num, sizeof(struct ztl_pro_node));
     if (!pro->vnodes) {
         free(pro);
@@ -318,14 +781,12 @@ int ztl_pro_grp_node_init(struct app_group *grp) {
         return XZTL_ZTL_PROV_ERR;
     }
 
-    if (pthread_spin_init(&pro->spin, 0)) {
-        free(pro->vnodes);
-        free(pro->vzones);
-        return XZTL_ZTL_PROV_ERR;
-    }
-
     grp->pro = pro;
-    rep      = grp->zmd.report;
+
+    /* Zones are reported in ranges while the nodes are built */
+    xztl_zn_report_iter_init(&it, grp->id * core->media->geo.zn_grp +
+                                      metadata_zone_num,
+                             grp->zmd.entries - metadata_zone_num);
 
     node_i           = 0;
     zone_num_in_node = 0;
@@ -338,9 +799,16 @@ int ztl_pro_grp_node_init(struct app_group *grp) {
             zone_num_in_node = 0;
         }
 
-        /* We are getting the full report here */
-        zinfo = XNVME_ZND_REPORT_DESCR(
-            rep, grp->id * core->media->geo.zn_grp + zone_i);
+        zinfo = xztl_zn_report_iter_next(&it);
+        if (!zinfo) {
+            log_erra("ztl-pro: Zone report failed. zone %d", zone_i);
+            xztl_zn_report_iter_exit(&it);
+            free(pro->vnodes);
+            free(pro->vzones);
+            free(pro);
+            grp->pro = NULL;
+            return XZTL_ZTL_PROV_ERR;
+        }
 
         zone = &pro->vzones[zone_i - metadata_zone_num];
 
@@ -403,16 +871,60 @@ int ztl_pro_grp_node_init(struct app_group *grp) {
 
         zmde->wptr = zmde->wptr_inflight = zinfo->wp;
     }
+    xztl_zn_report_iter_exit(&it);
+
+    /* The node metadata log takes the last two zones after the nodes. If a
+     * single zone is left, the last node gives its zones. Zones 6 and 7 then
+     * hold the log, so only zones 0-5 tell if the node holds data */
+    if (zone_num_in_node < 2 && pro->totalnode) {
+        if (!ztl_pro_grp_node_empty(&pro->vnodes[pro->totalnode - 1],
+                                    ZTL_PRO_ZONE_NUM_INNODE - 2)) {
+            log_err("ztl-pro: Last node holds data, no zones left for the "
+                    "node metadata log.");
+            goto FREE;
+        }
+        pro->totalnode--;
+        zone_num_in_node = ZTL_PRO_ZONE_NUM_INNODE;
+    }
+    if (zone_num_in_node < 2) {
+        log_err("ztl-pro: No zones left for the node metadata log.");
+        goto FREE;
+    }
+
+    /* Nodes holding data take their chunk from the log. Free nodes take
+     * the chunk in effect when handed out */
+    for (node_i = 0; node_i < pro->totalnode; node_i++)
+        ztl_pro_grp_node_chunk(&pro->vnodes[node_i], core->write_sec);
+
+    if (ztl_pro_md_init(grp,
+                        pro->vnodes[pro->totalnode].vzones[zone_num_in_node - 2],
+                        pro->vnodes[pro->totalnode].vzones[zone_num_in_node - 1])) {
+        log_err("ztl-pro: Node metadata log not available.");
+        goto FREE;
+    }
+
+    if (ztl_pro_grp_node_map_init(pro)) {
+        log_err("ztl-pro: Free node bitmap not allocated.");
+        ztl_pro_md_exit();
+        goto FREE;
+    }
 
     STAILQ_INIT(&submit_head);
     if (pthread_spin_init(&xnvme_mgmt_spin, 0)) {
         return 1;
     }
 
+    mthread.comp_active = 1;
     pthread_create(&mthread.comp_tid, NULL, ztl_pro_grp_process_mgmt, NULL);
 
     log_infoa("ztl-pro: Started. Group %d.", grp->id);
     return 0;
+
+FREE:
+    ztl_pro_grp_zones_free(grp);
+    free(grp->pro);
+    grp->pro = NULL;
+    return XZTL_ZTL_PROV_ERR;
 }
 
 void ztl_pro_grp_exit(struct app_group *grp) {
@@ -420,8 +932,16 @@ void ztl_pro_grp_exit(struct app_group *grp) {
 
     pro = (struct ztl_pro_node_grp *)grp->pro;
 
-    pthread_spin_destroy(&pro->spin);
+    /* Stop the management thread, it owns a media queue */
+    if (mthread.comp_active) {
+        mthread.comp_active = 0;
+        pthread_join(mthread.comp_tid, NULL);
+    }
+
+    ztl_pro_md_exit();
     ztl_pro_grp_zones_free(grp);
+    free(pro->free_bits);
+    free(pro->free_sum);
     free(grp->pro);
 
     log_infoa("ztl-pro: Stopped. Group %d.", grp->id);
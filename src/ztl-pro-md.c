@@ -0,0 +1,669 @@
+/* xZTL: Zone Translation Layer User-space Library
+ *
+ * Copyright 2019 Samsung Electronics
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <xztl.h>
+#include <ztl.h>
+#include <ztl_metadata.h>
+
+/* Node metadata log. Records that the zones cannot tell by themselves
+ * (the write chunk of a node, extents placed elsewhere by zone append) are
+ * appended to one of two log zones with synchronous writes, and replayed
+ * by ztl_pro_md_init.
+ *
+ * A log zone starts with a snapshot of the whole state, and the records
+ * committed later follow it. When the active zone is full, a snapshot is
+ * written to the other zone with the next generation. The zone with the
+ * highest generation and a complete snapshot is the log. */
+
+#define ZTL_PRO_MD_MAGIC     0x31444d4c545aULL /* ZTLMD1 */
+#define ZTL_PRO_MD_BUF_SEC   64 /* Sectors per log read and write */
+#define ZTL_PRO_MD_PEND      256 /* Initial pending records */
+#define ZTL_PRO_MD_ALL       UINT32_MAX /* Chunk of nodes without a record */
+#define ZTL_PRO_MD_REMAP_MAX UINT16_MAX /* Sectors of a remap record */
+
+enum ztl_pro_md_type {
+    ZTL_PRO_MD_REMAP = 0x1, /* Zone, logical offset, written offset, nsec */
+    ZTL_PRO_MD_RESET = 0x2, /* Node, its zones are empty */
+    ZTL_PRO_MD_CHUNK = 0x3  /* Node, chunk in sectors */
+};
+
+enum ztl_pro_md_flags {
+    ZTL_PRO_MD_SNAP     = 0x1, /* Sector of the snapshot */
+    ZTL_PRO_MD_SNAP_END = 0x2  /* Last sector of the snapshot */
+};
+
+/* Header of a log sector, the records follow it */
+struct ztl_pro_md_hdr {
+    uint64_t magic;
+    uint64_t gen; /* Generation of the log zone */
+    uint64_t seq; /* Sector within the log zone */
+    uint32_t nrec;
+    uint32_t flags;
+};
+
+/* Remap records without 'nsec' were written with a table of one entry per
+ * chunk, they remap the whole chunk */
+struct ztl_pro_md_rec {
+    uint16_t type;
+    uint16_t nsec;
+    uint32_t id; /* Zone or node */
+    uint32_t val[2];
+};
+
+struct ztl_pro_md {
+    struct app_group *   grp;
+    struct ztl_pro_zone *zone[2];
+    uint32_t             cur; /* Active log zone */
+    uint64_t             gen;
+    uint64_t             seq; /* Next sector of the active zone */
+    uint64_t             wp;
+
+    /* Chunk of the nodes written before the log was started */
+    uint32_t def_chunk;
+
+    /* Sectors of the next write, the last one is being filled */
+    uint8_t *buf;
+    uint32_t buf_sec;
+    uint32_t nsec;
+    uint32_t nrec_sec; /* Records per sector */
+
+    /* Records not written yet. The writer swaps them with 'spare' */
+    struct ztl_pro_md_rec *pend;
+    uint32_t               npend;
+    uint32_t               maxpend;
+    struct ztl_pro_md_rec *spare;
+    uint32_t               maxspare;
+
+    pthread_spinlock_t spin;
+    pthread_mutex_t    mutex; /* Log writes and remap table releases */
+};
+
+static struct ztl_pro_md md;
+
+static inline struct ztl_pro_md_hdr *ztl_pro_md_sec(uint32_t sec_i) {
+    struct xztl_core *core;
+    get_xztl_core(&core);
+
+    return (struct ztl_pro_md_hdr *)(md.buf +  // NOLINT
+                                     (uint64_t)sec_i * core->media->geo.nbytes);
+}
+
+static inline struct ztl_pro_md_rec *ztl_pro_md_recs(
+    struct ztl_pro_md_hdr *hdr) {
+    return (struct ztl_pro_md_rec *)(hdr + 1);  // NOLINT
+}
+
+static int ztl_pro_md_io(uint8_t opcode, uint64_t sect, uint32_t nsec) {
+    struct xztl_io_mcmd cmd;
+    int                 ret;
+
+    memset(&cmd, 0x0, sizeof(struct xztl_io_mcmd));
+    cmd.opcode         = opcode;
+    cmd.naddr          = 1;
+    cmd.synch          = 1;
+    cmd.nsec[0]        = nsec;
+    cmd.prp[0]         = (uint64_t)md.buf;  // NOLINT
+    cmd.addr[0].g.sect = sect;
+
+    ret = xztl_media_submit_io(&cmd);
+    if (ret || cmd.status) {
+        log_erra("ztl-pro-md: Log %s failed. sect 0x%lx, err %d, status %d",
+                 (opcode == XZTL_CMD_READ) ? "read" : "write", sect, ret,
+                 cmd.status);
+        return XZTL_ZTL_MD_ERR;
+    }
+
+    return XZTL_OK;
+}
+
+static int ztl_pro_md_zone_reset(struct ztl_pro_zone *zone) {
+    struct xztl_zn_mcmd cmd;
+    int                 ret;
+
+    cmd.opcode    = XZTL_ZONE_MGMT_RESET;
+    cmd.addr.addr = zone->addr.addr;
+    cmd.nzones    = 1;
+    cmd.status    = 0;
+
+    ret = xztl_media_submit_zn(&cmd);
+    if (ret || cmd.status) {
+        log_erra("ztl-pro-md: Log zone %d reset failed. status %d",
+                 zone->addr.g.zone, cmd.status);
+        return XZTL_ZTL_MD_ERR;
+    }
+
+    zone->zmd_entry->wptr = zone->zmd_entry->wptr_inflight = zone->addr.g.sect;
+
+    return XZTL_OK;
+}
+
+/* Write the buffered sectors at the log write pointer */
+static int ztl_pro_md_flush(void) {
+    struct ztl_pro_zone *zone = md.zone[md.cur];
+    int                  ret;
+
+    if (!md.nsec)
+        return XZTL_OK;
+
+    if (md.wp + md.nsec > zone->addr.g.sect + zone->capacity) {
+        log_err("ztl-pro-md: Node metadata does not fit in a log zone.");
+        return XZTL_ZTL_MD_ERR;
+    }
+
+    ret = ztl_pro_md_io(XZTL_CMD_WRITE, md.wp, md.nsec);
+    if (ret)
+        return ret;
+
+    md.wp += md.nsec;
+    md.seq += md.nsec;
+    md.nsec = 0;
+    zone->zmd_entry->wptr = zone->zmd_entry->wptr_inflight = md.wp;
+
+    return XZTL_OK;
+}
+
+/* Add a record to the buffered sectors, a new sector is started when the
+ * last one is full */
+static int ztl_pro_md_put(struct ztl_pro_md_rec *rec, uint32_t flags) {
+    struct ztl_pro_md_hdr *hdr = NULL;
+    struct xztl_core *     core;
+    int                    ret;
+    get_xztl_core(&core);
+
+    if (md.nsec)
+        hdr = ztl_pro_md_sec(md.nsec - 1);
+
+    if (!hdr || hdr->nrec == md.nrec_sec) {
+        if (md.nsec == md.buf_sec) {
+            ret = ztl_pro_md_flush();
+            if (ret)
+                return ret;
+        }
+
+        hdr = ztl_pro_md_sec(md.nsec);
+        memset(hdr, 0x0, core->media->geo.nbytes);
+        hdr->magic = ZTL_PRO_MD_MAGIC;
+        hdr->gen   = md.gen;
+        hdr->seq   = md.seq + md.nsec;
+        hdr->flags = flags;
+        md.nsec++;
+    }
+
+    if (rec)
+        ztl_pro_md_recs(hdr)[hdr->nrec++] = *rec;
+
+    return XZTL_OK;
+}
+
+/* Write a snapshot of the state and 'recs' to the other log zone. The log
+ * moves to it once the snapshot is complete */
+static int ztl_pro_md_snapshot(struct ztl_pro_md_rec *recs, uint32_t nrec) {
+    struct ztl_pro_node_grp *pro = (struct ztl_pro_node_grp *)md.grp->pro;
+    struct ztl_pro_md_rec    rec;
+    struct ztl_pro_zone *    zone;
+    struct ztl_pro_remap_ext ext;
+    uint32_t                 old_cur, node_i, zn_i, rec_i;
+    uint64_t                 old_gen, old_seq, old_wp, off;
+    int                      ret;
+
+    old_cur = md.cur;
+    old_gen = md.gen;
+    old_seq = md.seq;
+    old_wp  = md.wp;
+
+    md.cur = !md.cur;
+    ret    = ztl_pro_md_zone_reset(md.zone[md.cur]);
+    if (ret)
+        goto RESTORE;
+
+    md.gen++;
+    md.seq  = 0;
+    md.wp   = md.zone[md.cur]->addr.g.sect;
+    md.nsec = 0;
+
+    rec.type   = ZTL_PRO_MD_CHUNK;
+    rec.nsec   = 0;
+    rec.id     = ZTL_PRO_MD_ALL;
+    rec.val[0] = md.def_chunk;
+    rec.val[1] = 0;
+    ret        = ztl_pro_md_put(&rec, ZTL_PRO_MD_SNAP);
+
+    for (node_i = 0; !ret && node_i < pro->totalnode; node_i++) {
+        if (__atomic_load_n(&pro->vnodes[node_i].status, __ATOMIC_ACQUIRE) !=
+            XZTL_ZMD_NODE_USED)
+            continue;
+
+        rec.type   = ZTL_PRO_MD_CHUNK;
+        rec.nsec   = 0;
+        rec.id     = node_i;
+        rec.val[0] = pro->vnodes[node_i].chunk_sec;
+        rec.val[1] = 0;
+        ret        = ztl_pro_md_put(&rec, ZTL_PRO_MD_SNAP);
+
+        /* Extents are looked up by offset, writes in flight may grow the
+         * tables meanwhile */
+        for (zn_i = 0; !ret && zn_i < pro->vnodes[node_i].zone_num; zn_i++) {
+            zone = pro->vnodes[node_i].vzones[zn_i];
+            off  = 0;
+            while (!ret && ztl_pro_zone_remap_next(zone, off, &ext)) {
+                if (ext.off > off)
+                    off = ext.off;
+
+                rec.type   = ZTL_PRO_MD_REMAP;
+                rec.nsec   = (ext.off + ext.nsec - off > ZTL_PRO_MD_REMAP_MAX)
+                                 ? ZTL_PRO_MD_REMAP_MAX
+                                 : ext.off + ext.nsec - off;
+                rec.id     = zone->addr.g.zone;
+                rec.val[0] = off;
+                rec.val[1] = ext.poff + (off - ext.off);
+                ret        = ztl_pro_md_put(&rec, ZTL_PRO_MD_SNAP);
+                off += rec.nsec;
+            }
+        }
+    }
+
+    for (rec_i = 0; !ret && rec_i < nrec; rec_i++)
+        ret = ztl_pro_md_put(&recs[rec_i], ZTL_PRO_MD_SNAP);
+
+    if (!ret) {
+        ztl_pro_md_sec(md.nsec - 1)->flags |= ZTL_PRO_MD_SNAP_END;
+        ret = ztl_pro_md_flush();
+    }
+
+    if (!ret) {
+        log_infoa("ztl-pro-md: Log moved to zone %d. Generation %lu, %lu "
+                  "sectors.", md.zone[md.cur]->addr.g.zone, md.gen, md.seq);
+        return XZTL_OK;
+    }
+
+    /* The old log is still complete, the next commit tries again */
+RESTORE:
+    md.cur  = old_cur;
+    md.gen  = old_gen;
+    md.seq  = old_seq;
+    md.wp   = old_wp;
+    md.nsec = 0;
+
+    return ret;
+}
+
+/* Append records to the active log zone, or move the log if they do not
+ * fit */
+static int ztl_pro_md_write(struct ztl_pro_md_rec *recs, uint32_t nrec) {
+    struct ztl_pro_zone *zone = md.zone[md.cur];
+    uint64_t             nsec;
+    uint32_t             rec_i;
+    int                  ret = XZTL_OK;
+
+    nsec = (nrec + md.nrec_sec - 1) / md.nrec_sec;
+    if (md.wp + nsec > zone->addr.g.sect + zone->capacity)
+        return ztl_pro_md_snapshot(recs, nrec);
+
+    md.nsec = 0;
+    for (rec_i = 0; !ret && rec_i < nrec; rec_i++)
+        ret = ztl_pro_md_put(&recs[rec_i], 0);
+
+    if (!ret)
+        ret = ztl_pro_md_flush();
+
+    /* Part of the records may be written, the snapshot has them all */
+    if (ret) {
+        md.nsec = 0;
+        ret     = ztl_pro_md_snapshot(recs, nrec);
+    }
+
+    return ret;
+}
+
+static int ztl_pro_md_queue(struct ztl_pro_md_rec *recs, uint32_t nrec) {
+    struct ztl_pro_md_rec *pend;
+    uint32_t               max;
+
+    pthread_spin_lock(&md.spin);
+    if (md.npend + nrec > md.maxpend) {
+        max = md.maxpend;
+        while (md.npend + nrec > max)
+            max *= 2;
+
+        pend = realloc(md.pend, max * sizeof(struct ztl_pro_md_rec));
+        if (!pend) {
+            pthread_spin_unlock(&md.spin);
+            log_err("ztl-pro-md: Pending records allocation failed.");
+            return XZTL_ZTL_MD_ERR;
+        }
+        md.pend    = pend;
+        md.maxpend = max;
+    }
+
+    memcpy(&md.pend[md.npend], recs, nrec * sizeof(struct ztl_pro_md_rec));
+    __atomic_store_n(&md.npend, md.npend + nrec, __ATOMIC_RELEASE);
+    pthread_spin_unlock(&md.spin);
+
+    return XZTL_OK;
+}
+
+/* Write the queued records. Records queued before the call are durable
+ * when it returns XZTL_OK */
+int ztl_pro_md_commit(void) {
+    struct ztl_pro_md_rec *recs;
+    uint32_t               nrec, max;
+    int                    ret;
+
+    if (!md.grp || !__atomic_load_n(&md.npend, __ATOMIC_ACQUIRE))
+        return XZTL_OK;
+
+    pthread_mutex_lock(&md.mutex);
+
+    pthread_spin_lock(&md.spin);
+    recs       = md.pend;
+    nrec       = md.npend;
+    max        = md.maxpend;
+    md.pend    = md.spare;
+    md.maxpend = md.maxspare;
+    md.npend   = 0;
+    md.spare    = recs;
+    md.maxspare = max;
+    pthread_spin_unlock(&md.spin);
+
+    ret = (nrec) ? ztl_pro_md_write(recs, nrec) : XZTL_OK;
+    if (ret)
+        ztl_pro_md_queue(recs, nrec);
+
+    pthread_mutex_unlock(&md.mutex);
+
+    return ret;
+}
+
+void ztl_pro_md_remap(uint32_t zone_i, uint32_t off, uint32_t poff,
+                      uint32_t nsec) {
+    struct ztl_pro_md_rec rec;
+
+    if (!md.grp)
+        return;
+
+    while (nsec) {
+        rec.type   = ZTL_PRO_MD_REMAP;
+        rec.nsec   = (nsec > ZTL_PRO_MD_REMAP_MAX) ? ZTL_PRO_MD_REMAP_MAX : nsec;
+        rec.id     = zone_i;
+        rec.val[0] = off;
+        rec.val[1] = poff;
+        ztl_pro_md_queue(&rec, 1);
+
+        off += rec.nsec;
+        poff += rec.nsec;
+        nsec -= rec.nsec;
+    }
+}
+
+/* Queue the chunk of a node handed out for writing. The caller commits
+ * it before the node is written */
+void ztl_pro_md_chunk(struct ztl_pro_node *node) {
+    struct ztl_pro_md_rec rec;
+
+    if (!md.grp)
+        return;
+
+    rec.type   = ZTL_PRO_MD_CHUNK;
+    rec.nsec   = 0;
+    rec.id     = node->id;
+    rec.val[0] = node->chunk_sec;
+    rec.val[1] = 0;
+    ztl_pro_md_queue(&rec, 1);
+}
+
+/* The zones of the node are empty. The record is written before the node
+ * is free, its chunks are not remapped at the next start */
+int ztl_pro_md_reset(struct ztl_pro_node *node) {
+    struct ztl_pro_md_rec rec;
+    int                   ret;
+
+    if (!md.grp)
+        return XZTL_OK;
+
+    rec.type   = ZTL_PRO_MD_RESET;
+    rec.nsec   = 0;
+    rec.id     = node->id;
+    rec.val[0] = 0;
+    rec.val[1] = 0;
+    ret        = ztl_pro_md_queue(&rec, 1);
+
+    return (ret) ? ret : ztl_pro_md_commit();
+}
+
+/* Release the remap table of a zone, snapshots read the tables */
+void ztl_pro_md_zone_drop(struct ztl_pro_zone *zone) {
+    if (md.grp)
+        pthread_mutex_lock(&md.mutex);
+
+    ztl_pro_zone_remap_free(zone);
+
+    if (md.grp)
+        pthread_mutex_unlock(&md.mutex);
+}
+
+static void ztl_pro_md_apply(struct ztl_pro_md_rec *rec) {
+    struct ztl_pro_node_grp *pro = (struct ztl_pro_node_grp *)md.grp->pro;
+    struct ztl_pro_node *    node;
+    struct ztl_pro_zone *    zone;
+    struct xztl_core *       core;
+    uint32_t                 zn_i, node_i, off, poff, nsec;
+    get_xztl_core(&core);
+
+    switch (rec->type) {
+        case ZTL_PRO_MD_CHUNK:
+            if (!rec->val[0] || (rec->id != ZTL_PRO_MD_ALL &&
+                                 rec->id >= pro->totalnode))
+                break;
+
+            if (rec->id != ZTL_PRO_MD_ALL) {
+                ztl_pro_grp_node_chunk(&pro->vnodes[rec->id], rec->val[0]);
+                return;
+            }
+
+            /* Nodes holding data without a record of their own */
+            md.def_chunk = rec->val[0];
+            for (node_i = 0; node_i < pro->totalnode; node_i++)
+                if (pro->vnodes[node_i].status == XZTL_ZMD_NODE_USED)
+                    ztl_pro_grp_node_chunk(&pro->vnodes[node_i], md.def_chunk);
+            return;
+
+        case ZTL_PRO_MD_REMAP:
+            if (rec->id < get_metadata_zone_num() ||
+                rec->id >= md.grp->zmd.entries)
+                break;
+
+            zone = &pro->vzones[rec->id - get_metadata_zone_num()];
+            off  = rec->val[0];
+            poff = rec->val[1];
+            nsec = rec->nsec;
+            if (!nsec) {
+                if (!zone->chunk_sec || poff < off % zone->chunk_sec)
+                    break;
+                poff -= off % zone->chunk_sec;
+                off -= off % zone->chunk_sec;
+                nsec = zone->chunk_sec;
+            }
+
+            if ((uint64_t)off + nsec > zone->capacity ||
+                (uint64_t)poff + nsec > zone->capacity)
+                break;
+
+            ztl_pro_zone_remap(zone, off, poff, nsec);
+            return;
+
+        case ZTL_PRO_MD_RESET:
+            if (rec->id >= pro->totalnode)
+                break;
+
+            node = &pro->vnodes[rec->id];
+            for (zn_i = 0; zn_i < node->zone_num; zn_i++)
+                ztl_pro_zone_remap_free(node->vzones[zn_i]);
+            ztl_pro_grp_node_chunk(node, core->write_sec);
+            return;
+    }
+
+    log_erra("ztl-pro-md: Invalid record. type %u, id %u", rec->type, rec->id);
+}
+
+/* Scan a log zone. Returns the number of valid sectors and sets 'gen' if
+ * the zone starts with a complete snapshot. Records are applied if
+ * 'apply' is set */
+static uint64_t ztl_pro_md_scan(struct ztl_pro_zone *zone, uint64_t *gen,
+                                int apply) {
+    struct ztl_pro_md_hdr *hdr;
+    uint64_t               sect, end, nsec, snap_end = 0;
+    uint32_t               sec_i, rec_i, nread;
+
+    *gen = 0;
+    sect = zone->addr.g.sect;
+    end  = zone->zmd_entry->wptr;
+    nsec = 0;
+    if (end > sect + zone->capacity)
+        end = sect + zone->capacity;
+
+    while (sect < end) {
+        nread = (end - sect < md.buf_sec) ? end - sect : md.buf_sec;
+        if (ztl_pro_md_io(XZTL_CMD_READ, sect, nread))
+            break;
+
+        for (sec_i = 0; sec_i < nread; sec_i++) {
+            hdr = ztl_pro_md_sec(sec_i);
+            if (hdr->magic != ZTL_PRO_MD_MAGIC || hdr->seq != nsec ||
+                hdr->nrec > md.nrec_sec || (nsec && hdr->gen != *gen) ||
+                (!nsec && !(hdr->flags & ZTL_PRO_MD_SNAP)))
+                goto DONE;
+
+            *gen = hdr->gen;
+            if (apply)
+                for (rec_i = 0; rec_i < hdr->nrec; rec_i++)
+                    ztl_pro_md_apply(&ztl_pro_md_recs(hdr)[rec_i]);
+
+            nsec++;
+            if (hdr->flags & ZTL_PRO_MD_SNAP_END)
+                snap_end = nsec;
+        }
+        sect += nread;
+    }
+
+DONE:
+    if (!snap_end)
+        *gen = 0;
+
+    return (snap_end) ? nsec : 0;
+}
+
+/* Open the log on two spare zones of the group and replay it into the
+ * nodes. A new log is started if none is found */
+int ztl_pro_md_init(struct app_group *grp, struct ztl_pro_zone *zone0,
+                    struct ztl_pro_zone *zone1) {
+    struct xztl_core *core;
+    uint64_t          gen[2], nsec;
+    int               ret;
+    get_xztl_core(&core);
+
+    memset(&md, 0x0, sizeof(struct ztl_pro_md));
+    md.zone[0]   = zone0;
+    md.zone[1]   = zone1;
+    md.def_chunk = core->write_sec;
+    md.nrec_sec = (core->media->geo.nbytes - sizeof(struct ztl_pro_md_hdr)) /
+                  sizeof(struct ztl_pro_md_rec);
+    md.buf_sec  = ZTL_PRO_MD_BUF_SEC;
+    if (core->media->geo.sec_mdts && core->media->geo.sec_mdts < md.buf_sec)
+        md.buf_sec = core->media->geo.sec_mdts;
+
+    md.buf = xztl_media_dma_alloc(md.buf_sec * core->media->geo.nbytes);
+    if (!md.buf)
+        return XZTL_ZTL_MD_ERR;
+
+    md.maxpend  = ZTL_PRO_MD_PEND;
+    md.maxspare = ZTL_PRO_MD_PEND;
+    md.pend     = malloc(md.maxpend * sizeof(struct ztl_pro_md_rec));
+    md.spare    = malloc(md.maxspare * sizeof(struct ztl_pro_md_rec));
+    if (!md.pend || !md.spare)
+        goto FREE;
+
+    if (pthread_spin_init(&md.spin, 0))
+        goto FREE;
+
+    if (pthread_mutex_init(&md.mutex, NULL))
+        goto SPIN;
+
+    /* Records are applied to the group state */
+    md.grp = grp;
+
+    ztl_pro_md_scan(zone0, &gen[0], 0);
+    ztl_pro_md_scan(zone1, &gen[1], 0);
+
+    if (!gen[0] && !gen[1]) {
+        log_infoa("ztl-pro-md: No node metadata log. A new log is started, "
+                  "nodes holding data are read with a chunk of %u sectors.",
+                  md.def_chunk);
+        md.cur = 1;
+        ret    = ztl_pro_md_snapshot(NULL, 0);
+        if (ret)
+            goto MUTEX;
+        goto OPEN;
+    }
+
+    md.cur = (gen[1] > gen[0]) ? 1 : 0;
+    md.gen = gen[md.cur];
+    nsec   = ztl_pro_md_scan(md.zone[md.cur], &md.gen, 1);
+    md.seq = nsec;
+    md.wp  = md.zone[md.cur]->addr.g.sect + nsec;
+
+    /* A torn write is left after the log, the log moves on */
+    if (md.wp != md.zone[md.cur]->zmd_entry->wptr) {
+        ret = ztl_pro_md_snapshot(NULL, 0);
+        if (ret)
+            goto MUTEX;
+    }
+
+OPEN:
+    log_infoa("ztl-pro-md: Log zone %d, generation %lu, %lu sectors.",
+              md.zone[md.cur]->addr.g.zone, md.gen, md.seq);
+
+    return XZTL_OK;
+
+MUTEX:
+    pthread_mutex_destroy(&md.mutex);
+SPIN:
+    pthread_spin_destroy(&md.spin);
+FREE:
+    md.grp = NULL;
+    free(md.pend);
+    free(md.spare);
+    xztl_media_dma_free(md.buf);
+    return XZTL_ZTL_MD_ERR;
+}
+
+void ztl_pro_md_exit(void) {
+    if (!md.grp)
+        return;
+
+    if (ztl_pro_md_commit())
+        log_err("ztl-pro-md: Pending records are lost.");
+
+    md.grp = NULL;
+    pthread_mutex_destroy(&md.mutex);
+    pthread_spin_destroy(&md.spin);
+    free(md.pend);
+    free(md.spare);
+    xztl_media_dma_free(md.buf);
+}
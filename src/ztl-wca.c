@@ -17,9 +17,15 @@
  * limitations under the License.
 */
 
+#include <libxnvme_spec.h>
+#include <libxnvme_znd.h>
+#include <errno.h>
 #include <sched.h>
 #include <unistd.h>
+#include <xztl-config.h>
 #include <xztl-media.h>
+#include <xztl-numa.h>
+#include <xztl-ring.h>
 #include <xztl-ztl.h>
 #include <xztl.h>
 #include <ztl.h>
@@ -27,12 +33,23 @@
 #define ZTL_MCMD_ENTS       XZTL_IO_MAX_MCMD
 #define ZROCKS_DEBUG        0
 #define ZNS_ALIGMENT        4096
-#define XZTL_CTX_NVME_DEPTH 128
+
+/* Size of an mcmd in the per slot block, cache line aligned */
+#define ZTL_TH_MCMD_SZ ((sizeof(struct xztl_io_mcmd) + 63) & ~63UL)
 
 extern struct app_group **glist;
 
 uint8_t THREAD_NUM;
 
+struct xztl_thread *xtd;
+uint16_t            xtd_num;
+
+static uint32_t ztl_wca_rdepth = ZTL_READ_QDEPTH;
+static uint32_t ztl_wca_wdepth = ZTL_WRITE_QDEPTH;
+static uint32_t ztl_wca_adepth = ZTL_ASYNC_DEPTH;
+static uint32_t ztl_wca_zdepth = ZTL_WRITE_ZONE_QDEPTH;
+static uint8_t  ztl_wca_dispatch = ZTL_DISPATCH_INLINE;
+
 static void *zrocks_alloc(size_t size) {
     return xztl_media_dma_alloc(size);
 }
@@ -41,6 +58,95 @@ static void zrocks_free(void *ptr) {
     xztl_media_dma_free(ptr);
 }
 
+/* Read bounce buffers shared by the slots. Free buffers are listed per NUMA
+ * node, linked through their first bytes. Buffers are allocated on demand
+ * up to 'max', then borrowed from other nodes */
+struct ztl_bounce_pool {
+    pthread_spinlock_t spin;
+    void *             head[XZTL_NUMA_MAX_NODES + 1]; /* [0] without node */
+    uint32_t           nalloc;
+    uint32_t           max;
+    size_t             size;
+};
+
+/* Free slots, one bit per slot. A slot is taken by clearing its bit with
+ * a compare-and-swap and given back by setting it. node[n] has the bits
+ * of the slots bound to NUMA node n */
+struct ztl_slot_map {
+    uint64_t free[ZTL_TH_WORDS];
+    uint64_t node[XZTL_NUMA_MAX_NODES][ZTL_TH_WORDS];
+};
+
+static struct ztl_bounce_pool ztl_bounce;
+static struct ztl_slot_map    ztl_slots;
+static pthread_mutex_t        ztl_slot_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t               ztl_slot_idle_us;
+static uint64_t               ztl_slot_reap_us; /* Last idle slot check */
+
+static int ztl_thd_slot_open(int tid);
+
+static int ztl_wca_bounce_init(uint32_t max, size_t size) {
+    memset(&ztl_bounce, 0x0, sizeof(struct ztl_bounce_pool));
+    ztl_bounce.max  = max;
+    ztl_bounce.size = size;
+
+    return pthread_spin_init(&ztl_bounce.spin, 0);
+}
+
+static void ztl_wca_bounce_exit(void) {
+    void *buf;
+    int   list;
+
+    for (list = 0; list <= XZTL_NUMA_MAX_NODES; list++) {
+        while (ztl_bounce.head[list]) {
+            buf                   = ztl_bounce.head[list];
+            ztl_bounce.head[list] = *(void **)buf;
+            zrocks_free(buf);
+        }
+    }
+    pthread_spin_destroy(&ztl_bounce.spin);
+}
+
+/* Returns NULL if all buffers are in use */
+static void *ztl_wca_bounce_get(int node) {
+    void *buf;
+    int   list = node + 1;
+
+    pthread_spin_lock(&ztl_bounce.spin);
+    if (!ztl_bounce.head[list] && ztl_bounce.nalloc < ztl_bounce.max) {
+        ztl_bounce.nalloc++;
+        pthread_spin_unlock(&ztl_bounce.spin);
+
+        buf = xztl_media_dma_alloc_node(ztl_bounce.size, node);
+        if (!buf) {
+            pthread_spin_lock(&ztl_bounce.spin);
+            ztl_bounce.nalloc--;
+            pthread_spin_unlock(&ztl_bounce.spin);
+        }
+        return buf;
+    }
+
+    for (list = (ztl_bounce.head[list]) ? list : 0;
+         list <= XZTL_NUMA_MAX_NODES && !ztl_bounce.head[list]; list++) {
+    }
+
+    buf = NULL;
+    if (list <= XZTL_NUMA_MAX_NODES) {
+        buf                   = ztl_bounce.head[list];
+        ztl_bounce.head[list] = *(void **)buf;
+    }
+    pthread_spin_unlock(&ztl_bounce.spin);
+
+    return buf;
+}
+
+static void ztl_wca_bounce_put(void *buf, int node) {
+    pthread_spin_lock(&ztl_bounce.spin);
+    *(void **)buf               = ztl_bounce.head[node + 1];
+    ztl_bounce.head[node + 1] = buf;
+    pthread_spin_unlock(&ztl_bounce.spin);
+}
+
 static void zrocks_read_callback_mcmd(void *arg) {
     struct xztl_io_ucmd *ucmd;
     struct xztl_io_mcmd *mcmd;
@@ -51,14 +157,19 @@ static void zrocks_read_callback_mcmd(void *arg) {
 
     if (mcmd->status) {
         ucmd->status = mcmd->status;
-    } else {
+    } else if (mcmd->cpsize) {
         /* If I/O succeeded, we copy the data from the correct offset to the
-         * user */
+         * user. Commands read in place have nothing to copy */
         misalign = mcmd->sequence;  // temp
         memcpy(ucmd->buf + mcmd->buf_off,
             (char *)mcmd->prp[0] + misalign, mcmd->cpsize); // NOLINT
     }
 
+    if (mcmd->bounce) {
+        ztl_wca_bounce_put(mcmd->bounce, ucmd->xd.tdinfo->numa);
+        mcmd->bounce = NULL;
+    }
+
     xztl_atomic_int16_update(&ucmd->ncb, ucmd->ncb + 1);
 
     if (mcmd->status) {
@@ -138,62 +249,108 @@ static void ztl_wca_reorg_ucmd_off(struct xztl_io_ucmd *ucmd) {
     ucmd->noffs = (ucmd->nmcmd > 1) ? curr : 1;
 }
 
+/* Account a media command of a user write. The last one completes the
+ * user command */
+static void ztl_wca_mcmd_done(struct xztl_io_ucmd *ucmd,
+                              struct xztl_io_mcmd *mcmd) {
+    xztl_atomic_int16_update(&ucmd->ncb, ucmd->ncb + 1);
+
+    if (mcmd->status)
+        ZDEBUG(ZDEBUG_WCA,
+               "ztl-wca: Callback. (ID %lu, S %d/%d, C %d, WOFF 0x%lx). St: %d",
+               ucmd->id, mcmd->sequence, ucmd->nmcmd, ucmd->ncb,
+               ucmd->moffset[mcmd->sequence], mcmd->status);
+
+
+    if (ucmd->ncb == ucmd->nmcmd) {
+        /* Appends complete out of order, build the pieces from the
+         * completion addresses */
+        if (mcmd->opcode == XZTL_ZONE_APPEND)
+            ztl_wca_reorg_ucmd_off(ucmd);
+
+        ucmd->completed = 1;
+		ztl()->pro->free_fn(ucmd->prov);
+    }
+}
+
 static void ztl_wca_callback_mcmd(void *arg) {
     struct xztl_io_ucmd * ucmd;
     struct xztl_io_mcmd * mcmd;
     struct app_map_entry  map;
     struct app_zmd_entry *zmd;
     uint64_t              old;
-    int                   ret, off_i;
+    int                   ret;
 
     mcmd = (struct xztl_io_mcmd *)arg;
     ucmd = (struct xztl_io_ucmd *)mcmd->opaque;
 
-    ucmd->minflight[mcmd->sequence_zn] = 0;
+    /* A failed write is retried by the submitter once the writes in
+     * flight to its zone complete */
+    if (mcmd->status && mcmd->opcode == XZTL_CMD_WRITE) {
+        __atomic_add_fetch(&ucmd->nretry, 1, __ATOMIC_RELEASE);
+        __atomic_sub_fetch(&ucmd->minflight[mcmd->sequence_zn], 1,
+                           __ATOMIC_RELEASE);
+        return;
+    }
+
+    __atomic_sub_fetch(&ucmd->minflight[mcmd->sequence_zn], 1,
+                       __ATOMIC_RELEASE);
 
     if (mcmd->status) {
         ucmd->status = mcmd->status;
     } else {
         ucmd->moffset[mcmd->sequence] = mcmd->paddr[0];
-    }
-
-    xztl_atomic_int16_update(&ucmd->ncb, ucmd->ncb + 1);
 
-    if (mcmd->status)
-        ZDEBUG(ZDEBUG_WCA,
-               "ztl-wca: Callback. (ID %lu, S %d/%d, C %d, WOFF 0x%lx). St: %d",
-               ucmd->id, mcmd->sequence, ucmd->nmcmd, ucmd->ncb,
-               ucmd->moffset[mcmd->sequence], mcmd->status);
-
-
-    if (ucmd->ncb == ucmd->nmcmd) {
-        ucmd->completed = 1;
-		ztl()->pro->free_fn(ucmd->prov);
+        /* Zone append placed the command somewhere else in the zone. Its
+         * fragments are contiguous in the zone, one extent remaps them */
+        if (mcmd->paddr[0] != mcmd->addr[0].g.sect) {
+            ret = ztl_pro_grp_zone_remap(
+                ucmd->prov->grp, mcmd->addr[0].g.zone, mcmd->addr[0].g.sect,
+                mcmd->paddr[0], ucmd->msec[mcmd->sequence]);
+            if (ret)
+                ucmd->status = ret;
+        }
     }
+
+    ztl_wca_mcmd_done(ucmd, mcmd);
 }
 
 static void ztl_wca_callback(struct xztl_io_mcmd *mcmd) {
     ztl_wca_callback_mcmd(mcmd);
 }
 
+/* Refill the free node cache of a slot. Slots start their search at
+ * distinct nodes, so refills of distinct slots rarely meet */
 static int ztl_thd_allocNode_for_thd(struct xztl_thread *tdinfo) {
     struct ztl_pro_node_grp *pro = (struct ztl_pro_node_grp *)(glist[0]->pro);
+    struct ztl_pro_node *    nodes[ZTL_ALLOC_NODE_NUM];
+    struct xztl_core *       core;
+    uint32_t                 cnt, node_i, hint;
+    get_xztl_core(&core);
 
-    uint32_t snodeidx = 0;
-    uint32_t cnt      = 0;
+    hint = (uint64_t)tdinfo->tid * pro->totalnode / xtd_num;
+    cnt  = ztl_pro_grp_node_take(glist[0], hint, nodes, ZTL_ALLOC_NODE_NUM);
 
-    pthread_spin_lock(&pro->spin);
+    for (node_i = 0; node_i < cnt; node_i++) {
+        ztl_pro_grp_node_chunk(nodes[node_i], core->write_sec);
+        ztl_pro_md_chunk(nodes[node_i]);
+    }
 
-    for (int i = 0; i < pro->totalnode && cnt < ZTL_ALLOC_NODE_NUM; i++) {
-        if (XZTL_ZMD_NODE_FREE == pro->vnodes[i].status &&
-            pro->vnodes[i].zone_num == ZTL_PRO_ZONE_NUM_INNODE) {
-            pro->vnodes[i].status = XZTL_ZMD_NODE_USED;
-            STAILQ_INSERT_TAIL(&(tdinfo->free_head), &(pro->vnodes[i]), fentry);
-            cnt++;
-            tdinfo->nfree++;
-        }
+    /* The chunk is in the node metadata log before the nodes are written */
+    if (cnt && ztl_pro_md_commit()) {
+        log_err("ztl-thd: Chunk of new nodes not logged.");
+        for (node_i = 0; node_i < cnt; node_i++)
+            ztl_pro_grp_node_put(glist[0], nodes[node_i]);
+        return 0;
     }
-    pthread_spin_unlock(&pro->spin);
+
+    for (node_i = 0; node_i < cnt; node_i++) {
+        STAILQ_INSERT_TAIL(&(tdinfo->free_head), nodes[node_i], fentry);
+        tdinfo->nfree++;
+    }
+
+    xztl_stats_inc(XZTL_STATS_NODE_REFILL, 1);
+    xztl_stats_inc(XZTL_STATS_NODE_ALLOC, cnt);
 
     return cnt;
 }
@@ -222,12 +379,16 @@ static uint32_t ztl_thd_getNodeId(struct xztl_thread *tdinfo) {
     return node->id;
 }
 
-static int ztl_thd_submit(struct xztl_io_ucmd *ucmd) {
+static int ztl_thd_run(struct xztl_io_ucmd *ucmd) {
     int  tid, ret;
     bool flag = true;
 
     tid = ucmd->xd.tid;
 
+    /* Slots are normally opened by zrocks_get_resource */
+    if (!xtd[tid].ready && ztl_thd_slot_open(tid))
+        return -1;
+
     if (ucmd->xd.node_id == -1) {
         ucmd->xd.node_id = ztl_thd_getNodeId(&xtd[tid]);
     }
@@ -249,14 +410,35 @@ static int ztl_thd_submit(struct xztl_io_ucmd *ucmd) {
     return ret;
 }
 
-static uint32_t ztl_wca_ncmd_prov_based(struct app_pro_addr *prov) {
-    uint32_t zn_i, ncmd;
+/* Maximum sectors in a single media write. Chunks of the same zone are
+ * merged in a vectored command up to MDTS */
+static uint32_t ztl_wca_sec_cmd(struct xztl_core *core, uint32_t chunk) {
+    uint32_t sec_cmd = XZTL_MAX_MADDR * chunk;
+
+    if (core->media->geo.sec_mdts && core->media->geo.sec_mdts < sec_cmd)
+        sec_cmd = core->media->geo.sec_mdts / chunk * chunk;
+
+    return (sec_cmd) ? sec_cmd : chunk;
+}
+
+/* A write starting within a chunk gives the zone of that chunk a partial
+ * first fragment, its first command holds one chunk less */
+static uint32_t ztl_wca_ncmd_prov_based(struct app_pro_addr *prov,
+                                        uint32_t sec_cmd, uint32_t chunk) {
+    uint32_t zn_i, ncmd, first;
 
     ncmd = 0;
     for (zn_i = 0; zn_i < prov->naddr; zn_i++) {
-        ncmd += prov->nsec[zn_i] / ZTL_WCA_SEC_MCMD;
-        if (prov->nsec[zn_i] % ZTL_WCA_SEC_MCMD != 0)
-            ncmd++;
+        if (!prov->nsec[zn_i])
+            continue;
+
+        first = sec_cmd;
+        if (zn_i == prov->stripe_off / chunk && prov->stripe_off % chunk)
+            first -= prov->stripe_off % chunk;
+
+        ncmd++;
+        if (prov->nsec[zn_i] > first)
+            ncmd += (prov->nsec[zn_i] - first + sec_cmd - 1) / sec_cmd;
     }
 
     return ncmd;
@@ -276,19 +458,122 @@ static void ztl_wca_poke_ctx(struct xztl_mthread_ctx *tctx) {
     }
 }
 
+/* Wait for the callbacks of 'ncmd' submitted commands of the user command */
+static void ztl_wca_wait_ctx(struct xztl_io_ucmd *ucmd,
+                             struct xztl_mthread_ctx *tctx, uint32_t ncmd) {
+    while (ucmd->ncb < ncmd)
+        xztl_ctx_media_reap(tctx);
+}
+
+/* Prepare a read command of 'nsec' sectors at 'zone_sec_off' in a zone of
+ * the node. The data lands in 'dbuf' or, if NULL, in the bounce buffer
+ * given back by the completion. The caller sets the copy to the user
+ * buffer */
+static struct xztl_io_mcmd *ztl_wca_read_mcmd(struct xztl_io_ucmd *ucmd,
+                                              struct ztl_pro_node *znode,
+                                              uint64_t zindex,
+                                              uint64_t zone_sec_off,
+                                              uint64_t nsec, uint32_t cmd_i,
+                                              char *dbuf, char *bounce) {
+    struct xztl_thread * tdinfo = ucmd->xd.tdinfo;
+    struct xztl_io_mcmd *mcmd   = tdinfo->mcmd[cmd_i];
+    uint64_t             run    = nsec;
+
+    memset(mcmd, 0x0, sizeof(struct xztl_io_mcmd));
+
+    mcmd->opcode       = XZTL_CMD_READ;
+    mcmd->naddr        = 1;
+    mcmd->synch        = 0;
+    mcmd->async_ctx    = tdinfo->rctx;
+    mcmd->addr[0].addr = 0;
+    mcmd->nsec[0]      = nsec;
+    mcmd->prp[0]       = (dbuf) ? (uint64_t)dbuf     // NOLINT
+                                : (uint64_t)bounce;  // NOLINT
+    mcmd->bounce       = (dbuf) ? NULL : bounce;
+
+    mcmd->addr[0].g.sect =
+        znode->vzones[zindex]->addr.g.sect +
+        ztl_pro_zone_off(znode->vzones[zindex], zone_sec_off, &run);
+    mcmd->status   = 0;
+    mcmd->callback = zrocks_read_callback_mcmd;
+
+    mcmd->sequence_zn = zindex;
+    mcmd->opaque      = ucmd;
+    mcmd->submitted   = 0;
+    ucmd->mcmd[cmd_i] = mcmd;
+
+    return mcmd;
+}
+
+/* Submit the prepared commands of a read from 'submitted' on */
+static int ztl_wca_read_submit(struct xztl_io_ucmd *ucmd,
+                               struct xztl_mthread_ctx *tctx,
+                               uint32_t *submitted, uint32_t total_cmd) {
+    uint32_t cmd_i, nsub;
+    int      ret;
+
+    while (*submitted < total_cmd) {
+        ret = xztl_media_submit_io_batch(&ucmd->mcmd[*submitted],
+                                         total_cmd - *submitted, &nsub);
+
+        for (cmd_i = *submitted; cmd_i < *submitted + nsub; cmd_i++)
+            ucmd->mcmd[cmd_i]->submitted = 1;
+        *submitted += nsub;
+
+        if (ret == XZTL_MEDIA_QFULL) {
+            xztl_ctx_media_reap(tctx);
+            continue;
+        }
+
+        if (ret) {
+            log_erra("__zrocks_read err %d\r\n", ret);
+            return ret;
+        }
+    }
+
+    return XZTL_OK;
+}
+
+/* Take a bounce buffer for the next command of a read. Once all buffers
+ * are in use, the commands prepared so far are completed to give theirs
+ * back, then buffers of other reads are waited for */
+static char *ztl_wca_read_bounce(struct xztl_io_ucmd *ucmd,
+                                 struct xztl_mthread_ctx *tctx,
+                                 uint32_t *submitted, uint32_t total_cmd,
+                                 int *ret) {
+    char *buf;
+
+    while (!(buf = ztl_wca_bounce_get(ucmd->xd.tdinfo->numa))) {
+        *ret = ztl_wca_read_submit(ucmd, tctx, submitted, total_cmd);
+        if (*ret)
+            return NULL;
+
+        ztl_wca_wait_ctx(ucmd, tctx, *submitted);
+        sched_yield();
+    }
+
+    return buf;
+}
+
 int ztl_wca_read_ucmd(struct xztl_io_ucmd *ucmd, uint32_t node_id,
                        uint64_t offset, size_t size) {
     struct ztl_pro_node_grp *pro;
     struct ztl_pro_node *    znode;
     struct xztl_io_mcmd *    mcmd;
+    struct xztl_core *       core;
 
     uint64_t misalign, sec_size, sec_start, zindex, zone_sec_off, read_num;
-    uint64_t sec_left, bytes_off, left;
+    uint64_t sec_left, bytes_off, left, chunk_off, cpsize, sec_direct;
+    uint64_t bytes_zcopy, bytes_bounce;
     uint32_t nlevel, ncmd, cmd_i, total_cmd, zone_i, submitted;
+    uint32_t chunk, level_sec, rsec;
+    uint8_t  zcopy, tail, nhead, ntail;
+    char *   bounce;
     int      ret = 0;
 
     struct xztl_thread *     tdinfo = ucmd->xd.tdinfo;
-    struct xztl_mthread_ctx *tctx   = tdinfo->tctx;
+    struct xztl_mthread_ctx *tctx   = tdinfo->rctx;
+    get_xztl_core(&core);
 
     // struct app_group *grp = ztl()->groups.get_fn(0);
     struct app_group *grp = glist[0];
@@ -306,17 +591,22 @@ int ztl_wca_read_ucmd(struct xztl_io_ucmd *ucmd, uint32_t node_id,
     misalign = offset % ZNS_ALIGMENT;
     sec_size = (size + misalign) / ZNS_ALIGMENT +
                (((size + misalign) % ZNS_ALIGMENT) ? 1 : 0);
-    sec_start       = offset / ZNS_ALIGMENT;
-    int level_bytes = ZTL_PRO_ZONE_NUM_INNODE * ZTL_READ_SEC_MCMD;
+    sec_start = offset / ZNS_ALIGMENT;
+
+    /* The node is striped in chunks of the size it was written with, a
+     * read command covers up to 'rsec' sectors of a chunk */
+    chunk     = znode->chunk_sec;
+    rsec      = (core->read_sec < chunk) ? core->read_sec : chunk;
+    level_sec = ZTL_PRO_ZONE_NUM_INNODE * chunk;
 
     /* Count level:(8 * 16=128) (0~127 0lun 128~255 1lun ...)*/
-    nlevel = sec_start / level_bytes;
-    zindex = (sec_start % level_bytes) / ZTL_READ_SEC_MCMD;
-    zone_sec_off = (nlevel * ZTL_READ_SEC_MCMD) +
-                   (sec_start % level_bytes) % ZTL_READ_SEC_MCMD;
-    read_num =
-        ZTL_READ_SEC_MCMD - (sec_start % level_bytes) % ZTL_READ_SEC_MCMD;
-    read_num = (sec_size > read_num) ? read_num : sec_size;
+    nlevel       = sec_start / level_sec;
+    zindex       = (sec_start % level_sec) / chunk;
+    chunk_off    = (sec_start % level_sec) % chunk;
+    zone_sec_off = nlevel * chunk + chunk_off;
+    read_num     = chunk - chunk_off;
+    read_num     = (rsec < read_num) ? rsec : read_num;
+    read_num     = (sec_size > read_num) ? read_num : sec_size;
 
     /*printf("misalign=%lu sec_size=%lu sec_start=%lu nlevel=%d zindex=%lu
        zone_sec_off=%lu read_num=%lu\r\n",
@@ -326,118 +616,366 @@ int ztl_wca_read_ucmd(struct xztl_io_ucmd *ucmd, uint32_t node_id,
     if (ZROCKS_DEBUG)
         log_infoa("zrocks (__read): sec_size %lu\n", sec_size);
 
-    sec_left  = sec_size;
-    bytes_off = 0;
-    left      = size;
-    total_cmd = 0;
+    /* Sectors read in full land in the user buffer if it is sector aligned
+     * with the offset, only the partial head and tail sectors are read
+     * through the bounce buffers of the slot */
+    zcopy = (core->media->caps & XZTL_MEDIA_CAP_HOSTBUF) &&
+            !(((uintptr_t)ucmd->buf - misalign) % ZNS_ALIGMENT);
+    tail = ((size + misalign) % ZNS_ALIGMENT) ? 1 : 0;
+
+    sec_left     = sec_size;
+    bytes_off    = 0;
+    left         = size;
+    total_cmd    = 0;
+    submitted    = 0;
+    bytes_zcopy  = 0;
+    bytes_bounce = 0;
+    ucmd->ncb    = 0;
     while (sec_left) {
-        mcmd = tdinfo->mcmd[total_cmd];
-        memset(mcmd, 0x0, sizeof(struct xztl_io_mcmd));
-
-        mcmd->opcode       = XZTL_CMD_READ;
-        mcmd->naddr        = 1;
-        mcmd->synch        = 0;
-        mcmd->async_ctx    = tctx;
-        mcmd->addr[0].addr = 0;
-        mcmd->nsec[0]      = read_num;
-
-        sec_left -= mcmd->nsec[0];
-        mcmd->prp[0] = tdinfo->prp[total_cmd];
-
-        mcmd->addr[0].g.sect =
-            znode->vzones[zindex]->addr.g.sect + zone_sec_off;
-        mcmd->status   = 0;
-        mcmd->callback = zrocks_read_callback_mcmd;
-
-        mcmd->sequence    = misalign;  // tmp prp offset
-        mcmd->sequence_zn = zindex;
-        mcmd->buf_off     = bytes_off;  // temp
-        mcmd->cpsize =
-            (mcmd->nsec[0] * ZNS_ALIGMENT) - misalign > left
-                ? left
-                : ((mcmd->nsec[0] * ZNS_ALIGMENT) - misalign);  // copy size
-        left -= mcmd->cpsize;
-
-        mcmd->opaque          = ucmd;
-        mcmd->submitted       = 0;
-        ucmd->mcmd[total_cmd] = mcmd;
-
-        total_cmd++;
+        /* Extents remapped by zone append split the piece. Commands of the
+         * slot are reused once the prepared ones complete */
+        ztl_pro_zone_off(znode->vzones[zindex], zone_sec_off, &read_num);
+        if (total_cmd + 3 > ZTL_TH_RC_NUM) {
+            ret = ztl_wca_read_submit(ucmd, tctx, &submitted, total_cmd);
+            if (ret)
+                goto FAIL_SUBMIT;
+
+            ztl_wca_wait_ctx(ucmd, tctx, submitted);
+            total_cmd = 0;
+            submitted = 0;
+            ucmd->ncb = 0;
+        }
+
+        sec_left -= read_num;
+        nhead      = (misalign) ? 1 : 0;
+        ntail      = (sec_left) ? 0 : tail;
+        sec_direct = (read_num > nhead + ntail) ? read_num - nhead - ntail : 0;
+
+        /* A piece is split in up to 3 commands */
+        if (!zcopy || !sec_direct) {
+            bounce = ztl_wca_read_bounce(ucmd, tctx, &submitted, total_cmd,
+                                         &ret);
+            if (!bounce)
+                goto FAIL_SUBMIT;
+            mcmd = ztl_wca_read_mcmd(ucmd, znode, zindex, zone_sec_off,
+                                     read_num, total_cmd++, NULL, bounce);
+            mcmd->sequence = misalign;  // tmp prp offset
+            mcmd->buf_off  = bytes_off;
+            mcmd->cpsize   = (read_num * ZNS_ALIGMENT) - misalign > left
+                               ? left
+                               : ((read_num * ZNS_ALIGMENT) - misalign);
+            bytes_bounce += mcmd->cpsize;
+        } else {
+            if (nhead) {
+                bounce = ztl_wca_read_bounce(ucmd, tctx, &submitted,
+                                             total_cmd, &ret);
+                if (!bounce)
+                    goto FAIL_SUBMIT;
+                mcmd = ztl_wca_read_mcmd(ucmd, znode, zindex, zone_sec_off, 1,
+                                         total_cmd++, NULL, bounce);
+                mcmd->sequence = misalign;
+                mcmd->buf_off  = bytes_off;
+                mcmd->cpsize   = ZNS_ALIGMENT - misalign;
+                bytes_bounce += mcmd->cpsize;
+            }
+
+            cpsize = (nhead) ? ZNS_ALIGMENT - misalign : 0;
+            mcmd   = ztl_wca_read_mcmd(ucmd, znode, zindex,
+                                       zone_sec_off + nhead, sec_direct,
+                                       total_cmd++,
+                                       (char *)ucmd->buf + bytes_off + cpsize,
+                                       NULL);
+            mcmd->buf_off = bytes_off + cpsize;
+            mcmd->cpsize  = 0;
+            cpsize += sec_direct * ZNS_ALIGMENT;
+            bytes_zcopy += sec_direct * ZNS_ALIGMENT;
+
+            if (ntail) {
+                bounce = ztl_wca_read_bounce(ucmd, tctx, &submitted,
+                                             total_cmd, &ret);
+                if (!bounce)
+                    goto FAIL_SUBMIT;
+                mcmd = ztl_wca_read_mcmd(ucmd, znode, zindex,
+                                         zone_sec_off + read_num - 1, 1,
+                                         total_cmd++, NULL, bounce);
+                mcmd->buf_off = bytes_off + cpsize;
+                mcmd->cpsize  = left - cpsize;
+                bytes_bounce += mcmd->cpsize;
+            }
+        }
+
+        cpsize = (read_num * ZNS_ALIGMENT) - misalign > left
+                     ? left
+                     : ((read_num * ZNS_ALIGMENT) - misalign);
+        left -= cpsize;
 
         if (sec_left == 0)
             break;
 
-        zindex = (zindex + 1) % ZTL_PRO_ZONE_NUM_INNODE;
-        if (zindex == 0)
-            nlevel++;
+        chunk_off += read_num;
+        if (chunk_off == chunk) {
+            chunk_off = 0;
+            zindex    = (zindex + 1) % ZTL_PRO_ZONE_NUM_INNODE;
+            if (zindex == 0)
+                nlevel++;
+        }
 
-        zone_sec_off = nlevel * ZTL_READ_SEC_MCMD;
-        read_num =
-            (sec_left > ZTL_READ_SEC_MCMD) ? ZTL_READ_SEC_MCMD : sec_left;
-        bytes_off += mcmd->cpsize;
+        zone_sec_off = nlevel * chunk + chunk_off;
+        read_num     = chunk - chunk_off;
+        read_num     = (rsec < read_num) ? rsec : read_num;
+        read_num     = (sec_left > read_num) ? read_num : sec_left;
+        bytes_off += cpsize;
         misalign = 0;
     }
 
+    xztl_stats_inc(XZTL_STATS_READ_ZCOPY_BYTES, bytes_zcopy);
+    xztl_stats_inc(XZTL_STATS_READ_BOUNCE_BYTES, bytes_bounce);
+
     if (total_cmd == 1) {
-        ucmd->mcmd[0]->synch = 1;
-        ret = xztl_media_submit_io(ucmd->mcmd[0]);
+        mcmd        = ucmd->mcmd[0];
+        mcmd->synch = 1;
+        ret         = xztl_media_submit_io(mcmd);
 
-        misalign = ucmd->mcmd[0]->sequence;
-        memcpy(ucmd->buf,
-           (char *) ( ucmd->mcmd[0]->prp[0] + misalign), /* NOLINT */
-            ucmd->mcmd[0]->cpsize);
+        if (!ret && mcmd->cpsize)
+            memcpy(ucmd->buf + mcmd->buf_off,
+                   (char *)(mcmd->prp[0] + mcmd->sequence),  // NOLINT
+                   mcmd->cpsize);
+        if (mcmd->bounce)
+            ztl_wca_bounce_put(mcmd->bounce, tdinfo->numa);
 
         ucmd->completed = 1;
         return ret;
     }
 
-    submitted = 0;
-    while (submitted < total_cmd) {
-        for (cmd_i = 0; cmd_i < total_cmd; cmd_i++) {
-            if (ucmd->mcmd[cmd_i]->submitted)
-                continue;
-
-            ret = xztl_media_submit_io(ucmd->mcmd[cmd_i]);
-            if (ret) {
-                log_erra("__zrocks_read err %d\r\n", ret);
-                goto FAIL_SUBMIT;
-            }
-
-            ucmd->mcmd[cmd_i]->submitted = 1;
-            submitted++;
-        }
-    }
+    ret = ztl_wca_read_submit(ucmd, tctx, &submitted, total_cmd);
+    if (ret)
+        goto FAIL_SUBMIT;
 
-    int err = xnvme_queue_wait(tctx->queue);
-    if (err < 0) {
-        log_erra("xnvme_queue_wait() returns error %d\r\n", err);
-    }
+    ztl_wca_wait_ctx(ucmd, tctx, submitted);
     ucmd->completed = 1;
     return ret;
 
 FAIL_SUBMIT:
+    /* Commands not submitted give their bounce buffers back here */
+    for (cmd_i = submitted; cmd_i < total_cmd; cmd_i++) {
+        if (ucmd->mcmd[cmd_i]->bounce)
+            ztl_wca_bounce_put(ucmd->mcmd[cmd_i]->bounce, tdinfo->numa);
+    }
+
     if (submitted) {
-        int err = xnvme_queue_wait(tctx->queue);
-        if (err < 0) {
-            log_erra("xnvme_queue_wait() returns error %d\r\n", err);
-        }
+        ztl_wca_wait_ctx(ucmd, tctx, submitted);
         ucmd->completed = 1;
     }
 
     return ret;
 }
 
+static void ztl_wca_read_fast_callback(void *arg) {
+    struct xztl_io_mcmd *mcmd = (struct xztl_io_mcmd *)arg;
+
+    __atomic_store_n((uint8_t *)mcmd->opaque, 1, __ATOMIC_RELEASE);
+}
+
+/* Reads within a single read command (core->read_sec sectors in a chunk)
+ * skip the user command. The media command is submitted on the polled queue
+ * of the slot and its completion is polled without sleeping. Aligned
+ * buffers are read in place, others through the bounce buffer of the slot.
+ * Returns XZTL_ZTL_WCA_SLOW if the read needs several media commands */
+static int ztl_wca_read_fast(uint32_t node_id, uint64_t offset, void *buf,
+                             size_t size, int tid, uint64_t *lat_ns) {
+    struct ztl_pro_node_grp *pro;
+    struct ztl_pro_node *    znode;
+    struct xztl_io_mcmd *    mcmd;
+    struct xztl_thread *     tdinfo;
+    struct xztl_core *       core;
+    struct timespec          ts;
+    uint64_t misalign, sec_size, sec_start, sec_off, zindex, zone_sec_off;
+    uint64_t start, end, poff, run;
+    uint32_t chunk, level_sec, nlevel;
+    uint8_t  direct, done;
+    char *   bounce;
+    int      ret;
+
+    /* With worker dispatch, the slot resources belong to the worker */
+    if (!size || tid < 0 || tid >= xtd_num || !xtd[tid].ready ||
+        xtd[tid].ainflight || ztl_wca_dispatch == ZTL_DISPATCH_WORKER)
+        return XZTL_ZTL_WCA_SLOW;
+
+    GET_NANOSECONDS(start, ts);
+    get_xztl_core(&core);
+
+    pro   = glist[0]->pro;
+    znode = (struct ztl_pro_node *)(&pro->vnodes[node_id]);
+
+    misalign  = offset % ZNS_ALIGMENT;
+    sec_size  = (size + misalign + ZNS_ALIGMENT - 1) / ZNS_ALIGMENT;
+    sec_start = offset / ZNS_ALIGMENT;
+    chunk     = znode->chunk_sec;
+    level_sec = ZTL_PRO_ZONE_NUM_INNODE * chunk;
+    sec_off   = (sec_start % level_sec) % chunk;
+
+    if (sec_off + sec_size > chunk || sec_size > core->read_sec)
+        return XZTL_ZTL_WCA_SLOW;
+
+    tdinfo = &xtd[tid];
+
+    nlevel       = sec_start / level_sec;
+    zindex       = (sec_start % level_sec) / chunk;
+    zone_sec_off = nlevel * chunk + sec_off;
+
+    /* A read across extents remapped by zone append takes several
+     * commands */
+    run  = sec_size;
+    poff = ztl_pro_zone_off(znode->vzones[zindex], zone_sec_off, &run);
+    if (run < sec_size)
+        return XZTL_ZTL_WCA_SLOW;
+
+    direct = !misalign && !(size % ZNS_ALIGMENT) &&
+             !((uintptr_t)buf % ZNS_ALIGMENT) &&
+             (core->media->caps & XZTL_MEDIA_CAP_HOSTBUF);
+
+    bounce = NULL;
+    if (!direct) {
+        bounce = ztl_wca_bounce_get(tdinfo->numa);
+        if (!bounce)
+            return XZTL_ZTL_WCA_SLOW;
+    }
+
+    mcmd = tdinfo->mcmd[0];
+    memset(mcmd, 0x0, sizeof(struct xztl_io_mcmd));
+
+    done                 = 0;
+    mcmd->opcode         = XZTL_CMD_READ;
+    mcmd->naddr          = 1;
+    mcmd->synch          = 0;
+    mcmd->async_ctx      = tdinfo->pctx;
+    mcmd->nsec[0]        = sec_size;
+    mcmd->prp[0]         = (direct) ? (uint64_t)buf      // NOLINT
+                                    : (uint64_t)bounce;  // NOLINT
+    mcmd->addr[0].g.sect = znode->vzones[zindex]->addr.g.sect + poff;
+    mcmd->callback       = ztl_wca_read_fast_callback;
+    mcmd->opaque         = &done;
+
+    ret = xztl_media_submit_io(mcmd);
+    if (!ret) {
+        while (!__atomic_load_n(&done, __ATOMIC_ACQUIRE))
+            xztl_ctx_media_poke(tdinfo->pctx);
+        ret = mcmd->status;
+    }
+
+    if (!ret && !direct)
+        memcpy(buf, bounce + misalign, size);
+    if (bounce)
+        ztl_wca_bounce_put(bounce, tdinfo->numa);
+    if (ret)
+        return ret;
+
+    GET_NANOSECONDS(end, ts);
+    if (lat_ns)
+        *lat_ns = end - start;
+
+    xztl_stats_inc(XZTL_STATS_READ_FAST, 1);
+    if (direct) {
+        xztl_stats_inc(XZTL_STATS_READ_FAST_DIRECT, 1);
+        xztl_stats_inc(XZTL_STATS_READ_ZCOPY_BYTES, size);
+    } else {
+        xztl_stats_inc(XZTL_STATS_READ_BOUNCE_BYTES, size);
+    }
+
+    return XZTL_OK;
+}
+
+/* Handle the failed writes of a zone. Once a write of a zone fails, the
+ * following writes of the zone fail too. They are given back when the zone
+ * has no write in flight. If the zone write pointer is at the first failed
+ * write, the zone is resubmitted from it one write at a time. Otherwise,
+ * or after ZTL_WCA_WRITE_RETRY attempts, the remaining writes of the zone
+ * fail the user command. Returns 1 while failed writes wait for the zone */
+static int ztl_wca_write_retry(struct xztl_io_ucmd *ucmd, uint32_t zn_i,
+                               int *cmd_id, int ncmd_zn, int *index,
+                               uint8_t *depth, uint8_t *retry) {
+    struct xnvme_spec_znd_descr zinfo;
+    struct xztl_io_mcmd *       mcmd;
+    struct xztl_core *          core;
+    int                         first, pos, nfail, ret;
+
+    for (first = 0; first < *index; first++) {
+        if (ucmd->mcmd[cmd_id[first]]->status)
+            break;
+    }
+    if (first == *index)
+        return 0;
+
+    if (__atomic_load_n(&ucmd->minflight[zn_i], __ATOMIC_ACQUIRE))
+        return 1;
+
+    get_xztl_core(&core);
+    mcmd = ucmd->mcmd[cmd_id[first]];
+
+    nfail = 0;
+    for (pos = first; pos < *index; pos++) {
+        if (ucmd->mcmd[cmd_id[pos]]->status)
+            nfail++;
+    }
+    __atomic_sub_fetch(&ucmd->nretry, nfail, __ATOMIC_RELEASE);
+
+    ret = xztl_media_zone_info(
+        mcmd->addr[0].g.grp * core->media->geo.zn_grp + mcmd->addr[0].g.zone,
+        &zinfo);
+    if (!ret && zinfo.wp == mcmd->addr[0].g.sect &&
+        (*retry)++ < ZTL_WCA_WRITE_RETRY) {
+        ZDEBUG(ZDEBUG_WCA, "ztl-wca: Write retry. zone %d, sect 0x%lx, n %d",
+               mcmd->addr[0].g.zone, (uint64_t)mcmd->addr[0].g.sect,
+               *index - first);
+
+        for (pos = first; pos < *index; pos++) {
+            ucmd->mcmd[cmd_id[pos]]->status    = 0;
+            ucmd->mcmd[cmd_id[pos]]->submitted = 0;
+        }
+        xztl_stats_inc(XZTL_STATS_WRITE_RETRY, *index - first);
+
+        *index = first;
+        *depth = 1;
+        return 0;
+    }
+
+    log_erra("ztl-wca: Write failed. zone %d, sect 0x%lx, wp 0x%lx, st %d",
+             mcmd->addr[0].g.zone, (uint64_t)mcmd->addr[0].g.sect,
+             (ret) ? 0 : zinfo.wp, mcmd->status);
+
+    ucmd->status = XZTL_ZTL_WCA_S_ERR;
+    for (pos = first; pos < ncmd_zn; pos++) {
+        mcmd = ucmd->mcmd[cmd_id[pos]];
+        if (pos < *index && !mcmd->status)
+            continue;
+
+        mcmd->status = XZTL_ZTL_WCA_S_ERR;
+        ztl_wca_mcmd_done(ucmd, mcmd);
+    }
+    *index = ncmd_zn;
+
+    return 0;
+}
+
 void ztl_wca_write_ucmd(struct xztl_io_ucmd *ucmd, int32_t *node_id) {
-    struct app_pro_addr *prov;
-    struct xztl_io_mcmd *mcmd;
-    struct xztl_core *   core;
+    struct app_pro_addr *    prov;
+    struct xztl_io_mcmd *    mcmd;
+    struct ztl_pro_node_grp *pro;
+    struct xztl_core *       core;
     get_xztl_core(&core);
-    uint32_t nsec, nsec_zn, ncmd, cmd_i, zn_i, submitted;
+    uint32_t nsec, ncmd, cmd_i, zn_i, submitted, sec_cmd, chunk;
+    struct xztl_io_mcmd *zn_mcmd[ZTL_PRO_STRIPE * 2] = {NULL};
+    struct xztl_io_mcmd *batch[ZTL_TH_RC_NUM];
+    uint32_t             nbatch, nsub;
+    uint8_t              more;
+    uint8_t              zn_depth[ZTL_PRO_STRIPE * 2];
+    uint8_t              zn_retry[ZTL_PRO_STRIPE * 2];
+    uint8_t              zn_stall[ZTL_PRO_STRIPE * 2];
     int      zn_cmd_id[ZTL_PRO_STRIPE * 2][2000] = {-1};
     int      zn_cmd_id_num[ZTL_PRO_STRIPE * 2]   = {0};
-    uint64_t boff;
-    int      ret, ncmd_zn, zncmd_i;
-	int ret = 0;
+    uint64_t boff, soff, piece;
+    int      ncmd_zn, zncmd_i;
+    int      ret = 0;
 
     struct xztl_thread *     tdinfo = ucmd->xd.tdinfo;
     struct xztl_mthread_ctx *tctx   = tdinfo->tctx;
@@ -453,7 +991,7 @@ void ztl_wca_write_ucmd(struct xztl_io_ucmd *ucmd, int32_t *node_id) {
         goto FAILURE;
     }
 
-    /* First we check the number of commands based on ZTL_WCA_SEC_MCMD */
+    /* First we check the number of commands based on the minimum chunk */
     ncmd = nsec / ZTL_WCA_SEC_MCMD;
     if (nsec % ZTL_WCA_SEC_MCMD != 0)
         ncmd++;
@@ -478,7 +1016,10 @@ void ztl_wca_write_ucmd(struct xztl_io_ucmd *ucmd, int32_t *node_id) {
 		goto FAILURE;
 
     /* We check the number of commands again based on the provisioning */
-    ncmd = ztl_wca_ncmd_prov_based(prov);
+    pro     = (struct ztl_pro_node_grp *)glist[0]->pro;
+    chunk   = pro->vnodes[*node_id].chunk_sec;
+    sec_cmd = ztl_wca_sec_cmd(core, chunk);
+    ncmd    = ztl_wca_ncmd_prov_based(prov, sec_cmd, chunk);
     if (ncmd > XZTL_IO_MAX_MCMD) {
         log_erra(
             "ztl-wca: User command exceed XZTL_IO_MAX_MCMD. "
@@ -500,105 +1041,145 @@ void ztl_wca_write_ucmd(struct xztl_io_ucmd *ucmd, int32_t *node_id) {
     cmd_i = 0;
     int zone_sector_num[ZTL_PRO_STRIPE * 2] = {0};
 
+    nsec = 0;
     for (int i = 0; i < prov->naddr; i++) {
         zone_sector_num[i] = prov->nsec[i];
+        nsec += prov->nsec[i];
     }
 
-    while (cmd_i < ncmd) {
-        for (zn_i = 0; zn_i < prov->naddr; zn_i++) {
-            nsec_zn = zone_sector_num[zn_i];
-            if (nsec_zn <= 0) {
-                continue;
-            }
-
+    /* The buffer is striped across the zones in chunks of the node, from
+     * the stripe offset where the previous write stopped. Chunks of the
+     * same zone are contiguous in the zone, so they are merged as fragments
+     * of a vectored command up to sec_cmd */
+    soff = prov->stripe_off;
+    while (nsec) {
+        zn_i  = soff / chunk;
+        piece = chunk - soff % chunk;
+        piece = (piece < nsec) ? piece : nsec;
+        soff  = (soff + piece) % (ZTL_PRO_ZONE_NUM_INNODE * chunk);
+
+        mcmd = zn_mcmd[zn_i];
+        if (!mcmd) {
             mcmd = tdinfo->mcmd[cmd_i];
             mcmd->opcode =
-                (XZTL_WRITE_APPEND) ? XZTL_ZONE_APPEND : XZTL_CMD_WRITE;
+                (core->append) ? XZTL_ZONE_APPEND : XZTL_CMD_WRITE;
             mcmd->synch       = 0;
             mcmd->submitted   = 0;
             mcmd->sequence    = cmd_i;
             mcmd->sequence_zn = zn_i;
-            mcmd->naddr       = 1;
+            mcmd->naddr       = 0;
             mcmd->status      = 0;
-            mcmd->nsec[0] =
-                (nsec_zn >= ZTL_WCA_SEC_MCMD) ? ZTL_WCA_SEC_MCMD : nsec_zn;
 
+            /* With zone append, the sector is the expected address. The
+             * callback compares it with the address returned by the
+             * device */
             mcmd->addr[0].g.grp  = prov->addr[zn_i].g.grp;
             mcmd->addr[0].g.zone = prov->addr[zn_i].g.zone;
-
-            if (!XZTL_WRITE_APPEND) {
-                mcmd->addr[0].g.sect = (uint64_t)prov->addr[zn_i].g.sect;
-            }
-
-            zone_sector_num[zn_i] -= mcmd->nsec[0];
-            prov->addr[zn_i].g.sect += mcmd->nsec[0];
-
-            ucmd->msec[cmd_i] = mcmd->nsec[0];
-            mcmd->prp[0]      = boff;
-            boff += core->media->geo.nbytes * mcmd->nsec[0];
+            mcmd->addr[0].g.sect = (uint64_t)prov->addr[zn_i].g.sect;
 
             mcmd->callback  = ztl_wca_callback_mcmd;
             mcmd->opaque    = ucmd;
             mcmd->async_ctx = tctx;
 
+            ucmd->msec[cmd_i]            = 0;
             ucmd->mcmd[cmd_i]            = mcmd;
             ucmd->mcmd[cmd_i]->submitted = 0;
             zn_cmd_id[zn_i][zn_cmd_id_num[zn_i]++] = cmd_i;
+            zn_mcmd[zn_i]                          = mcmd;
             cmd_i++;
         }
+
+        mcmd->nsec[mcmd->naddr] = piece;
+        mcmd->prp[mcmd->naddr]  = boff;
+
+        zone_sector_num[zn_i] -= mcmd->nsec[mcmd->naddr];
+        nsec -= mcmd->nsec[mcmd->naddr];
+        prov->addr[zn_i].g.sect += mcmd->nsec[mcmd->naddr];
+        ucmd->msec[mcmd->sequence] += mcmd->nsec[mcmd->naddr];
+        boff += core->media->geo.nbytes * mcmd->nsec[mcmd->naddr];
+        mcmd->naddr++;
+
+        /* Close the command if the next chunk does not fit */
+        if (mcmd->naddr == XZTL_MAX_MADDR || !zone_sector_num[zn_i] ||
+            ucmd->msec[mcmd->sequence] + chunk > sec_cmd)
+            zn_mcmd[zn_i] = NULL;
     }
 
     ZDEBUG(ZDEBUG_WCA, "ztl-wca: Populated: %d", cmd_i);
 
     /* Submit media commands */
-    for (cmd_i = 0; cmd_i < ZTL_PRO_STRIPE * 2; cmd_i++)
-        ucmd->minflight[cmd_i] = 0;
-
+    for (zn_i = 0; zn_i < ZTL_PRO_STRIPE * 2; zn_i++) {
+        ucmd->minflight[zn_i] = 0;
+        zn_depth[zn_i]        = ztl_wca_zdepth;
+        zn_retry[zn_i]        = 0;
+        zn_stall[zn_i]        = 0;
+    }
+    ucmd->nretry = 0;
 
     submitted = 0;
     int zn_cmd_id_index[ZTL_PRO_STRIPE * 2] = {0};
-    while (submitted < ncmd) {
-        for (zn_i = 0; zn_i < prov->naddr; zn_i++) {
-            int index = zn_cmd_id_index[zn_i];
-            int num   = zn_cmd_id_num[zn_i];
-            if (index >= num) {
-                continue;
-            }
+    while (ucmd->ncb < ucmd->nmcmd) {
+        if (__atomic_load_n(&ucmd->nretry, __ATOMIC_ACQUIRE)) {
+            for (zn_i = 0; zn_i < prov->naddr; zn_i++)
+                zn_stall[zn_i] = ztl_wca_write_retry(
+                    ucmd, zn_i, zn_cmd_id[zn_i], zn_cmd_id_num[zn_i],
+                    &zn_cmd_id_index[zn_i], &zn_depth[zn_i], &zn_retry[zn_i]);
+        }
 
-            /* Limit to 1 write per zone if append is not supported */
-            if (!XZTL_WRITE_APPEND) {
-                if (ucmd->minflight[zn_i]) {
-                    ztl_wca_poke_ctx(tctx);
+        /* Gather the next commands of each zone in order. Without append
+         * a zone has up to zn_depth writes in flight */
+        nbatch = 0;
+        do {
+            more = 0;
+            for (zn_i = 0; zn_i < prov->naddr; zn_i++) {
+                int index = zn_cmd_id_index[zn_i];
+                int num   = zn_cmd_id_num[zn_i];
+                if (index >= num || zn_stall[zn_i]) {
                     continue;
                 }
 
-                ucmd->minflight[zn_i] = 1;
-            }
+                if (!core->append &&
+                    __atomic_load_n(&ucmd->minflight[zn_i], __ATOMIC_ACQUIRE) >=
+                        zn_depth[zn_i])
+                    continue;
 
-            ret = xztl_media_submit_io(ucmd->mcmd[zn_cmd_id[zn_i][index]]);
-            if (ret) {
-                ztl_wca_poke_ctx(tctx);
-                zn_i--;
-                continue;
+                __atomic_add_fetch(&ucmd->minflight[zn_i], 1, __ATOMIC_RELEASE);
+                batch[nbatch++] = ucmd->mcmd[zn_cmd_id[zn_i][index]];
+                zn_cmd_id_index[zn_i]++;
+                more = 1;
             }
+        } while (more && nbatch + prov->naddr <= ZTL_TH_RC_NUM);
+
+        /* All zones have their writes in flight */
+        if (!nbatch) {
+            xztl_ctx_media_reap(tctx);
+            continue;
+        }
 
-            ucmd->mcmd[zn_cmd_id[zn_i][index]]->submitted = 1;
-            submitted++;
-            zn_cmd_id_index[zn_i]++;
+        ret = xztl_media_submit_io_batch(batch, nbatch, &nsub);
 
-            if (submitted % ZTL_PRO_STRIPE == 0)
-                ztl_wca_poke_ctx(tctx);
+        for (cmd_i = 0; cmd_i < nsub; cmd_i++)
+            batch[cmd_i]->submitted = 1;
+        submitted += nsub;
+
+        /* Queue is full, give back the commands not submitted. Commands
+         * of a zone are given back from the last one */
+        for (cmd_i = nbatch; cmd_i > nsub; cmd_i--) {
+            zn_i = batch[cmd_i - 1]->sequence_zn;
+            zn_cmd_id_index[zn_i]--;
+            __atomic_sub_fetch(&ucmd->minflight[zn_i], 1, __ATOMIC_RELEASE);
         }
-        usleep(1);
-    }
 
-    /* Poke the context for completions */
-    while (ucmd->ncb < ucmd->nmcmd) {
         ztl_wca_poke_ctx(tctx);
     }
 
     ZDEBUG(ZDEBUG_WCA, "  Submitted: %d", submitted);
 
+    /* Chunks placed elsewhere by zone append are in the node metadata log
+     * before the command is returned */
+    if (core->append && ztl_pro_md_commit() && !ucmd->status)
+        ucmd->status = XZTL_ZTL_MD_ERR;
+
     return;
 
     /* If we get a submit failure but previous I/Os have been
@@ -616,118 +1197,625 @@ FAILURE:
     ucmd->completed = 1;
 }
 
-static void *ztl_process_th(void *arg) {
-    struct xztl_io_ucmd *ucmd;
+/* Wake the slot worker if it sleeps. The fence orders the push before the
+ * check, the worker sets wca_sleeping before checking the ring */
+static void ztl_thd_wake(struct xztl_thread *td) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&td->wca_sleeping, __ATOMIC_SEQ_CST) &&
+        __atomic_exchange_n(&td->wca_sleeping, 0, __ATOMIC_SEQ_CST))
+        sem_post(&td->ucmd_sem);
+}
 
-    uint8_t             tid = *(uint8_t *)arg; // NOLINT
-    struct xztl_thread *td  = &xtd[tid];
+/* Queue a user command to the slot worker */
+static void ztl_thd_enqueue(struct xztl_thread *td, struct xztl_io_ucmd *ucmd) {
+    while (xztl_ring_push(&td->ring, ucmd)) {
+        ztl_thd_wake(td);
+        sched_yield();
+    }
+    ztl_thd_wake(td);
+}
 
-    td->wca_running = 1;
+/* The worker polls the ring for wait_spin_us and then sleeps until a
+ * command is queued */
+static void ztl_thd_worker_wait(struct xztl_thread *td) {
+    struct xztl_core *core;
+    struct timespec   ts;
+    uint64_t          start, now;
+    get_xztl_core(&core);
 
-    while (td->wca_running) {
-NEXT:
-        if (!STAILQ_EMPTY(&td->ucmd_head)) {
-            pthread_spin_lock(&td->ucmd_spin);
+    GET_MICROSECONDS(start, ts);
+    now = start;
+    while (now - start < core->wait_spin_us) {
+        if (!xztl_ring_empty(&td->ring) || !td->wca_running)
+            return;
+        GET_MICROSECONDS(now, ts);
+    }
 
-            ucmd = STAILQ_FIRST(&td->ucmd_head);
-            STAILQ_REMOVE_HEAD(&td->ucmd_head, entry);
+    __atomic_store_n(&td->wca_sleeping, 1, __ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (xztl_ring_empty(&td->ring) && td->wca_running) {
+        while (sem_wait(&td->ucmd_sem) && errno == EINTR) {
+        }
+    }
+    __atomic_store_n(&td->wca_sleeping, 0, __ATOMIC_SEQ_CST);
+}
 
-            pthread_spin_unlock(&td->ucmd_spin);
+static int ztl_thd_pooled(struct xztl_thread *td, struct xztl_io_ucmd *ucmd) {
+    return td->aucmd && ucmd >= td->aucmd && ucmd < td->aucmd + ztl_wca_adepth;
+}
 
-            if (ucmd->prov_type == XZTL_CMD_READ) {
-                ztl_wca_read_ucmd(ucmd, ucmd->xd.node_id, ucmd->offset,
-                                  ucmd->size);
-            } else if (ucmd->prov_type == XZTL_CMD_WRITE) {
-                ztl_wca_write_ucmd(ucmd, &ucmd->xd.node_id);
-            }
+/* Slot worker. Queued user commands run in order on the slot commands and
+ * buffers, popped in batches of ZTL_WORKER_BATCH. The worker runs on the
+ * CPUs given by the affinity policy, by default those of the slot NUMA
+ * node, and leaves once the ring is drained and wca_running is cleared */
+static void *ztl_process_th(void *arg) {
+    struct xztl_thread * td = (struct xztl_thread *)arg;
+    struct xztl_io_ucmd *ucmd[ZTL_WORKER_BATCH];
+    uint32_t             nucmd, ucmd_i;
+    int                  ret;
+
+    xztl_numa_pin_slot(td->numa, td->tid);
+
+    while (1) {
+        nucmd = xztl_ring_pop(&td->ring, (void **)ucmd, ZTL_WORKER_BATCH);
+        if (!nucmd) {
+            if (!td->wca_running)
+                break;
+            ztl_thd_worker_wait(td);
+            continue;
+        }
 
-            goto NEXT;
+        for (ucmd_i = 0; ucmd_i < nucmd; ucmd_i++) {
+            ret = ztl_thd_run(ucmd[ucmd_i]);
+            if ((ret || ucmd[ucmd_i]->xd.node_id == -1) &&
+                !ucmd[ucmd_i]->status)
+                ucmd[ucmd_i]->status = XZTL_ZTL_WCA_ERR;
+            ucmd[ucmd_i]->completed = 1;
+
+            if (ucmd[ucmd_i]->callback) {
+                ucmd[ucmd_i]->callback(ucmd[ucmd_i]);
+            } else if (ztl_thd_pooled(td, ucmd[ucmd_i])) {
+                pthread_spin_lock(&td->ucmd_spin);
+                STAILQ_INSERT_TAIL(&td->cpl_head, ucmd[ucmd_i], entry);
+                pthread_spin_unlock(&td->ucmd_spin);
+            } else {
+                /* Synchronous command, the submitter owns it from now */
+                __atomic_store_n(&ucmd[ucmd_i]->wdone, 1, __ATOMIC_RELEASE);
+            }
         }
     }
 
     return NULL;
 }
 
+/* The worker of a slot is started by the first command queued to it */
+static int ztl_thd_worker_start(struct xztl_thread *td) {
+    if (td->wca_running)
+        return XZTL_OK;
+
+    if (xztl_ring_init(&td->ring, ztl_wca_adepth * 2, td->numa))
+        return XZTL_MEM;
+
+    if (sem_init(&td->ucmd_sem, 0, 0))
+        goto RING;
+
+    td->wca_sleeping = 0;
+    td->wca_running  = 1;
+    if (pthread_create(&td->wca_thread, NULL, ztl_process_th, td)) {
+        td->wca_running = 0;
+        sem_destroy(&td->ucmd_sem);
+        goto RING;
+    }
+
+    return XZTL_OK;
+
+RING:
+    xztl_ring_exit(&td->ring);
+    return XZTL_ZTL_WCA_ERR;
+}
+
+static void ztl_thd_worker_stop(struct xztl_thread *td) {
+    if (!td->wca_running)
+        return;
+
+    td->wca_running = 0;
+    sem_post(&td->ucmd_sem);
+    pthread_join(td->wca_thread, NULL);
+    sem_destroy(&td->ucmd_sem);
+    xztl_ring_exit(&td->ring);
+}
+
+/* Run a synchronous command on the slot worker and wait for it. The wait
+ * polls for wait_spin_us and then sleeps, doubling up to
+ * XZTL_WAIT_SLEEP_US */
+static int ztl_thd_dispatch(struct xztl_io_ucmd *ucmd) {
+    struct xztl_thread *td = &xtd[ucmd->xd.tid];
+    struct xztl_core *  core;
+    struct timespec     ts;
+    uint64_t            start, now;
+    uint32_t            sleep_us = 1;
+    get_xztl_core(&core);
+
+    if (ztl_thd_worker_start(td)) {
+        log_erra("ztl-thd: Worker of slot %d failed.", ucmd->xd.tid);
+        return -1;
+    }
+
+    ucmd->wdone = 0;
+    ztl_thd_enqueue(td, ucmd);
+
+    GET_MICROSECONDS(start, ts);
+    now = start;
+    while (!__atomic_load_n(&ucmd->wdone, __ATOMIC_ACQUIRE)) {
+        if (now - start < core->wait_spin_us) {
+            GET_MICROSECONDS(now, ts);
+            continue;
+        }
+
+        ts.tv_sec  = 0;
+        ts.tv_nsec = sleep_us * 1000;
+        nanosleep(&ts, NULL);
+        if (sleep_us < XZTL_WAIT_SLEEP_US)
+            sleep_us <<= 1;
+    }
+
+    return XZTL_OK;
+}
+
+static int ztl_thd_submit(struct xztl_io_ucmd *ucmd) {
+    int tid = ucmd->xd.tid;
+
+    if (ztl_wca_dispatch == ZTL_DISPATCH_WORKER)
+        return ztl_thd_dispatch(ucmd);
+
+    /* The slot commands and buffers belong to the slot worker while
+     * asynchronous commands are outstanding, the command is queued behind
+     * them */
+    if (__atomic_load_n(&xtd[tid].ainflight, __ATOMIC_ACQUIRE))
+        return ztl_thd_dispatch(ucmd);
+
+    return ztl_thd_run(ucmd);
+}
+
+/* The pool of asynchronous commands is allocated by the first
+ * asynchronous command of the slot */
+static int ztl_thd_async_init(struct xztl_thread *td) {
+    uint32_t ucmd_i;
+
+    td->aucmd = xztl_numa_alloc(ztl_wca_adepth * sizeof(struct xztl_io_ucmd),
+                                td->numa);
+    if (!td->aucmd)
+        return XZTL_MEM;
+
+    STAILQ_INIT(&td->afree_head);
+    STAILQ_INIT(&td->cpl_head);
+    for (ucmd_i = 0; ucmd_i < ztl_wca_adepth; ucmd_i++) {
+        td->aucmd[ucmd_i].handle = ucmd_i;
+        STAILQ_INSERT_TAIL(&td->afree_head, &td->aucmd[ucmd_i], entry);
+    }
+
+    if (ztl_thd_worker_start(td)) {
+        xztl_numa_free(td->aucmd,
+                       ztl_wca_adepth * sizeof(struct xztl_io_ucmd));
+        td->aucmd = NULL;
+        return XZTL_ZTL_WCA_ERR;
+    }
+
+    return XZTL_OK;
+}
+
+static void ztl_thd_async_exit(struct xztl_thread *td) {
+    ztl_thd_worker_stop(td);
+
+    if (!td->aucmd)
+        return;
+
+    xztl_numa_free(td->aucmd, ztl_wca_adepth * sizeof(struct xztl_io_ucmd));
+    td->aucmd = NULL;
+}
+
+/* Take an asynchronous command of the slot. Returns NULL if all commands
+ * of the slot are outstanding */
+static struct xztl_io_ucmd *ztl_thd_ucmd_get(int tid) {
+    struct xztl_thread * td = &xtd[tid];
+    struct xztl_io_ucmd *ucmd;
+
+    if (!td->aucmd && ztl_thd_async_init(td)) {
+        log_erra("ztl-thd: Asynchronous resources of slot %d failed.", tid);
+        return NULL;
+    }
+
+    pthread_spin_lock(&td->ucmd_spin);
+    ucmd = STAILQ_FIRST(&td->afree_head);
+    if (ucmd) {
+        STAILQ_REMOVE_HEAD(&td->afree_head, entry);
+        td->ainflight++;
+    }
+    pthread_spin_unlock(&td->ucmd_spin);
+
+    return ucmd;
+}
+
+static void ztl_thd_ucmd_put(struct xztl_io_ucmd *ucmd) {
+    struct xztl_thread *td = &xtd[ucmd->xd.tid];
+
+    pthread_spin_lock(&td->ucmd_spin);
+    STAILQ_INSERT_TAIL(&td->afree_head, ucmd, entry);
+    td->ainflight--;
+    pthread_spin_unlock(&td->ucmd_spin);
+}
+
+/* Queue a command taken by ztl_thd_ucmd_get to the slot worker */
+static int ztl_thd_submit_async(struct xztl_io_ucmd *ucmd) {
+    struct xztl_thread *td = &xtd[ucmd->xd.tid];
+
+    ucmd->status    = 0;
+    ucmd->completed = 0;
+    ztl_thd_enqueue(td, ucmd);
+
+    return XZTL_OK;
+}
+
+/* Return up to 'max' completed commands without callback. The caller
+ * gives them back with ztl_thd_ucmd_put */
+static uint32_t ztl_thd_poll(int tid, struct xztl_io_ucmd **ucmd,
+                             uint32_t max) {
+    struct xztl_thread *td = &xtd[tid];
+    uint32_t            ncpl = 0;
+
+    if (!td->aucmd || STAILQ_EMPTY(&td->cpl_head))
+        return 0;
+
+    pthread_spin_lock(&td->ucmd_spin);
+    while (ncpl < max && !STAILQ_EMPTY(&td->cpl_head)) {
+        ucmd[ncpl] = STAILQ_FIRST(&td->cpl_head);
+        STAILQ_REMOVE_HEAD(&td->cpl_head, entry);
+        ncpl++;
+    }
+    pthread_spin_unlock(&td->ucmd_spin);
+
+    return ncpl;
+}
+
+/* The slot resources are allocated while the thread runs on the slot NUMA
+ * node. Buffers and commands are bound to the node, and the queue and its
+ * completion structures are allocated by the media on the current node */
 static int _ztl_thd_init(struct xztl_thread *td) {
-    int mcmd_id;
+    struct xztl_numa_affinity aff;
+    struct xztl_core *        core;
+    int                       mcmd_id, ret = -1;
 
-    td->usedflag = false;
+    get_xztl_core(&core);
+    if (xztl_numa_bind(td->numa, &aff))
+        td->numa = -1;
+
+    td->mcmd_buf = xztl_numa_alloc(ZTL_TH_RC_NUM * ZTL_TH_MCMD_SZ, td->numa);
+    if (!td->mcmd_buf) {
+        log_err("Thread resource (mcmd) allocation error.");
+        goto UNBIND;
+    }
 
     for (mcmd_id = 0; mcmd_id < ZTL_TH_RC_NUM; mcmd_id++) {
-        // each mcmd read max 256K(64 * 4K)
-        td->prp[mcmd_id] = zrocks_alloc(256 * 1024);
-        td->mcmd[mcmd_id] = aligned_alloc(64, sizeof(struct xztl_io_mcmd));
+        td->mcmd[mcmd_id] =
+            (struct xztl_io_mcmd *)((char *)td->mcmd_buf +
+                                    mcmd_id * ZTL_TH_MCMD_SZ);
     }
 
-    td->prov = zrocks_alloc(sizeof(struct app_pro_addr));
+    td->prov =
+        xztl_media_dma_alloc_node(sizeof(struct app_pro_addr), td->numa);
     if (!td->prov) {
         log_err("Thread resource (data buffer) allocation error.");
-        return -1;
+        goto UNBIND;
     }
 
     struct app_pro_addr *prov = (struct app_pro_addr *)td->prov;
     prov->grp                 = glist[0];
 
-    td->tctx = xztl_ctx_media_init(XZTL_CTX_NVME_DEPTH);
+    td->tctx = xztl_ctx_media_init(ztl_wca_wdepth);
     if (!td->tctx) {
         log_err("Thread resource (tctx) allocation error.");
+        goto UNBIND;
+    }
+
+    td->rctx = xztl_ctx_media_init(ztl_wca_rdepth);
+    if (!td->rctx) {
+        log_err("Thread resource (rctx) allocation error.");
+        goto UNBIND;
+    }
+    td->rctx->wait_mode = core->rwait_mode;
+
+    /* Single command reads are polled on their own queue. The read queue
+     * is used if the media cannot create it */
+    td->pctx = xztl_ctx_media_init_flags(ZTL_READ_POLL_DEPTH, XZTL_CTX_POLL);
+    if (!td->pctx)
+        td->pctx = td->rctx;
+
+    ret = XZTL_OK;
+
+UNBIND:
+    xztl_numa_unbind(&aff);
+    return ret;
+}
+
+/* Release the resources of a slot. The provisioning nodes of the slot
+ * (free_head) are kept for the next use */
+static void _ztl_thd_exit(struct xztl_thread *td) {
+    ztl_thd_async_exit(td);
+
+    if (td->pctx != td->rctx)
+        xztl_ctx_media_exit(td->pctx);
+    xztl_ctx_media_exit(td->rctx);
+    xztl_ctx_media_exit(td->tctx);
+    td->pctx = NULL;
+    td->rctx = NULL;
+    td->tctx = NULL;
+
+    if (td->prov)
+        zrocks_free(td->prov);
+    td->prov = NULL;
+
+    if (td->mcmd_buf)
+        xztl_numa_free(td->mcmd_buf, ZTL_TH_RC_NUM * ZTL_TH_MCMD_SZ);
+    td->mcmd_buf = NULL;
+}
+
+/* Create the resources of a slot on its first use. The caller marks the
+ * slot used before, a concurrent release either sees the mark or lets
+ * this call recreate the resources */
+static int ztl_thd_slot_open(int tid) {
+    struct xztl_thread *td = &xtd[tid];
+    int                 ret = XZTL_OK;
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&td->ready, __ATOMIC_SEQ_CST))
+        return XZTL_OK;
+
+    pthread_mutex_lock(&ztl_slot_lock);
+    if (!td->ready) {
+        ret = _ztl_thd_init(td);
+        if (ret) {
+            log_erra("ztl-thd: Slot %d resources failed.", tid);
+            _ztl_thd_exit(td);
+        } else {
+            __atomic_store_n(&td->ready, 1, __ATOMIC_SEQ_CST);
+            THREAD_NUM++;
+        }
+    }
+    pthread_mutex_unlock(&ztl_slot_lock);
+
+    return ret;
+}
+
+/* Release the resources of the slots unused for ztl_slot_idle_us. A slot
+ * marked used after the check keeps its resources */
+static void ztl_thd_slot_reap(uint64_t now) {
+    struct xztl_thread *td;
+    int                 tid;
+
+    pthread_mutex_lock(&ztl_slot_lock);
+    for (tid = 0; xtd && tid < xtd_num; tid++) {
+        td = &xtd[tid];
+        if (!td->ready || td->usedflag || td->ainflight ||
+            now - td->idle_us < ztl_slot_idle_us)
+            continue;
+
+        __atomic_store_n(&td->ready, 0, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&td->usedflag, __ATOMIC_SEQ_CST)) {
+            __atomic_store_n(&td->ready, 1, __ATOMIC_SEQ_CST);
+            continue;
+        }
+
+        _ztl_thd_exit(td);
+        THREAD_NUM--;
+    }
+    pthread_mutex_unlock(&ztl_slot_lock);
+}
+
+/* Take a free slot within 'mask', NULL for any slot */
+static int ztl_thd_slot_take(const uint64_t *mask) {
+    uint64_t old, avail;
+    int      word_i, bit;
+
+    for (word_i = 0; word_i < ZTL_TH_WORDS; word_i++) {
+        old = __atomic_load_n(&ztl_slots.free[word_i], __ATOMIC_RELAXED);
+        while (1) {
+            avail = (mask) ? old & mask[word_i] : old;
+            if (!avail)
+                break;
+
+            bit = __builtin_ctzll(avail);
+            if (__atomic_compare_exchange_n(
+                    &ztl_slots.free[word_i], &old, old & ~(1ULL << bit), 1,
+                    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+                return word_i * 64 + bit;
+        }
+    }
+
+    return -1;
+}
+
+/* Hand out a free slot, of NUMA node 'node' first (-1 for any node). The
+ * slot resources are created on first use */
+static int ztl_thd_slot_get(int node) {
+    int tid = -1;
+
+    if (node >= 0 && node < XZTL_NUMA_MAX_NODES)
+        tid = ztl_thd_slot_take(ztl_slots.node[node]);
+    if (tid < 0)
+        tid = ztl_thd_slot_take(NULL);
+
+    if (tid < 0) {
+        xztl_stats_inc(XZTL_STATS_SLOT_EXHAUSTED, 1);
         return -1;
     }
 
-    STAILQ_INIT(&td->free_head);
-    if (pthread_spin_init(&td->ucmd_spin, 0))
+    __atomic_store_n(&xtd[tid].usedflag, true, __ATOMIC_SEQ_CST);
+    if (ztl_thd_slot_open(tid)) {
+        __atomic_store_n(&xtd[tid].usedflag, false, __ATOMIC_SEQ_CST);
+        __atomic_fetch_or(&ztl_slots.free[tid / 64], 1ULL << (tid % 64),
+                          __ATOMIC_RELEASE);
         return -1;
-    return XZTL_OK;
+    }
+
+    xztl_stats_inc(XZTL_STATS_SLOT_GET, 1);
+
+    return tid;
+}
+
+/* Called by the management thread. The slots are checked every
+ * ZTL_SLOT_REAP_MS, releases of slots do not take the slot lock */
+static void ztl_thd_slot_reap_idle(void) {
+    struct timespec ts;
+    uint64_t        now;
+
+    GET_MICROSECONDS(now, ts);
+    if (now - ztl_slot_reap_us < ZTL_SLOT_REAP_MS * 1000)
+        return;
+
+    ztl_slot_reap_us = now;
+    ztl_thd_slot_reap(now);
+}
+
+/* Give a slot back. Its resources are released by the management thread
+ * once the slot is idle */
+static void ztl_thd_slot_put(int tid) {
+    struct timespec ts;
+    uint64_t        now, old;
+
+    if (tid < 0 || tid >= xtd_num)
+        return;
+
+    GET_MICROSECONDS(now, ts);
+    xtd[tid].idle_us = now;
+
+    /* The slot is free once its bit is set, usedflag is cleared before */
+    __atomic_store_n(&xtd[tid].usedflag, false, __ATOMIC_SEQ_CST);
+    old = __atomic_fetch_or(&ztl_slots.free[tid / 64], 1ULL << (tid % 64),
+                            __ATOMIC_RELEASE);
+    if (old & (1ULL << (tid % 64)))
+        log_erra("ztl-thd: Slot %d given back twice.", tid);
+}
+
+/* Unset or invalid settings select the default */
+static uint32_t ztl_thd_depth(int64_t *val, uint32_t depth) {
+    if (*val > 0 && *val <= UINT32_MAX)
+        depth = *val;
+    *val = depth;
+
+    return depth;
 }
 
 static int ztl_thd_init(void) {
-    int tid, ret;
+    struct xztl_config *cfg = xztl_config_active();
+    struct xztl_core *  core;
+    int                 tid;
     THREAD_NUM = 0;
+    get_xztl_core(&core);
 
-    for (tid = 0; tid < ZTL_TH_NUM; tid++) {
-        xtd[tid].tid = tid;
-        ret          = _ztl_thd_init(&xtd[tid]);
-        if (!ret) {
-            THREAD_NUM++;
-        } else {
+    ztl_wca_rdepth = ztl_thd_depth(&cfg->read_qdepth, ZTL_READ_QDEPTH);
+    ztl_wca_wdepth = ztl_thd_depth(&cfg->write_qdepth, ZTL_WRITE_QDEPTH);
+    ztl_wca_adepth = ztl_thd_depth(&cfg->async_depth, ZTL_ASYNC_DEPTH);
+    if (cfg->write_zone_qdepth > ZTL_WRITE_ZONE_QDEPTH_MAX)
+        cfg->write_zone_qdepth = ZTL_WRITE_ZONE_QDEPTH_MAX;
+    ztl_wca_zdepth =
+        ztl_thd_depth(&cfg->write_zone_qdepth, ZTL_WRITE_ZONE_QDEPTH);
+    log_infoa("ztl-thd: Queue depth read %u, write %u (zone %u), async %u",
+              ztl_wca_rdepth, ztl_wca_wdepth, ztl_wca_zdepth, ztl_wca_adepth);
+
+    if (!strcmp(cfg->dispatch, "worker"))
+        ztl_wca_dispatch = ZTL_DISPATCH_WORKER;
+    else
+        ztl_wca_dispatch = ZTL_DISPATCH_INLINE;
+    snprintf(cfg->dispatch, XZTL_CONFIG_STR, "%s",
+             (ztl_wca_dispatch == ZTL_DISPATCH_WORKER) ? "worker" : "inline");
+    log_infoa("ztl-thd: User commands run %s",
+              (ztl_wca_dispatch == ZTL_DISPATCH_WORKER) ? "in slot workers"
+                                                        : "inline");
+
+    ztl_slot_idle_us =
+        (uint64_t)ztl_thd_depth(&cfg->slot_idle_ms, ZTL_SLOT_IDLE_MS) * 1000;
+    if (ztl_wca_bounce_init(
+            ztl_thd_depth(&cfg->bounce_bufs, ZTL_BOUNCE_BUFS),
+            (size_t)core->read_sec * core->media->geo.nbytes))
+        return XZTL_ZTL_WCA_ERR;
+
+    if (cfg->nslots > ZTL_TH_NUM_MAX)
+        cfg->nslots = ZTL_TH_NUM_MAX;
+    xtd_num = ztl_thd_depth(&cfg->nslots, ZTL_TH_NUM);
+    xtd     = calloc(xtd_num, sizeof(struct xztl_thread));
+    if (!xtd) {
+        ztl_wca_bounce_exit();
+        return XZTL_MEM;
+    }
+
+    log_infoa("ztl-thd: %u slots created on use, released after %lu ms "
+              "idle. %u read bounce buffers of %lu KB",
+              xtd_num, ztl_slot_idle_us / 1000, ztl_bounce.max,
+              ztl_bounce.size / 1024);
+
+    /* Only the slot NUMA node is set here, see ztl_thd_slot_open */
+    memset(&ztl_slots, 0x0, sizeof(struct ztl_slot_map));
+    for (tid = 0; tid < xtd_num; tid++) {
+        xtd[tid].tid      = tid;
+        xtd[tid].usedflag = false;
+        xtd[tid].ready    = 0;
+        xtd[tid].numa     = xztl_numa_slot_node(tid);
+        xtd[tid].nfree    = 0;
+        STAILQ_INIT(&xtd[tid].free_head);
+        if (pthread_spin_init(&xtd[tid].ucmd_spin, 0)) {
             log_erra("ztl-thd: thread (%d) created failed.", tid);
-            break;
+            return XZTL_ZTL_WCA_ERR;
         }
+        xztl_numa_slot_add(xtd[tid].numa);
+
+        ztl_slots.free[tid / 64] |= 1ULL << (tid % 64);
+        if (xtd[tid].numa >= 0 && xtd[tid].numa < XZTL_NUMA_MAX_NODES)
+            ztl_slots.node[xtd[tid].numa][tid / 64] |= 1ULL << (tid % 64);
     }
 
-    return ret;
+    return XZTL_OK;
 }
 
 static void ztl_thd_exit(void) {
-    int                 tid, ret;
-    struct xztl_thread *td = NULL;
-    int                 mcmd_id;
-
-    for (tid = 0; tid < ZTL_TH_NUM; tid++) {
-        td              = &xtd[tid];
-        td->wca_running = 0;
-        
+    struct xztl_thread *td;
+    int                 tid;
+
+    pthread_mutex_lock(&ztl_slot_lock);
+    for (tid = 0; tid < xtd_num; tid++) {
+        td = &xtd[tid];
+        if (td->ready)
+            _ztl_thd_exit(td);
+        td->ready = 0;
         pthread_spin_destroy(&td->ucmd_spin);
-		xztl_ctx_media_exit(td->tctx);
-		zrocks_free(td->prov);
+    }
+    THREAD_NUM = 0;
 
-		for (mcmd_id = 0; mcmd_id < ZTL_TH_RC_NUM; mcmd_id++) {
-            zrocks_free(td->prp[mcmd_id]);
-            free(td->mcmd[mcmd_id]);
-        }
+    memset(&ztl_slots, 0x0, sizeof(struct ztl_slot_map));
+    free(xtd);
+    xtd     = NULL;
+    xtd_num = 0;
+    pthread_mutex_unlock(&ztl_slot_lock);
 
-        pthread_join(td->wca_thread, NULL);
-    }
+    ztl_wca_bounce_exit();
 
     log_info("ztl-thd stopped.\n");
 }
 
-static struct app_wca_mod libztl_wca = {.mod_id      = LIBZTL_WCA,
-                                        .name        = "LIBZTL-WCA",
-                                        .init_fn     = ztl_thd_init,
-                                        .exit_fn     = ztl_thd_exit,
-                                        .submit_fn   = ztl_thd_submit,
-                                        .callback_fn = ztl_wca_callback};
+static struct app_wca_mod libztl_wca = {
+    .mod_id          = LIBZTL_WCA,
+    .name            = "LIBZTL-WCA",
+    .init_fn         = ztl_thd_init,
+    .exit_fn         = ztl_thd_exit,
+    .submit_fn       = ztl_thd_submit,
+    .callback_fn     = ztl_wca_callback,
+    .read_fast_fn    = ztl_wca_read_fast,
+    .ucmd_get_fn     = ztl_thd_ucmd_get,
+    .ucmd_put_fn     = ztl_thd_ucmd_put,
+    .submit_async_fn = ztl_thd_submit_async,
+    .poll_fn         = ztl_thd_poll,
+    .slot_get_fn     = ztl_thd_slot_get,
+    .slot_put_fn     = ztl_thd_slot_put,
+    .slot_reap_fn    = ztl_thd_slot_reap_idle};
 
 void ztl_wca_register(void) {
     ztl_mod_register(ZTLMOD_WCA, LIBZTL_WCA, &libztl_wca);
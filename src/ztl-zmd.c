@@ -51,33 +51,9 @@ static int ztl_zmd_create(struct app_group *grp) {
     return XZTL_OK;
 }
 
-static int ztl_zmd_load_report(struct app_group *grp) {
-    struct xztl_core *core;
-    get_xztl_core(&core);
-    struct xztl_zn_mcmd cmd;
-    int                 ret;
-
-    cmd.opcode      = XZTL_ZONE_MGMT_REPORT;
-    cmd.addr.g.grp  = grp->id;
-    cmd.addr.g.zone = core->media->geo.zn_grp * grp->id * 1UL;
-    cmd.nzones      = core->media->geo.zn_grp;
-
-    ret = xztl_media_submit_zn(&cmd);
-    if (!ret) {
-        grp->zmd.report = (struct xnvme_znd_report *)cmd.opaque;
-    }
-
-    if (ret) {
-        log_erra("zmd err report: %d", cmd.status);
-    }
-
-    return ret;
-}
-
+/* Zone states are not kept here. Consumers walk the device report in
+ * ranges (xztl_zn_report_iter) while building their own structures. */
 static int ztl_zmd_load(struct app_group *grp) {
-    if (ztl_zmd_load_report(grp))
-        return XZTL_ZTL_ZMD_REP;
-
     /* Set byte for table creation */
     grp->zmd.byte.magic = APP_MAGIC;
 
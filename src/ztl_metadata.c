@@ -17,18 +17,14 @@
  * limitations under the License.
 */
 
-#include <libxnvme.h>
-#include <libxnvme_nvm.h>
 #include <libxnvme_znd.h>
-#include <libxnvmec.h>
 #include <libzrocks.h>
+#include <string.h>
 #include <xztl-ztl.h>
 #include <xztl.h>
-#include <ztl-media.h>
 #include <ztl.h>
 #include <ztl_metadata.h>
 
-static struct znd_media *  _zndmedia;
 static struct ztl_metadata metadata;
 
 uint64_t zrocks_get_metadata_slba() {
@@ -58,14 +54,14 @@ static uint64_t get_metadata_slba(int start, int end) {
 
 int ztl_metadata_init(struct app_group *grp) {
     struct xnvme_spec_znd_descr *zinfo;
+    struct xztl_zn_report_iter   it;
     struct ztl_pro_zone *        zone;
     struct app_zmd_entry *       zmde;
     struct xztl_core *           core;
     int                          zone_i;
     get_xztl_core(&core);
-    _zndmedia         = get_znd_media();
     metadata.zone_num = 1;
-    metadata.nlb_max = _zndmedia->devgeo->mdts_nbytes / core->media->geo.nbytes;
+    metadata.nlb_max  = core->media->geo.sec_mdts;
     metadata.metadata_zone = (struct ztl_pro_zone *)calloc(metadata.zone_num,
                                                            sizeof(struct ztl_pro_zone));
     if (!metadata.metadata_zone) {
@@ -76,10 +72,15 @@ int ztl_metadata_init(struct app_group *grp) {
         return XZTL_ZTL_MD_ERR;
     }
 
+    xztl_zn_report_iter_init(&it, grp->id * core->media->geo.zn_grp,
+                             metadata.zone_num);
+
     for (zone_i = 0; zone_i < metadata.zone_num; zone_i++) {
-        /* We are getting the full report here */
-        zinfo = XNVME_ZND_REPORT_DESCR(
-            grp->zmd.report, grp->id * core->media->geo.zn_grp + zone_i);
+        zinfo = xztl_zn_report_iter_next(&it);
+        if (!zinfo) {
+            log_erra("ztl-metadata: Zone report failed (%d)", zone_i);
+            return XZTL_ZTL_MD_ERR;
+        }
 
         zone = &metadata.metadata_zone[zone_i];
 
@@ -91,11 +92,13 @@ int ztl_metadata_init(struct app_group *grp) {
 
         if (!(zmde->flags & XZTL_ZMD_AVLB)) {
             log_infoa("ztl-metadata: Cannot read an invalid zone (%d)", zone_i);
+            xztl_zn_report_iter_exit(&it);
             return -1;
         }
 
         if (zmde->flags & XZTL_ZMD_RSVD) {
             log_infoa("ztl-metadata: Zone is RESERVED (%d)", zone_i);
+            xztl_zn_report_iter_exit(&it);
             return -2;
         }
 
@@ -106,6 +109,8 @@ int ztl_metadata_init(struct app_group *grp) {
         zone->lock      = 0;
         zmde->wptr = zmde->wptr_inflight = zinfo->wp;
     }
+    xztl_zn_report_iter_exit(&it);
+
     metadata.file_slba = get_metadata_slba(0, metadata.zone_num);
     log_infoa("init metadata.file_slba:%ull\n", metadata.file_slba);
 
@@ -113,10 +118,12 @@ int ztl_metadata_init(struct app_group *grp) {
 }
 
 int zrocks_read_metadata(uint64_t slba, unsigned char *buf, uint32_t length) {
-    uint64_t max_left = (metadata.file_slba - slba) * _zndmedia->devgeo->nbytes;
+    struct xztl_core *core;
+    get_xztl_core(&core);
+    uint64_t max_left = (metadata.file_slba - slba) * core->media->geo.nbytes;
     length            = length > max_left ? max_left : length;
     struct xztl_mp_entry *mp_entry = NULL;
-    uint16_t              nlb      = length / _zndmedia->devgeo->nbytes;
+    uint16_t              nlb      = length / core->media->geo.nbytes;
     int                   ret      = 0;
     uint16_t              left_nlb = nlb;
     while (left_nlb > 0) {
@@ -154,20 +161,20 @@ int zrocks_read_metadata(uint64_t slba, unsigned char *buf, uint32_t length) {
 }
 
 static inline int zrocks_reset_file_md(uint8_t reset_op) {
-    struct xnvme_cmd_ctx xnvme_ctx = xnvme_cmd_ctx_from_dev(_zndmedia->dev);
-    int                  err       = 0;
-    int                  zone_id;
+    struct xztl_zn_mcmd cmd;
+    int                 err = 0;
+    int                 zone_id;
 
     for (zone_id = 0; zone_id < metadata.zone_num; zone_id++) {
-        xnvme_ctx.async.queue  = NULL;
-        xnvme_ctx.async.cb_arg = NULL;
-        err                    = xnvme_znd_mgmt_send(
-            &xnvme_ctx, xnvme_dev_get_nsid(_zndmedia->dev),
-            metadata.metadata_zone[zone_id].zmd_entry->addr.addr, false,
-            reset_op, 0, NULL);
-
-        if (err) {
-            log_erra("znd_cmd_mgmt_send. err %d", err);
+        cmd.opcode    = reset_op;
+        cmd.addr.addr = metadata.metadata_zone[zone_id].addr.addr;
+        cmd.nzones    = 1;
+        err           = xztl_media_submit_zn(&cmd);
+
+        if (err || cmd.status) {
+            log_erra("zrocks_reset_file_md. err %d, status %d", err,
+                     cmd.status);
+            err = err ? err : -XZTL_ZTL_MD_ERR;
             break;
         }
     }
@@ -180,7 +187,7 @@ int zrocks_write_file_metadata(const unsigned char *buf, uint32_t length) {
     struct xztl_core *core;
     int               err = 0;
 
-    struct xnvme_cmd_ctx xnvme_ctx = xnvme_cmd_ctx_from_dev(_zndmedia->dev);
+    struct xztl_io_mcmd cmd;
     get_xztl_core(&core);
     max_len                   = MAX_WRITE_NLB_NUM * ZNS_ALIGMENT;
     remain_len                = length;
@@ -190,19 +197,25 @@ int zrocks_write_file_metadata(const unsigned char *buf, uint32_t length) {
     if (metadata.file_slba * core->media->geo.nbytes + length >=
         (metadata.metadata_zone[metadata.zone_num - 1].capacity) *
             core->media->geo.nbytes) {
-        zrocks_reset_file_md(XNVME_SPEC_ZND_CMD_MGMT_SEND_RESET);
+        zrocks_reset_file_md(XZTL_ZONE_MGMT_RESET);
         metadata.file_slba = 0;
     }
 
     while (remain_len > 0) {
         write_len = (remain_len > max_len) ? max_len : remain_len;
         nlb       = write_len / core->media->geo.nbytes;
-        err = xnvme_nvm_write(&xnvme_ctx, xnvme_dev_get_nsid(_zndmedia->dev),
-                              metadata.file_slba, nlb - 1, data, NULL);
-
-        if (err || xnvme_cmd_ctx_cpl_status(&xnvme_ctx)) {
-            xnvmec_perr("xnvme_nvm_write()", err);
-            xnvme_cmd_ctx_pr(&xnvme_ctx, XNVME_PR_DEF);
+        memset(&cmd, 0x0, sizeof(struct xztl_io_mcmd));
+        cmd.opcode         = XZTL_CMD_WRITE;
+        cmd.naddr          = 1;
+        cmd.synch          = 1;
+        cmd.nsec[0]        = nlb;
+        cmd.prp[0]         = (uint64_t)data;
+        cmd.addr[0].g.sect = metadata.file_slba;
+        err                = xztl_media_submit_io(&cmd);
+
+        if (err || cmd.status) {
+            log_erra("zrocks_write_file_metadata. err %d, status %d", err,
+                     cmd.status);
             err = err ? err : -XZTL_ZTL_MD_ERR;
             break;
         }
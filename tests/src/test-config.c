@@ -0,0 +1,120 @@
+/* xZTL: Zone Translation Layer User-space Library
+ *
+ * Copyright 2019 Samsung Electronics
+ *
+ * Written by Ivan L. Picoli <i.picoli@samsung.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <xztl-config.h>
+#include <xztl.h>
+
+#include "CUnit/Basic.h"
+
+static struct xztl_config cfg;
+static char               cfg_path[] = "/tmp/xztl-config-XXXXXX";
+
+static int cunit_config_init(void) {
+    return 0;
+}
+
+static int cunit_config_exit(void) {
+    unlink(cfg_path);
+    return 0;
+}
+
+static void test_config_init(void) {
+    xztl_config_init(&cfg);
+    CU_ASSERT(cfg.nslots == XZTL_CONFIG_UNSET);
+    CU_ASSERT(cfg.read_qdepth == XZTL_CONFIG_UNSET);
+    CU_ASSERT(cfg.dispatch[0] == '\0');
+}
+
+static void test_config_set(void) {
+    CU_ASSERT(xztl_config_set(&cfg, "XZTL_READ_QDEPTH", "64") == 0);
+    CU_ASSERT(cfg.read_qdepth == 64);
+    CU_ASSERT(xztl_config_set(&cfg, "XZTL_DISPATCH", "worker") == 0);
+    CU_ASSERT(!strcmp(cfg.dispatch, "worker"));
+
+    CU_ASSERT(xztl_config_set(&cfg, "XZTL_NO_KEY", "1") == XZTL_CONFIG_ERR);
+    CU_ASSERT(xztl_config_set(&cfg, "XZTL_SLOTS", "4x") == XZTL_CONFIG_ERR);
+    CU_ASSERT(cfg.nslots == XZTL_CONFIG_UNSET);
+}
+
+static void test_config_file(void) {
+    FILE *fp;
+    int   fd;
+
+    fd = mkstemp(cfg_path);
+    CU_ASSERT_FATAL(fd >= 0);
+    fp = fdopen(fd, "w");
+    CU_ASSERT_FATAL(fp != NULL);
+    fprintf(fp, "# Comment\n\n  XZTL_SLOTS = 16\nXZTL_WAIT=spin\n");
+    fclose(fp);
+
+    CU_ASSERT(xztl_config_load_file(&cfg, cfg_path) == 0);
+    CU_ASSERT(cfg.nslots == 16);
+    CU_ASSERT(!strcmp(cfg.wait, "spin"));
+
+    fp = fopen(cfg_path, "a");
+    CU_ASSERT_FATAL(fp != NULL);
+    fprintf(fp, "XZTL_NUMA\n");
+    fclose(fp);
+    CU_ASSERT(xztl_config_load_file(&cfg, cfg_path) == XZTL_CONFIG_ERR);
+}
+
+static void test_config_env(void) {
+    /* The environment overrides the file */
+    setenv("XZTL_SLOTS", "32", 1);
+    xztl_config_load_env(&cfg);
+    CU_ASSERT(cfg.nslots == 32);
+    unsetenv("XZTL_SLOTS");
+}
+
+int main(int argc, const char **argv) {
+    int failed;
+
+    CU_pSuite pSuite = NULL;
+
+    if (CUE_SUCCESS != CU_initialize_registry())
+        return CU_get_error();
+
+    pSuite =
+        CU_add_suite("Suite_config", cunit_config_init, cunit_config_exit);
+    if (pSuite == NULL) {
+        CU_cleanup_registry();
+        return CU_get_error();
+    }
+
+    if ((CU_add_test(pSuite, "Unset all keys", test_config_init) == NULL) ||
+        (CU_add_test(pSuite, "Set keys", test_config_set) == NULL) ||
+        (CU_add_test(pSuite, "Load a file", test_config_file) == NULL) ||
+        (CU_add_test(pSuite, "Load the environment", test_config_env) ==
+         NULL)) {
+        CU_cleanup_registry();
+        return CU_get_error();
+    }
+
+    CU_basic_set_mode(CU_BRM_VERBOSE);
+    CU_basic_run_tests();
+
+    failed = CU_get_number_of_tests_failed();
+    CU_cleanup_registry();
+
+    return failed;
+}
@@ -0,0 +1,228 @@
+/* xZTL: Zone Translation Layer User-space Library
+ *
+ * Copyright 2019 Samsung Electronics
+ *
+ * Written by Ivan L. Picoli <i.picoli@samsung.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+
+#include <omp.h>
+#include <stdlib.h>
+#include <string.h>
+#include <xztl-dma.h>
+#include <xztl-numa.h>
+#include <xztl.h>
+
+#include "CUnit/Basic.h"
+
+#define TEST_DMA_REGION_MB "64"
+
+static void cunit_dma_assert_ptr(char *fn, void *ptr) {
+    CU_ASSERT((uint64_t)ptr != 0);
+    if (!ptr)
+        printf("\n %s: ptr %p\n", fn, ptr);
+}
+
+static void cunit_dma_assert_int(char *fn, uint64_t status) {
+    CU_ASSERT(status == 0);
+    if (status)
+        printf("\n %s: %lx\n", fn, status);
+}
+
+static int cunit_dma_init(void) {
+    return 0;
+}
+
+static int cunit_dma_exit(void) {
+    return 0;
+}
+
+static void test_dma_init(void) {
+    struct xztl_dma_stats st;
+
+    setenv(XZTL_DMA_PAGE_ENV, "2M", 1);
+    setenv(XZTL_DMA_REGION_MB_ENV, TEST_DMA_REGION_MB, 1);
+    cunit_dma_assert_int("xztl_dma_init", xztl_dma_init());
+
+    xztl_dma_get_stats(&st);
+    CU_ASSERT(st.nregions == 1);
+    CU_ASSERT(st.reserved == atoi(TEST_DMA_REGION_MB) * 1048576ULL);
+}
+
+static void test_dma_alloc_free(void) {
+    struct xztl_dma_stats st;
+    void *                buf[3], *ptr;
+
+    buf[0] = xztl_dma_alloc(4096);
+    buf[1] = xztl_dma_alloc(100 * 1024);
+    buf[2] = xztl_dma_alloc(256 * 1024);
+    cunit_dma_assert_ptr("xztl_dma_alloc", buf[0]);
+    cunit_dma_assert_ptr("xztl_dma_alloc", buf[1]);
+    cunit_dma_assert_ptr("xztl_dma_alloc", buf[2]);
+    if (!buf[0] || !buf[1] || !buf[2])
+        return;
+
+    /* Buffers are aligned to their class */
+    CU_ASSERT(((uint64_t)buf[0] & 4095) == 0);
+    CU_ASSERT(((uint64_t)buf[1] & (128 * 1024 - 1)) == 0);
+    CU_ASSERT(((uint64_t)buf[2] & (256 * 1024 - 1)) == 0);
+
+    memset(buf[1], 0xa5, 100 * 1024);
+    memset(buf[2], 0x5a, 256 * 1024);
+
+    xztl_dma_get_stats(&st);
+    CU_ASSERT(st.used == (4 + 128 + 256) * 1024);
+    CU_ASSERT(st.requested == (4 + 100 + 256) * 1024);
+
+    /* A freed buffer is reused by its class */
+    CU_ASSERT(xztl_dma_free(buf[1]) == 1);
+    ptr = xztl_dma_alloc(128 * 1024);
+    CU_ASSERT(ptr == buf[1]);
+    buf[1] = ptr;
+
+    CU_ASSERT(xztl_dma_free(buf[0]) == 1);
+    CU_ASSERT(xztl_dma_free(buf[1]) == 1);
+    CU_ASSERT(xztl_dma_free(buf[2]) == 1);
+
+    xztl_dma_get_stats(&st);
+    CU_ASSERT(st.used == 0 && st.requested == 0);
+    CU_ASSERT(st.nalloc == st.nfree);
+}
+
+static void test_dma_direct(void) {
+    struct xztl_dma_stats st;
+    uint64_t              ndirect;
+    void *                ptr;
+
+    xztl_dma_get_stats(&st);
+    ndirect = st.ndirect;
+
+    /* Bigger than the region, the caller uses the media allocator */
+    CU_ASSERT(xztl_dma_alloc(128 * 1048576) == NULL);
+
+    /* Memory out of the arena is not freed */
+    ptr = malloc(4096);
+    CU_ASSERT(xztl_dma_free(ptr) == 0);
+    free(ptr);
+
+    xztl_dma_get_stats(&st);
+    CU_ASSERT(st.ndirect == ndirect + 1);
+}
+
+static void test_dma_regions(void) {
+    struct xztl_dma_stats st;
+    void *                buf[8];
+    int                   buf_i;
+
+    /* 8 x 8 MB needs a second region */
+#pragma omp parallel for
+    for (buf_i = 0; buf_i < 8; buf_i++) {
+        buf[buf_i] = xztl_dma_alloc(8 * 1048576);
+        cunit_dma_assert_ptr("xztl_dma_alloc", buf[buf_i]);
+    }
+
+    xztl_dma_get_stats(&st);
+    CU_ASSERT(st.nregions == 2);
+    CU_ASSERT(st.carved <= st.reserved);
+
+    for (buf_i = 0; buf_i < 8; buf_i++) {
+        if (buf[buf_i])
+            CU_ASSERT(xztl_dma_free(buf[buf_i]) == 1);
+    }
+
+    xztl_dma_print_stats();
+}
+
+static void test_dma_node(void) {
+    struct xztl_dma_stats st;
+    void *                ptr, *buf;
+    int                   node;
+
+    cunit_dma_assert_int("xztl_numa_init", xztl_numa_init());
+    node = xztl_numa_local_node();
+    if (node < 0)
+        node = 0;
+
+    xztl_dma_get_stats(&st);
+    CU_ASSERT(st.nbound == 0);
+
+    /* Unbound buffers are not reused for a node */
+    ptr = xztl_dma_alloc(4096);
+    cunit_dma_assert_ptr("xztl_dma_alloc", ptr);
+    CU_ASSERT(xztl_dma_free(ptr) == 1);
+
+    buf = xztl_dma_alloc_node(4096, node);
+    cunit_dma_assert_ptr("xztl_dma_alloc_node", buf);
+    CU_ASSERT(buf != ptr);
+
+    xztl_dma_get_stats(&st);
+    CU_ASSERT(st.nbound == 1);
+
+    /* Node buffers are reused by the node */
+    CU_ASSERT(xztl_dma_free(buf) == 1);
+    CU_ASSERT(xztl_dma_alloc_node(4096, node) == buf);
+    CU_ASSERT(xztl_dma_free(buf) == 1);
+
+    xztl_numa_print_stats();
+    xztl_numa_exit();
+}
+
+static void test_dma_exit(void) {
+    struct xztl_dma_stats st;
+
+    xztl_dma_exit();
+
+    /* A disabled arena serves nothing */
+    CU_ASSERT(xztl_dma_alloc(4096) == NULL);
+    xztl_dma_get_stats(&st);
+    CU_ASSERT(st.nregions == 0);
+}
+
+int main(int argc, const char **argv) {
+    int failed;
+
+    CU_pSuite pSuite = NULL;
+
+    if (CUE_SUCCESS != CU_initialize_registry())
+        return CU_get_error();
+
+    pSuite = CU_add_suite("Suite_dma_arena", cunit_dma_init, cunit_dma_exit);
+    if (pSuite == NULL) {
+        CU_cleanup_registry();
+        return CU_get_error();
+    }
+
+    if ((CU_add_test(pSuite, "Initialize the arena", test_dma_init) ==
+         NULL) ||
+        (CU_add_test(pSuite, "Allocate and free buffers",
+                     test_dma_alloc_free) == NULL) ||
+        (CU_add_test(pSuite, "Decline sizes out of the arena",
+                     test_dma_direct) == NULL) ||
+        (CU_add_test(pSuite, "Map a new region", test_dma_regions) ==
+         NULL) ||
+        (CU_add_test(pSuite, "Bind buffers to a NUMA node", test_dma_node) ==
+         NULL) ||
+        (CU_add_test(pSuite, "Close the arena", test_dma_exit) == NULL)) {
+        CU_cleanup_registry();
+        return CU_get_error();
+    }
+
+    CU_basic_set_mode(CU_BRM_VERBOSE);
+    CU_basic_run_tests();
+
+    failed = CU_get_number_of_tests_failed();
+    CU_cleanup_registry();
+
+    return failed;
+}
@@ -0,0 +1,613 @@
+/* xZTL: Zone Translation Layer User-space Library
+ *
+ * Copyright 2019 Samsung Electronics
+ *
+ * Written by Ivan L. Picoli <i.picoli@samsung.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+
+#include <libxnvme_spec.h>
+#include <libxnvme_znd.h>
+#include <string.h>
+#include <xztl.h>
+#include <ztl-media-emu.h>
+
+#include "CUnit/Basic.h"
+
+#define TEST_EMU_DEV   "emu:mem?nzones=16&zsze=4096&zcap=3072&maxopen=2"
+#define TEST_EMU_ZSZE  4096
+#define TEST_EMU_ZCAP  3072
+#define TEST_EMU_NLBAS 16
+
+static const char *devname = TEST_EMU_DEV;
+
+static void cunit_emu_assert_ptr(char *fn, void *ptr) {
+    CU_ASSERT((uint64_t)ptr != 0);
+    if (!ptr)
+        printf("\n %s: ptr %p\n", fn, ptr);
+}
+
+static void cunit_emu_assert_int(char *fn, uint64_t status) {
+    CU_ASSERT(status == 0);
+    if (status)
+        printf("\n %s: %lx\n", fn, status);
+}
+
+static void cunit_emu_assert_int_equal(char *fn, uint64_t value,
+                                       uint64_t expected) {
+    CU_ASSERT_EQUAL(value, expected);
+    if (value != expected)
+        printf("\n %s: value %lx != expected %lx\n", fn, value, expected);
+}
+
+static int cunit_emu_media_init(void) {
+    return 0;
+}
+
+static int cunit_emu_media_exit(void) {
+    return 0;
+}
+
+static struct xnvme_spec_znd_descr test_emu_zone_info(uint32_t zone) {
+    struct xnvme_spec_znd_descr zinfo;
+
+    memset(&zinfo, 0x0, sizeof(zinfo));
+    cunit_emu_assert_int("xztl_media_zone_info",
+                         xztl_media_zone_info(zone, &zinfo));
+
+    return zinfo;
+}
+
+static int test_emu_manage(uint8_t op, uint32_t zone) {
+    struct xztl_zn_mcmd cmd;
+
+    cmd.opcode      = op;
+    cmd.addr.addr   = 0;
+    cmd.addr.g.zone = zone;
+    cmd.nzones      = 1;
+
+    return xztl_media_submit_zn(&cmd);
+}
+
+static int test_emu_io(uint8_t opcode, uint32_t zone, uint64_t sect,
+                       void *buf, uint64_t *paddr) {
+    struct xztl_io_mcmd cmd;
+    int                 ret;
+
+    memset(&cmd, 0x0, sizeof(struct xztl_io_mcmd));
+
+    cmd.opcode         = opcode;
+    cmd.synch          = 1;
+    cmd.naddr          = 1;
+    cmd.prp[0]         = (uint64_t)buf;
+    cmd.nsec[0]        = TEST_EMU_NLBAS;
+    cmd.addr[0].g.zone = zone;
+    cmd.addr[0].g.sect = sect;
+
+    ret = xztl_media_submit_io(&cmd);
+    if (!ret && paddr)
+        *paddr = cmd.paddr[0];
+
+    return ret;
+}
+
+static void test_emu_media_register(void) {
+    cunit_emu_assert_int("emu_media_register", emu_media_register(devname));
+}
+
+static void test_emu_media_init(void) {
+    struct xztl_core *core;
+
+    cunit_emu_assert_int("xztl_media_init", xztl_media_init());
+
+    get_xztl_core(&core);
+    cunit_emu_assert_int_equal("xztl_media_init:sec_zn",
+                               core->media->geo.sec_zn, TEST_EMU_ZSZE);
+    cunit_emu_assert_int_equal("xztl_media_init:caps",
+                               core->media->caps & XZTL_MEDIA_CAP_APPEND,
+                               XZTL_MEDIA_CAP_APPEND);
+}
+
+/* Command sizes hold at least XZTL_CMD_SEC_DEF sectors and fit in MDTS,
+ * reads also fit in the slot buffers */
+static void test_emu_cmd_sec(void) {
+    struct xztl_core *core;
+    uint32_t          mdts, rmax;
+    get_xztl_core(&core);
+
+    mdts = EMU_MEDIA_MDTS / EMU_MEDIA_NBYTES;
+    rmax = XZTL_READ_BYTES_MAX / EMU_MEDIA_NBYTES;
+
+    cunit_emu_assert_int("xztl_set_cmd_sec", xztl_set_cmd_sec(mdts, rmax));
+    cunit_emu_assert_int_equal("xztl_set_cmd_sec:write", core->write_sec,
+                               mdts);
+    cunit_emu_assert_int_equal("xztl_set_cmd_sec:read", core->read_sec, rmax);
+
+    CU_ASSERT(xztl_set_cmd_sec(XZTL_CMD_SEC_DEF - 1, 0) != 0);
+    CU_ASSERT(xztl_set_cmd_sec(mdts + 1, 0) != 0);
+    CU_ASSERT(xztl_set_cmd_sec(0, rmax + 1) != 0);
+
+    /* Rejected sizes are not applied */
+    cunit_emu_assert_int_equal("xztl_set_cmd_sec:write", core->write_sec,
+                               mdts);
+    cunit_emu_assert_int_equal("xztl_set_cmd_sec:read", core->read_sec, rmax);
+
+    cunit_emu_assert_int("xztl_set_cmd_sec",
+                         xztl_set_cmd_sec(XZTL_CMD_SEC_DEF, XZTL_CMD_SEC_DEF));
+}
+
+static void test_emu_media_exit(void) {
+    cunit_emu_assert_int("xztl_media_exit", xztl_media_exit());
+}
+
+static void test_emu_report(void) {
+    struct xnvme_spec_znd_descr zinfo;
+
+    zinfo = test_emu_zone_info(3);
+    cunit_emu_assert_int_equal("emu:report:zslba", zinfo.zslba,
+                               3 * TEST_EMU_ZSZE);
+    cunit_emu_assert_int_equal("emu:report:zcap", zinfo.zcap, TEST_EMU_ZCAP);
+    cunit_emu_assert_int_equal("emu:report:zs", zinfo.zs,
+                               XNVME_SPEC_ZND_STATE_EMPTY);
+}
+
+static void test_emu_report_iter(void) {
+    struct xztl_zn_report_iter   it;
+    struct xnvme_spec_znd_descr *zinfo;
+    uint32_t                     zone = 2, nzones = 0;
+
+    /* Small ranges to cross report boundaries */
+    xztl_zn_report_iter_init(&it, zone, 11);
+    it.batch = 4;
+
+    while ((zinfo = xztl_zn_report_iter_next(&it))) {
+        cunit_emu_assert_int_equal("emu:report_iter:zslba", zinfo->zslba,
+                                   (zone + nzones) * TEST_EMU_ZSZE);
+        nzones++;
+    }
+    xztl_zn_report_iter_exit(&it);
+
+    cunit_emu_assert_int("emu:report_iter:status", it.status);
+    cunit_emu_assert_int_equal("emu:report_iter:nzones", nzones, 11);
+}
+
+static void test_emu_write_read(void) {
+    uint64_t bsize, sect;
+    char *   wbuf, *rbuf;
+    uint32_t zone = 1;
+
+    bsize = TEST_EMU_NLBAS * EMU_MEDIA_NBYTES;
+    sect  = zone * TEST_EMU_ZSZE;
+
+    wbuf = xztl_media_dma_alloc(bsize);
+    rbuf = xztl_media_dma_alloc(bsize);
+    cunit_emu_assert_ptr("xztl_media_dma_alloc", wbuf);
+    cunit_emu_assert_ptr("xztl_media_dma_alloc", rbuf);
+    if (!wbuf || !rbuf)
+        goto FREE;
+
+    memset(wbuf, 0xa5, bsize);
+    memset(rbuf, 0x0, bsize);
+
+    /* Writes must land on the write pointer */
+    cunit_emu_assert_int("emu:write:wp",
+                         test_emu_io(XZTL_CMD_WRITE, zone, sect, wbuf, NULL));
+    CU_ASSERT(test_emu_io(XZTL_CMD_WRITE, zone, sect, wbuf, NULL) != 0);
+
+    cunit_emu_assert_int("emu:read",
+                         test_emu_io(XZTL_CMD_READ, zone, sect, rbuf, NULL));
+    CU_ASSERT(memcmp(wbuf, rbuf, bsize) == 0);
+
+    cunit_emu_assert_int_equal("emu:write:state", test_emu_zone_info(zone).zs,
+                               XNVME_SPEC_ZND_STATE_IOPEN);
+
+FREE:
+    if (wbuf)
+        xztl_media_dma_free(wbuf);
+    if (rbuf)
+        xztl_media_dma_free(rbuf);
+}
+
+static void test_emu_append(void) {
+    uint64_t paddr = 0;
+    void *   wbuf;
+    uint32_t zone = 2;
+
+    wbuf = xztl_media_dma_alloc(TEST_EMU_NLBAS * EMU_MEDIA_NBYTES);
+    cunit_emu_assert_ptr("xztl_media_dma_alloc", wbuf);
+    if (!wbuf)
+        return;
+
+    /* Appends return the written sector */
+    cunit_emu_assert_int("emu:append",
+                         test_emu_io(XZTL_ZONE_APPEND, zone, 0, wbuf, &paddr));
+    cunit_emu_assert_int_equal("emu:append:paddr", paddr,
+                               zone * TEST_EMU_ZSZE);
+
+    cunit_emu_assert_int("emu:append",
+                         test_emu_io(XZTL_ZONE_APPEND, zone, 0, wbuf, &paddr));
+    cunit_emu_assert_int_equal("emu:append:paddr", paddr,
+                               zone * TEST_EMU_ZSZE + TEST_EMU_NLBAS);
+
+    xztl_media_dma_free(wbuf);
+}
+
+static void test_emu_open_limit(void) {
+    /* Zones 1 and 2 are open after the previous tests, maxopen is 2 */
+    CU_ASSERT(test_emu_manage(XZTL_ZONE_MGMT_OPEN, 3) != 0);
+
+    cunit_emu_assert_int("emu:close",
+                         test_emu_manage(XZTL_ZONE_MGMT_CLOSE, 1));
+    cunit_emu_assert_int("emu:open", test_emu_manage(XZTL_ZONE_MGMT_OPEN, 3));
+    cunit_emu_assert_int_equal("emu:open:state", test_emu_zone_info(3).zs,
+                               XNVME_SPEC_ZND_STATE_EOPEN);
+}
+
+static void test_emu_finish_reset(void) {
+    struct xnvme_spec_znd_descr zinfo;
+    uint32_t                    zone;
+
+    cunit_emu_assert_int("emu:finish",
+                         test_emu_manage(XZTL_ZONE_MGMT_FINISH, 2));
+    zinfo = test_emu_zone_info(2);
+    cunit_emu_assert_int_equal("emu:finish:state", zinfo.zs,
+                               XNVME_SPEC_ZND_STATE_FULL);
+    cunit_emu_assert_int_equal("emu:finish:wp", zinfo.wp,
+                               2 * TEST_EMU_ZSZE + TEST_EMU_ZCAP);
+
+    for (zone = 1; zone <= 3; zone++) {
+        cunit_emu_assert_int("emu:reset",
+                             test_emu_manage(XZTL_ZONE_MGMT_RESET, zone));
+        zinfo = test_emu_zone_info(zone);
+        cunit_emu_assert_int_equal("emu:reset:state", zinfo.zs,
+                                   XNVME_SPEC_ZND_STATE_EMPTY);
+        cunit_emu_assert_int_equal("emu:reset:wp", zinfo.wp,
+                                   zone * TEST_EMU_ZSZE);
+    }
+}
+
+static int test_emu_copy(uint32_t src_zone, uint32_t dst_zone,
+                         uint64_t *paddr) {
+    struct xztl_io_mcmd cmd;
+    int                 ret;
+
+    memset(&cmd, 0x0, sizeof(struct xztl_io_mcmd));
+
+    /* Copy the two written ranges of the source zone in reverse order */
+    cmd.opcode          = XZTL_CMD_COPY;
+    cmd.synch           = 1;
+    cmd.naddr           = 2;
+    cmd.nsec[0]         = TEST_EMU_NLBAS;
+    cmd.nsec[1]         = TEST_EMU_NLBAS;
+    cmd.addr[0].g.sect  = src_zone * TEST_EMU_ZSZE + TEST_EMU_NLBAS;
+    cmd.addr[1].g.sect  = src_zone * TEST_EMU_ZSZE;
+    cmd.copy_dst.g.sect = dst_zone * TEST_EMU_ZSZE;
+
+    ret = xztl_media_submit_io(&cmd);
+    if (!ret)
+        *paddr = cmd.paddr[0];
+
+    return ret;
+}
+
+static void test_emu_copy_check(uint32_t zone, char *rbuf) {
+    uint64_t bsize = TEST_EMU_NLBAS * EMU_MEDIA_NBYTES;
+    uint64_t sect  = zone * TEST_EMU_ZSZE;
+
+    cunit_emu_assert_int("emu:copy:read",
+                         test_emu_io(XZTL_CMD_READ, zone, sect, rbuf, NULL));
+    CU_ASSERT(rbuf[0] == 0x5a && rbuf[bsize - 1] == 0x5a);
+
+    cunit_emu_assert_int("emu:copy:read",
+                         test_emu_io(XZTL_CMD_READ, zone,
+                                     sect + TEST_EMU_NLBAS, rbuf, NULL));
+    CU_ASSERT(rbuf[0] == (char)0xa5 && rbuf[bsize - 1] == (char)0xa5);
+
+    cunit_emu_assert_int_equal("emu:copy:wp", test_emu_zone_info(zone).wp,
+                               sect + 2 * TEST_EMU_NLBAS);
+}
+
+static void test_emu_ctx_callback(void *arg) {
+    struct xztl_io_mcmd *cmd = (struct xztl_io_mcmd *)arg;
+
+    cunit_emu_assert_int("xztl_media_submit_io:cb", cmd->status);
+    (*(int *)cmd->opaque)--;
+}
+
+/* Completions of a context are only reaped from it, a read context waits
+ * with its own mode and never processes the commands of another context */
+static void test_emu_reap_ctx(void) {
+    struct xztl_io_mcmd      cmd[2];
+    struct xztl_mthread_ctx *wctx, *rctx;
+    struct xztl_core *       core;
+    uint8_t                  mode;
+    void *                   rbuf[2];
+    int                      pending[2], ctx_i, ret;
+    get_xztl_core(&core);
+
+    wctx = xztl_ctx_media_init(4);
+    rctx = xztl_ctx_media_init(4);
+    cunit_emu_assert_ptr("xztl_ctx_media_init", wctx);
+    cunit_emu_assert_ptr("xztl_ctx_media_init", rctx);
+    rbuf[0] = xztl_media_dma_alloc(TEST_EMU_NLBAS * EMU_MEDIA_NBYTES);
+    rbuf[1] = xztl_media_dma_alloc(TEST_EMU_NLBAS * EMU_MEDIA_NBYTES);
+    cunit_emu_assert_ptr("xztl_media_dma_alloc", rbuf[0]);
+    cunit_emu_assert_ptr("xztl_media_dma_alloc", rbuf[1]);
+    if (!wctx || !rctx || !rbuf[0] || !rbuf[1])
+        goto FREE;
+
+    mode            = core->wait_mode;
+    core->wait_mode = XZTL_WAIT_BLOCK;
+    rctx->wait_mode = XZTL_WAIT_SPIN;
+
+    for (ctx_i = 0; ctx_i < 2; ctx_i++) {
+        memset(&cmd[ctx_i], 0x0, sizeof(struct xztl_io_mcmd));
+        cmd[ctx_i].opcode         = XZTL_CMD_READ;
+        cmd[ctx_i].naddr          = 1;
+        cmd[ctx_i].async_ctx      = (ctx_i) ? rctx : wctx;
+        cmd[ctx_i].prp[0]         = (uint64_t)rbuf[ctx_i];
+        cmd[ctx_i].addr[0].g.sect = TEST_EMU_ZSZE;
+        cmd[ctx_i].nsec[0]        = TEST_EMU_NLBAS;
+        cmd[ctx_i].callback       = test_emu_ctx_callback;
+        cmd[ctx_i].opaque         = &pending[ctx_i];
+
+        pending[ctx_i] = 1;
+        ret            = xztl_media_submit_io(&cmd[ctx_i]);
+        cunit_emu_assert_int("xztl_media_submit_io", ret);
+        if (ret)
+            pending[ctx_i] = 0;
+    }
+
+    while (pending[1])
+        xztl_ctx_media_reap(rctx);
+
+    /* The read context spun, the other command is still in its queue */
+    cunit_emu_assert_int_equal("rctx:nsleep", rctx->wait_nsleep, 0);
+    cunit_emu_assert_int_equal("wctx:pending", pending[0], 1);
+
+    while (pending[0])
+        xztl_ctx_media_reap(wctx);
+    CU_ASSERT(memcmp(rbuf[0], rbuf[1], TEST_EMU_NLBAS * EMU_MEDIA_NBYTES) ==
+              0);
+
+    core->wait_mode = mode;
+
+FREE:
+    if (rbuf[0])
+        xztl_media_dma_free(rbuf[0]);
+    if (rbuf[1])
+        xztl_media_dma_free(rbuf[1]);
+    if (rctx)
+        cunit_emu_assert_int("xztl_ctx_media_exit",
+                             xztl_ctx_media_exit(rctx));
+    if (wctx)
+        cunit_emu_assert_int("xztl_ctx_media_exit",
+                             xztl_ctx_media_exit(wctx));
+}
+
+static void test_emu_copy_zone(void) {
+    struct xztl_core *core;
+    uint64_t          bsize, sect, paddr = 0;
+    uint32_t          caps, zone = 8;
+    char *            buf;
+
+    get_xztl_core(&core);
+    bsize = TEST_EMU_NLBAS * EMU_MEDIA_NBYTES;
+    sect  = zone * TEST_EMU_ZSZE;
+
+    buf = xztl_media_dma_alloc(bsize);
+    cunit_emu_assert_ptr("xztl_media_dma_alloc", buf);
+    if (!buf)
+        return;
+
+    memset(buf, 0xa5, bsize);
+    cunit_emu_assert_int("emu:write",
+                         test_emu_io(XZTL_CMD_WRITE, zone, sect, buf, NULL));
+    memset(buf, 0x5a, bsize);
+    cunit_emu_assert_int("emu:write",
+                         test_emu_io(XZTL_CMD_WRITE, zone,
+                                     sect + TEST_EMU_NLBAS, buf, NULL));
+
+    /* Device copy */
+    cunit_emu_assert_int("emu:copy", test_emu_copy(zone, zone + 1, &paddr));
+    cunit_emu_assert_int_equal("emu:copy:paddr", paddr,
+                               (zone + 1) * TEST_EMU_ZSZE);
+    test_emu_copy_check(zone + 1, buf);
+
+    /* Host fallback, keep the open zones under the limit */
+    cunit_emu_assert_int("emu:finish",
+                         test_emu_manage(XZTL_ZONE_MGMT_FINISH, zone + 1));
+    caps = core->media->caps;
+    core->media->caps &= ~XZTL_MEDIA_CAP_COPY;
+    cunit_emu_assert_int("emu:copy:host",
+                         test_emu_copy(zone, zone + 2, &paddr));
+    core->media->caps = caps;
+    cunit_emu_assert_int_equal("emu:copy:host:paddr", paddr,
+                               (zone + 2) * TEST_EMU_ZSZE);
+    test_emu_copy_check(zone + 2, buf);
+
+    xztl_media_dma_free(buf);
+}
+
+static int  outstanding;
+static void test_emu_zn_callback(void *arg) {
+    struct xztl_zn_mcmd *cmd = (struct xztl_zn_mcmd *)arg;
+
+    cunit_emu_assert_int("xztl_media_submit_zn_asynch:cb", cmd->status);
+    outstanding--;
+}
+
+static void test_emu_zn_asynch(void) {
+    struct xztl_zn_mcmd      cmd[4];
+    struct xztl_misc_cmd     misc;
+    struct xztl_mthread_ctx *tctx;
+    uint32_t                 zone;
+    int                      ret;
+
+    tctx = xztl_ctx_media_init(4);
+    cunit_emu_assert_ptr("xztl_ctx_media_init", tctx);
+    if (!tctx)
+        return;
+
+    /* Finish 4 zones in parallel */
+    outstanding = 4;
+    for (zone = 4; zone < 8; zone++) {
+        cmd[zone - 4].opcode      = XZTL_ZONE_MGMT_FINISH;
+        cmd[zone - 4].addr.addr   = 0;
+        cmd[zone - 4].addr.g.zone = zone;
+        cmd[zone - 4].nzones      = 1;
+        cmd[zone - 4].async_ctx   = tctx;
+        cmd[zone - 4].callback    = test_emu_zn_callback;
+
+        ret = xztl_media_submit_zn_asynch(&cmd[zone - 4]);
+        cunit_emu_assert_int("xztl_media_submit_zn_asynch", ret);
+        if (ret)
+            outstanding--;
+    }
+
+    misc.opcode         = XZTL_MISC_ASYNCH_POKE;
+    misc.asynch.ctx_ptr = tctx;
+    misc.asynch.limit   = 0;
+    while (outstanding)
+        xztl_media_submit_misc(&misc);
+
+    for (zone = 4; zone < 8; zone++)
+        cunit_emu_assert_int_equal("emu:finish:state",
+                                   test_emu_zone_info(zone).zs,
+                                   XNVME_SPEC_ZND_STATE_FULL);
+
+    /* Reports are synchronous only */
+    cmd[0].opcode = XZTL_ZONE_MGMT_REPORT;
+    CU_ASSERT(xztl_media_submit_zn_asynch(&cmd[0]) != 0);
+
+    ret = xztl_ctx_media_exit(tctx);
+    cunit_emu_assert_int("xztl_ctx_media_exit", ret);
+}
+
+static void test_emu_io_callback(void *arg) {
+    struct xztl_io_mcmd *cmd = (struct xztl_io_mcmd *)arg;
+
+    cunit_emu_assert_int("xztl_media_submit_io:cb", cmd->status);
+    outstanding--;
+}
+
+static void test_emu_reap(void) {
+    struct xztl_io_mcmd      cmd;
+    struct xztl_mthread_ctx *tctx;
+    struct xztl_core *       core;
+    uint8_t                  mode;
+    void *                   rbuf;
+    int                      ret;
+    get_xztl_core(&core);
+
+    tctx = xztl_ctx_media_init(4);
+    cunit_emu_assert_ptr("xztl_ctx_media_init", tctx);
+    if (!tctx)
+        return;
+
+    rbuf = xztl_media_dma_alloc(TEST_EMU_NLBAS * EMU_MEDIA_NBYTES);
+    cunit_emu_assert_ptr("xztl_media_dma_alloc", rbuf);
+    if (!rbuf)
+        goto CTX;
+
+    memset(&cmd, 0x0, sizeof(struct xztl_io_mcmd));
+    cmd.opcode    = XZTL_CMD_READ;
+    cmd.naddr     = 1;
+    cmd.async_ctx = tctx;
+    cmd.prp[0]    = (uint64_t)rbuf;
+    cmd.nsec[0]   = TEST_EMU_NLBAS;
+    cmd.callback  = test_emu_io_callback;
+
+    /* Nothing outstanding, blocking must return */
+    mode            = core->wait_mode;
+    core->wait_mode = XZTL_WAIT_BLOCK;
+    cunit_emu_assert_int_equal("xztl_ctx_media_reap:empty",
+                               xztl_ctx_media_reap(tctx), 0);
+
+    outstanding = 1;
+    ret         = xztl_media_submit_io(&cmd);
+    cunit_emu_assert_int("xztl_media_submit_io", ret);
+    if (ret)
+        outstanding = 0;
+
+    while (outstanding)
+        xztl_ctx_media_reap(tctx);
+
+    /* The reap with nothing outstanding blocked once */
+    CU_ASSERT(tctx->wait_nsleep >= 1);
+    core->wait_mode = mode;
+
+    xztl_media_dma_free(rbuf);
+CTX:
+    ret = xztl_ctx_media_exit(tctx);
+    cunit_emu_assert_int("xztl_ctx_media_exit", ret);
+}
+
+int main(int argc, const char **argv) {
+    int failed;
+
+    if (argc > 1)
+        devname = argv[1];
+    printf("Device: %s\n", devname);
+
+    CU_pSuite pSuite = NULL;
+
+    if (CUE_SUCCESS != CU_initialize_registry())
+        return CU_get_error();
+
+    pSuite = CU_add_suite("Suite_emu_media", cunit_emu_media_init,
+                          cunit_emu_media_exit);
+    if (pSuite == NULL) {
+        CU_cleanup_registry();
+        return CU_get_error();
+    }
+
+    if ((CU_add_test(pSuite, "Set the emu_media layer",
+                     test_emu_media_register) == NULL) ||
+        (CU_add_test(pSuite, "Initialize media", test_emu_media_init) ==
+         NULL) ||
+        (CU_add_test(pSuite, "Validate media command sizes",
+                     test_emu_cmd_sec) == NULL) ||
+        (CU_add_test(pSuite, "Get/Check zone report", test_emu_report) ==
+         NULL) ||
+        (CU_add_test(pSuite, "Iterate zone report in ranges",
+                     test_emu_report_iter) == NULL) ||
+        (CU_add_test(pSuite, "Write/Read at the write pointer",
+                     test_emu_write_read) == NULL) ||
+        (CU_add_test(pSuite, "Append to a zone", test_emu_append) == NULL) ||
+        (CU_add_test(pSuite, "Enforce the open zone limit",
+                     test_emu_open_limit) == NULL) ||
+        (CU_add_test(pSuite, "Finish/Reset zones", test_emu_finish_reset) ==
+         NULL) ||
+        (CU_add_test(pSuite, "Finish zones asynchronously",
+                     test_emu_zn_asynch) == NULL) ||
+        (CU_add_test(pSuite, "Reap completions in block mode",
+                     test_emu_reap) == NULL) ||
+        (CU_add_test(pSuite, "Reap read and write contexts apart",
+                     test_emu_reap_ctx) == NULL) ||
+        (CU_add_test(pSuite, "Copy ranges to a zone", test_emu_copy_zone) ==
+         NULL) ||
+        (CU_add_test(pSuite, "Close media", test_emu_media_exit) == NULL)) {
+        CU_cleanup_registry();
+        return CU_get_error();
+    }
+
+    CU_basic_set_mode(CU_BRM_VERBOSE);
+    CU_basic_run_tests();
+
+    failed = CU_get_number_of_tests_failed();
+    CU_cleanup_registry();
+
+    return failed;
+}
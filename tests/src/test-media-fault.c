@@ -0,0 +1,378 @@
+/* xZTL: Zone Translation Layer User-space Library
+ *
+ * Copyright 2019 Samsung Electronics
+ *
+ * Written by Ivan L. Picoli <i.picoli@samsung.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+
+#include <libxnvme_spec.h>
+#include <libxnvme_znd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <xztl.h>
+#include <ztl-media-emu.h>
+#include <ztl-media-fault.h>
+
+#include "CUnit/Basic.h"
+
+#define TEST_FAULT_DEV   "emu:mem?nzones=8&zsze=4096&maxopen=4"
+#define TEST_FAULT_NLBAS 16
+#define TEST_FAULT_NREAD 64
+
+static const char *devname = TEST_FAULT_DEV;
+static int         outstanding;
+
+static void cunit_fault_assert_ptr(char *fn, void *ptr) {
+    CU_ASSERT((uint64_t)ptr != 0);
+    if (!ptr)
+        printf("\n %s: ptr %p\n", fn, ptr);
+}
+
+static void cunit_fault_assert_int(char *fn, uint64_t status) {
+    CU_ASSERT(status == 0);
+    if (status)
+        printf("\n %s: %lx\n", fn, status);
+}
+
+static void cunit_fault_assert_int_equal(char *fn, uint64_t value,
+                                         uint64_t expected) {
+    CU_ASSERT_EQUAL(value, expected);
+    if (value != expected)
+        printf("\n %s: value %lx != expected %lx\n", fn, value, expected);
+}
+
+static int cunit_fault_media_init(void) {
+    return 0;
+}
+
+static int cunit_fault_media_exit(void) {
+    return 0;
+}
+
+static uint64_t test_fault_now(void) {
+    struct timespec ts;
+    uint64_t        us;
+
+    GET_MICROSECONDS(us, ts);
+    return us;
+}
+
+static int test_fault_manage(struct xztl_zn_mcmd *cmd, uint8_t op,
+                             uint32_t zone) {
+    memset(cmd, 0x0, sizeof(struct xztl_zn_mcmd));
+    cmd->opcode      = op;
+    cmd->addr.g.zone = zone;
+    cmd->nzones      = 1;
+
+    return xztl_media_submit_zn(cmd);
+}
+
+static int test_fault_io(struct xztl_io_mcmd *cmd, uint8_t opcode,
+                         uint32_t zone, void *buf) {
+    struct xztl_core *core;
+    get_xztl_core(&core);
+
+    memset(cmd, 0x0, sizeof(struct xztl_io_mcmd));
+    cmd->opcode         = opcode;
+    cmd->synch          = 1;
+    cmd->naddr          = 1;
+    cmd->prp[0]         = (uint64_t)buf;
+    cmd->nsec[0]        = TEST_FAULT_NLBAS;
+    cmd->addr[0].g.sect = zone * core->media->geo.sec_zn;
+
+    return xztl_media_submit_io(cmd);
+}
+
+static void test_fault_media_register(void) {
+    cunit_fault_assert_int("emu_media_register", emu_media_register(devname));
+    cunit_fault_assert_int("xztl_media_init", xztl_media_init());
+}
+
+static void test_fault_parse(void) {
+    struct fault_media_rule rules[FAULT_MEDIA_NOPS];
+
+    cunit_fault_assert_int(
+        "fault_media_parse",
+        fault_media_parse("read:exp=100/5000,stall=100/50000;"
+                          "reset:uniform=10/20,err=1000,tmo=5/300",
+                          rules));
+
+    CU_ASSERT(rules[FAULT_MEDIA_READ].dist == FAULT_MEDIA_LAT_EXP);
+    CU_ASSERT(rules[FAULT_MEDIA_READ].lat_us == 100);
+    CU_ASSERT(rules[FAULT_MEDIA_READ].lat_max == 5000);
+    CU_ASSERT(rules[FAULT_MEDIA_READ].stall_ppm == 100);
+    CU_ASSERT(rules[FAULT_MEDIA_READ].stall_us == 50000);
+    CU_ASSERT(rules[FAULT_MEDIA_RESET].dist == FAULT_MEDIA_LAT_UNIFORM);
+    CU_ASSERT(rules[FAULT_MEDIA_RESET].err_ppm == 1000);
+    CU_ASSERT(rules[FAULT_MEDIA_RESET].tmo_ppm == 5);
+    CU_ASSERT(rules[FAULT_MEDIA_RESET].tmo_us == 300);
+    CU_ASSERT(rules[FAULT_MEDIA_WRITE].dist == FAULT_MEDIA_LAT_NONE);
+
+    CU_ASSERT(fault_media_parse("flush:fixed=10", rules) != 0);
+    CU_ASSERT(fault_media_parse("read:fixed", rules) != 0);
+    CU_ASSERT(fault_media_parse("read:uniform=10", rules) != 0);
+    CU_ASSERT(fault_media_parse("read:slow=10", rules) != 0);
+}
+
+static void test_fault_latency(void) {
+    struct xztl_zn_mcmd cmd;
+    uint64_t            start;
+
+    cunit_fault_assert_int("fault_media_wrap",
+                           fault_media_wrap("reset:fixed=3000", 1));
+
+    start = test_fault_now();
+    cunit_fault_assert_int("xztl_media_submit_zn",
+                           test_fault_manage(&cmd, XZTL_ZONE_MGMT_RESET, 0));
+    CU_ASSERT(test_fault_now() - start >= 3000);
+
+    fault_media_unwrap();
+}
+
+static void test_fault_zn_callback(void *arg) {
+    struct xztl_zn_mcmd *cmd = (struct xztl_zn_mcmd *)arg;
+
+    cunit_fault_assert_int_equal("fault:zn:cb", cmd->status,
+                                 FAULT_MEDIA_STATUS_ERR);
+    outstanding--;
+}
+
+static void test_fault_errors(void) {
+    struct fault_media_stats st;
+    struct xztl_zn_mcmd      zcmd;
+    struct xztl_io_mcmd      cmd;
+    struct xztl_mthread_ctx *tctx;
+    uint64_t                 start;
+    void *                   buf;
+
+    buf = xztl_media_dma_alloc(TEST_FAULT_NLBAS * EMU_MEDIA_NBYTES);
+    cunit_fault_assert_ptr("xztl_media_dma_alloc", buf);
+    if (!buf)
+        return;
+
+    cunit_fault_assert_int(
+        "fault_media_wrap",
+        fault_media_wrap("finish:err=1000000;write:tmo=1000000/2000", 1));
+
+    CU_ASSERT(test_fault_manage(&zcmd, XZTL_ZONE_MGMT_FINISH, 1) ==
+              FAULT_MEDIA_STATUS_ERR);
+
+    /* Timed out writes do not reach the media */
+    start = test_fault_now();
+    CU_ASSERT(test_fault_io(&cmd, XZTL_CMD_WRITE, 1, buf) ==
+              FAULT_MEDIA_STATUS_TMO);
+    CU_ASSERT(test_fault_now() - start >= 2000);
+
+    fault_media_get_stats(FAULT_MEDIA_FINISH, &st);
+    CU_ASSERT(st.ncmd == 1 && st.nerr == 1);
+    fault_media_get_stats(FAULT_MEDIA_WRITE, &st);
+    CU_ASSERT(st.ncmd == 1 && st.ntmo == 1);
+
+    /* Asynchronous failures complete through the callback, when the
+     * context is reaped */
+    tctx = xztl_ctx_media_init(4);
+    cunit_fault_assert_ptr("xztl_ctx_media_init", tctx);
+    if (tctx) {
+        memset(&zcmd, 0x0, sizeof(struct xztl_zn_mcmd));
+        zcmd.opcode      = XZTL_ZONE_MGMT_FINISH;
+        zcmd.addr.g.zone = 1;
+        zcmd.nzones      = 1;
+        zcmd.async_ctx   = tctx;
+        zcmd.callback    = test_fault_zn_callback;
+
+        outstanding = 1;
+        cunit_fault_assert_int("xztl_media_submit_zn_asynch",
+                               xztl_media_submit_zn_asynch(&zcmd));
+        while (outstanding)
+            xztl_ctx_media_reap(tctx);
+
+        cunit_fault_assert_int("xztl_ctx_media_exit",
+                               xztl_ctx_media_exit(tctx));
+    }
+
+    fault_media_unwrap();
+
+    /* The zone was neither written nor finished */
+    cunit_fault_assert_int("xztl_media_submit_io",
+                           test_fault_io(&cmd, XZTL_CMD_WRITE, 1, buf));
+
+    xztl_media_dma_free(buf);
+}
+
+static void test_fault_io_callback(void *arg) {
+    struct xztl_io_mcmd *cmd = (struct xztl_io_mcmd *)arg;
+
+    cunit_fault_assert_int("fault:io:cb", cmd->status);
+    outstanding--;
+}
+
+static void test_fault_asynch(void) {
+    struct xztl_io_mcmd      cmd;
+    struct xztl_mthread_ctx *tctx;
+    uint64_t                 start;
+    void *                   buf;
+    int                      ret;
+
+    tctx = xztl_ctx_media_init(4);
+    cunit_fault_assert_ptr("xztl_ctx_media_init", tctx);
+    if (!tctx)
+        return;
+
+    buf = xztl_media_dma_alloc(TEST_FAULT_NLBAS * EMU_MEDIA_NBYTES);
+    cunit_fault_assert_ptr("xztl_media_dma_alloc", buf);
+    if (!buf)
+        goto CTX;
+
+    cunit_fault_assert_int("fault_media_wrap",
+                           fault_media_wrap("read:fixed=3000", 1));
+
+    memset(&cmd, 0x0, sizeof(struct xztl_io_mcmd));
+    cmd.opcode    = XZTL_CMD_READ;
+    cmd.naddr     = 1;
+    cmd.async_ctx = tctx;
+    cmd.prp[0]    = (uint64_t)buf;
+    cmd.nsec[0]   = TEST_FAULT_NLBAS;
+    cmd.callback  = test_fault_io_callback;
+
+    /* The completion is held until the latency has passed */
+    start       = test_fault_now();
+    outstanding = 1;
+    ret         = xztl_media_submit_io(&cmd);
+    cunit_fault_assert_int("xztl_media_submit_io", ret);
+    if (ret)
+        outstanding = 0;
+
+    /* Pokes do not wait for the held completion */
+    xztl_ctx_media_poke(tctx);
+    CU_ASSERT(test_fault_now() - start < 3000);
+    CU_ASSERT(!ret && outstanding == 1);
+
+    while (outstanding)
+        xztl_ctx_media_reap(tctx);
+
+    CU_ASSERT(test_fault_now() - start >= 3000);
+    CU_ASSERT(cmd.callback == test_fault_io_callback);
+
+    fault_media_unwrap();
+    xztl_media_dma_free(buf);
+CTX:
+    cunit_fault_assert_int("xztl_ctx_media_exit", xztl_ctx_media_exit(tctx));
+}
+
+static int test_fault_cmp(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+/* Read with exponential latency and stalls, returns the injected stats
+ * and prints the measured p99 */
+static void test_fault_run(uint64_t seed, struct fault_media_stats *st) {
+    struct xztl_io_mcmd cmd;
+    uint64_t            lat[TEST_FAULT_NREAD], start;
+    uint32_t            read_i;
+    void *              buf;
+
+    memset(st, 0x0, sizeof(struct fault_media_stats));
+
+    buf = xztl_media_dma_alloc(TEST_FAULT_NLBAS * EMU_MEDIA_NBYTES);
+    cunit_fault_assert_ptr("xztl_media_dma_alloc", buf);
+    if (!buf)
+        return;
+
+    cunit_fault_assert_int(
+        "fault_media_wrap",
+        fault_media_wrap("read:exp=100/1000,stall=50000/2000", seed));
+
+    for (read_i = 0; read_i < TEST_FAULT_NREAD; read_i++) {
+        start = test_fault_now();
+        cunit_fault_assert_int("xztl_media_submit_io",
+                               test_fault_io(&cmd, XZTL_CMD_READ, 2, buf));
+        lat[read_i] = test_fault_now() - start;
+    }
+
+    fault_media_get_stats(FAULT_MEDIA_READ, st);
+    fault_media_print_stats();
+    fault_media_unwrap();
+
+    qsort(lat, TEST_FAULT_NREAD, sizeof(uint64_t), test_fault_cmp);
+    printf("\n  seed %lu: p50 %lu us, p99 %lu us\n", seed,
+           lat[TEST_FAULT_NREAD / 2], lat[TEST_FAULT_NREAD * 99 / 100]);
+
+    xztl_media_dma_free(buf);
+}
+
+static void test_fault_seed(void) {
+    struct fault_media_stats st[3];
+
+    test_fault_run(7, &st[0]);
+    test_fault_run(7, &st[1]);
+    test_fault_run(8, &st[2]);
+
+    CU_ASSERT(st[0].ncmd == TEST_FAULT_NREAD);
+    CU_ASSERT(st[0].lat_us == st[1].lat_us);
+    CU_ASSERT(st[0].nstall == st[1].nstall);
+    CU_ASSERT(st[0].lat_us != st[2].lat_us);
+}
+
+static void test_fault_media_exit(void) {
+    cunit_fault_assert_int("xztl_media_exit", xztl_media_exit());
+}
+
+int main(int argc, const char **argv) {
+    int failed;
+
+    if (argc > 1)
+        devname = argv[1];
+    printf("Device: %s\n", devname);
+
+    CU_pSuite pSuite = NULL;
+
+    if (CUE_SUCCESS != CU_initialize_registry())
+        return CU_get_error();
+
+    pSuite = CU_add_suite("Suite_fault_media", cunit_fault_media_init,
+                          cunit_fault_media_exit);
+    if (pSuite == NULL) {
+        CU_cleanup_registry();
+        return CU_get_error();
+    }
+
+    if ((CU_add_test(pSuite, "Set the media layer",
+                     test_fault_media_register) == NULL) ||
+        (CU_add_test(pSuite, "Parse fault specs", test_fault_parse) ==
+         NULL) ||
+        (CU_add_test(pSuite, "Inject latency on zone resets",
+                     test_fault_latency) == NULL) ||
+        (CU_add_test(pSuite, "Inject errors and timeouts",
+                     test_fault_errors) == NULL) ||
+        (CU_add_test(pSuite, "Hold asynchronous completions",
+                     test_fault_asynch) == NULL) ||
+        (CU_add_test(pSuite, "Reproduce faults from a seed",
+                     test_fault_seed) == NULL) ||
+        (CU_add_test(pSuite, "Close media", test_fault_media_exit) == NULL)) {
+        CU_cleanup_registry();
+        return CU_get_error();
+    }
+
+    CU_basic_set_mode(CU_BRM_VERBOSE);
+    CU_basic_run_tests();
+
+    failed = CU_get_number_of_tests_failed();
+    CU_cleanup_registry();
+
+    return failed;
+}
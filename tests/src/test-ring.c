@@ -0,0 +1,171 @@
+/* xZTL: Zone Translation Layer User-space Library
+ *
+ * Copyright 2019 Samsung Electronics
+ *
+ * Written by Ivan L. Picoli <i.picoli@samsung.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <xztl-ring.h>
+#include <xztl.h>
+
+#include "CUnit/Basic.h"
+
+#define TEST_RING_SIZE      64
+#define TEST_RING_PRODUCERS 4
+#define TEST_RING_ENTRIES   100000
+
+static struct xztl_ring ring;
+
+struct test_ring_producer {
+    uint64_t  id;
+    pthread_t th;
+};
+
+static int cunit_ring_init(void) {
+    return 0;
+}
+
+static int cunit_ring_exit(void) {
+    return 0;
+}
+
+static void test_ring_init(void) {
+    CU_ASSERT(xztl_ring_init(&ring, TEST_RING_SIZE - 1, -1) == 0);
+    CU_ASSERT(ring.size == TEST_RING_SIZE);
+    CU_ASSERT(xztl_ring_empty(&ring));
+}
+
+static void test_ring_order(void) {
+    void *   ptr[TEST_RING_SIZE];
+    uint64_t ent_i;
+
+    for (ent_i = 1; ent_i <= 10; ent_i++)
+        CU_ASSERT(xztl_ring_push(&ring, (void *)ent_i) == 0); // NOLINT
+    CU_ASSERT(!xztl_ring_empty(&ring));
+
+    /* Pops stop at 'max' and keep the push order */
+    CU_ASSERT(xztl_ring_pop(&ring, ptr, 4) == 4);
+    CU_ASSERT(xztl_ring_pop(&ring, &ptr[4], TEST_RING_SIZE) == 6);
+    for (ent_i = 0; ent_i < 10; ent_i++)
+        CU_ASSERT((uint64_t)ptr[ent_i] == ent_i + 1); // NOLINT
+
+    CU_ASSERT(xztl_ring_empty(&ring));
+    CU_ASSERT(xztl_ring_pop(&ring, ptr, TEST_RING_SIZE) == 0);
+}
+
+static void test_ring_full(void) {
+    void *   ptr[TEST_RING_SIZE];
+    uint64_t ent_i;
+
+    for (ent_i = 0; ent_i < TEST_RING_SIZE; ent_i++)
+        CU_ASSERT(xztl_ring_push(&ring, (void *)ent_i) == 0); // NOLINT
+    CU_ASSERT(xztl_ring_push(&ring, NULL) == XZTL_RING_FULL);
+
+    /* A popped entry is free for the next lap */
+    CU_ASSERT(xztl_ring_pop(&ring, ptr, 1) == 1);
+    CU_ASSERT(xztl_ring_push(&ring, NULL) == 0);
+    CU_ASSERT(xztl_ring_pop(&ring, ptr, TEST_RING_SIZE) == TEST_RING_SIZE);
+    CU_ASSERT(xztl_ring_empty(&ring));
+}
+
+static void *test_ring_producer_th(void *arg) {
+    struct test_ring_producer *prod = (struct test_ring_producer *)arg;
+    uint64_t                   ent_i, val;
+
+    for (ent_i = 0; ent_i < TEST_RING_ENTRIES; ent_i++) {
+        val = (prod->id << 32) | ent_i;
+        while (xztl_ring_push(&ring, (void *)val)) // NOLINT
+            sched_yield();
+    }
+
+    return NULL;
+}
+
+static void test_ring_producers(void) {
+    struct test_ring_producer prod[TEST_RING_PRODUCERS];
+    uint64_t                  next[TEST_RING_PRODUCERS], val;
+    void *                    ptr[16];
+    uint32_t                  nptr, ptr_i, prod_i, npop = 0, nerr = 0;
+
+    for (prod_i = 0; prod_i < TEST_RING_PRODUCERS; prod_i++) {
+        next[prod_i]    = 0;
+        prod[prod_i].id = prod_i;
+        pthread_create(&prod[prod_i].th, NULL, test_ring_producer_th,
+                       &prod[prod_i]);
+    }
+
+    /* Entries of each producer come out in order, none is lost */
+    while (npop < TEST_RING_PRODUCERS * TEST_RING_ENTRIES) {
+        nptr = xztl_ring_pop(&ring, ptr, 16);
+        for (ptr_i = 0; ptr_i < nptr; ptr_i++) {
+            val    = (uint64_t)ptr[ptr_i]; // NOLINT
+            prod_i = val >> 32;
+            if (prod_i >= TEST_RING_PRODUCERS ||
+                (val & 0xffffffff) != next[prod_i]++)
+                nerr++;
+        }
+        npop += nptr;
+    }
+
+    for (prod_i = 0; prod_i < TEST_RING_PRODUCERS; prod_i++)
+        pthread_join(prod[prod_i].th, NULL);
+
+    CU_ASSERT(nerr == 0);
+    CU_ASSERT(xztl_ring_empty(&ring));
+}
+
+static void test_ring_exit(void) {
+    xztl_ring_exit(&ring);
+    CU_ASSERT(ring.cells == NULL);
+}
+
+int main(int argc, const char **argv) {
+    int failed;
+
+    CU_pSuite pSuite = NULL;
+
+    if (CUE_SUCCESS != CU_initialize_registry())
+        return CU_get_error();
+
+    pSuite = CU_add_suite("Suite_ring", cunit_ring_init, cunit_ring_exit);
+    if (pSuite == NULL) {
+        CU_cleanup_registry();
+        return CU_get_error();
+    }
+
+    if ((CU_add_test(pSuite, "Create a ring", test_ring_init) == NULL) ||
+        (CU_add_test(pSuite, "Pop in push order", test_ring_order) ==
+         NULL) ||
+        (CU_add_test(pSuite, "Decline pushes to a full ring",
+                     test_ring_full) == NULL) ||
+        (CU_add_test(pSuite, "Push from several threads",
+                     test_ring_producers) == NULL) ||
+        (CU_add_test(pSuite, "Destroy the ring", test_ring_exit) == NULL)) {
+        CU_cleanup_registry();
+        return CU_get_error();
+    }
+
+    CU_basic_set_mode(CU_BRM_VERBOSE);
+    CU_basic_run_tests();
+
+    failed = CU_get_number_of_tests_failed();
+    CU_cleanup_registry();
+
+    return failed;
+}
@@ -79,6 +79,7 @@ static void test_znd_report(void) {
 
     zone = 0;
     cmd.opcode      = XZTL_ZONE_MGMT_REPORT;
+    cmd.addr.addr   = 0;
     cmd.addr.g.zone = 0;
     cmd.nzones = nzones = core->media->geo.zn_dev;
 
@@ -113,7 +114,7 @@ static void test_znd_manage_single(uint8_t op, uint8_t devop, uint32_t zone,
     ret = xztl_media_submit_zn(&cmd);
     cunit_znd_assert_int(name, ret);
 
-    /* Verify log page */
+    /* Verify log page, the report starts at the command zone */
     cmd.opcode = XZTL_ZONE_MGMT_REPORT;
     cmd.nzones = 1;
 
@@ -122,7 +123,7 @@ static void test_znd_manage_single(uint8_t op, uint8_t devop, uint32_t zone,
 
     if (!ret) {
         report = (struct xnvme_znd_report *)cmd.opaque;
-        zinfo  = XNVME_ZND_REPORT_DESCR(report, cmd.addr.g.zone);
+        zinfo  = XNVME_ZND_REPORT_DESCR(report, 0);
         cunit_znd_assert_int_equal(name, zinfo->zs, devop);
     }
 
@@ -394,6 +395,96 @@ MP:
     cunit_znd_assert_int("", ret);
 }
 
+static void test_znd_read_batch(void) {
+    struct xztl_mp_entry *   mp_cmd[4];
+    struct xztl_io_mcmd *    cmd[4];
+    struct xztl_mthread_ctx *tctx;
+    uint16_t                 tid, ents, nlbas, zone, cmd_i;
+    uint32_t                 nsub;
+    uint64_t                 bsize;
+    char *                   wbuf;
+    int                      ret;
+    struct xztl_core *       core;
+    get_xztl_core(&core);
+
+    tid   = 0;
+    ents  = 128;
+    nlbas = 16;
+    zone  = 0;
+    bsize = nlbas * core->media->geo.nbytes * 1UL;
+
+    /* Initialize mempool module */
+    ret = xztl_mempool_init();
+    cunit_znd_assert_int("xztl_mempool_init", ret);
+    if (ret)
+        return;
+
+    /* Initialize thread media context */
+    tctx = xztl_ctx_media_init(ents);
+    cunit_znd_assert_ptr("xztl_ctx_media_init", tctx);
+    if (!tctx)
+        goto MP;
+
+    /* Allocate DMA memory, the last command reads into 2 buffers */
+    wbuf = xztl_media_dma_alloc(bsize * 5);
+    cunit_znd_assert_ptr("xztl_media_dma_alloc", wbuf);
+    if (!wbuf)
+        goto CTX;
+
+    xztl_mempool_create(XZTL_MEMPOOL_MCMD, 0, 16, sizeof(struct xztl_io_mcmd),
+                        NULL, NULL);
+
+    for (cmd_i = 0; cmd_i < 4; cmd_i++) {
+        mp_cmd[cmd_i] = xztl_mempool_get(XZTL_MEMPOOL_MCMD, tid);
+        cunit_znd_assert_ptr("xztl_mempool_get", mp_cmd[cmd_i]);
+        if (!mp_cmd[cmd_i])
+            goto PUT;
+
+        cmd[cmd_i] = (struct xztl_io_mcmd *)mp_cmd[cmd_i]->opaque;
+        memset(cmd[cmd_i], 0x0, sizeof(struct xztl_io_mcmd));
+
+        cmd[cmd_i]->opcode    = XZTL_CMD_READ;
+        cmd[cmd_i]->synch     = 0;
+        cmd[cmd_i]->async_ctx = tctx;
+        cmd[cmd_i]->naddr     = 1;
+        cmd[cmd_i]->prp[0]    = (uint64_t)(wbuf + bsize * cmd_i);
+        cmd[cmd_i]->nsec[0]   = nlbas;
+        cmd[cmd_i]->callback  = test_znd_callback;
+        cmd[cmd_i]->addr[0].g.sect =
+            zone * core->media->geo.sec_zn * 1UL + nlbas * cmd_i;
+    }
+
+    /* Vectored command: 2 non-contiguous buffers */
+    cmd[3]->naddr   = 2;
+    cmd[3]->nsec[0] = nlbas / 2;
+    cmd[3]->nsec[1] = nlbas / 2;
+    cmd[3]->prp[1]  = (uint64_t)(wbuf + bsize * 4);
+
+    /* Submit the batch */
+    outstanding = 4;
+    ret         = xztl_media_submit_io_batch(cmd, 4, &nsub);
+    cunit_znd_assert_int("xztl_media_submit_io_batch", ret);
+    CU_ASSERT_EQUAL(nsub, 4);
+
+    /* Wait for completions */
+    while (outstanding) {
+        test_znd_poke_ctx(tctx);
+    }
+
+PUT:
+    while (cmd_i) {
+        cmd_i--;
+        xztl_mempool_put(mp_cmd[cmd_i], XZTL_MEMPOOL_MCMD, tid);
+    }
+    xztl_media_dma_free(wbuf);
+CTX:
+    ret = xztl_ctx_media_exit(tctx);
+    cunit_znd_assert_int("xztl_ctx_media_exit", ret);
+MP:
+    ret = xztl_mempool_exit();
+    cunit_znd_assert_int("xztl_mempool_exit", ret);
+}
+
 int main(int argc, const char **argv) {
     int failed;
 
@@ -433,6 +524,8 @@ int main(int argc, const char **argv) {
                      test_znd_append_zone) == NULL) ||
         (CU_add_test(pSuite, "Read 16 sectors from a zone",
                      test_znd_read_zone) == NULL) ||
+        (CU_add_test(pSuite, "Batch read 4 commands (1 vectored)",
+                     test_znd_read_batch) == NULL) ||
         (CU_add_test(pSuite, "Close media", test_znd_media_exit) == NULL)) {
         CU_cleanup_registry();
         return CU_get_error();
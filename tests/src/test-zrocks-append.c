@@ -0,0 +1,350 @@
+/* xZTL: Zone Translation Layer User-space Library
+ *
+ * Copyright 2019 Samsung Electronics
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <libzrocks.h>
+#include <xztl.h>
+#include <ztl.h>
+
+#include "CUnit/Basic.h"
+
+/* Appends complete newest first and are placed in completion order. With
+ * 128 KB commands, a zone gets 4 commands of each write */
+#define TEST_APPEND_FILE "/tmp/xztl-test-append"
+#define TEST_APPEND_DEV                                                        \
+    "emu:" TEST_APPEND_FILE "?nzones=28&zsze=4096&mdts=131072&ooo=1"
+
+/* 25 zones after the metadata zone leave one zone after the nodes, the
+ * node metadata log then takes zones of the last node */
+#define TEST_APPEND_LOG_FILE "/tmp/xztl-test-append-log"
+#define TEST_APPEND_LOG_DEV                                                    \
+    "emu:" TEST_APPEND_LOG_FILE "?nzones=26&zsze=4096&mdts=131072&ooo=1"
+#define TEST_APPEND_LOG_NODES 2
+#define TEST_APPEND_LOG_START 3
+
+#define TEST_APPEND_NBUF 4
+#define TEST_APPEND_SZ   (1024 * 1024 * 4) /* 4 MB */
+#define TEST_APPEND_RDSZ (1024 * 64)
+#define TEST_APPEND_WAIT 5000 /* Node reset wait in ms */
+
+/* Write sizes in KB, not multiples of the node stripe. The next write of a
+ * zone starts within a chunk */
+static const uint32_t test_append_kb[] = {68, 1036, 4, 260, 132, 2052, 12, 516};
+#define TEST_APPEND_NKB (sizeof(test_append_kb) / sizeof(test_append_kb[0]))
+
+static const char *devname = TEST_APPEND_DEV;
+static int         devfile = 1;
+static uint8_t *   wbuf[TEST_APPEND_NBUF];
+static uint8_t *   rbuf;
+static int32_t     node_id = -1;
+static int         tid     = -1;
+
+static int cunit_append_init(void) {
+    setenv(XZTL_WRITE_APPEND_ENV, "1", 1);
+    if (devfile)
+        unlink(TEST_APPEND_FILE);
+    return 0;
+}
+
+static int cunit_append_exit(void) {
+    if (devfile)
+        unlink(TEST_APPEND_FILE);
+    unlink(TEST_APPEND_LOG_FILE);
+    return 0;
+}
+
+static struct ztl_pro_node *test_append_node(void) {
+    struct app_group *       grp = ztl()->groups.get_fn(0);
+    struct ztl_pro_node_grp *pro = (struct ztl_pro_node_grp *)grp->pro;
+
+    return &pro->vnodes[node_id];
+}
+
+/* Chunks of the node were placed elsewhere by the appends */
+static int test_append_remapped(void) {
+    struct ztl_pro_node *node = test_append_node();
+    uint32_t             zn_i;
+
+    for (zn_i = 0; zn_i < node->zone_num; zn_i++)
+        if (node->vzones[zn_i]->remap)
+            return 1;
+
+    return 0;
+}
+
+static void test_append_open(void) {
+    CU_ASSERT_FATAL(zrocks_init(devname) == 0);
+    tid = zrocks_get_resource();
+    CU_ASSERT_FATAL(tid >= 0);
+}
+
+static void test_append_close(void) {
+    zrocksk_put_resource(tid);
+    CU_ASSERT(zrocks_exit() == 0);
+}
+
+static void test_append_write(void) {
+    uint32_t buf_i, byte;
+    uint8_t *buf;
+
+    buf = zrocks_alloc(TEST_APPEND_SZ);
+    CU_ASSERT_FATAL(buf != NULL);
+
+    for (buf_i = 0; buf_i < TEST_APPEND_NBUF; buf_i++) {
+        wbuf[buf_i] = malloc(TEST_APPEND_SZ);
+        CU_ASSERT_FATAL(wbuf[buf_i] != NULL);
+
+        for (byte = 0; byte < TEST_APPEND_SZ; byte += 16)
+            memset(&wbuf[buf_i][byte], (buf_i * 31 + byte / 16) & 0xff, 16);
+
+        memcpy(buf, wbuf[buf_i], TEST_APPEND_SZ);
+        CU_ASSERT(zrocks_write(buf, TEST_APPEND_SZ, &node_id, tid) == 0);
+    }
+
+    zrocks_free(buf);
+    CU_ASSERT_FATAL(node_id >= 0);
+    CU_ASSERT(test_append_remapped());
+}
+
+static void test_append_check(void) {
+    uint64_t off;
+    uint32_t buf_i;
+
+    rbuf = zrocks_alloc(TEST_APPEND_SZ);
+    CU_ASSERT_FATAL(rbuf != NULL);
+
+    for (buf_i = 0; buf_i < TEST_APPEND_NBUF; buf_i++) {
+        memset(rbuf, 0x0, TEST_APPEND_SZ);
+        for (off = 0; off < TEST_APPEND_SZ; off += TEST_APPEND_RDSZ)
+            CU_ASSERT(zrocks_read(node_id,
+                                  (uint64_t)buf_i * TEST_APPEND_SZ + off,
+                                  rbuf + off, TEST_APPEND_RDSZ, tid) == 0);
+        CU_ASSERT(!memcmp(wbuf[buf_i], rbuf, TEST_APPEND_SZ));
+
+        /* A read across chunks and zones */
+        memset(rbuf, 0x0, TEST_APPEND_SZ);
+        CU_ASSERT(zrocks_read(node_id, (uint64_t)buf_i * TEST_APPEND_SZ + 4096,
+                              rbuf, TEST_APPEND_SZ / 2, tid) == 0);
+        CU_ASSERT(!memcmp(wbuf[buf_i] + 4096, rbuf, TEST_APPEND_SZ / 2));
+    }
+
+    zrocks_free(rbuf);
+}
+
+/* The chunk and the remapping are replayed from the node metadata log,
+ * also with another write size */
+static void test_append_reopen(void) {
+    uint32_t chunk = test_append_node()->chunk_sec;
+
+    test_append_close();
+    setenv(XZTL_WRITE_KB_ENV, "128", 1);
+    test_append_open();
+    unsetenv(XZTL_WRITE_KB_ENV);
+
+    CU_ASSERT(test_append_node()->chunk_sec == chunk);
+    CU_ASSERT(test_append_remapped());
+    test_append_check();
+}
+
+/* After a reset the node is written in place again, also after a
+ * restart */
+static void test_append_trim(void) {
+    struct ztl_pro_node *node = test_append_node();
+    uint32_t             wait_ms;
+
+    CU_ASSERT(zrocks_trim(node_id) == 0);
+    for (wait_ms = 0; wait_ms < TEST_APPEND_WAIT; wait_ms++) {
+        if (__atomic_load_n(&node->status, __ATOMIC_ACQUIRE) ==
+            XZTL_ZMD_NODE_FREE)
+            break;
+        usleep(1000);
+    }
+    CU_ASSERT(node->status == XZTL_ZMD_NODE_FREE);
+    CU_ASSERT(!test_append_remapped());
+
+    test_append_close();
+    test_append_open();
+    CU_ASSERT(!test_append_remapped());
+}
+
+static void test_append_unaligned_check(uint8_t *data, uint64_t total) {
+    uint64_t off, len;
+
+    rbuf = zrocks_alloc(total);
+    CU_ASSERT_FATAL(rbuf != NULL);
+
+    memset(rbuf, 0x0, total);
+    CU_ASSERT(zrocks_read(node_id, 0, rbuf, total, tid) == 0);
+    CU_ASSERT(!memcmp(data, rbuf, total));
+
+    /* Reads not aligned to sectors, across the writes */
+    for (off = 100; off < total; off += TEST_APPEND_RDSZ + 4196) {
+        len = (total - off < TEST_APPEND_RDSZ + 300) ? total - off
+                                                     : TEST_APPEND_RDSZ + 300;
+        memset(rbuf, 0x0, len);
+        CU_ASSERT(zrocks_read(node_id, off, rbuf, len, tid) == 0);
+        CU_ASSERT(!memcmp(data + off, rbuf, len));
+    }
+
+    zrocks_free(rbuf);
+}
+
+/* Appends of writes not aligned to the stripe are remapped by extent, also
+ * after a restart */
+static void test_append_unaligned(void) {
+    uint64_t total = 0, off;
+    uint32_t wr_i, byte;
+    uint8_t *data, *buf;
+
+    for (wr_i = 0; wr_i < TEST_APPEND_NKB; wr_i++)
+        total += test_append_kb[wr_i] * 1024;
+
+    data = malloc(total);
+    buf  = zrocks_alloc(total);
+    CU_ASSERT_FATAL(data != NULL && buf != NULL);
+
+    for (byte = 0; byte < total; byte += 16)
+        memset(&data[byte], (byte / 16 * 7) & 0xff, 16);
+
+    node_id = -1;
+    for (wr_i = 0, off = 0; wr_i < TEST_APPEND_NKB; wr_i++) {
+        memcpy(buf, data + off, test_append_kb[wr_i] * 1024);
+        CU_ASSERT(zrocks_write(buf, test_append_kb[wr_i] * 1024, &node_id,
+                               tid) == 0);
+        off += test_append_kb[wr_i] * 1024;
+    }
+    zrocks_free(buf);
+
+    CU_ASSERT_FATAL(node_id >= 0);
+    CU_ASSERT(test_append_remapped());
+    test_append_unaligned_check(data, total);
+
+    test_append_close();
+    test_append_open();
+    CU_ASSERT(test_append_remapped());
+    test_append_unaligned_check(data, total);
+
+    free(data);
+}
+
+static void test_append_free(void) {
+    uint32_t buf_i;
+
+    for (buf_i = 0; buf_i < TEST_APPEND_NBUF; buf_i++)
+        free(wbuf[buf_i]);
+
+    test_append_close();
+}
+
+/* The log zones are taken from the last node on every start, also once
+ * the log holds data */
+static void test_append_log_node(void) {
+    struct ztl_pro_node_grp *pro;
+    uint32_t                 start, byte;
+    int32_t                  log_node = -1;
+    int                      log_tid;
+    uint8_t *                buf, *data;
+
+    unlink(TEST_APPEND_LOG_FILE);
+
+    data = malloc(TEST_APPEND_RDSZ);
+    CU_ASSERT_FATAL(data != NULL);
+    for (byte = 0; byte < TEST_APPEND_RDSZ; byte++)
+        data[byte] = (byte * 7) & 0xff;
+
+    for (start = 0; start < TEST_APPEND_LOG_START; start++) {
+        CU_ASSERT_FATAL(zrocks_init(TEST_APPEND_LOG_DEV) == 0);
+        log_tid = zrocks_get_resource();
+        CU_ASSERT_FATAL(log_tid >= 0);
+
+        pro = (struct ztl_pro_node_grp *)ztl()->groups.get_fn(0)->pro;
+        CU_ASSERT(pro->totalnode == TEST_APPEND_LOG_NODES);
+
+        buf = zrocks_alloc(TEST_APPEND_RDSZ);
+        CU_ASSERT_FATAL(buf != NULL);
+
+        if (!start) {
+            memcpy(buf, data, TEST_APPEND_RDSZ);
+            CU_ASSERT(zrocks_write(buf, TEST_APPEND_RDSZ, &log_node, log_tid) ==
+                      0);
+            CU_ASSERT_FATAL(log_node >= 0);
+            CU_ASSERT(log_node < TEST_APPEND_LOG_NODES);
+        }
+
+        memset(buf, 0x0, TEST_APPEND_RDSZ);
+        CU_ASSERT(zrocks_read(log_node, 0, buf, TEST_APPEND_RDSZ, log_tid) ==
+                  0);
+        CU_ASSERT(!memcmp(data, buf, TEST_APPEND_RDSZ));
+
+        zrocks_free(buf);
+        zrocksk_put_resource(log_tid);
+        CU_ASSERT(zrocks_exit() == 0);
+    }
+
+    free(data);
+    unlink(TEST_APPEND_LOG_FILE);
+}
+
+int main(int argc, const char **argv) {
+    int failed;
+
+    if (argc > 1) {
+        devname = argv[1];
+        devfile = 0;
+    }
+    printf("Device: %s\n", devname);
+
+    CU_pSuite pSuite = NULL;
+
+    if (CUE_SUCCESS != CU_initialize_registry())
+        return CU_get_error();
+
+    pSuite =
+        CU_add_suite("Suite_zrocks_append", cunit_append_init, cunit_append_exit);
+    if (pSuite == NULL) {
+        CU_cleanup_registry();
+        return CU_get_error();
+    }
+
+    if ((CU_add_test(pSuite, "Initialize ZRocks", test_append_open) == NULL) ||
+        (CU_add_test(pSuite, "Out of order appends", test_append_write) ==
+         NULL) ||
+        (CU_add_test(pSuite, "Read back", test_append_check) == NULL) ||
+        (CU_add_test(pSuite, "Read back after a restart", test_append_reopen) ==
+         NULL) ||
+        (CU_add_test(pSuite, "Reset the node", test_append_trim) == NULL) ||
+        (CU_add_test(pSuite, "Writes not aligned to the stripe",
+                     test_append_unaligned) == NULL) ||
+        (CU_add_test(pSuite, "Close ZRocks", test_append_free) == NULL) ||
+        (CU_add_test(pSuite, "Log zones from the last node, restarted",
+                     test_append_log_node) == NULL)) {
+        CU_cleanup_registry();
+        return CU_get_error();
+    }
+
+    CU_basic_set_mode(CU_BRM_VERBOSE);
+    CU_basic_run_tests();
+
+    failed = CU_get_number_of_tests_failed();
+    CU_cleanup_registry();
+
+    return failed;
+}
@@ -21,6 +21,7 @@
 #include <pthread.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <xztl.h>
 #include <libzrocks.h>
 
@@ -44,8 +45,15 @@
 
 /* Read Iterations */
 #define READ_ITERATIONS 16
+
+/* Single command reads of the latency test */
+#define READ_SMALL_ITERATIONS 4096
 #define WRITE_NTHREADS  64
 
+/* Asynchronous writes and reads of the queued I/O test */
+#define ASYNC_NCMD 16
+#define ASYNC_SZ   (ZNS_ALIGMENT * 16)
+
 static const char **devname;
 
 static uint64_t buffer_sz = WRITE_TBUFFER_SZ;
@@ -301,6 +309,136 @@ static void *test_random_read_th(int th_i) {
     return NULL;
 }
 
+/* Single command reads: aligned reads go in place, unaligned ones through
+ * the bounce buffer of the slot. Both must return the same data */
+static void test_zrocksrw_small_read(void) {
+    char *   abuf, *ubuf;
+    uint64_t offset, lat_ns, lat_sum, lat_max, totalsec;
+    int      tid, ret, i;
+
+    abuf = zrocks_alloc(ZNS_ALIGMENT * 2);
+    ubuf = malloc(ZNS_ALIGMENT + 1);
+    cunit_zrocksrw_assert_ptr("zrocksrw_small_read:alloc", abuf);
+    cunit_zrocksrw_assert_ptr("zrocksrw_small_read:malloc", ubuf);
+    if (!abuf || !ubuf)
+        goto FREE;
+
+    tid = zrocks_get_resource();
+    CU_ASSERT(tid >= 0);
+    if (tid < 0)
+        goto FREE;
+
+    totalsec = buffer_sz * nwrites / ZNS_ALIGMENT;
+    lat_sum  = 0;
+    lat_max  = 0;
+
+    for (i = 0; i < READ_SMALL_ITERATIONS; i++) {
+        offset = (rand() % (totalsec - 1)) * ZNS_ALIGMENT;
+
+        ret = zrocks_read_timed(nodes[0], offset, abuf, ZNS_ALIGMENT * 2, tid,
+                                &lat_ns);
+        cunit_zrocksrw_assert_int("zrocks_read_timed:aligned", ret);
+
+        lat_sum += lat_ns;
+        if (lat_ns > lat_max)
+            lat_max = lat_ns;
+
+        ret = zrocks_read_timed(nodes[0], offset + 512, ubuf + 1,
+                                ZNS_ALIGMENT, tid, NULL);
+        cunit_zrocksrw_assert_int("zrocks_read_timed:unaligned", ret);
+        CU_ASSERT(!memcmp(abuf + 512, ubuf + 1, ZNS_ALIGMENT));
+    }
+
+    zrocksk_put_resource(tid);
+
+    printf("\n");
+    printf("Small read latency: avg %.2lf us, max %.2lf us\n",
+           (double)lat_sum / READ_SMALL_ITERATIONS / 1000,  // NOLINT
+           (double)lat_max / 1000);                         // NOLINT
+
+FREE:
+    free(ubuf);
+    if (abuf)
+        zrocks_free(abuf);
+}
+
+struct async_wr {
+    uint32_t node_id;
+    int      done;
+};
+
+static void test_zrocksrw_async_cb(struct zrocks_io_cpl *cpl) {
+    struct async_wr *wr = (struct async_wr *)cpl->opaque;
+
+    CU_ASSERT(cpl->status == 0);
+    wr->node_id = cpl->node_id;
+    __atomic_store_n(&wr->done, 1, __ATOMIC_RELEASE);
+}
+
+/* Writes are completed by callback, reads through zrocks_poll. Each write
+ * takes a node of the slot and is read back from it */
+static void test_zrocksrw_async(void) {
+    struct async_wr      wr[ASYNC_NCMD];
+    struct zrocks_io_cpl cpl[ASYNC_NCMD];
+    char *               wbuf, *rbuf;
+    int                  tid, ret, cmd_i, ndone;
+
+    wbuf = zrocks_alloc(ASYNC_SZ * ASYNC_NCMD);
+    rbuf = zrocks_alloc(ASYNC_SZ * ASYNC_NCMD);
+    cunit_zrocksrw_assert_ptr("zrocksrw_async:alloc", wbuf);
+    cunit_zrocksrw_assert_ptr("zrocksrw_async:alloc", rbuf);
+    if (!wbuf || !rbuf)
+        goto FREE;
+
+    tid = zrocks_get_resource();
+    CU_ASSERT(tid >= 0);
+    if (tid < 0)
+        goto FREE;
+
+    memset(wr, 0x0, sizeof(wr));
+    for (cmd_i = 0; cmd_i < ASYNC_NCMD; cmd_i++) {
+        memset(wbuf + cmd_i * ASYNC_SZ, cmd_i + 1, ASYNC_SZ);
+
+        ret = zrocks_write_async(wbuf + cmd_i * ASYNC_SZ, ASYNC_SZ, -1, tid,
+                                 test_zrocksrw_async_cb, &wr[cmd_i]);
+        CU_ASSERT(ret >= 0);
+        if (ret < 0)
+            wr[cmd_i].done = 1;
+    }
+
+    do {
+        ndone = 0;
+        for (cmd_i = 0; cmd_i < ASYNC_NCMD; cmd_i++)
+            ndone += __atomic_load_n(&wr[cmd_i].done, __ATOMIC_ACQUIRE);
+    } while (ndone < ASYNC_NCMD);
+
+    for (cmd_i = 0; cmd_i < ASYNC_NCMD; cmd_i++) {
+        ret = zrocks_read_async(wr[cmd_i].node_id, 0, rbuf + cmd_i * ASYNC_SZ,
+                                ASYNC_SZ, tid, NULL, NULL);
+        CU_ASSERT(ret >= 0);
+    }
+
+    /* Completions are held until polled, synchronous calls fail */
+    ret = zrocks_read(wr[0].node_id, 0, rbuf, ASYNC_SZ, tid);
+    CU_ASSERT(ret != 0);
+
+    ndone = 0;
+    while (ndone < ASYNC_NCMD)
+        ndone += zrocks_poll(tid, cpl + ndone, ASYNC_NCMD - ndone);
+
+    for (cmd_i = 0; cmd_i < ASYNC_NCMD; cmd_i++)
+        CU_ASSERT(cpl[cmd_i].status == 0);
+    CU_ASSERT(!memcmp(wbuf, rbuf, ASYNC_SZ * ASYNC_NCMD));
+
+    zrocksk_put_resource(tid);
+
+FREE:
+    if (rbuf)
+        zrocks_free(rbuf);
+    if (wbuf)
+        zrocks_free(wbuf);
+}
+
 static void test_zrocksrw_random_read(void) {
     void *    buf[nthreads];
     uint64_t  bufi, th_i, it;
@@ -445,6 +583,10 @@ int main(int argc, const char **argv) {
         (CU_add_test(pSuite, "Read Bandwidth", test_zrocksrw_read) == NULL) ||
         (CU_add_test(pSuite, "Random Read Bandwidth",
                      test_zrocksrw_random_read) == NULL) ||
+        (CU_add_test(pSuite, "Small Read Latency",
+                     test_zrocksrw_small_read) == NULL) ||
+        (CU_add_test(pSuite, "Asynchronous Read/Write",
+                     test_zrocksrw_async) == NULL) ||
         (CU_add_test(pSuite, "Close ZRocks", test_zrocksrw_exit) == NULL)) {
         failed = 1;
         CU_cleanup_registry();
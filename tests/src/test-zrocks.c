@@ -18,6 +18,7 @@
 */
 
 #include <omp.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <xztl.h>
@@ -70,6 +71,54 @@ static void test_zrocks_exit(void) {
     zrocks_exit();
 }
 
+/* Take all free slots, then give them back */
+static int test_zrocks_count_slots(void) {
+    int *tids, tid, nslots = 0;
+
+    tids = malloc(sizeof(int) * 256);
+    if (!tids)
+        return -1;
+
+    while (nslots < 256 && (tid = zrocks_get_resource()) >= 0)
+        tids[nslots++] = tid;
+
+    for (tid = 0; tid < nslots; tid++)
+        zrocksk_put_resource(tids[tid]);
+
+    free(tids);
+    return nslots;
+}
+
+static void *test_zrocks_bind_th(void *arg) {
+    int *tid = (int *)arg;
+
+    *tid = zrocks_bind_resource();
+    return NULL;
+}
+
+static void test_zrocks_slots(void) {
+    pthread_t th;
+    int       nslots, tid, th_tid = -1;
+
+    nslots = test_zrocks_count_slots();
+    CU_ASSERT(nslots > 0);
+
+    /* A bound slot is returned again until the thread unbinds it */
+    tid = zrocks_bind_resource();
+    CU_ASSERT(tid >= 0);
+    CU_ASSERT(zrocks_bind_resource() == tid);
+    CU_ASSERT(test_zrocks_count_slots() == nslots - 1);
+
+    /* The slot of another thread is given back when the thread exits */
+    CU_ASSERT(pthread_create(&th, NULL, test_zrocks_bind_th, &th_tid) == 0);
+    pthread_join(th, NULL);
+    CU_ASSERT(th_tid >= 0 && th_tid != tid);
+    CU_ASSERT(test_zrocks_count_slots() == nslots - 1);
+
+    zrocks_unbind_resource();
+    CU_ASSERT(test_zrocks_count_slots() == nslots);
+}
+
 static void test_zrocks_fill_buffer(uint32_t id) {
     uint32_t byte;
     uint8_t  value = 0x1;
@@ -227,6 +276,7 @@ int main(int argc, const char **argv) {
     }
 
     if ((CU_add_test(pSuite, "Initialize ZRocks", test_zrocks_init) == NULL) ||
+        (CU_add_test(pSuite, "ZRocks Slots", test_zrocks_slots) == NULL) ||
         (CU_add_test(pSuite, "ZRocks New", test_zrocks_new) == NULL) ||
         (CU_add_test(pSuite, "ZRocks Read", test_zrocks_read) == NULL) ||
         (CU_add_test(pSuite, "ZRocks Random Read", test_zrocks_random_read) ==
@@ -0,0 +1,204 @@
+/* xZTL: Zone Translation Layer User-space Library
+ *
+ * Copyright 2019 Samsung Electronics
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <libzrocks.h>
+#include <xztl.h>
+#include <ztl.h>
+
+#include "CUnit/Basic.h"
+
+/* Enough zones for several words of the free node bitmap */
+#define TEST_NODE_DEV "emu:mem?nzones=1300&zsze=1024"
+
+#define TEST_NODE_THREADS 8
+#define TEST_NODE_ITER    20000
+#define TEST_NODE_MAX     4 /* Nodes taken at once, up to */
+
+static const char *             devname = TEST_NODE_DEV;
+static struct app_group *       grp;
+static struct ztl_pro_node_grp *pro;
+static uint8_t *                owner;  /* Holders of each node */
+static uint8_t *                isfree; /* Free before the test */
+static uint32_t                 nfree;
+static uint32_t                 ntaken;
+static uint32_t                 ndouble;
+static uint32_t                 nbadstat;
+
+/* Free nodes in the bitmap */
+static uint32_t test_node_nfree(void) {
+    uint32_t word_i, count = 0;
+
+    for (word_i = 0; word_i < pro->nwords; word_i++)
+        count += __builtin_popcountll(pro->free_bits[word_i]);
+
+    return count;
+}
+
+static void test_node_init(void) {
+    uint32_t node_i;
+
+    CU_ASSERT_FATAL(zrocks_init(devname) == 0);
+
+    grp = ztl()->groups.get_fn(0);
+    pro = (struct ztl_pro_node_grp *)grp->pro;
+
+    owner  = calloc(pro->nwords * 64, sizeof(uint8_t));
+    isfree = calloc(pro->nwords * 64, sizeof(uint8_t));
+    CU_ASSERT_FATAL(owner != NULL && isfree != NULL);
+
+    for (node_i = 0; node_i < pro->nwords * 64; node_i++)
+        isfree[node_i] =
+            (pro->free_bits[node_i / 64] >> (node_i % 64)) & 0x1;
+
+    nfree = test_node_nfree();
+    printf("\n %u free nodes in %u words\n", nfree, pro->nwords);
+    CU_ASSERT_FATAL(nfree > 64 * 2);
+}
+
+/* Take and give back nodes in a loop. A node held by two threads at once
+ * is counted in ndouble */
+static void *test_node_thread(void *arg) {
+    struct ztl_pro_node *nodes[TEST_NODE_MAX];
+    uint32_t             tid = (uint32_t)(uintptr_t)arg;  // NOLINT
+    uint32_t             iter, node_i, ntake, n;
+
+    for (iter = 0; iter < TEST_NODE_ITER; iter++) {
+        ntake = 1 + (tid + iter) % TEST_NODE_MAX;
+        n     = ztl_pro_grp_node_take(grp, tid * 64, nodes, ntake);
+        __atomic_fetch_add(&ntaken, n, __ATOMIC_RELAXED);
+
+        for (node_i = 0; node_i < n; node_i++) {
+            if (__atomic_fetch_add(&owner[nodes[node_i]->id], 1,
+                                   __ATOMIC_SEQ_CST))
+                __atomic_fetch_add(&ndouble, 1, __ATOMIC_RELAXED);
+            if (nodes[node_i]->status != XZTL_ZMD_NODE_USED)
+                __atomic_fetch_add(&nbadstat, 1, __ATOMIC_RELAXED);
+        }
+
+        for (node_i = 0; node_i < n; node_i++) {
+            __atomic_fetch_sub(&owner[nodes[node_i]->id], 1, __ATOMIC_SEQ_CST);
+            ztl_pro_grp_node_put(grp, nodes[node_i]);
+        }
+    }
+
+    return NULL;
+}
+
+static void test_node_mthread(void) {
+    pthread_t th[TEST_NODE_THREADS];
+    uint32_t  tid;
+
+    for (tid = 0; tid < TEST_NODE_THREADS; tid++)
+        CU_ASSERT_FATAL(pthread_create(&th[tid], NULL, test_node_thread,
+                                       (void *)(uintptr_t)tid) == 0);  // NOLINT
+
+    for (tid = 0; tid < TEST_NODE_THREADS; tid++)
+        pthread_join(th[tid], NULL);
+
+    CU_ASSERT(ntaken > 0);
+    CU_ASSERT(ndouble == 0);
+    CU_ASSERT(nbadstat == 0);
+    CU_ASSERT(test_node_nfree() == nfree);
+}
+
+/* Every free node is handed out once, and all are back in the bitmap
+ * after they are given back */
+static void test_node_all(void) {
+    struct ztl_pro_node **nodes;
+    uint32_t              node_i, word_i, n, count = 0;
+
+    nodes = calloc(nfree + 1, sizeof(struct ztl_pro_node *));
+    CU_ASSERT_FATAL(nodes != NULL);
+
+    do {
+        n = ztl_pro_grp_node_take(grp, count * 7, &nodes[count],
+                                  (nfree + 1 - count < TEST_NODE_MAX)
+                                      ? nfree + 1 - count
+                                      : TEST_NODE_MAX);
+        count += n;
+    } while (n && count <= nfree);
+
+    CU_ASSERT(count == nfree);
+    CU_ASSERT(test_node_nfree() == 0);
+
+    for (node_i = 0; node_i < count; node_i++) {
+        CU_ASSERT(isfree[nodes[node_i]->id]);
+        CU_ASSERT(owner[nodes[node_i]->id]++ == 0);
+    }
+
+    for (node_i = 0; node_i < count; node_i++) {
+        owner[nodes[node_i]->id] = 0;
+        ztl_pro_grp_node_put(grp, nodes[node_i]);
+    }
+
+    for (word_i = 0; word_i < pro->nwords; word_i++) {
+        for (node_i = word_i * 64; node_i < word_i * 64 + 64; node_i++)
+            CU_ASSERT(((pro->free_bits[word_i] >> (node_i % 64)) & 0x1) ==
+                      isfree[node_i]);
+        if (pro->free_bits[word_i])
+            CU_ASSERT((pro->free_sum[word_i / 64] >> (word_i % 64)) & 0x1);
+    }
+
+    free(nodes);
+}
+
+static void test_node_exit(void) {
+    free(owner);
+    free(isfree);
+    CU_ASSERT(zrocks_exit() == 0);
+}
+
+int main(int argc, const char **argv) {
+    int failed;
+
+    if (argc > 1)
+        devname = argv[1];
+    printf("Device: %s\n", devname);
+
+    CU_pSuite pSuite = NULL;
+
+    if (CUE_SUCCESS != CU_initialize_registry())
+        return CU_get_error();
+
+    pSuite = CU_add_suite("Suite_ztl_node", NULL, NULL);
+    if (pSuite == NULL) {
+        CU_cleanup_registry();
+        return CU_get_error();
+    }
+
+    if ((CU_add_test(pSuite, "Initialize ZRocks", test_node_init) == NULL) ||
+        (CU_add_test(pSuite, "Take and put nodes from threads",
+                     test_node_mthread) == NULL) ||
+        (CU_add_test(pSuite, "Take and put all nodes", test_node_all) ==
+         NULL) ||
+        (CU_add_test(pSuite, "Close ZRocks", test_node_exit) == NULL)) {
+        CU_cleanup_registry();
+        return CU_get_error();
+    }
+
+    CU_basic_set_mode(CU_BRM_VERBOSE);
+    CU_basic_run_tests();
+
+    failed = CU_get_number_of_tests_failed();
+    CU_cleanup_registry();
+
+    return failed;
+}
@@ -86,11 +86,6 @@ struct ZrocksFileMeta {
   }
 };
 
-struct ZrocksMediaRes {
-  int rid;
-  int cnt;
-};
-
 class ZNSFile {
  public:
   const std::string name;
@@ -121,9 +116,6 @@ class ZNSEnv : public Env {
   uint64_t read_bytes[ZNS_MAX_NODE_NUM];
   bool alloc_flag[ZNS_MAX_NODE_NUM];
 
-  port::Mutex xztlResMutext;
-  std::map<std::uint64_t, struct ZrocksMediaRes*> tidmap;
-
   port::Mutex envStartMutex;
   bool isEnvStart;
   std::uint64_t uuididx;
@@ -209,52 +201,12 @@ class ZNSEnv : public Env {
     return (std::uint64_t)pthread_self();
   }
 
+  // The slot is bound to the calling thread by ZRocks and given back when
+  // the thread exits
   int updateMediaResource() {
-    int rid;
-    uint64_t tid;
-    struct ZrocksMediaRes* resptr = NULL;
-
-    tid = gettid();
-
-    std::map<std::uint64_t, struct ZrocksMediaRes*>::iterator iter =
-        tidmap.find(tid);
-    if (iter != tidmap.end()) {
-      resptr = iter->second;
-      rid = resptr->rid;
-    } else {
-      resptr = (struct ZrocksMediaRes*)malloc(sizeof(struct ZrocksMediaRes));
-      if (!resptr) {
-          printf("zrocks media resource alloc failed.\n");
-          zrocks_exit();
-          return -1;
-      }
-      xztlResMutext.Lock();
-      resptr->rid = zrocks_get_resource();
-
-      if (resptr->rid == -1) {
-          int kret = 0;
-          for (iter = tidmap.begin(); iter != tidmap.end(); iter++) {
-              kret =  pthread_kill((pthread_t)iter->first, 0);
-              if (kret == ESRCH) {
-                   zrocksk_put_resource(iter->second->rid);
-                   free((struct ZrocksMediaRes*)iter->second);
-                   tidmap.erase(iter);
-              }
-          }
-
-         // After release the source, apply again
-         resptr->rid = zrocks_get_resource();
-      }
-
-      // Try to get resource again
-      if (resptr->rid == -1) {
-          printf("No resource again.\n");
-      }
-      resptr->cnt = 1;
-      tidmap[tid] = resptr;
-      rid = resptr->rid;
-      xztlResMutext.Unlock();
-    }
+    int rid = zrocks_bind_resource();
+
+    if (rid == -1) printf("No resource again.\n");
 
     return rid;
   }
@@ -24,7 +24,10 @@
 extern "C" {
 #endif
 
+#include <errno.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <xztl-config.h>
 
 #define ZNS_ALIGMENT          4096
 #define ZNS_PAGE_SIZE_8K      (8 * 1024)
@@ -72,6 +75,19 @@ struct zrocks_map {
  */
 int zrocks_init(const char *dev_name);
 
+/**
+ * Initialize zrocks library with a configuration. zrocks_init loads it
+ * from the file named by XZTL_CONFIG and from the environment
+ *
+ * @param dev_name URI provided by the user
+ * @param cfg      Configuration built with xztl_config_init, the loaders
+ *                 and xztl_config_set (xztl-config.h)
+ *
+ * @return Returns zero if the calls succeed, or a negative value
+ * 	   if the call fails
+ */
+int zrocks_init_config(const char *dev_name, const struct xztl_config *cfg);
+
 /**
  * Close zrocks library
  *
@@ -186,10 +202,123 @@ int zrocks_write(void *buf, size_t size, int32_t *node_id, int tid);
 int zrocks_read(uint32_t node_id, uint64_t offset, void *buf, uint64_t size,
                 int tid);
 
+/**
+ * Read from the ZNS drive and measure the call latency. Reads within a
+ * single media command are polled on the queue of the slot 'tid' and go
+ * in place to buffers aligned to 4 KB (offset and size included)
+ *
+ * @offset - Offset in bytes within the ZNS device
+ * @buf - Pointer to a buffer where data must be copied into
+ * @size - Size in bytes starting from offset
+ * @lat_ns - If not NULL, returns the latency of the call in nanoseconds
+ *
+ * @return Returns zero if the calls succeed, or a negative value
+ *      if the call fails
+ */
+int zrocks_read_timed(uint32_t node_id, uint64_t offset, void *buf,
+                      uint64_t size, int tid, uint64_t *lat_ns);
+
+/* >>> ASYNCHRONOUS BLOCK INTERFACE
+ * >>> Commands of a slot run in order on a worker thread of the slot. Up
+ * 	    to XZTL_ASYNC_DEPTH (default 32) commands are outstanding per
+ * 	    slot. Synchronous calls on a slot with outstanding asynchronous
+ * 	    commands are queued to the worker and run after them.
+ */
+
+/**
+ * Completion of an asynchronous command
+ *
+ * @handle  - Value returned by the submit call
+ * @status  - Zero if the command succeeded
+ * @node_id - Node written (writes) or read
+ * @opaque  - Context given to the submit call
+ */
+struct zrocks_io_cpl {
+    int      handle;
+    int      status;
+    uint32_t node_id;
+    void *   opaque;
+};
+
+/* Called by the worker of the slot, it must not block nor submit
+ * synchronous commands on the slot */
+typedef void(zrocks_io_cb)(struct zrocks_io_cpl *cpl);
+
+/**
+ * Write to the ZNS device without waiting for completion
+ *
+ * @param buf Pointer to the data, it must be kept until completion
+ * @param size Data size
+ * @param node_id Node to write, -1 takes a node of the slot
+ * @param tid Slot returned by zrocks_get_resource
+ * @param cb Completion callback. If NULL, the completion is returned by
+ * 	     zrocks_poll
+ * @param opaque Context returned in the completion
+ *
+ * @return Returns a handle (zero or positive) if the command is queued,
+ * 	   -EAGAIN if all commands of the slot are outstanding, or -1 if
+ * 	   the call fails
+ */
+int zrocks_write_async(void *buf, size_t size, int32_t node_id, int tid,
+                       zrocks_io_cb *cb, void *opaque);
+
+/**
+ * Read from the ZNS device without waiting for completion
+ *
+ * @node_id - Node to read
+ * @offset - Offset in bytes within the node
+ * @buf - Pointer to a buffer where data must be copied into
+ * @size - Size in bytes starting from offset
+ * @tid - Slot returned by zrocks_get_resource
+ * @cb - Completion callback. If NULL, the completion is returned by
+ *       zrocks_poll
+ * @opaque - Context returned in the completion
+ *
+ * @return Returns a handle (zero or positive) if the command is queued,
+ *      -EAGAIN if all commands of the slot are outstanding, or -1 if the
+ *      call fails
+ */
+int zrocks_read_async(uint32_t node_id, uint64_t offset, void *buf,
+                      uint64_t size, int tid, zrocks_io_cb *cb, void *opaque);
+
+/**
+ * Return completions of asynchronous commands submitted without callback
+ *
+ * @tid - Slot returned by zrocks_get_resource
+ * @cpl - Array filled with up to 'max' completions
+ * @max - Size of 'cpl'
+ *
+ * @return Returns the number of completions, it does not wait
+ */
+int zrocks_poll(int tid, struct zrocks_io_cpl *cpl, int max);
+
+/**
+ * Take a free slot, of the NUMA node of the caller first
+ *
+ * @return Returns the slot, or -1 if none is free
+ */
 int zrocks_get_resource();
 
+/**
+ * Give back a slot returned by zrocks_get_resource
+ */
 void zrocksk_put_resource(int id);
 
+/**
+ * Return the slot bound to the calling thread. The first call takes a slot
+ * with zrocks_get_resource, later calls return it without locking. The
+ * slot is given back when the thread exits or calls
+ * zrocks_unbind_resource
+ *
+ * @return Returns the slot, or -1 if none is free
+ */
+int zrocks_bind_resource(void);
+
+/**
+ * Give back the slot bound to the calling thread, if any
+ */
+void zrocks_unbind_resource(void);
+
 /**
  * Get metadata zone's start lba from the ZNS device
  *
@@ -23,16 +23,21 @@
 #include <omp.h>
 #include <pthread.h>
 #include <stdlib.h>
+#include <string.h>
+#include <xztl-config.h>
 #include <xztl-media.h>
 #include <xztl-mempool.h>
+#include <xztl-numa.h>
 #include <xztl-ztl.h>
 #include <xztl.h>
+#include <ztl-media-emu.h>
 #include <ztl-media.h>
 #include <ztl.h>
 
 #define ZROCKS_DEBUG       0
 #define ZROCKS_BUF_ENTS    1024
 #define ZROCKS_MAX_READ_SZ (256 * ZNS_ALIGMENT) /* 512 KB */
+#define ZROCKS_POLL_BATCH  32 /* Completions taken from a slot at once */
 
 extern struct znd_media zndmedia;
 
@@ -47,8 +52,9 @@ void zrocks_free(void *ptr) {
     xztl_media_dma_free(ptr);
 }
 
-static int __zrocks_write(struct xztl_io_ucmd *ucmd, uint64_t id, void *buf,
-                          size_t size, int32_t *node_id, int tid) {
+static void zrocks_write_fill(struct xztl_io_ucmd *ucmd, uint64_t id,
+                              void *buf, size_t size, int32_t node_id,
+                              int tid) {
     uint32_t misalign;
     size_t   new_sz, alignment;
 
@@ -61,7 +67,7 @@ static int __zrocks_write(struct xztl_io_ucmd *ucmd, uint64_t id, void *buf,
         log_infoa(
             "zrocks (write): ID %lu, node_id %d, size %lu, new size %lu, "
             "aligment %lu, misalign %d\n",
-            id, *node_id, size, new_sz, alignment, misalign);
+            id, node_id, size, new_sz, alignment, misalign);
 
     ucmd->prov_type  = XZTL_CMD_WRITE;
     ucmd->id         = id;
@@ -71,8 +77,13 @@ static int __zrocks_write(struct xztl_io_ucmd *ucmd, uint64_t id, void *buf,
     ucmd->completed  = 0;
     ucmd->callback   = NULL;
     ucmd->prov       = NULL;
-    ucmd->xd.node_id = *node_id;
+    ucmd->xd.node_id = node_id;
     ucmd->xd.tid     = tid;
+}
+
+static int __zrocks_write(struct xztl_io_ucmd *ucmd, uint64_t id, void *buf,
+                          size_t size, int32_t *node_id, int tid) {
+    zrocks_write_fill(ucmd, id, buf, size, *node_id, tid);
 
     if (ztl()->wca->submit_fn(ucmd))
         return -1;
@@ -81,7 +92,7 @@ static int __zrocks_write(struct xztl_io_ucmd *ucmd, uint64_t id, void *buf,
     *node_id = ucmd->xd.node_id;
 
     xztl_stats_inc(XZTL_STATS_APPEND_BYTES_U, size);
-    xztl_stats_inc(XZTL_STATS_APPEND_BYTES, new_sz);
+    xztl_stats_inc(XZTL_STATS_APPEND_BYTES, ucmd->size);
     xztl_stats_inc(XZTL_STATS_APPEND_UCMD, 1);
 
     return 0;
@@ -142,26 +153,36 @@ int zrocks_read_obj(uint64_t id, uint64_t offset, void *buf, size_t size) {
     return 0;
 }
 
-int zrocks_read(uint32_t node_id, uint64_t offset, void *buf, uint64_t size,
-                int tid) {
-    int                 ret;
-    struct xztl_io_ucmd ucmd;
-
-    ucmd.prov_type = XZTL_CMD_READ;
-    ucmd.id        = 0;
-    ucmd.buf       = buf;
-    ucmd.size      = size;
-    ucmd.offset    = offset;
-    ucmd.status    = 0;
-    ucmd.callback  = NULL;
-    ucmd.prov      = NULL;
-    ucmd.completed = 0;
-
-    ucmd.xd.node_id = node_id;
-    ucmd.xd.tid     = tid;
+static void zrocks_read_fill(struct xztl_io_ucmd *ucmd, uint32_t node_id,
+                             uint64_t offset, void *buf, uint64_t size,
+                             int tid) {
+    ucmd->prov_type = XZTL_CMD_READ;
+    ucmd->id        = 0;
+    ucmd->buf       = buf;
+    ucmd->size      = size;
+    ucmd->offset    = offset;
+    ucmd->status    = 0;
+    ucmd->callback  = NULL;
+    ucmd->prov      = NULL;
+    ucmd->completed = 0;
+
+    ucmd->xd.node_id = node_id;
+    ucmd->xd.tid     = tid;
     if (ZROCKS_DEBUG)
         log_infoa("zrocks (read): node:%d off %lu, size %lu, tid is %d \n",
                   node_id, offset, size, tid);
+}
+
+/* Reads of several media commands */
+static int zrocks_read_ucmd(uint32_t node_id, uint64_t offset, void *buf,
+                            uint64_t size, int tid, uint64_t *lat_ns) {
+    struct xztl_io_ucmd ucmd;
+    struct timespec     ts;
+    uint64_t            start, end;
+
+    GET_NANOSECONDS(start, ts);
+
+    zrocks_read_fill(&ucmd, node_id, offset, buf, size, tid);
 
     if (ztl()->wca->submit_fn(&ucmd))
         return -1;
@@ -170,9 +191,13 @@ int zrocks_read(uint32_t node_id, uint64_t offset, void *buf, uint64_t size,
         log_infoa("zrocks (read) done: node:%d off %lu, size %lu, tid is %d \n",
                   node_id, offset, size, tid);
 
+    GET_NANOSECONDS(end, ts);
+    if (lat_ns)
+        *lat_ns = end - start;
+
     if (ucmd.status) {
         log_erra("zrocks: Read failure. node:%d off %lu, sz %lu. ret %d",
-                 node_id, offset, size, ret);
+                 node_id, offset, size, ucmd.status);
     } else {
         xztl_stats_inc(XZTL_STATS_READ_BYTES_U, size);
         xztl_stats_inc(XZTL_STATS_READ_UCMD, 1);
@@ -181,21 +206,224 @@ int zrocks_read(uint32_t node_id, uint64_t offset, void *buf, uint64_t size,
     return 0;
 }
 
-int zrocks_get_resource() {
-    int tid, rettid = -1;
-
-    for (tid = 0; tid < ZTL_TH_NUM; tid++) {
-       if (!xtd[tid].usedflag) {
-           xtd[tid].usedflag = true;
-           rettid = tid;
-           break;
-      }
+int zrocks_read_timed(uint32_t node_id, uint64_t offset, void *buf,
+                      uint64_t size, int tid, uint64_t *lat_ns) {
+    int ret;
+
+    ret = ztl()->wca->read_fast_fn(node_id, offset, buf, size, tid, lat_ns);
+    if (ret == XZTL_ZTL_WCA_SLOW)
+        return zrocks_read_ucmd(node_id, offset, buf, size, tid, lat_ns);
+
+    if (ret) {
+        log_erra("zrocks: Read failure. node:%d off %lu, sz %lu. ret %d",
+                 node_id, offset, size, ret);
+        return -1;
+    }
+
+    xztl_stats_inc(XZTL_STATS_READ_BYTES_U, size);
+    xztl_stats_inc(XZTL_STATS_READ_UCMD, 1);
+
+    return 0;
+}
+
+int zrocks_read(uint32_t node_id, uint64_t offset, void *buf, uint64_t size,
+                int tid) {
+    return zrocks_read_timed(node_id, offset, buf, size, tid, NULL);
+}
+
+/* Fill the completion of an asynchronous command, the statistics are
+ * accounted as in the synchronous calls */
+static void zrocks_async_cpl(struct xztl_io_ucmd * ucmd,
+                             struct zrocks_io_cpl *cpl) {
+    cpl->handle  = ucmd->handle;
+    cpl->status  = ucmd->status;
+    cpl->node_id = ucmd->xd.node_id;
+    cpl->opaque  = ucmd->opaque;
+
+    if (ucmd->status) {
+        log_erra("zrocks: Asynchronous %s failure. node:%d, sz %lu. ret %d",
+                 (ucmd->prov_type == XZTL_CMD_WRITE) ? "write" : "read",
+                 ucmd->xd.node_id, ucmd->size, ucmd->status);
+        return;
+    }
+
+    if (ucmd->prov_type == XZTL_CMD_WRITE) {
+        xztl_stats_inc(XZTL_STATS_APPEND_BYTES_U, ucmd->offset);
+        xztl_stats_inc(XZTL_STATS_APPEND_BYTES, ucmd->size);
+        xztl_stats_inc(XZTL_STATS_APPEND_UCMD, 1);
+    } else {
+        xztl_stats_inc(XZTL_STATS_READ_BYTES_U, ucmd->size);
+        xztl_stats_inc(XZTL_STATS_READ_UCMD, 1);
     }
-    return rettid;
+}
+
+/* Called by the slot worker. The command is given back before the user
+ * callback, which can then submit up to the full slot depth */
+static void zrocks_async_callback(void *arg) {
+    struct xztl_io_ucmd *ucmd = (struct xztl_io_ucmd *)arg;
+    zrocks_io_cb *       cb   = (zrocks_io_cb *)ucmd->opaque_cb;  // NOLINT
+    struct zrocks_io_cpl cpl;
+
+    zrocks_async_cpl(ucmd, &cpl);
+    ztl()->wca->ucmd_put_fn(ucmd);
+
+    cb(&cpl);
+}
+
+static int zrocks_submit_async(struct xztl_io_ucmd *ucmd, zrocks_io_cb *cb,
+                               void *opaque) {
+    ucmd->callback  = (cb) ? zrocks_async_callback : NULL;
+    ucmd->opaque_cb = (xztl_callback *)cb;  // NOLINT
+    ucmd->opaque    = opaque;
+
+    if (ztl()->wca->submit_async_fn(ucmd)) {
+        ztl()->wca->ucmd_put_fn(ucmd);
+        return -1;
+    }
+
+    return ucmd->handle;
+}
+
+int zrocks_write_async(void *buf, size_t size, int32_t node_id, int tid,
+                       zrocks_io_cb *cb, void *opaque) {
+    struct xztl_io_ucmd *ucmd;
+
+    if (tid < 0 || tid >= xtd_num)
+        return -1;
+
+    ucmd = ztl()->wca->ucmd_get_fn(tid);
+    if (!ucmd)
+        return -EAGAIN;
+
+    zrocks_write_fill(ucmd, 0, buf, size, node_id, tid);
+    ucmd->app_md = 1;
+    ucmd->offset = size;
+
+    return zrocks_submit_async(ucmd, cb, opaque);
+}
+
+int zrocks_read_async(uint32_t node_id, uint64_t offset, void *buf,
+                      uint64_t size, int tid, zrocks_io_cb *cb, void *opaque) {
+    struct xztl_io_ucmd *ucmd;
+
+    if (tid < 0 || tid >= xtd_num || !size)
+        return -1;
+
+    ucmd = ztl()->wca->ucmd_get_fn(tid);
+    if (!ucmd)
+        return -EAGAIN;
+
+    zrocks_read_fill(ucmd, node_id, offset, buf, size, tid);
+
+    return zrocks_submit_async(ucmd, cb, opaque);
+}
+
+int zrocks_poll(int tid, struct zrocks_io_cpl *cpl, int max) {
+    struct xztl_io_ucmd *ucmd[ZROCKS_POLL_BATCH];
+    uint32_t             ncpl, cpl_i, batch;
+    int                  total = 0;
+
+    if (tid < 0 || tid >= xtd_num)
+        return 0;
+
+    while (total < max) {
+        batch = (max - total < ZROCKS_POLL_BATCH) ? max - total
+                                                  : ZROCKS_POLL_BATCH;
+        ncpl  = ztl()->wca->poll_fn(tid, ucmd, batch);
+
+        for (cpl_i = 0; cpl_i < ncpl; cpl_i++) {
+            zrocks_async_cpl(ucmd[cpl_i], &cpl[total + cpl_i]);
+            ztl()->wca->ucmd_put_fn(ucmd[cpl_i]);
+        }
+        total += ncpl;
+
+        if (ncpl < batch)
+            break;
+    }
+
+    return total;
+}
+
+/* Slots bound to the NUMA node of the caller are handed out first. If
+ * none is free, any free slot is used */
+int zrocks_get_resource() {
+    int tid, local;
+
+    local = xztl_numa_local_node();
+
+    tid = ztl()->wca->slot_get_fn(local);
+    if (tid < 0)
+        return tid;
+
+    xztl_numa_slot_use(xtd[tid].numa, local, 1);
+
+    return tid;
 }
 
 void zrocksk_put_resource(int tid) {
-    xtd[tid].usedflag = false;
+    if (tid < 0 || tid >= xtd_num)
+        return;
+
+    xztl_numa_slot_use(xtd[tid].numa, -1, 0);
+    ztl()->wca->slot_put_fn(tid);
+}
+
+/* Slot bound to the calling thread. The key destructor gives it back when
+ * the thread exits. A binding made before the last zrocks_init is stale,
+ * zrocks_bind_gen tells them apart */
+static __thread int      zrocks_bind_tid = -1;
+static __thread uint32_t zrocks_bind_tgen;
+static uint32_t          zrocks_bind_gen;
+static pthread_key_t     zrocks_bind_key;
+static pthread_once_t    zrocks_bind_once = PTHREAD_ONCE_INIT;
+
+static void zrocks_bind_release(void *val) {
+    uint64_t bind = (uint64_t)val;  // NOLINT
+
+    if ((uint32_t)(bind >> 32) ==
+        __atomic_load_n(&zrocks_bind_gen, __ATOMIC_ACQUIRE))
+        zrocksk_put_resource((int)(bind & 0xffffffff) - 1);
+}
+
+static void zrocks_bind_key_init(void) {
+    pthread_key_create(&zrocks_bind_key, zrocks_bind_release);
+}
+
+int zrocks_bind_resource(void) {
+    uint32_t gen = __atomic_load_n(&zrocks_bind_gen, __ATOMIC_ACQUIRE);
+    uint64_t bind;
+    int      tid;
+
+    if (zrocks_bind_tid >= 0 && zrocks_bind_tgen == gen)
+        return zrocks_bind_tid;
+
+    tid = zrocks_get_resource();
+    if (tid < 0)
+        return tid;
+
+    pthread_once(&zrocks_bind_once, zrocks_bind_key_init);
+    bind = ((uint64_t)gen << 32) | (uint64_t)(tid + 1);
+    if (pthread_setspecific(zrocks_bind_key, (void *)bind)) {  // NOLINT
+        zrocksk_put_resource(tid);
+        return -1;
+    }
+
+    zrocks_bind_tid  = tid;
+    zrocks_bind_tgen = gen;
+
+    return tid;
+}
+
+void zrocks_unbind_resource(void) {
+    if (zrocks_bind_tid < 0)
+        return;
+
+    if (zrocks_bind_tgen ==
+        __atomic_load_n(&zrocks_bind_gen, __ATOMIC_ACQUIRE))
+        zrocksk_put_resource(zrocks_bind_tid);
+
+    pthread_setspecific(zrocks_bind_key, NULL);
+    zrocks_bind_tid = -1;
 }
 
 int zrocks_delete(uint64_t id) {
@@ -219,6 +447,9 @@ int zrocks_trim(uint32_t node_id) {
 }
 
 int zrocks_exit(void) {
+    /* Bindings of running threads are dropped */
+    __atomic_fetch_add(&zrocks_bind_gen, 1, __ATOMIC_RELEASE);
+
     pthread_spin_destroy(&zrocks_mp_spin);
     xztl_mempool_destroy(ZROCKS_MEMORY, 0);
     return xztl_exit();
@@ -237,10 +468,29 @@ int zrocks_node_finish(uint32_t node_id) {
 }
 
 int zrocks_init(const char *dev_name) {
-    int ret;
+    struct xztl_config cfg;
+    const char *       path;
+
+    xztl_config_init(&cfg);
+
+    path = getenv(XZTL_CONFIG_ENV);
+    if (path && xztl_config_load_file(&cfg, path))
+        return -1;
 
-    /* Add libznd media layer */
-    xztl_add_media(znd_media_register);
+    xztl_config_load_env(&cfg);
+
+    return zrocks_init_config(dev_name, &cfg);
+}
+
+int zrocks_init_config(const char *dev_name, const struct xztl_config *cfg) {
+    struct xztl_config *acfg;
+    int                 ret;
+
+    /* Add the media layer: emulated zones (emu:) or libznd */
+    if (!strncmp(dev_name, EMU_MEDIA_PREFIX, strlen(EMU_MEDIA_PREFIX)))
+        xztl_add_media(emu_media_register);
+    else
+        xztl_add_media(znd_media_register);
 
     /* Add the ZTL modules */
     ztl_zmd_register();
@@ -252,14 +502,18 @@ int zrocks_init(const char *dev_name) {
     if (pthread_spin_init(&zrocks_mp_spin, 0))
         return -1;
 
-    ret = xztl_init(dev_name);
+    ret = xztl_init_config(dev_name, cfg);
 
     if (ret) {
         pthread_spin_destroy(&zrocks_mp_spin);
         return -1;
     }
 
-    if (xztl_mempool_create(ZROCKS_MEMORY, 0, ZROCKS_BUF_ENTS,
+    acfg = xztl_config_active();
+    if (acfg->zrocks_buf_ents <= 0)
+        acfg->zrocks_buf_ents = ZROCKS_BUF_ENTS;
+
+    if (xztl_mempool_create(ZROCKS_MEMORY, 0, acfg->zrocks_buf_ents,
                             ZROCKS_MAX_READ_SZ, zrocks_alloc, zrocks_free)) {
         xztl_exit();
         pthread_spin_destroy(&zrocks_mp_spin);